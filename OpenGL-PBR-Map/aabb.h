@@ -0,0 +1,58 @@
+#ifndef OPENGL_PBR_MAP_AABB_H_
+#define OPENGL_PBR_MAP_AABB_H_
+
+#include <glm/glm.hpp>
+
+#include <limits>
+
+namespace game {
+
+/**
+ * @brief 軸に平行なバウンディングボックス
+ *
+ * デフォルトでは何も含まない空の箱になる。
+ */
+struct AABB {
+  glm::vec3 min{std::numeric_limits<float>::infinity()};
+  glm::vec3 max{-std::numeric_limits<float>::infinity()};
+
+  AABB() = default;
+  AABB(const glm::vec3& min, const glm::vec3& max) : min(min), max(max) {}
+
+  void Extend(const glm::vec3& point) {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+  }
+
+  void Extend(const AABB& other) {
+    min = glm::min(min, other.min);
+    max = glm::max(max, other.max);
+  }
+
+  bool IsEmpty() const {
+    return min.x > max.x || min.y > max.y || min.z > max.z;
+  }
+
+  bool Contains(const glm::vec3& point) const {
+    return glm::all(glm::greaterThanEqual(point, min)) &&
+           glm::all(glm::lessThanEqual(point, max));
+  }
+
+  bool Overlaps(const AABB& other) const {
+    return glm::all(glm::lessThanEqual(min, other.max)) &&
+           glm::all(glm::lessThanEqual(other.min, max));
+  }
+
+  glm::vec3 GetCenter() const { return (min + max) * 0.5f; }
+
+  glm::vec3 GetSize() const { return max - min; }
+
+  float GetSurfaceArea() const {
+    const auto size = GetSize();
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+  }
+};
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_AABB_H_
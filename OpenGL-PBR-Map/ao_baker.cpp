@@ -0,0 +1,142 @@
+#include "ao_baker.h"
+
+#include <glm/gtc/packing.hpp>
+
+#include "job_system.h"
+#include "path_tracer.h"
+#include "sampling.h"
+#include "texel_rasterizer.h"
+
+namespace game {
+
+namespace {
+
+// 表面の1点から半球にコサイン分布のレイを飛ばして遮蔽されない割合を求める
+float ComputeAmbientOcclusion(const Bvh& bvh, const glm::vec3& position,
+                              const glm::vec3& normal,
+                              const AmbientOcclusionSettings& settings,
+                              std::uint64_t seed) {
+  glm::vec3 tangent;
+  glm::vec3 bitangent;
+  BuildOrthonormalBasis(normal, tangent, bitangent);
+
+  // 点ごとにHammersley点列をずらして縞模様を避ける
+  Pcg32 random(seed);
+  const auto shift = random.NextVec2();
+  Ray ray;
+  ray.origin = OffsetRayOrigin(position, normal);
+  // 隣の面の平面上にある頂点から出たレイが距離0で当たらないようにする
+  ray.t_min = 1.0e-4f;
+  ray.t_max = settings.max_distance;
+  int occluded = 0;
+  for (int i = 0; i < settings.ray_count; ++i) {
+    const auto local = SampleCosineHemisphere(glm::fract(
+        Hammersley(static_cast<std::uint32_t>(i),
+                   static_cast<std::uint32_t>(settings.ray_count)) +
+        shift));
+    ray.direction = tangent * local.x + bitangent * local.y + normal * local.z;
+    if (bvh.IsOccluded(ray)) {
+      ++occluded;
+    }
+  }
+  return 1.0f - static_cast<float>(occluded) /
+                    static_cast<float>(settings.ray_count);
+}
+
+}  // namespace
+
+Bvh BuildOcclusionBvh(const std::vector<glm::vec3>& positions,
+                      const std::vector<std::uint32_t>& indices,
+                      const std::vector<glm::vec3>& neighbor_positions,
+                      const std::vector<std::uint32_t>& neighbor_indices) {
+  auto all_positions = positions;
+  all_positions.insert(all_positions.end(), neighbor_positions.begin(),
+                       neighbor_positions.end());
+  auto all_indices = indices;
+  const auto base = static_cast<std::uint32_t>(positions.size());
+  for (const auto index : neighbor_indices) {
+    all_indices.push_back(base + index);
+  }
+  Bvh bvh;
+  bvh.Build(all_positions, all_indices);
+  return bvh;
+}
+
+std::vector<float> BakeVertexAmbientOcclusion(
+    const Bvh& bvh, const std::vector<glm::vec3>& positions,
+    const std::vector<glm::vec3>& normals,
+    const AmbientOcclusionSettings& settings, JobSystem& job_system) {
+  std::vector<float> ambient_occlusion(positions.size());
+  job_system.ParallelFor(
+      positions.size(), 64, [&](std::size_t begin, std::size_t end) {
+        for (auto i = begin; i < end; ++i) {
+          ambient_occlusion[i] = ComputeAmbientOcclusion(
+              bvh, positions[i], glm::normalize(normals[i]), settings, i);
+        }
+      });
+  return ambient_occlusion;
+}
+
+std::vector<std::uint32_t> PackVertexAmbientOcclusion(
+    const std::vector<glm::vec3>& colors,
+    const std::vector<float>& ambient_occlusion) {
+  std::vector<std::uint32_t> packed(ambient_occlusion.size());
+  for (std::size_t i = 0; i < packed.size(); ++i) {
+    const auto color = colors.empty() ? glm::vec3(1.0f) : colors[i];
+    packed[i] = glm::packUnorm4x8(glm::vec4(color, ambient_occlusion[i]));
+  }
+  return packed;
+}
+
+void BakeOrmAmbientOcclusion(const Bvh& bvh,
+                             const std::vector<glm::vec3>& positions,
+                             const std::vector<glm::vec3>& normals,
+                             const std::vector<glm::vec2>& uvs,
+                             const std::vector<std::uint32_t>& indices,
+                             int width, int height,
+                             const AmbientOcclusionSettings& settings,
+                             JobSystem& job_system,
+                             std::vector<std::uint32_t>& orm_texels) {
+  // 各テクセルに対応する表面の点を先に求めておく
+  const auto texel_count = static_cast<std::size_t>(width) * height;
+  std::vector<glm::vec3> texel_positions(texel_count);
+  std::vector<glm::vec3> texel_normals(texel_count);
+  std::vector<std::uint8_t> covered(texel_count, 0);
+  const glm::vec2 size(width, height);
+  for (std::size_t triangle = 0; triangle < indices.size() / 3; ++triangle) {
+    const auto* index = &indices[triangle * 3];
+    const glm::vec2 uv[3] = {uvs[index[0]] * size, uvs[index[1]] * size,
+                             uvs[index[2]] * size};
+    RasterizeTriangleTexels(
+        uv, width, height, [&](int x, int y, const glm::vec3& w) {
+          const auto texel = static_cast<std::size_t>(y) * width + x;
+          texel_positions[texel] = positions[index[0]] * w.x +
+                                   positions[index[1]] * w.y +
+                                   positions[index[2]] * w.z;
+          texel_normals[texel] = glm::normalize(normals[index[0]] * w.x +
+                                                normals[index[1]] * w.y +
+                                                normals[index[2]] * w.z);
+          covered[texel] = 1;
+        });
+  }
+
+  job_system.ParallelFor(
+      static_cast<std::size_t>(height), 1,
+      [&](std::size_t begin, std::size_t end) {
+        for (auto y = begin; y < end; ++y) {
+          for (std::size_t x = 0; x < static_cast<std::size_t>(width); ++x) {
+            const auto texel = y * width + x;
+            if (!covered[texel]) {
+              continue;
+            }
+            auto orm = glm::unpackUnorm4x8(orm_texels[texel]);
+            orm.r = ComputeAmbientOcclusion(bvh, texel_positions[texel],
+                                            texel_normals[texel], settings,
+                                            texel);
+            orm_texels[texel] = glm::packUnorm4x8(orm);
+          }
+        }
+      });
+}
+
+}  // namespace game
@@ -0,0 +1,89 @@
+#ifndef OPENGL_PBR_MAP_AO_BAKER_H_
+#define OPENGL_PBR_MAP_AO_BAKER_H_
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "bvh.h"
+
+namespace game {
+
+class JobSystem;
+
+/**
+ * @brief アンビエントオクルージョンのベイクの設定
+ */
+struct AmbientOcclusionSettings {
+  // 1点あたりのレイの数
+  int ray_count = 64;
+  // この距離より遠くの遮蔽は無視する
+  float max_distance = 1.0f;
+};
+
+/**
+ * @brief 対象のメッシュと周囲のメッシュをまとめた遮蔽判定用のBVHを作る
+ * @param positions 対象のメッシュの頂点座標
+ * @param indices 対象のメッシュのインデックス
+ * @param neighbor_positions 周囲のメッシュの頂点座標
+ * @param neighbor_indices 周囲のメッシュのインデックス
+ * @return BVH
+ */
+Bvh BuildOcclusionBvh(const std::vector<glm::vec3>& positions,
+                      const std::vector<std::uint32_t>& indices,
+                      const std::vector<glm::vec3>& neighbor_positions,
+                      const std::vector<std::uint32_t>& neighbor_indices);
+
+/**
+ * @brief 頂点ごとのアンビエントオクルージョンをベイクする
+ * @param bvh 遮蔽物のBVH
+ * @param positions 頂点座標
+ * @param normals 頂点法線
+ * @param settings ベイクの設定
+ * @param job_system 頂点単位の並列化に使うJobSystem
+ * @return 頂点ごとの遮蔽されていない割合 (1で遮蔽なし)
+ */
+std::vector<float> BakeVertexAmbientOcclusion(
+    const Bvh& bvh, const std::vector<glm::vec3>& positions,
+    const std::vector<glm::vec3>& normals,
+    const AmbientOcclusionSettings& settings, JobSystem& job_system);
+
+/**
+ * @brief 頂点カラーとAOをpackUnorm4x8で1つの頂点属性に詰める
+ * @param colors 頂点カラー、空なら白
+ * @param ambient_occlusion 頂点ごとのAO
+ * @return RGBに頂点カラー、AにAOを持つRGBA8
+ */
+std::vector<std::uint32_t> PackVertexAmbientOcclusion(
+    const std::vector<glm::vec3>& colors,
+    const std::vector<float>& ambient_occlusion);
+
+/**
+ * @brief テクセルごとのアンビエントオクルージョンをORMテクスチャのRに書き込む
+ * @param bvh 遮蔽物のBVH
+ * @param positions 頂点座標
+ * @param normals 頂点法線
+ * @param uvs 重なりのないテクスチャ座標
+ * @param indices 三角形リストのインデックス
+ * @param width ORMテクスチャの幅
+ * @param height ORMテクスチャの高さ
+ * @param settings ベイクの設定
+ * @param job_system テクセル行単位の並列化に使うJobSystem
+ * @param orm_texels packUnorm4x8で詰めたORMテクスチャのテクセル
+ *
+ * 三角形に覆われていないテクセルは元の値のまま残す。
+ */
+void BakeOrmAmbientOcclusion(const Bvh& bvh,
+                             const std::vector<glm::vec3>& positions,
+                             const std::vector<glm::vec3>& normals,
+                             const std::vector<glm::vec2>& uvs,
+                             const std::vector<std::uint32_t>& indices,
+                             int width, int height,
+                             const AmbientOcclusionSettings& settings,
+                             JobSystem& job_system,
+                             std::vector<std::uint32_t>& orm_texels);
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_AO_BAKER_H_
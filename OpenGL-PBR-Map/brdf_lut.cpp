@@ -0,0 +1,217 @@
+#include "brdf_lut.h"
+
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "job_system.h"
+#include "sampling.h"
+
+namespace game {
+
+namespace {
+
+struct BrdfLutFileHeader {
+  std::uint32_t magic;
+  std::uint32_t version;
+  std::uint32_t size;
+  std::uint32_t sample_count;
+  std::uint32_t checksum;
+};
+
+// FNV-1a
+std::uint32_t ComputeChecksum(const void* data, std::size_t size) {
+  const auto* bytes = static_cast<const std::uint8_t*>(data);
+  std::uint32_t hash = 2166136261u;
+  for (std::size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+// IBL用のSchlick-GGXの幾何減衰項 (k = alpha / 2)
+float GeometrySmith(float n_dot_v, float n_dot_l, float alpha) {
+  const float k = alpha / 2.0f;
+  const float g_v = n_dot_v / (n_dot_v * (1.0f - k) + k);
+  const float g_l = n_dot_l / (n_dot_l * (1.0f - k) + k);
+  return g_v * g_l;
+}
+
+// Split-Sumの (scale, bias) を積分する
+glm::vec2 IntegrateBrdf(float n_dot_v, float roughness, int sample_count) {
+  const glm::vec3 v(std::sqrt(1.0f - n_dot_v * n_dot_v), 0.0f, n_dot_v);
+  const float alpha = roughness * roughness;
+
+  glm::vec2 result(0.0f);
+  for (int i = 0; i < sample_count; ++i) {
+    const auto h = ImportanceSampleGGX(
+        Hammersley(static_cast<std::uint32_t>(i),
+                   static_cast<std::uint32_t>(sample_count)),
+        alpha);
+    const auto l = 2.0f * glm::dot(v, h) * h - v;
+    const float n_dot_l = l.z;
+    if (n_dot_l <= 0.0f) {
+      continue;
+    }
+    const float n_dot_h = std::max(h.z, 0.0f);
+    const float v_dot_h = std::max(glm::dot(v, h), 0.0f);
+    const float g_visibility = GeometrySmith(n_dot_v, n_dot_l, alpha) *
+                               v_dot_h / (n_dot_h * n_dot_v);
+    const float fresnel = std::pow(1.0f - v_dot_h, 5.0f);
+    result.x += (1.0f - fresnel) * g_visibility;
+    result.y += fresnel * g_visibility;
+  }
+  return result / static_cast<float>(sample_count);
+}
+
+glm::vec3 FetchTexel(const BrdfLut& lut, int x, int y) {
+  const auto* texel =
+      &lut.texels[(static_cast<std::size_t>(y) * lut.size + x) * 3];
+  return glm::vec3(glm::unpackHalf1x16(texel[0]),
+                   glm::unpackHalf1x16(texel[1]),
+                   glm::unpackHalf1x16(texel[2]));
+}
+
+}  // namespace
+
+BrdfLut GenerateBrdfLut(int size, int sample_count, JobSystem& job_system) {
+  BrdfLut lut;
+  lut.size = size;
+  lut.sample_count = sample_count;
+  lut.texels.resize(static_cast<std::size_t>(size) * size * 3);
+
+  job_system.ParallelFor(
+      static_cast<std::size_t>(size), 1,
+      [&](std::size_t begin, std::size_t end) {
+        std::vector<glm::vec2> row(size);
+        for (auto y = begin; y < end; ++y) {
+          const float roughness =
+              (static_cast<float>(y) + 0.5f) / static_cast<float>(size);
+
+          // E_avg = 2 * integral(E(mu) * mu) を行の中点則で求める
+          float average_albedo = 0.0f;
+          for (int x = 0; x < size; ++x) {
+            const float n_dot_v =
+                (static_cast<float>(x) + 0.5f) / static_cast<float>(size);
+            row[x] = IntegrateBrdf(n_dot_v, roughness, sample_count);
+            average_albedo += (row[x].x + row[x].y) * n_dot_v;
+          }
+          average_albedo *= 2.0f / static_cast<float>(size);
+
+          auto* texels = &lut.texels[y * size * 3];
+          for (int x = 0; x < size; ++x) {
+            texels[x * 3 + 0] = glm::packHalf1x16(row[x].x);
+            texels[x * 3 + 1] = glm::packHalf1x16(row[x].y);
+            texels[x * 3 + 2] = glm::packHalf1x16(average_albedo);
+          }
+        }
+      });
+  return lut;
+}
+
+std::vector<std::uint8_t> SerializeBrdfLut(const BrdfLut& lut) {
+  const auto texel_bytes = lut.texels.size() * sizeof(std::uint16_t);
+  BrdfLutFileHeader header;
+  header.magic = BrdfLut::kMagic;
+  header.version = BrdfLut::kVersion;
+  header.size = static_cast<std::uint32_t>(lut.size);
+  header.sample_count = static_cast<std::uint32_t>(lut.sample_count);
+  header.checksum = ComputeChecksum(lut.texels.data(), texel_bytes);
+
+  std::vector<std::uint8_t> bytes(sizeof(header) + texel_bytes);
+  std::memcpy(bytes.data(), &header, sizeof(header));
+  std::memcpy(bytes.data() + sizeof(header), lut.texels.data(), texel_bytes);
+  return bytes;
+}
+
+std::optional<BrdfLut> DeserializeBrdfLut(const std::uint8_t* data,
+                                          std::size_t size) {
+  BrdfLutFileHeader header;
+  if (size < sizeof(header)) {
+    return std::nullopt;
+  }
+  std::memcpy(&header, data, sizeof(header));
+  if (header.magic != BrdfLut::kMagic ||
+      header.version != BrdfLut::kVersion) {
+    return std::nullopt;
+  }
+  const auto texel_count =
+      static_cast<std::size_t>(header.size) * header.size * 3;
+  const auto texel_bytes = texel_count * sizeof(std::uint16_t);
+  if (size != sizeof(header) + texel_bytes ||
+      ComputeChecksum(data + sizeof(header), texel_bytes) != header.checksum) {
+    return std::nullopt;
+  }
+
+  BrdfLut lut;
+  lut.size = static_cast<int>(header.size);
+  lut.sample_count = static_cast<int>(header.sample_count);
+  lut.texels.resize(texel_count);
+  std::memcpy(lut.texels.data(), data + sizeof(header), texel_bytes);
+  return lut;
+}
+
+BrdfLut LoadOrGenerateBrdfLut(const std::string& path, int size,
+                              int sample_count, JobSystem& job_system) {
+  std::ifstream input(path, std::ios::binary);
+  if (input) {
+    const std::vector<std::uint8_t> bytes(
+        (std::istreambuf_iterator<char>(input)),
+        std::istreambuf_iterator<char>());
+    auto lut = DeserializeBrdfLut(bytes.data(), bytes.size());
+    if (lut && lut->size == size && lut->sample_count == sample_count) {
+      return *lut;
+    }
+    std::cerr << "BRDF LUT cache is stale: " << path << std::endl;
+  }
+
+  auto lut = GenerateBrdfLut(size, sample_count, job_system);
+  const auto bytes = SerializeBrdfLut(lut);
+  std::ofstream output(path, std::ios::binary);
+  if (!output.write(reinterpret_cast<const char*>(bytes.data()),
+                    bytes.size())) {
+    std::cerr << "Can't write BRDF LUT cache: " << path << std::endl;
+  }
+  return lut;
+}
+
+glm::vec3 SampleBrdfLut(const BrdfLut& lut, float n_dot_v, float roughness) {
+  const float x = glm::clamp(n_dot_v * lut.size - 0.5f, 0.0f,
+                             static_cast<float>(lut.size - 1));
+  const float y = glm::clamp(roughness * lut.size - 0.5f, 0.0f,
+                             static_cast<float>(lut.size - 1));
+  const int x0 = static_cast<int>(x);
+  const int y0 = static_cast<int>(y);
+  const int x1 = std::min(x0 + 1, lut.size - 1);
+  const int y1 = std::min(y0 + 1, lut.size - 1);
+  const float fx = x - static_cast<float>(x0);
+  const float fy = y - static_cast<float>(y0);
+  const auto bottom =
+      glm::mix(FetchTexel(lut, x0, y0), FetchTexel(lut, x1, y0), fx);
+  const auto top =
+      glm::mix(FetchTexel(lut, x0, y1), FetchTexel(lut, x1, y1), fx);
+  return glm::mix(bottom, top, fy);
+}
+
+GLuint CreateBrdfLutTexture(const BrdfLut& lut) {
+  GLuint texture;
+  glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+  glTextureStorage2D(texture, 1, GL_RGB16F, lut.size, lut.size);
+  // RGB16Fの行は4バイト境界に揃うとは限らない
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+  glTextureSubImage2D(texture, 0, 0, 0, lut.size, lut.size, GL_RGB,
+                      GL_HALF_FLOAT, lut.texels.data());
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  return texture;
+}
+
+}  // namespace game
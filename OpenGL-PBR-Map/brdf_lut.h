@@ -0,0 +1,91 @@
+#ifndef OPENGL_PBR_MAP_BRDF_LUT_H_
+#define OPENGL_PBR_MAP_BRDF_LUT_H_
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace game {
+
+class JobSystem;
+
+/**
+ * @brief GGX/SmithのSplit-Sum近似で使うDFGのルックアップテーブル
+ *
+ * 横軸がNoV、縦軸がroughness (perceptual roughness) で、各テクセルは
+ * half floatのRGBを持つ。
+ * R: F0に掛けるスケール
+ * G: F0に足すバイアス
+ * B: 多重散乱のエネルギー補償に使う平均アルベドE_avg (行ごとに一定)
+ *
+ * F0 = 1のときの単散乱アルベドE(NoV)はR + Gになる。
+ */
+struct BrdfLut {
+  static constexpr std::uint32_t kMagic = 0x54554c42;  // "BLUT"
+  static constexpr std::uint32_t kVersion = 1;
+
+  int size = 0;
+  int sample_count = 0;
+  std::vector<std::uint16_t> texels;
+};
+
+/**
+ * @brief BRDF LUTをHammersley点列による重点的サンプリングで生成する
+ * @param size テーブルの一辺の解像度
+ * @param sample_count テクセルあたりのサンプル数
+ * @param job_system 行単位の並列化に使うJobSystem
+ * @return 生成したBRDF LUT
+ */
+BrdfLut GenerateBrdfLut(int size, int sample_count, JobSystem& job_system);
+
+/**
+ * @brief BRDF LUTをバージョンとチェックサム付きのバイト列にする
+ * @param lut 書き出すBRDF LUT
+ * @return ヘッダとRGB16Fのテクセルを並べたバイト列
+ */
+std::vector<std::uint8_t> SerializeBrdfLut(const BrdfLut& lut);
+
+/**
+ * @brief バイト列からBRDF LUTを読み込む
+ * @param data SerializeBrdfLutで書き出したバイト列
+ * @param size バイト列の長さ
+ * @return マジックナンバー、バージョン、チェックサムが一致すればBRDF LUT
+ */
+std::optional<BrdfLut> DeserializeBrdfLut(const std::uint8_t* data,
+                                          std::size_t size);
+
+/**
+ * @brief キャッシュファイルからBRDF LUTを読み込み、無効なら生成して保存する
+ * @param path キャッシュファイルのパス
+ * @param size 生成する場合の一辺の解像度
+ * @param sample_count 生成する場合のテクセルあたりのサンプル数
+ * @param job_system 生成する場合に使うJobSystem
+ * @return BRDF LUT
+ */
+BrdfLut LoadOrGenerateBrdfLut(const std::string& path, int size,
+                              int sample_count, JobSystem& job_system);
+
+/**
+ * @brief CPU側でBRDF LUTをバイリニア補間で参照する
+ * @param lut 参照するBRDF LUT
+ * @param n_dot_v 法線と視線の内積
+ * @param roughness perceptual roughness
+ * @return (scale, bias, E_avg)
+ */
+glm::vec3 SampleBrdfLut(const BrdfLut& lut, float n_dot_v, float roughness);
+
+/**
+ * @brief BRDF LUTからGL_RGB16Fのテクスチャを作成する
+ * @param lut アップロードするBRDF LUT
+ * @return テクスチャの名前、呼び出し側で
+ *         GlStateCache::GetInstance().DeleteTexturesで削除すること
+ */
+GLuint CreateBrdfLutTexture(const BrdfLut& lut);
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_BRDF_LUT_H_
@@ -0,0 +1,607 @@
+#include "bvh.h"
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/intersect.hpp>
+
+#include <algorithm>
+#include <array>
+#include <utility>
+
+#include "frustum.h"
+#include "job_system.h"
+
+namespace game {
+
+namespace {
+
+// 葉に入れるプリミティブの最大数
+constexpr std::uint32_t kMaxLeafSize = 8;
+constexpr int kMaxStackDepth = 64;
+// これより深い節はSAHをやめて中央値で分け、探索のスタックに収める
+constexpr std::uint32_t kMaxSahDepth = 32;
+// SAHの候補にする分割位置のビン数
+constexpr int kBinCount = 16;
+// 節をたどる費用のプリミティブとの交差判定に対する比
+constexpr float kTraversalCost = 1.0f;
+// これより多くのプリミティブを持つ節は集計と子の構築を並列に行う
+constexpr std::uint32_t kParallelBuildThreshold = 8192;
+constexpr std::size_t kBuildGrainSize = 4096;
+
+struct Bin {
+  AABB bounds;
+  std::uint32_t count = 0;
+};
+using AxisBins = std::array<std::array<Bin, kBinCount>, 3>;
+
+// [begin, end)を分けて並列に集計し、分けた順に結合する
+template <typename T, typename Map, typename Reduce>
+T ParallelReduce(JobSystem& job_system, std::uint32_t begin,
+                 std::uint32_t end, const T& initial, const Map& map,
+                 const Reduce& reduce) {
+  const std::size_t count = end - begin;
+  if (count < kParallelBuildThreshold) {
+    return map(begin, end);
+  }
+  std::vector<T> partials((count + kBuildGrainSize - 1) / kBuildGrainSize,
+                          initial);
+  job_system.ParallelFor(
+      count, kBuildGrainSize, [&](std::size_t first, std::size_t last) {
+        partials[first / kBuildGrainSize] =
+            map(begin + static_cast<std::uint32_t>(first),
+                begin + static_cast<std::uint32_t>(last));
+      });
+  auto result = initial;
+  for (const auto& partial : partials) {
+    result = reduce(result, partial);
+  }
+  return result;
+}
+
+// スラブ法で交差区間の入口を求める
+bool IntersectAABB(const glm::vec3& min, const glm::vec3& max,
+                   const glm::vec3& origin,
+                   const glm::vec3& inverse_direction, float t_min,
+                   float t_max, float& t_entry) {
+  const auto t0 = (min - origin) * inverse_direction;
+  const auto t1 = (max - origin) * inverse_direction;
+  const auto t_near = glm::min(t0, t1);
+  const auto t_far = glm::max(t0, t1);
+  t_entry = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, t_min));
+  const float t_exit =
+      std::min(std::min(t_far.x, t_far.y), std::min(t_far.z, t_max));
+  return t_entry <= t_exit;
+}
+
+// 点から箱までの距離の2乗
+float GetDistanceSquared(const AABB& bounds, const glm::vec3& point) {
+  const auto d = point - glm::clamp(point, bounds.min, bounds.max);
+  return glm::dot(d, d);
+}
+
+// 箱が視錐台に完全に含まれるか
+bool IsInsideFrustum(const Frustum& frustum, const AABB& bounds) {
+  for (const auto& plane : frustum.planes) {
+    const glm::vec3 normal(plane);
+    const auto nearest = glm::mix(bounds.max, bounds.min,
+                                  glm::greaterThanEqual(normal,
+                                                        glm::vec3(0.0f)));
+    if (glm::dot(normal, nearest) + plane.w < 0.0f) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::vector<AABB> ComputeTriangleBounds(
+    const std::vector<glm::vec3>& positions,
+    const std::vector<std::uint32_t>& indices) {
+  std::vector<AABB> bounds(indices.size() / 3);
+  for (std::size_t i = 0; i < bounds.size(); ++i) {
+    for (std::size_t j = 0; j < 3; ++j) {
+      bounds[i].Extend(positions[indices[i * 3 + j]]);
+    }
+  }
+  return bounds;
+}
+
+}  // namespace
+
+struct Bvh::BuildContext {
+  // 構築中に並べ替えるプリミティブ。番号を介さず連続して読めるよう
+  // 箱と重心を一緒に持つ
+  struct Primitive {
+    AABB bounds;
+    glm::vec3 centroid;
+    std::uint32_t id;
+  };
+
+  std::vector<Primitive> primitives;
+  JobSystem& job_system;
+};
+
+void Bvh::Build(const std::vector<glm::vec3>& positions,
+                const std::vector<std::uint32_t>& indices,
+                JobSystem& job_system) {
+  BuildNodes(ComputeTriangleBounds(positions, indices), job_system);
+
+  // 葉の中の三角形がメモリ上で連続するよう並べ替える
+  vertices_.resize(primitive_ids_.size() * 3);
+  for (std::size_t slot = 0; slot < primitive_ids_.size(); ++slot) {
+    const auto id = primitive_ids_[slot];
+    for (std::size_t j = 0; j < 3; ++j) {
+      vertices_[slot * 3 + j] = positions[indices[id * 3 + j]];
+    }
+  }
+}
+
+void Bvh::Build(const std::vector<glm::vec3>& positions,
+                const std::vector<std::uint32_t>& indices) {
+  Build(positions, indices, JobSystem::GetInstance());
+}
+
+void Bvh::Build(const std::vector<AABB>& primitive_bounds,
+                JobSystem& job_system) {
+  BuildNodes(primitive_bounds, job_system);
+  vertices_.clear();
+}
+
+void Bvh::BuildNodes(const std::vector<AABB>& primitive_bounds,
+                     JobSystem& job_system) {
+  const auto primitive_count =
+      static_cast<std::uint32_t>(primitive_bounds.size());
+  primitive_ids_.resize(primitive_count);
+  nodes_.clear();
+  primitive_slots_.resize(primitive_count);
+  primitive_bounds_.clear();
+  if (primitive_count == 0) {
+    return;
+  }
+
+  BuildContext context{{}, job_system};
+  context.primitives.resize(primitive_count);
+  job_system.ParallelFor(
+      primitive_count, kBuildGrainSize,
+      [&](std::size_t begin, std::size_t end) {
+        for (auto i = begin; i < end; ++i) {
+          const auto& bounds = primitive_bounds[i];
+          context.primitives[i] = {bounds, bounds.GetCenter(),
+                                   static_cast<std::uint32_t>(i)};
+        }
+      });
+  nodes_.reserve(static_cast<std::size_t>(primitive_count) * 2 - 1);
+  BuildSubtree(context, 0, primitive_count, 0, nodes_);
+
+  primitive_bounds_.resize(primitive_count);
+  for (std::uint32_t slot = 0; slot < primitive_count; ++slot) {
+    const auto& primitive = context.primitives[slot];
+    primitive_ids_[slot] = primitive.id;
+    primitive_slots_[primitive.id] = slot;
+    primitive_bounds_[slot] = primitive.bounds;
+  }
+}
+
+void Bvh::BuildSubtree(BuildContext& context, std::uint32_t begin,
+                       std::uint32_t end, std::uint32_t depth,
+                       std::vector<Node>& nodes) {
+  auto& primitives = context.primitives;
+  const auto node_index = static_cast<std::uint32_t>(nodes.size());
+  nodes.emplace_back();
+  const auto count = end - begin;
+
+  // 節の箱と重心の範囲
+  using BoundsPair = std::pair<AABB, AABB>;
+  const auto [bounds, centroid_bounds] = ParallelReduce(
+      context.job_system, begin, end, BoundsPair(),
+      [&](std::uint32_t first, std::uint32_t last) {
+        BoundsPair result;
+        for (auto i = first; i < last; ++i) {
+          result.first.Extend(primitives[i].bounds);
+          result.second.Extend(primitives[i].centroid);
+        }
+        return result;
+      },
+      [](BoundsPair a, const BoundsPair& b) {
+        a.first.Extend(b.first);
+        a.second.Extend(b.second);
+        return a;
+      });
+  nodes[node_index].min = bounds.min;
+  nodes[node_index].max = bounds.max;
+  nodes[node_index].offset = begin;
+  nodes[node_index].count = count;
+  if (count <= 1) {
+    return;
+  }
+
+  // 重心を3軸それぞれビンに振り分ける。小さな節はビンを減らして
+  // 節ごとの固定の手間を抑える
+  const int bin_count = static_cast<int>(
+      std::min<std::uint32_t>(kBinCount, count * 2));
+  const auto extent = centroid_bounds.GetSize();
+  const auto bin_scale = glm::vec3(static_cast<float>(bin_count)) /
+                         glm::max(extent, glm::vec3(1.0e-20f));
+  auto get_bin = [&](const glm::vec3& centroid, int axis) {
+    const auto bin = static_cast<int>((centroid[axis] -
+                                       centroid_bounds.min[axis]) *
+                                      bin_scale[axis]);
+    return std::min(bin, bin_count - 1);
+  };
+  const auto bins = ParallelReduce(
+      context.job_system, begin, end, AxisBins(),
+      [&](std::uint32_t first, std::uint32_t last) {
+        AxisBins result;
+        for (auto i = first; i < last; ++i) {
+          const auto& primitive = primitives[i];
+          for (int axis = 0; axis < 3; ++axis) {
+            auto& bin = result[axis][get_bin(primitive.centroid, axis)];
+            bin.bounds.Extend(primitive.bounds);
+            ++bin.count;
+          }
+        }
+        return result;
+      },
+      [](AxisBins a, const AxisBins& b) {
+        for (int axis = 0; axis < 3; ++axis) {
+          for (int i = 0; i < kBinCount; ++i) {
+            a[axis][i].bounds.Extend(b[axis][i].bounds);
+            a[axis][i].count += b[axis][i].count;
+          }
+        }
+        return a;
+      });
+
+  // ビンの境界ごとに左右の表面積とプリミティブ数からSAHの費用を求める
+  float best_cost = std::numeric_limits<float>::infinity();
+  int best_axis = -1;
+  int best_split = 0;
+  for (int axis = 0; axis < 3; ++axis) {
+    if (extent[axis] <= 0.0f) {
+      continue;
+    }
+    std::array<float, kBinCount - 1> right_costs;
+    AABB right_bounds;
+    std::uint32_t right_count = 0;
+    for (int i = bin_count - 1; i > 0; --i) {
+      right_bounds.Extend(bins[axis][i].bounds);
+      right_count += bins[axis][i].count;
+      right_costs[i - 1] =
+          right_count == 0 ? 0.0f : right_bounds.GetSurfaceArea() * right_count;
+    }
+    AABB left_bounds;
+    std::uint32_t left_count = 0;
+    for (int i = 0; i < bin_count - 1; ++i) {
+      left_bounds.Extend(bins[axis][i].bounds);
+      left_count += bins[axis][i].count;
+      if (left_count == 0 || left_count == count) {
+        continue;
+      }
+      const float cost =
+          left_bounds.GetSurfaceArea() * left_count + right_costs[i];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_split = i + 1;
+      }
+    }
+  }
+
+  auto middle = begin + count / 2;
+  if (best_axis >= 0 && depth >= kMaxSahDepth) {
+    std::nth_element(primitives.begin() + begin, primitives.begin() + middle,
+                     primitives.begin() + end,
+                     [&](const BuildContext::Primitive& a,
+                         const BuildContext::Primitive& b) {
+                       return a.centroid[best_axis] < b.centroid[best_axis];
+                     });
+  } else if (best_axis >= 0) {
+    const float split_cost =
+        kTraversalCost + best_cost / bounds.GetSurfaceArea();
+    if (split_cost >= static_cast<float>(count) && count <= kMaxLeafSize) {
+      return;
+    }
+    middle = static_cast<std::uint32_t>(
+        std::partition(primitives.begin() + begin, primitives.begin() + end,
+                       [&](const BuildContext::Primitive& primitive) {
+                         return get_bin(primitive.centroid, best_axis) <
+                                best_split;
+                       }) -
+        primitives.begin());
+  } else if (count <= kMaxLeafSize) {
+    // 重心が全て重なっていて分けられない
+    return;
+  }
+
+  nodes[node_index].count = 0;
+  if (count < kParallelBuildThreshold) {
+    BuildSubtree(context, begin, middle, depth + 1, nodes);
+    nodes[node_index].offset = static_cast<std::uint32_t>(nodes.size());
+    BuildSubtree(context, middle, end, depth + 1, nodes);
+    return;
+  }
+
+  // 大きな節は左右の部分木を別々の配列に並列に作ってからつなげる
+  std::array<std::vector<Node>, 2> children;
+  children[0].reserve(static_cast<std::size_t>(middle - begin) * 2);
+  children[1].reserve(static_cast<std::size_t>(end - middle) * 2);
+  context.job_system.ParallelFor(
+      2, 1, [&](std::size_t first, std::size_t last) {
+        for (auto i = first; i < last; ++i) {
+          BuildSubtree(context, i == 0 ? begin : middle,
+                       i == 0 ? middle : end, depth + 1, children[i]);
+        }
+      });
+  for (const auto& child : children) {
+    const auto base = static_cast<std::uint32_t>(nodes.size());
+    for (auto node : child) {
+      if (node.count == 0) {
+        node.offset += base;
+      }
+      nodes.push_back(node);
+    }
+  }
+  nodes[node_index].offset =
+      node_index + 1 + static_cast<std::uint32_t>(children[0].size());
+}
+
+void Bvh::Refit(const std::vector<glm::vec3>& positions,
+                const std::vector<std::uint32_t>& indices) {
+  RefitNodes(ComputeTriangleBounds(positions, indices));
+  for (std::size_t slot = 0; slot < primitive_ids_.size(); ++slot) {
+    const auto id = primitive_ids_[slot];
+    for (std::size_t j = 0; j < 3; ++j) {
+      vertices_[slot * 3 + j] = positions[indices[id * 3 + j]];
+    }
+  }
+}
+
+void Bvh::Refit(const std::vector<AABB>& primitive_bounds) {
+  RefitNodes(primitive_bounds);
+}
+
+void Bvh::RefitNodes(const std::vector<AABB>& primitive_bounds) {
+  // 子は必ず親より後ろにあるので逆順に処理すれば下から更新できる
+  for (auto i = nodes_.size(); i-- > 0;) {
+    auto& node = nodes_[i];
+    AABB bounds;
+    if (node.count > 0) {
+      for (auto slot = node.offset; slot < node.offset + node.count; ++slot) {
+        primitive_bounds_[slot] = primitive_bounds[primitive_ids_[slot]];
+        bounds.Extend(primitive_bounds_[slot]);
+      }
+    } else {
+      bounds = nodes_[i + 1].GetBounds();
+      bounds.Extend(nodes_[node.offset].GetBounds());
+    }
+    node.min = bounds.min;
+    node.max = bounds.max;
+  }
+}
+
+bool Bvh::Intersect(const Ray& ray, RayHit& hit) const {
+  return Traverse<false>(ray, hit);
+}
+
+bool Bvh::IsOccluded(const Ray& ray) const {
+  RayHit hit;
+  return Traverse<true>(ray, hit);
+}
+
+template <bool kAnyHit>
+bool Bvh::Traverse(const Ray& ray, RayHit& hit) const {
+  if (vertices_.empty()) {
+    return false;
+  }
+  const auto inverse_direction = 1.0f / ray.direction;
+  float t_max = ray.t_max;
+  float t_entry;
+  if (!IntersectAABB(nodes_[0].min, nodes_[0].max, ray.origin,
+                     inverse_direction, ray.t_min, t_max, t_entry)) {
+    return false;
+  }
+
+  struct StackEntry {
+    std::uint32_t node;
+    float t_entry;
+  };
+  StackEntry stack[kMaxStackDepth];
+  int stack_size = 0;
+  stack[stack_size++] = {0, t_entry};
+
+  bool found = false;
+  while (stack_size > 0) {
+    const auto entry = stack[--stack_size];
+    if (entry.t_entry > t_max) {
+      continue;
+    }
+    const auto& node = nodes_[entry.node];
+
+    if (node.count > 0) {
+      for (auto slot = node.offset; slot < node.offset + node.count; ++slot) {
+        glm::vec2 barycentric;
+        float t;
+        if (!glm::intersectRayTriangle(ray.origin, ray.direction,
+                                       vertices_[slot * 3 + 0],
+                                       vertices_[slot * 3 + 1],
+                                       vertices_[slot * 3 + 2], barycentric,
+                                       t) ||
+            t < ray.t_min || t > t_max) {
+          continue;
+        }
+        found = true;
+        if constexpr (kAnyHit) {
+          return true;
+        }
+        t_max = t;
+        hit.t = t;
+        hit.triangle = primitive_ids_[slot];
+        hit.barycentric = barycentric;
+      }
+      continue;
+    }
+
+    // 近い方の子から処理するよう遠い方を先に積む
+    const auto left = entry.node + 1;
+    const auto right = node.offset;
+    float t_left;
+    float t_right;
+    const bool hit_left =
+        IntersectAABB(nodes_[left].min, nodes_[left].max, ray.origin,
+                      inverse_direction, ray.t_min, t_max, t_left);
+    const bool hit_right =
+        IntersectAABB(nodes_[right].min, nodes_[right].max, ray.origin,
+                      inverse_direction, ray.t_min, t_max, t_right);
+    if (hit_left && hit_right) {
+      if (t_left < t_right) {
+        stack[stack_size++] = {right, t_right};
+        stack[stack_size++] = {left, t_left};
+      } else {
+        stack[stack_size++] = {left, t_left};
+        stack[stack_size++] = {right, t_right};
+      }
+    } else if (hit_left) {
+      stack[stack_size++] = {left, t_left};
+    } else if (hit_right) {
+      stack[stack_size++] = {right, t_right};
+    }
+  }
+  return found;
+}
+
+void Bvh::QueryRay(const Ray& ray,
+                   std::vector<std::uint32_t>& primitives) const {
+  primitives.clear();
+  if (nodes_.empty()) {
+    return;
+  }
+  const auto inverse_direction = 1.0f / ray.direction;
+  struct StackEntry {
+    std::uint32_t node;
+    float t_entry;
+  };
+  StackEntry stack[kMaxStackDepth];
+  int stack_size = 0;
+  float t_entry;
+  if (IntersectAABB(nodes_[0].min, nodes_[0].max, ray.origin,
+                    inverse_direction, ray.t_min, ray.t_max, t_entry)) {
+    stack[stack_size++] = {0, t_entry};
+  }
+  while (stack_size > 0) {
+    const auto index = stack[--stack_size].node;
+    const auto& node = nodes_[index];
+    if (node.count > 0) {
+      for (auto slot = node.offset; slot < node.offset + node.count; ++slot) {
+        const auto& bounds = primitive_bounds_[slot];
+        if (IntersectAABB(bounds.min, bounds.max, ray.origin,
+                          inverse_direction, ray.t_min, ray.t_max,
+                          t_entry)) {
+          primitives.push_back(primitive_ids_[slot]);
+        }
+      }
+      continue;
+    }
+    const std::uint32_t children[] = {index + 1, node.offset};
+    StackEntry hits[2];
+    int hit_count = 0;
+    for (const auto child : children) {
+      float t;
+      if (IntersectAABB(nodes_[child].min, nodes_[child].max, ray.origin,
+                        inverse_direction, ray.t_min, ray.t_max, t)) {
+        hits[hit_count++] = {child, t};
+      }
+    }
+    if (hit_count == 2 && hits[0].t_entry < hits[1].t_entry) {
+      std::swap(hits[0], hits[1]);
+    }
+    for (int i = 0; i < hit_count; ++i) {
+      stack[stack_size++] = hits[i];
+    }
+  }
+}
+
+void Bvh::QueryBox(const AABB& bounds,
+                   std::vector<std::uint32_t>& primitives) const {
+  CollectPrimitives(
+      [&](const AABB& node) { return bounds.Overlaps(node); },
+      [&](const AABB& node) {
+        return bounds.Contains(node.min) && bounds.Contains(node.max);
+      },
+      primitives);
+}
+
+void Bvh::QuerySphere(const glm::vec3& center, float radius,
+                      std::vector<std::uint32_t>& primitives) const {
+  const float radius_squared = radius * radius;
+  CollectPrimitives(
+      [&](const AABB& node) {
+        return GetDistanceSquared(node, center) <= radius_squared;
+      },
+      [&](const AABB& node) {
+        // 中心から最も遠い頂点が球の中にあれば箱全体が含まれる
+        const auto farthest =
+            glm::max(glm::abs(node.min - center), glm::abs(node.max - center));
+        return glm::dot(farthest, farthest) <= radius_squared;
+      },
+      primitives);
+}
+
+void Bvh::QueryFrustum(const Frustum& frustum,
+                       std::vector<std::uint32_t>& primitives) const {
+  CollectPrimitives(
+      [&](const AABB& node) { return frustum.Intersects(node); },
+      [&](const AABB& node) { return IsInsideFrustum(frustum, node); },
+      primitives);
+}
+
+template <typename Overlap, typename Contain>
+void Bvh::CollectPrimitives(const Overlap& overlaps, const Contain& contains,
+                            std::vector<std::uint32_t>& primitives) const {
+  primitives.clear();
+  if (nodes_.empty()) {
+    return;
+  }
+  struct StackEntry {
+    std::uint32_t node;
+    // 親が範囲に完全に含まれていて判定を省けるかどうか
+    bool inside;
+  };
+  StackEntry stack[kMaxStackDepth];
+  int stack_size = 0;
+  stack[stack_size++] = {0, false};
+  while (stack_size > 0) {
+    auto entry = stack[--stack_size];
+    const auto& node = nodes_[entry.node];
+    if (!entry.inside) {
+      const auto bounds = node.GetBounds();
+      if (!overlaps(bounds)) {
+        continue;
+      }
+      entry.inside = contains(bounds);
+    }
+    if (node.count > 0) {
+      // 葉の箱が含まれていなければプリミティブごとに判定する
+      for (auto slot = node.offset; slot < node.offset + node.count; ++slot) {
+        if (entry.inside || overlaps(primitive_bounds_[slot])) {
+          primitives.push_back(primitive_ids_[slot]);
+        }
+      }
+      continue;
+    }
+    stack[stack_size++] = {node.offset, entry.inside};
+    stack[stack_size++] = {entry.node + 1, entry.inside};
+  }
+}
+
+void Bvh::GetTriangle(std::uint32_t triangle, glm::vec3 vertices[3]) const {
+  const auto slot = primitive_slots_[triangle];
+  for (int j = 0; j < 3; ++j) {
+    vertices[j] = vertices_[slot * 3 + j];
+  }
+}
+
+std::size_t Bvh::GetTriangleCount() const { return vertices_.size() / 3; }
+
+AABB Bvh::GetBounds() const {
+  return nodes_.empty() ? AABB() : nodes_[0].GetBounds();
+}
+
+}  // namespace game
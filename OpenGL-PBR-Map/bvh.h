@@ -0,0 +1,200 @@
+#ifndef OPENGL_PBR_MAP_BVH_H_
+#define OPENGL_PBR_MAP_BVH_H_
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "aabb.h"
+
+namespace game {
+
+/**
+ * @brief 半直線
+ */
+struct Ray {
+  glm::vec3 origin;
+  glm::vec3 direction;
+  float t_min = 0.0f;
+  float t_max = std::numeric_limits<float>::infinity();
+};
+
+/**
+ * @brief 半直線と三角形の交差結果
+ */
+struct RayHit {
+  float t;
+  std::uint32_t triangle;
+  glm::vec2 barycentric;
+};
+
+class JobSystem;
+struct Frustum;
+
+/**
+ * @brief Bounding Volume Hierarchy
+ *
+ * 三角形メッシュから作ればレイとの交差判定に、シーンのインスタンスなどの
+ * バウンディングボックスから作れば範囲検索に使える。
+ * ビンに分けたSAHでジョブシステム上で並列に構築し、同じ入力なら
+ * スレッド数によらず同じ木になる。
+ * 構築後は読み取り専用なので複数スレッドから同時に検索してよい。
+ */
+class Bvh {
+ public:
+  /**
+   * @brief 三角形メッシュからBVHを構築する
+   * @param positions 頂点座標
+   * @param indices 三角形リストのインデックス
+   * @param job_system 構築に使うジョブシステム
+   */
+  void Build(const std::vector<glm::vec3>& positions,
+             const std::vector<std::uint32_t>& indices,
+             JobSystem& job_system);
+
+  /**
+   * @brief 共有のジョブシステムで三角形メッシュからBVHを構築する
+   * @param positions 頂点座標
+   * @param indices 三角形リストのインデックス
+   */
+  void Build(const std::vector<glm::vec3>& positions,
+             const std::vector<std::uint32_t>& indices);
+
+  /**
+   * @brief 任意のプリミティブのバウンディングボックスからBVHを構築する
+   * @param primitive_bounds プリミティブごとのバウンディングボックス
+   * @param job_system 構築に使うジョブシステム
+   *
+   * 三角形を持たないのでIntersectとIsOccludedは常にfalseを返す。
+   */
+  void Build(const std::vector<AABB>& primitive_bounds,
+             JobSystem& job_system);
+
+  /**
+   * @brief 木の形を変えずに三角形の移動に合わせて箱を更新する
+   * @param positions 新しい頂点座標
+   * @param indices Buildに渡したものと同じインデックス
+   */
+  void Refit(const std::vector<glm::vec3>& positions,
+             const std::vector<std::uint32_t>& indices);
+
+  /**
+   * @brief 木の形を変えずにプリミティブの移動に合わせて箱を更新する
+   * @param primitive_bounds 新しいバウンディングボックス
+   *
+   * 大きく動くと検索が遅くなるので、その場合は作り直す。
+   */
+  void Refit(const std::vector<AABB>& primitive_bounds);
+
+  /**
+   * @brief 最も近い三角形との交差を求める
+   * @param ray 半直線
+   * @param hit 交差した場合の結果
+   * @return 交差したかどうか
+   */
+  bool Intersect(const Ray& ray, RayHit& hit) const;
+
+  /**
+   * @brief [t_min, t_max]の間に何か交差するかを求める
+   * @param ray 半直線
+   * @return 遮蔽されているかどうか
+   */
+  bool IsOccluded(const Ray& ray) const;
+
+  /**
+   * @brief 半直線がバウンディングボックスを通るプリミティブを集める
+   * @param ray 半直線
+   * @param primitives Buildに渡した番号の出力、手前の葉から順に並ぶ
+   */
+  void QueryRay(const Ray& ray, std::vector<std::uint32_t>& primitives) const;
+
+  /**
+   * @brief バウンディングボックスが重なるプリミティブを集める
+   * @param bounds 検索範囲
+   * @param primitives Buildに渡した番号の出力
+   */
+  void QueryBox(const AABB& bounds,
+                std::vector<std::uint32_t>& primitives) const;
+
+  /**
+   * @brief バウンディングボックスが球と重なるプリミティブを集める
+   * @param center 球の中心
+   * @param radius 球の半径
+   * @param primitives Buildに渡した番号の出力
+   */
+  void QuerySphere(const glm::vec3& center, float radius,
+                   std::vector<std::uint32_t>& primitives) const;
+
+  /**
+   * @brief バウンディングボックスが視錐台と重なるプリミティブを集める
+   * @param frustum 視錐台
+   * @param primitives Buildに渡した番号の出力
+   *
+   * 視錐台に完全に含まれる節はその下を判定せずにまとめて出力する。
+   */
+  void QueryFrustum(const Frustum& frustum,
+                    std::vector<std::uint32_t>& primitives) const;
+
+  /**
+   * @brief 三角形の頂点座標を取得する
+   * @param triangle Buildに渡したインデックスでの三角形番号
+   * @param vertices 3頂点の出力
+   */
+  void GetTriangle(std::uint32_t triangle, glm::vec3 vertices[3]) const;
+
+  /**
+   * @brief 三角形の数を取得する
+   * @return 三角形の数
+   */
+  std::size_t GetTriangleCount() const;
+
+  /**
+   * @brief 全体のバウンディングボックスを取得する
+   * @return バウンディングボックス
+   */
+  AABB GetBounds() const;
+
+ private:
+  // キャッシュラインに2つ入る32バイトの節。左の子は常に直後に置く
+  struct Node {
+    glm::vec3 min;
+    // 葉なら最初のプリミティブ、節なら右の子のインデックス
+    std::uint32_t offset;
+    glm::vec3 max;
+    // 葉のプリミティブ数、0なら節
+    std::uint32_t count;
+
+    AABB GetBounds() const { return AABB(min, max); }
+  };
+  static_assert(sizeof(Node) == 32, "Bvh::Node must be 32 bytes.");
+
+  struct BuildContext;
+
+  void BuildNodes(const std::vector<AABB>& primitive_bounds,
+                  JobSystem& job_system);
+  void BuildSubtree(BuildContext& context, std::uint32_t begin,
+                    std::uint32_t end, std::uint32_t depth,
+                    std::vector<Node>& nodes);
+  void RefitNodes(const std::vector<AABB>& primitive_bounds);
+  template <bool kAnyHit>
+  bool Traverse(const Ray& ray, RayHit& hit) const;
+  template <typename Overlap, typename Contain>
+  void CollectPrimitives(const Overlap& overlaps, const Contain& contains,
+                         std::vector<std::uint32_t>& primitives) const;
+
+  std::vector<Node> nodes_;
+  // 葉の順に並べたプリミティブのBuildに渡した番号
+  std::vector<std::uint32_t> primitive_ids_;
+  // Buildに渡した番号からBVH内の順番への対応
+  std::vector<std::uint32_t> primitive_slots_;
+  // 葉の順に並べたプリミティブのバウンディングボックス
+  std::vector<AABB> primitive_bounds_;
+  // 葉の順に並べた三角形の頂点 (三角形あたり3個)、三角形で作ったときだけ
+  std::vector<glm::vec3> vertices_;
+};
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_BVH_H_
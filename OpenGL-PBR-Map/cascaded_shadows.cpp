@@ -0,0 +1,311 @@
+#include "cascaded_shadows.h"
+
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "frustum.h"
+#include "frustum_culling.h"
+#include "gl_state_cache.h"
+#include "job_system.h"
+#include "shader_program.h"
+
+namespace game {
+
+namespace {
+
+// 深度の範囲を求めるワークグループの一辺のピクセル数
+constexpr int kReductionGroupSize = 16;
+// 読み戻した深度の範囲は遅れているので、この割合だけ広げて使う
+constexpr float kDepthRangeMargin = 0.1f;
+// 球の半径をこの逆数の単位に切り上げ、範囲の小さな変化で大きさが
+// 変わらないようにする
+constexpr float kRadiusQuantization = 16.0f;
+
+}  // namespace
+
+CascadedShadowMaps::CascadedShadowMaps(int cascade_count, int resolution,
+                                       float split_lambda)
+    : cascade_count_(std::clamp(cascade_count, 1, kMaxCascadeCount)),
+      resolution_(resolution),
+      split_lambda_(split_lambda),
+      depth_range_(0.0f),
+      reduced_depth_range_(1.0f, 0.0f),
+      reduction_program_(0),
+      shadow_texture_(0),
+      framebuffer_(0),
+      cascade_buffer_(0),
+      readback_buffer_(0),
+      readback_mapped_(nullptr),
+      readback_stride_(0),
+      next_readback_serial_(0),
+      latest_readback_serial_(0) {
+  readback_fences_.fill(nullptr);
+  readback_serials_.fill(0);
+}
+
+CascadedShadowMaps::~CascadedShadowMaps() {
+  if (reduction_program_ == 0) {
+    return;
+  }
+  for (auto fence : readback_fences_) {
+    if (fence != nullptr) {
+      glDeleteSync(fence);
+    }
+  }
+  glDeleteProgram(reduction_program_);
+  glDeleteFramebuffers(1, &framebuffer_);
+  GlStateCache::GetInstance().DeleteTextures(1, &shadow_texture_);
+  glDeleteBuffers(1, &cascade_buffer_);
+  glDeleteBuffers(1, &readback_buffer_);
+}
+
+bool CascadedShadowMaps::Initialize(const std::string& shader_directory) {
+  reduction_program_ = LoadShaderProgram(
+      {{GL_COMPUTE_SHADER, shader_directory + "/depth_reduction.comp"}});
+  if (reduction_program_ == 0) {
+    return false;
+  }
+
+  glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &shadow_texture_);
+  glTextureStorage3D(shadow_texture_, 1, GL_DEPTH_COMPONENT32F, resolution_,
+                     resolution_, cascade_count_);
+  glTextureParameteri(shadow_texture_, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTextureParameteri(shadow_texture_, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTextureParameteri(shadow_texture_, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTextureParameteri(shadow_texture_, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTextureParameteri(shadow_texture_, GL_TEXTURE_COMPARE_MODE,
+                      GL_COMPARE_REF_TO_TEXTURE);
+  glTextureParameteri(shadow_texture_, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+  glCreateFramebuffers(1, &framebuffer_);
+
+  glCreateBuffers(1, &cascade_buffer_);
+  glNamedBufferStorage(cascade_buffer_, sizeof(GpuCascadedShadows), nullptr,
+                       GL_DYNAMIC_STORAGE_BIT);
+
+  // 読み戻しの各領域の先頭はSSBOのオフセットの制約に揃える
+  GLint alignment;
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  readback_stride_ = std::max<GLintptr>(alignment, 2 * sizeof(std::uint32_t));
+  const GLbitfield flags =
+      GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  glCreateBuffers(1, &readback_buffer_);
+  glNamedBufferStorage(readback_buffer_,
+                       readback_stride_ * kReadbackFrameCount, nullptr,
+                       flags);
+  readback_mapped_ = static_cast<const std::uint32_t*>(glMapNamedBufferRange(
+      readback_buffer_, 0, readback_stride_ * kReadbackFrameCount, flags));
+  return true;
+}
+
+void CascadedShadowMaps::ReduceDepth(GLuint depth_texture,
+                                     const glm::ivec2& size,
+                                     const glm::mat4& projection) {
+  PollDepthReadback();
+  int region = 0;
+  while (region < kReadbackFrameCount &&
+         readback_fences_[region] != nullptr) {
+    ++region;
+  }
+  // GPUが数フレーム遅れているときは待たずにこのフレームを飛ばす
+  if (region == kReadbackFrameCount) {
+    return;
+  }
+
+  const auto offset = region * readback_stride_;
+  const GLuint initial[] = {0xffffffffu, 0u};
+  glClearNamedBufferSubData(readback_buffer_, GL_RG32UI, offset,
+                            sizeof(initial), GL_RG_INTEGER, GL_UNSIGNED_INT,
+                            initial);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  auto& state = GlStateCache::GetInstance();
+  state.UseProgram(reduction_program_);
+  const auto inverse_projection = glm::inverse(projection);
+  glProgramUniformMatrix4fv(
+      reduction_program_,
+      glGetUniformLocation(reduction_program_, "inverse_projection"), 1,
+      GL_FALSE, &inverse_projection[0][0]);
+  state.BindTextureUnit(0, depth_texture);
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, kReductionBufferBinding,
+                    readback_buffer_, offset, sizeof(initial));
+  glDispatchCompute((size.x + kReductionGroupSize - 1) / kReductionGroupSize,
+                    (size.y + kReductionGroupSize - 1) / kReductionGroupSize,
+                    1);
+  // マップしたポインタから読めるようにしてからフェンスを置く
+  glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+  readback_fences_[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  readback_serials_[region] = ++next_readback_serial_;
+}
+
+void CascadedShadowMaps::Update(const glm::mat4& view,
+                                const glm::mat4& projection, float near_plane,
+                                float far_plane,
+                                const glm::vec3& light_direction,
+                                const AABB& scene_bounds,
+                                const InstanceBounds& casters,
+                                JobSystem& job_system) {
+  PollDepthReadback();
+  auto min_depth = near_plane;
+  auto max_depth = far_plane;
+  if (reduced_depth_range_.x <= reduced_depth_range_.y) {
+    min_depth = std::max(near_plane,
+                         reduced_depth_range_.x * (1.0f - kDepthRangeMargin));
+    max_depth = std::min(far_plane,
+                         reduced_depth_range_.y * (1.0f + kDepthRangeMargin));
+    max_depth = std::max(max_depth, min_depth * (1.0f + kDepthRangeMargin));
+  }
+  depth_range_ = glm::vec2(min_depth, max_depth);
+
+  const auto direction = glm::normalize(light_direction);
+  const auto up = std::abs(direction.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f)
+                                                : glm::vec3(0.0f, 1.0f, 0.0f);
+  const auto light_view = glm::lookAt(glm::vec3(0.0f), direction, up);
+  const auto inverse_view = glm::inverse(view);
+  // 手前は対数分割、奥は等分割に近い区切り
+  auto split = [&](int index) {
+    const auto t = static_cast<float>(index) / cascade_count_;
+    const auto uniform = min_depth + (max_depth - min_depth) * t;
+    const auto logarithmic = min_depth * std::pow(max_depth / min_depth, t);
+    return glm::mix(uniform, logarithmic, split_lambda_);
+  };
+  for (int i = 0; i < cascade_count_; ++i) {
+    auto& cascade = cascades_[i];
+    cascade.near_depth = split(i);
+    cascade.far_depth = split(i + 1);
+    FitCascade(inverse_view, projection, light_view, scene_bounds, cascade);
+  }
+
+  // カスケードごとのカリングをそれぞれジョブにし、中でも箱を分けて並列に
+  // 判定する
+  job_system.ParallelFor(
+      cascade_count_, 1, [&](std::size_t begin, std::size_t end) {
+        for (auto i = begin; i < end; ++i) {
+          auto& cascade = cascades_[i];
+          CullInstances(casters, Frustum::FromMatrix(cascade.view_projection),
+                        cascade.casters, job_system);
+        }
+      });
+}
+
+void CascadedShadowMaps::Render(
+    const std::function<void(int, const ShadowCascade&)>& draw_casters) {
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+  glViewport(0, 0, resolution_, resolution_);
+  GLfloat far_depth = 1.0f;
+  for (int i = 0; i < cascade_count_; ++i) {
+    glNamedFramebufferTextureLayer(framebuffer_, GL_DEPTH_ATTACHMENT,
+                                   shadow_texture_, 0, i);
+    glClearNamedFramebufferfv(framebuffer_, GL_DEPTH, 0, &far_depth);
+    draw_casters(i, cascades_[i]);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void CascadedShadowMaps::Upload() {
+  GpuCascadedShadows data = {};
+  for (int i = 0; i < cascade_count_; ++i) {
+    data.view_projections[i] = cascades_[i].view_projection;
+    data.split_depths[i] = cascades_[i].far_depth;
+    data.texel_sizes[i] = cascades_[i].texel_size;
+  }
+  data.cascade_count = static_cast<std::uint32_t>(cascade_count_);
+  glNamedBufferSubData(cascade_buffer_, 0, sizeof(data), &data);
+}
+
+void CascadedShadowMaps::Bind(GLuint texture_unit) const {
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kCascadeBufferBinding,
+                   cascade_buffer_);
+  GlStateCache::GetInstance().BindTextureUnit(texture_unit, shadow_texture_);
+}
+
+int CascadedShadowMaps::GetCascadeCount() const { return cascade_count_; }
+
+const ShadowCascade& CascadedShadowMaps::GetCascade(int index) const {
+  return cascades_[index];
+}
+
+glm::vec2 CascadedShadowMaps::GetDepthRange() const { return depth_range_; }
+
+void CascadedShadowMaps::PollDepthReadback() {
+  for (int i = 0; i < kReadbackFrameCount; ++i) {
+    auto& fence = readback_fences_[i];
+    if (fence == nullptr) {
+      continue;
+    }
+    const auto status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+      continue;
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+    if (readback_serials_[i] < latest_readback_serial_) {
+      continue;
+    }
+    latest_readback_serial_ = readback_serials_[i];
+    const auto* values = readback_mapped_ + i * readback_stride_ /
+                                                sizeof(std::uint32_t);
+    // シェーダーは正のfloatのビット列をそのまま比べている
+    float depths[2];
+    std::memcpy(depths, values, sizeof(depths));
+    reduced_depth_range_ = glm::vec2(depths[0], depths[1]);
+    if (values[0] > values[1]) {
+      reduced_depth_range_ = glm::vec2(1.0f, 0.0f);
+    }
+  }
+}
+
+void CascadedShadowMaps::FitCascade(const glm::mat4& inverse_view,
+                                    const glm::mat4& projection,
+                                    const glm::mat4& light_view,
+                                    const AABB& scene_bounds,
+                                    ShadowCascade& cascade) const {
+  // 視錐台の区切りの8頂点をワールド空間で求める
+  glm::vec3 corners[8];
+  glm::vec3 center(0.0f);
+  for (int i = 0; i < 8; ++i) {
+    const auto depth = i < 4 ? cascade.near_depth : cascade.far_depth;
+    const glm::vec2 ndc(i % 2 == 0 ? -1.0f : 1.0f,
+                        (i / 2) % 2 == 0 ? -1.0f : 1.0f);
+    const glm::vec4 view_corner(ndc.x * depth / projection[0][0],
+                                ndc.y * depth / projection[1][1], -depth,
+                                1.0f);
+    corners[i] = glm::vec3(inverse_view * view_corner);
+    center += corners[i];
+  }
+  center /= 8.0f;
+  auto radius = 0.0f;
+  for (const auto& corner : corners) {
+    radius = std::max(radius, glm::distance(corner, center));
+  }
+  radius = std::ceil(radius * kRadiusQuantization) / kRadiusQuantization;
+
+  // 中心をテクセルの格子に合わせる。半径はテクセルの整数倍になる
+  const auto texel_size = 2.0f * radius / resolution_;
+  auto light_center = glm::vec3(light_view * glm::vec4(center, 1.0f));
+  light_center.x = std::floor(light_center.x / texel_size) * texel_size;
+  light_center.y = std::floor(light_center.y / texel_size) * texel_size;
+
+  // 光源側は区切りの外の遮蔽物も含むよう、シーンの箱まで広げる
+  auto nearest_z = light_center.z + radius;
+  if (!scene_bounds.IsEmpty()) {
+    for (int i = 0; i < 8; ++i) {
+      const glm::vec3 corner(i & 1 ? scene_bounds.max.x : scene_bounds.min.x,
+                             i & 2 ? scene_bounds.max.y : scene_bounds.min.y,
+                             i & 4 ? scene_bounds.max.z : scene_bounds.min.z);
+      nearest_z = std::max(nearest_z,
+                           (light_view * glm::vec4(corner, 1.0f)).z);
+    }
+  }
+  const auto light_projection =
+      glm::ortho(light_center.x - radius, light_center.x + radius,
+                 light_center.y - radius, light_center.y + radius, -nearest_z,
+                 -(light_center.z - radius));
+  cascade.view_projection = light_projection * light_view;
+  cascade.texel_size = texel_size;
+}
+
+}  // namespace game
@@ -0,0 +1,177 @@
+#ifndef OPENGL_PBR_MAP_CASCADED_SHADOWS_H_
+#define OPENGL_PBR_MAP_CASCADED_SHADOWS_H_
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "aabb.h"
+
+namespace game {
+
+class InstanceBounds;
+class JobSystem;
+
+/**
+ * @brief 1つのカスケード
+ */
+struct ShadowCascade {
+  glm::mat4 view_projection;
+  // カメラからの深度の範囲
+  float near_depth;
+  float far_depth;
+  // シャドウマップの1テクセルのワールド空間での大きさ
+  float texel_size;
+  // このカスケードに影を落とすインスタンスの番号 (番号の昇順)
+  std::vector<std::uint32_t> casters;
+};
+
+/**
+ * @brief シェーダーがSSBOから読むカスケードの値 (std430)
+ */
+struct GpuCascadedShadows {
+  glm::mat4 view_projections[4];
+  // 各カスケードの奥の深度
+  glm::vec4 split_depths;
+  glm::vec4 texel_sizes;
+  std::uint32_t cascade_count;
+  std::uint32_t padding[3];
+};
+
+/**
+ * @brief 平行光源のカスケードシャドウマップ
+ *
+ * カメラの視錐台を深度で区切り、区切りごとに正射影のシャドウマップを
+ * 2Dテクスチャ配列の1層に描く。区切る深度の範囲は、深度バッファから
+ * コンピュートシェーダーで求めた見えている面の最小と最大の深度に絞る
+ * (shaders/depth_reduction.comp)。結果はフェンスで終わったものだけを
+ * 永続的にマップしたバッファから読み、描画は待たないので、1～2フレーム
+ * 遅れた値を少し広げて使う。
+ *
+ * 各カスケードは視錐台の区切りを囲む球に合わせるので、カメラが回っても
+ * 大きさが変わらない。光源の空間での位置をテクセル単位に丸め、
+ * カメラが動いても影の輪郭がちらつかないようにする。
+ * カスケードごとの遮蔽物のカリングはJobSystemで並列に行う。
+ */
+class CascadedShadowMaps {
+ public:
+  static constexpr int kMaxCascadeCount = 4;
+  static constexpr GLuint kCascadeBufferBinding = 7;
+  static constexpr GLuint kReductionBufferBinding = 8;
+  // 深度の範囲を読み戻すまでに使い回す領域の数
+  static constexpr int kReadbackFrameCount = 3;
+
+  /**
+   * @brief コンストラクタ
+   * @param cascade_count カスケードの数 (kMaxCascadeCount以下)
+   * @param resolution シャドウマップの一辺のピクセル数
+   * @param split_lambda 区切りの対数分割と等分割の混合比 (1で対数分割)
+   */
+  CascadedShadowMaps(int cascade_count = 4, int resolution = 2048,
+                     float split_lambda = 0.75f);
+  ~CascadedShadowMaps();
+
+  CascadedShadowMaps(const CascadedShadowMaps&) = delete;
+  CascadedShadowMaps& operator=(const CascadedShadowMaps&) = delete;
+
+  /**
+   * @brief シェーダーを読み込み、テクスチャとバッファを作る
+   * @param shader_directory shadersディレクトリのパス (末尾の区切りなし)
+   * @return 成功すればtrue
+   */
+  bool Initialize(const std::string& shader_directory);
+
+  /**
+   * @brief 深度バッファの見えている面の深度の範囲を求めるディスパッチを
+   *        発行する
+   * @param depth_texture カメラの深度テクスチャ
+   * @param size 深度テクスチャのピクセル数
+   * @param projection 深度テクスチャを描いた射影行列
+   *
+   * 読み戻しの領域が全て使用中なら何もしない。
+   */
+  void ReduceDepth(GLuint depth_texture, const glm::ivec2& size,
+                   const glm::mat4& projection);
+
+  /**
+   * @brief カスケードを求め、遮蔽物をカリングする
+   * @param view カメラのビュー行列
+   * @param projection カメラの対称な透視投影行列
+   * @param near_plane 近クリップ面までの距離
+   * @param far_plane 影を描く最大の距離
+   * @param light_direction 光の進む向き
+   * @param scene_bounds 影を落としうる全ての遮蔽物を囲む箱
+   * @param casters 遮蔽物のバウンディングボックス
+   * @param job_system カリングに使うJobSystem
+   */
+  void Update(const glm::mat4& view, const glm::mat4& projection,
+              float near_plane, float far_plane,
+              const glm::vec3& light_direction, const AABB& scene_bounds,
+              const InstanceBounds& casters, JobSystem& job_system);
+
+  /**
+   * @brief 各カスケードのシャドウマップを描く
+   * @param draw_casters draw_casters(cascade_index, cascade)の形で呼ばれ、
+   *        cascade.castersのインスタンスを描く
+   *
+   * 呼ばれる時点でフレームバッファとビューポートは設定してある。
+   */
+  void Render(const std::function<void(int, const ShadowCascade&)>&
+                  draw_casters);
+
+  /**
+   * @brief カスケードの値をSSBOに書き込む
+   */
+  void Upload();
+
+  /**
+   * @brief SSBOとシャドウマップをバインドする
+   * @param texture_unit シャドウマップをバインドするテクスチャユニット
+   */
+  void Bind(GLuint texture_unit) const;
+
+  int GetCascadeCount() const;
+  const ShadowCascade& GetCascade(int index) const;
+
+  /**
+   * @brief 直前のUpdateで区切った深度の範囲を取得する
+   * @return xが最小、yが最大の深度
+   */
+  glm::vec2 GetDepthRange() const;
+
+ private:
+  void PollDepthReadback();
+  void FitCascade(const glm::mat4& inverse_view, const glm::mat4& projection,
+                  const glm::mat4& light_view, const AABB& scene_bounds,
+                  ShadowCascade& cascade) const;
+
+  int cascade_count_;
+  int resolution_;
+  float split_lambda_;
+  std::array<ShadowCascade, kMaxCascadeCount> cascades_;
+  glm::vec2 depth_range_;
+  // 読み戻した見えている面の深度の範囲。面がなければxがyより大きい
+  glm::vec2 reduced_depth_range_;
+
+  GLuint reduction_program_;
+  GLuint shadow_texture_;
+  GLuint framebuffer_;
+  GLuint cascade_buffer_;
+  GLuint readback_buffer_;
+  const std::uint32_t* readback_mapped_;
+  GLintptr readback_stride_;
+  std::array<GLsync, kReadbackFrameCount> readback_fences_;
+  // 領域ごとの発行した順番。新しい結果だけを使うために比べる
+  std::array<std::uint64_t, kReadbackFrameCount> readback_serials_;
+  std::uint64_t next_readback_serial_;
+  std::uint64_t latest_readback_serial_;
+};
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_CASCADED_SHADOWS_H_
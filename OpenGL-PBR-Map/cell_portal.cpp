@@ -0,0 +1,461 @@
+#include "cell_portal.h"
+
+#include <algorithm>
+#include <limits>
+#include <map>
+
+#include "job_system.h"
+
+namespace game {
+
+namespace {
+
+// PVSを求めるときにたどるポータルの列の最大長
+constexpr std::size_t kMaxPortalSequence = 32;
+// 実行時にたどるポータルの最大の深さ
+constexpr int kMaxPortalDepth = 64;
+constexpr std::uint32_t kNoPortal = 0xffffffffu;
+
+float Cross(const glm::vec2& a, const glm::vec2& b) {
+  return a.x * b.y - a.y * b.x;
+}
+
+// 左の点が全て左側、右の点が全て右側にある直線があるか。
+// そのような直線があれば左右の点を1つずつ通るものもあるので、
+// 全ての組を調べる
+bool IsStabbable(const std::vector<glm::vec2>& lefts,
+                 const std::vector<glm::vec2>& rights) {
+  constexpr float kEpsilon = 1.0e-4f;
+  for (const auto& left : lefts) {
+    for (const auto& right : rights) {
+      const auto delta = left - right;
+      const float length = glm::length(delta);
+      if (length <= kEpsilon) {
+        continue;
+      }
+      for (const float sign : {1.0f, -1.0f}) {
+        const auto direction = delta * (sign / length);
+        bool separated = true;
+        for (const auto& p : lefts) {
+          if (Cross(direction, p - right) < -kEpsilon) {
+            separated = false;
+            break;
+          }
+        }
+        for (std::size_t i = 0; separated && i < rights.size(); ++i) {
+          if (Cross(direction, rights[i] - right) > kEpsilon) {
+            separated = false;
+          }
+        }
+        if (separated) {
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+// 1つのセルから見えるセルをポータルの列をたどって探す
+struct PvsSearch {
+  const std::vector<Cell>& cells;
+  const std::vector<Portal>& portals;
+  std::vector<std::uint8_t> bits;
+  std::vector<std::uint8_t> in_path;
+  std::vector<glm::vec2> lefts;
+  std::vector<glm::vec2> rights;
+
+  void Expand(std::uint32_t cell, std::uint32_t entered_portal) {
+    if (lefts.size() >= kMaxPortalSequence) {
+      return;
+    }
+    for (const auto portal_index : cells[cell].portals) {
+      if (portal_index == entered_portal) {
+        continue;
+      }
+      const auto& portal = portals[portal_index];
+      const bool forward = portal.cells[0] == cell;
+      const auto next = portal.cells[forward ? 1 : 0];
+      if (in_path[next]) {
+        continue;
+      }
+      // 進む方向の左側の端点を左の点にする
+      glm::vec2 direction(0.0f);
+      direction[portal.axis] = forward ? 1.0f : -1.0f;
+      const auto center = (portal.endpoints[0] + portal.endpoints[1]) * 0.5f;
+      const bool first_is_left =
+          Cross(direction, portal.endpoints[0] - center) > 0.0f;
+      lefts.push_back(portal.endpoints[first_is_left ? 0 : 1]);
+      rights.push_back(portal.endpoints[first_is_left ? 1 : 0]);
+      if (IsStabbable(lefts, rights)) {
+        bits[next / 8] |= static_cast<std::uint8_t>(1u << (next % 8));
+        in_path[next] = 1;
+        Expand(next, portal_index);
+        in_path[next] = 0;
+      }
+      lefts.pop_back();
+      rights.pop_back();
+    }
+  }
+};
+
+// 0のバイトを(0, 連続数)にまとめて圧縮する
+void CompressBits(const std::vector<std::uint8_t>& bits,
+                  std::vector<std::uint8_t>& compressed) {
+  for (std::size_t i = 0; i < bits.size();) {
+    if (bits[i] != 0) {
+      compressed.push_back(bits[i++]);
+      continue;
+    }
+    std::size_t run = 0;
+    while (i < bits.size() && bits[i] == 0 && run < 255) {
+      ++run;
+      ++i;
+    }
+    compressed.push_back(0);
+    compressed.push_back(static_cast<std::uint8_t>(run));
+  }
+}
+
+// 画面上の正規化デバイス座標での矩形
+struct ScreenRect {
+  glm::vec2 min;
+  glm::vec2 max;
+
+  bool IsEmpty() const { return min.x >= max.x || min.y >= max.y; }
+};
+
+// ポータルを近クリップ面で切り取ってから投影した矩形を求める
+bool ProjectPortal(const Portal& portal, const glm::mat4& view_projection,
+                   ScreenRect& rect) {
+  const auto& e = portal.endpoints;
+  const glm::vec4 corners[] = {
+      view_projection * glm::vec4(e[0].x, 0.0f, e[0].y, 1.0f),
+      view_projection * glm::vec4(e[1].x, 0.0f, e[1].y, 1.0f),
+      view_projection * glm::vec4(e[1].x, kWallHeight, e[1].y, 1.0f),
+      view_projection * glm::vec4(e[0].x, kWallHeight, e[0].y, 1.0f)};
+  rect = {glm::vec2(std::numeric_limits<float>::infinity()),
+          glm::vec2(-std::numeric_limits<float>::infinity())};
+  bool any = false;
+  auto add = [&](const glm::vec4& clip) {
+    const auto ndc = glm::vec2(clip) / std::max(clip.w, 1.0e-6f);
+    rect.min = glm::min(rect.min, ndc);
+    rect.max = glm::max(rect.max, ndc);
+    any = true;
+  };
+  // z >= -wの側だけを残す
+  for (int i = 0; i < 4; ++i) {
+    const auto& a = corners[i];
+    const auto& b = corners[(i + 1) % 4];
+    const float da = a.z + a.w;
+    const float db = b.z + b.w;
+    if (da >= 0.0f) {
+      add(a);
+    }
+    if ((da >= 0.0f) != (db >= 0.0f)) {
+      add(glm::mix(a, b, da / (da - db)));
+    }
+  }
+  return any;
+}
+
+// 視点からポータルをたどって見えるセルを集める
+struct PortalWalker {
+  const std::vector<Cell>& cells;
+  const std::vector<Portal>& portals;
+  const std::vector<std::uint8_t>& pvs_bits;
+  const glm::mat4& view_projection;
+  glm::vec2 eye;
+  std::vector<std::uint8_t> visible;
+  std::vector<std::uint8_t> in_path;
+  std::vector<std::uint32_t>& output;
+
+  void Visit(std::uint32_t cell, const ScreenRect& rect, int depth) {
+    if (!visible[cell]) {
+      visible[cell] = 1;
+      output.push_back(cell);
+    }
+    if (depth >= kMaxPortalDepth) {
+      return;
+    }
+    in_path[cell] = 1;
+    for (const auto portal_index : cells[cell].portals) {
+      const auto& portal = portals[portal_index];
+      const auto next =
+          portal.cells[portal.cells[0] == cell ? 1 : 0];
+      if (in_path[next] ||
+          (!pvs_bits.empty() && !(pvs_bits[next / 8] & (1u << (next % 8))))) {
+        continue;
+      }
+      // 出入り口のタイルの上に立っているときは投影が潰れるので狭めない
+      const int axis = portal.axis;
+      const float plane = portal.endpoints[0][axis];
+      const bool on_portal =
+          std::abs(eye[axis] - plane) <= kTileWorldSize * 0.5f &&
+          eye[1 - axis] >= portal.endpoints[0][1 - axis] &&
+          eye[1 - axis] <= portal.endpoints[1][1 - axis];
+      auto next_rect = rect;
+      if (!on_portal) {
+        ScreenRect portal_rect;
+        if (!ProjectPortal(portal, view_projection, portal_rect)) {
+          continue;
+        }
+        next_rect.min = glm::max(rect.min, portal_rect.min);
+        next_rect.max = glm::min(rect.max, portal_rect.max);
+        if (next_rect.IsEmpty()) {
+          continue;
+        }
+      }
+      Visit(next, next_rect, depth + 1);
+    }
+    in_path[cell] = 0;
+  }
+};
+
+}  // namespace
+
+void CellPortalGraph::Build(const TileMap& map) {
+  width_ = map.GetWidth();
+  height_ = map.GetHeight();
+  tile_cells_.assign(static_cast<std::size_t>(width_) * height_, -1);
+  cells_.clear();
+  portals_.clear();
+  pvs_data_.clear();
+  pvs_offsets_.clear();
+
+  auto is_floor = [&map](int x, int y) {
+    return map.Get(x, y).type == TileType::kFloor;
+  };
+  auto is_solid = [&map](int x, int y) { return map.Get(x, y).IsSolid(); };
+
+  // 両側が床で横が壁の出入り口だけをポータルにし、残りは床として扱う
+  struct DoorTile {
+    glm::ivec2 position;
+    int axis;
+  };
+  std::vector<DoorTile> doors;
+  std::vector<std::uint8_t> floor_mask(tile_cells_.size(), 0);
+  for (int y = 0; y < height_; ++y) {
+    for (int x = 0; x < width_; ++x) {
+      const auto type = map.Get(x, y).type;
+      auto& mask = floor_mask[static_cast<std::size_t>(y) * width_ + x];
+      if (type == TileType::kFloor) {
+        mask = 1;
+      } else if (type == TileType::kDoor) {
+        if (is_floor(x - 1, y) && is_floor(x + 1, y) && is_solid(x, y - 1) &&
+            is_solid(x, y + 1)) {
+          doors.push_back({{x, y}, 0});
+        } else if (is_floor(x, y - 1) && is_floor(x, y + 1) &&
+                   is_solid(x - 1, y) && is_solid(x + 1, y)) {
+          doors.push_back({{x, y}, 1});
+        } else {
+          mask = 1;
+        }
+      }
+    }
+  }
+
+  auto get_tile_bounds = [](const glm::ivec2& tile) {
+    const auto min = glm::vec2(tile) * kTileWorldSize;
+    return AABB(glm::vec3(min.x, 0.0f, min.y),
+                glm::vec3(min.x + kTileWorldSize, kWallHeight,
+                          min.y + kTileWorldSize));
+  };
+
+  // 4近傍で連結した床をセルにする
+  std::vector<glm::ivec2> stack;
+  for (int y = 0; y < height_; ++y) {
+    for (int x = 0; x < width_; ++x) {
+      const auto start = static_cast<std::size_t>(y) * width_ + x;
+      if (!floor_mask[start] || tile_cells_[start] >= 0) {
+        continue;
+      }
+      const auto cell_index = static_cast<std::int32_t>(cells_.size());
+      cells_.emplace_back();
+      auto& cell = cells_.back();
+      tile_cells_[start] = cell_index;
+      stack.push_back({x, y});
+      while (!stack.empty()) {
+        const auto p = stack.back();
+        stack.pop_back();
+        cell.bounds.Extend(get_tile_bounds(p));
+        ++cell.tile_count;
+        const glm::ivec2 neighbors[] = {
+            p + glm::ivec2(1, 0), p - glm::ivec2(1, 0),
+            p + glm::ivec2(0, 1), p - glm::ivec2(0, 1)};
+        for (const auto& n : neighbors) {
+          if (n.x < 0 || n.y < 0 || n.x >= width_ || n.y >= height_) {
+            continue;
+          }
+          const auto index = static_cast<std::size_t>(n.y) * width_ + n.x;
+          if (floor_mask[index] && tile_cells_[index] < 0) {
+            tile_cells_[index] = cell_index;
+            stack.push_back(n);
+          }
+        }
+      }
+    }
+  }
+
+  // 出入り口をポータルにする。同じセルの組で隣り合う出入り口は1つにまとめる
+  std::map<std::array<int, 4>, std::pair<std::uint32_t, int>> open_portals;
+  for (const auto& door : doors) {
+    glm::ivec2 offset(0);
+    offset[door.axis] = 1;
+    const auto get_cell = [this](const glm::ivec2& p) {
+      return tile_cells_[static_cast<std::size_t>(p.y) * width_ + p.x];
+    };
+    const auto negative = get_cell(door.position - offset);
+    const auto positive = get_cell(door.position + offset);
+    const auto tile_index =
+        static_cast<std::size_t>(door.position.y) * width_ + door.position.x;
+    tile_cells_[tile_index] = negative;
+    const auto tile_bounds = get_tile_bounds(door.position);
+    cells_[negative].bounds.Extend(tile_bounds);
+    ++cells_[negative].tile_count;
+    if (negative == positive) {
+      continue;
+    }
+    cells_[positive].bounds.Extend(tile_bounds);
+
+    // 出入り口の並ぶ向きの座標
+    const int along = door.position[1 - door.axis];
+    const std::array<int, 4> key = {negative, positive, door.axis,
+                                    door.position[door.axis]};
+    const auto it = open_portals.find(key);
+    if (it != open_portals.end() && it->second.second == along) {
+      portals_[it->second.first].endpoints[1][1 - door.axis] =
+          static_cast<float>(along + 1) * kTileWorldSize;
+      it->second.second = along + 1;
+      continue;
+    }
+
+    Portal portal;
+    portal.cells = {static_cast<std::uint32_t>(negative),
+                    static_cast<std::uint32_t>(positive)};
+    portal.axis = door.axis;
+    const float plane =
+        (static_cast<float>(door.position[door.axis]) + 0.5f) *
+        kTileWorldSize;
+    for (int i = 0; i < 2; ++i) {
+      portal.endpoints[i][door.axis] = plane;
+      portal.endpoints[i][1 - door.axis] =
+          static_cast<float>(along + i) * kTileWorldSize;
+    }
+    const auto portal_index = static_cast<std::uint32_t>(portals_.size());
+    portals_.push_back(portal);
+    cells_[negative].portals.push_back(portal_index);
+    cells_[positive].portals.push_back(portal_index);
+    open_portals[key] = {portal_index, along + 1};
+  }
+}
+
+void CellPortalGraph::ComputePvs(JobSystem& job_system) {
+  const auto cell_count = cells_.size();
+  const auto byte_count = (cell_count + 7) / 8;
+  std::vector<std::vector<std::uint8_t>> compressed(cell_count);
+  job_system.ParallelFor(
+      cell_count, 16, [&](std::size_t begin, std::size_t end) {
+        PvsSearch search{cells_, portals_, {}, {}, {}, {}};
+        search.in_path.assign(cell_count, 0);
+        for (auto cell = begin; cell < end; ++cell) {
+          search.bits.assign(byte_count, 0);
+          search.bits[cell / 8] |= static_cast<std::uint8_t>(1u << (cell % 8));
+          search.in_path[cell] = 1;
+          search.Expand(static_cast<std::uint32_t>(cell), kNoPortal);
+          search.in_path[cell] = 0;
+          CompressBits(search.bits, compressed[cell]);
+        }
+      });
+
+  pvs_data_.clear();
+  pvs_offsets_.clear();
+  for (const auto& data : compressed) {
+    pvs_offsets_.push_back(static_cast<std::uint32_t>(pvs_data_.size()));
+    pvs_data_.insert(pvs_data_.end(), data.begin(), data.end());
+  }
+  pvs_offsets_.push_back(static_cast<std::uint32_t>(pvs_data_.size()));
+}
+
+std::int32_t CellPortalGraph::FindCell(const glm::vec3& position) const {
+  const auto tile = glm::ivec2(
+      glm::floor(glm::vec2(position.x, position.z) / kTileWorldSize));
+  if (tile.x < 0 || tile.y < 0 || tile.x >= width_ || tile.y >= height_) {
+    return -1;
+  }
+  return tile_cells_[static_cast<std::size_t>(tile.y) * width_ + tile.x];
+}
+
+bool CellPortalGraph::IsPotentiallyVisible(std::uint32_t from,
+                                           std::uint32_t to) const {
+  if (pvs_offsets_.empty()) {
+    return true;
+  }
+  // 目的のバイトに着くまで圧縮を展開しながら読み進める
+  const std::size_t target = to / 8;
+  std::size_t byte = 0;
+  for (auto i = pvs_offsets_[from]; i < pvs_offsets_[from + 1]; ++i) {
+    if (pvs_data_[i] != 0) {
+      if (byte == target) {
+        return (pvs_data_[i] & (1u << (to % 8))) != 0;
+      }
+      ++byte;
+      continue;
+    }
+    byte += pvs_data_[++i];
+    if (byte > target) {
+      return false;
+    }
+  }
+  return false;
+}
+
+void CellPortalGraph::DecompressPvs(std::uint32_t cell,
+                                    std::vector<std::uint8_t>& bits) const {
+  bits.assign((cells_.size() + 7) / 8, 0);
+  std::size_t byte = 0;
+  for (auto i = pvs_offsets_[cell]; i < pvs_offsets_[cell + 1]; ++i) {
+    if (pvs_data_[i] != 0) {
+      bits[byte++] = pvs_data_[i];
+    } else {
+      byte += pvs_data_[++i];
+    }
+  }
+}
+
+bool CellPortalGraph::FindVisibleCells(
+    const glm::vec3& eye, const glm::mat4& view_projection,
+    std::vector<std::uint32_t>& cells) const {
+  cells.clear();
+  const auto start = FindCell(eye);
+  if (start < 0) {
+    return false;
+  }
+  std::vector<std::uint8_t> pvs_bits;
+  if (!pvs_offsets_.empty()) {
+    DecompressPvs(static_cast<std::uint32_t>(start), pvs_bits);
+  }
+  PortalWalker walker{cells_,
+                      portals_,
+                      pvs_bits,
+                      view_projection,
+                      glm::vec2(eye.x, eye.z),
+                      std::vector<std::uint8_t>(cells_.size(), 0),
+                      std::vector<std::uint8_t>(cells_.size(), 0),
+                      cells};
+  walker.Visit(static_cast<std::uint32_t>(start),
+               {glm::vec2(-1.0f), glm::vec2(1.0f)}, 0);
+  return true;
+}
+
+const std::vector<Cell>& CellPortalGraph::GetCells() const { return cells_; }
+
+const std::vector<Portal>& CellPortalGraph::GetPortals() const {
+  return portals_;
+}
+
+std::size_t CellPortalGraph::GetPvsMemorySize() const {
+  return pvs_data_.size() + pvs_offsets_.size() * sizeof(std::uint32_t);
+}
+
+}  // namespace game
@@ -0,0 +1,123 @@
+#ifndef OPENGL_PBR_MAP_CELL_PORTAL_H_
+#define OPENGL_PBR_MAP_CELL_PORTAL_H_
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "aabb.h"
+#include "dungeon_map.h"
+
+namespace game {
+
+class JobSystem;
+
+/**
+ * @brief 出入り口で区切られた床の連結領域
+ */
+struct Cell {
+  AABB bounds;
+  std::vector<std::uint32_t> portals;
+  std::uint32_t tile_count = 0;
+};
+
+/**
+ * @brief 2つのセルをつなぐ出入り口
+ *
+ * 出入り口のタイルの中央を通る縦の長方形で、床から天井までの高さを持つ。
+ * endpointsはワールド座標のXZ平面上の両端で、軸の小さい側から順に並ぶ。
+ */
+struct Portal {
+  // cells[0]が軸の負の側、cells[1]が正の側のセル
+  std::array<std::uint32_t, 2> cells;
+  std::array<glm::vec2, 2> endpoints;
+  // 通り抜ける方向の軸 (0ならX、1ならZ)
+  int axis;
+};
+
+/**
+ * @brief タイルマップから作るセルとポータルのグラフ
+ *
+ * 床を出入り口 (kDoor) のタイルで区切ってセルにし、出入り口をポータルにする。
+ * ComputePvsでセルごとの潜在可視集合 (PVS) をオフラインで求めておくと、
+ * 実行時にはFindVisibleCellsがPVSとポータルの画面上の矩形で
+ * 視点から見えるセルだけを探す。
+ */
+class CellPortalGraph {
+ public:
+  /**
+   * @brief タイルマップからセルとポータルを取り出す
+   * @param map タイルマップ
+   */
+  void Build(const TileMap& map);
+
+  /**
+   * @brief 全てのセルのPVSを求める
+   * @param job_system セルごとの計算に使うジョブシステム
+   *
+   * 壁は床から天井まであるので上から見た2Dで判定する。
+   * ポータルの列の全てを順に通る直線があればその先のセルを可視とする。
+   * セルの中の柱などによる遮蔽は考えないので保守的な結果になる。
+   */
+  void ComputePvs(JobSystem& job_system);
+
+  /**
+   * @brief 位置を含むセルを探す
+   * @param position ワールド座標
+   * @return セルの番号、床の上でなければ-1
+   */
+  std::int32_t FindCell(const glm::vec3& position) const;
+
+  /**
+   * @brief PVSでセルからセルが見える可能性があるか
+   * @param from 視点のセル
+   * @param to 調べるセル
+   * @return 見える可能性があるか、PVSを求めていなければ常にtrue
+   */
+  bool IsPotentiallyVisible(std::uint32_t from, std::uint32_t to) const;
+
+  /**
+   * @brief 視点から見えるセルを集める
+   * @param eye 視点のワールド座標
+   * @param view_projection ビュー射影行列
+   * @param cells 見えるセルの番号の出力
+   * @return 視点がセルの中にあったかどうか
+   *
+   * 視点のセルからポータルをたどり、ポータルを画面に投影した矩形で
+   * 見える範囲を狭めながら先のセルに進む。視点がセルの外ならfalseを
+   * 返すので、呼び出し元は視錐台カリングだけに切り替える。
+   */
+  bool FindVisibleCells(const glm::vec3& eye,
+                        const glm::mat4& view_projection,
+                        std::vector<std::uint32_t>& cells) const;
+
+  const std::vector<Cell>& GetCells() const;
+  const std::vector<Portal>& GetPortals() const;
+
+  /**
+   * @brief 圧縮したPVSのバイト数を取得する
+   * @return バイト数
+   */
+  std::size_t GetPvsMemorySize() const;
+
+ private:
+  void DecompressPvs(std::uint32_t cell,
+                     std::vector<std::uint8_t>& bits) const;
+
+  int width_ = 0;
+  int height_ = 0;
+  // タイルごとのセルの番号、床でなければ-1
+  std::vector<std::int32_t> tile_cells_;
+  std::vector<Cell> cells_;
+  std::vector<Portal> portals_;
+  // セルごとのPVSのビット列を0のバイトの連続だけ圧縮して連結したもの
+  std::vector<std::uint8_t> pvs_data_;
+  // セルごとのpvs_data_の開始位置 (末尾に全体の長さを持つ)
+  std::vector<std::uint32_t> pvs_offsets_;
+};
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_CELL_PORTAL_H_
@@ -0,0 +1,186 @@
+#include "chunk_mesher.h"
+
+#include <map>
+
+namespace game {
+
+namespace {
+
+// マテリアルごとに頂点とインデックスを集める
+struct MaterialMeshBuilder {
+  std::vector<ChunkVertex> vertices;
+  std::vector<std::uint32_t> indices;
+};
+
+// 法線の側から見て反時計回りになるよう四角形を追加する
+void AddQuad(MaterialMeshBuilder& builder, const glm::vec3 (&corners)[4],
+             const glm::vec3& normal, const glm::vec2 (&uvs)[4]) {
+  const auto base = static_cast<std::uint32_t>(builder.vertices.size());
+  for (int i = 0; i < 4; ++i) {
+    builder.vertices.push_back({corners[i], normal, uvs[i]});
+  }
+  const bool counter_clockwise =
+      glm::dot(glm::cross(corners[1] - corners[0], corners[2] - corners[0]),
+               normal) > 0.0f;
+  if (counter_clockwise) {
+    builder.indices.insert(
+        builder.indices.end(),
+        {base, base + 1, base + 2, base, base + 2, base + 3});
+  } else {
+    builder.indices.insert(
+        builder.indices.end(),
+        {base, base + 2, base + 1, base, base + 3, base + 2});
+  }
+}
+
+const Tile& GetTile(const std::vector<Tile>& tiles, int x, int y) {
+  return tiles[GetChunkTileIndex(x + kChunkApron, y + kChunkApron)];
+}
+
+// 床のタイルを同じマテリアルの長方形にまとめて床と天井を張る
+void MeshFloorsAndCeilings(const std::vector<Tile>& tiles,
+                           const glm::vec3& origin,
+                           std::map<std::uint8_t, MaterialMeshBuilder>&
+                               builders) {
+  bool used[kChunkSize][kChunkSize] = {};
+  for (int y = 0; y < kChunkSize; ++y) {
+    for (int x = 0; x < kChunkSize; ++x) {
+      const auto& tile = GetTile(tiles, x, y);
+      if (used[y][x] || tile.IsSolid()) {
+        continue;
+      }
+      const auto matches = [&](int tx, int ty) {
+        const auto& other = GetTile(tiles, tx, ty);
+        return !used[ty][tx] && !other.IsSolid() &&
+               other.material == tile.material;
+      };
+
+      int width = 1;
+      while (x + width < kChunkSize && matches(x + width, y)) {
+        ++width;
+      }
+      int height = 1;
+      for (; y + height < kChunkSize; ++height) {
+        bool row_matches = true;
+        for (int i = 0; i < width && row_matches; ++i) {
+          row_matches = matches(x + i, y + height);
+        }
+        if (!row_matches) {
+          break;
+        }
+      }
+      for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+          used[y + j][x + i] = true;
+        }
+      }
+
+      const float x0 = origin.x + x * kTileWorldSize;
+      const float z0 = origin.z + y * kTileWorldSize;
+      const float x1 = x0 + width * kTileWorldSize;
+      const float z1 = z0 + height * kTileWorldSize;
+      const glm::vec2 uvs[4] = {{x0, z0}, {x0, z1}, {x1, z1}, {x1, z0}};
+      auto& builder = builders[tile.material];
+      AddQuad(builder,
+              {{x0, 0.0f, z0}, {x0, 0.0f, z1}, {x1, 0.0f, z1}, {x1, 0.0f, z0}},
+              glm::vec3(0.0f, 1.0f, 0.0f), uvs);
+      AddQuad(builder,
+              {{x0, kWallHeight, z0},
+               {x0, kWallHeight, z1},
+               {x1, kWallHeight, z1},
+               {x1, kWallHeight, z0}},
+              glm::vec3(0.0f, -1.0f, 0.0f), uvs);
+    }
+  }
+}
+
+// 床と壁の境界を壁のマテリアルが同じ区間ごとにまとめて壁を張る
+void MeshWalls(const std::vector<Tile>& tiles, const glm::vec3& origin,
+               std::map<std::uint8_t, MaterialMeshBuilder>& builders) {
+  const glm::ivec2 offsets[4] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+  for (const auto& offset : offsets) {
+    // 壁の面に沿う方向のタイル座標の軸
+    const bool along_y = offset.x != 0;
+    const auto tile_at = [&](int slice, int t) {
+      return along_y ? glm::ivec2(slice, t) : glm::ivec2(t, slice);
+    };
+    const auto wall_material = [&](int slice, int t) -> int {
+      const auto p = tile_at(slice, t);
+      const auto& tile = GetTile(tiles, p.x, p.y);
+      const auto& neighbor = GetTile(tiles, p.x + offset.x, p.y + offset.y);
+      return !tile.IsSolid() && neighbor.IsSolid() ? neighbor.material : -1;
+    };
+
+    for (int slice = 0; slice < kChunkSize; ++slice) {
+      for (int t = 0; t < kChunkSize;) {
+        const int material = wall_material(slice, t);
+        if (material < 0) {
+          ++t;
+          continue;
+        }
+        int length = 1;
+        while (t + length < kChunkSize &&
+               wall_material(slice, t + length) == material) {
+          ++length;
+        }
+
+        // 床のタイルと壁のタイルの境界の平面
+        const int slice_offset = along_y ? offset.x : offset.y;
+        const float plane_world =
+            (along_y ? origin.x : origin.z) +
+            static_cast<float>(slice + (slice_offset > 0 ? 1 : 0)) *
+                kTileWorldSize;
+        const float t0 = (along_y ? origin.z : origin.x) + t * kTileWorldSize;
+        const float t1 = t0 + length * kTileWorldSize;
+        const auto corner = [&](float along, float height) {
+          return along_y ? glm::vec3(plane_world, height, along)
+                         : glm::vec3(along, height, plane_world);
+        };
+
+        const glm::vec3 normal(-offset.x, 0.0f, -offset.y);
+        const glm::vec2 uvs[4] = {
+            {t0, 0.0f}, {t1, 0.0f}, {t1, kWallHeight}, {t0, kWallHeight}};
+        AddQuad(builders[static_cast<std::uint8_t>(material)],
+                {corner(t0, 0.0f), corner(t1, 0.0f),
+                 corner(t1, kWallHeight), corner(t0, kWallHeight)},
+                normal, uvs);
+        t += length;
+      }
+    }
+  }
+}
+
+}  // namespace
+
+glm::vec3 GetChunkOrigin(const glm::ivec2& chunk) {
+  const auto origin = glm::vec2(chunk * kChunkSize) * kTileWorldSize;
+  return glm::vec3(origin.x, 0.0f, origin.y);
+}
+
+ChunkMesh BuildChunkMesh(const glm::ivec2& chunk,
+                         const std::vector<Tile>& tiles) {
+  const auto origin = GetChunkOrigin(chunk);
+  std::map<std::uint8_t, MaterialMeshBuilder> builders;
+  MeshFloorsAndCeilings(tiles, origin, builders);
+  MeshWalls(tiles, origin, builders);
+
+  // マテリアルの順に1つの頂点とインデックスの列につなげる
+  ChunkMesh mesh;
+  const float chunk_world_size = kChunkSize * kTileWorldSize;
+  mesh.bounds = AABB(origin, origin + glm::vec3(chunk_world_size, kWallHeight,
+                                                chunk_world_size));
+  for (const auto& [material, builder] : builders) {
+    const auto base = static_cast<std::uint32_t>(mesh.vertices.size());
+    mesh.batches.push_back(
+        {material, static_cast<std::uint32_t>(mesh.indices.size()),
+         static_cast<std::uint32_t>(builder.indices.size())});
+    mesh.vertices.insert(mesh.vertices.end(), builder.vertices.begin(),
+                         builder.vertices.end());
+    for (const auto index : builder.indices) {
+      mesh.indices.push_back(base + index);
+    }
+  }
+  return mesh;
+}
+
+}  // namespace game
@@ -0,0 +1,67 @@
+#ifndef OPENGL_PBR_MAP_CHUNK_MESHER_H_
+#define OPENGL_PBR_MAP_CHUNK_MESHER_H_
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "aabb.h"
+#include "dungeon_map.h"
+
+namespace game {
+
+/**
+ * @brief チャンクのメッシュの頂点
+ */
+struct ChunkVertex {
+  glm::vec3 position;
+  glm::vec3 normal;
+  glm::vec2 uv;
+};
+
+/**
+ * @brief 同じマテリアルで1回に描画するインデックスの範囲
+ */
+struct ChunkBatch {
+  std::uint32_t material;
+  std::uint32_t first_index;
+  std::uint32_t index_count;
+};
+
+/**
+ * @brief チャンク1つ分の床、天井、壁のメッシュ
+ *
+ * 頂点とインデックスはマテリアルの順に並んでいて、
+ * マテリアルごとに1つのChunkBatchで描画できる。
+ */
+struct ChunkMesh {
+  std::vector<ChunkVertex> vertices;
+  std::vector<std::uint32_t> indices;
+  std::vector<ChunkBatch> batches;
+  AABB bounds;
+};
+
+/**
+ * @brief チャンクの左下隅のワールド座標を求める
+ * @param chunk チャンクの座標
+ * @return ワールド座標
+ */
+glm::vec3 GetChunkOrigin(const glm::ivec2& chunk);
+
+/**
+ * @brief チャンクのタイルからメッシュを作る
+ * @param chunk チャンクの座標
+ * @param tiles エプロン込みのチャンクのタイル
+ * @return メッシュ
+ *
+ * 床と天井は同じマテリアルの床のタイルを貪欲法で長方形にまとめ、
+ * 壁は床と壁の境界のうち壁のマテリアルが同じ区間を1枚にまとめる。
+ * 壁同士、床同士の間の見えない面は作らない。
+ */
+ChunkMesh BuildChunkMesh(const glm::ivec2& chunk,
+                         const std::vector<Tile>& tiles);
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_CHUNK_MESHER_H_
@@ -0,0 +1,305 @@
+#include "chunk_streamer.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "job_system.h"
+
+namespace game {
+
+namespace {
+
+// 読み込みと破棄の境界でチャンクが出入りを繰り返さないための余裕
+constexpr float kEvictionMargin = kChunkSize * kTileWorldSize * 0.5f;
+
+// タイルを含むチャンクの座標を求める
+glm::ivec2 GetTileChunk(const glm::ivec2& tile_position) {
+  return glm::ivec2(
+      glm::floor(glm::vec2(tile_position) / static_cast<float>(kChunkSize)));
+}
+
+// タイルのチャンク内のエプロン込みの座標を求める
+// チャンクがエプロンまで含めてタイルを持っていなければfalseを返す
+bool GetLocalTile(const glm::ivec2& chunk, const glm::ivec2& tile_position,
+                  glm::ivec2& local) {
+  local = tile_position - chunk * kChunkSize + kChunkApron;
+  return glm::all(glm::greaterThanEqual(local, glm::ivec2(0))) &&
+         glm::all(glm::lessThan(local, glm::ivec2(kChunkSizeWithApron)));
+}
+
+}  // namespace
+
+std::size_t Chunk::GetMemorySize() const {
+  return sizeof(Chunk) + tiles.capacity() * sizeof(Tile) +
+         mesh.vertices.capacity() * sizeof(ChunkVertex) +
+         mesh.indices.capacity() * sizeof(std::uint32_t) +
+         lights.capacity() * sizeof(PointLight);
+}
+
+float GetDistanceToChunk(const glm::vec3& camera_position,
+                         const glm::ivec2& chunk) {
+  const auto origin = GetChunkOrigin(chunk);
+  const glm::vec2 min(origin.x, origin.z);
+  const auto max = min + glm::vec2(kChunkSize * kTileWorldSize);
+  const glm::vec2 camera(camera_position.x, camera_position.z);
+  return glm::distance(camera, glm::clamp(camera, min, max));
+}
+
+ChunkStreamer::ChunkStreamer(const DungeonMapFile& map,
+                             const Settings& settings, JobSystem& job_system)
+    : map_(map),
+      settings_(settings),
+      job_system_(job_system),
+      memory_usage_(0),
+      running_jobs_(0) {}
+
+ChunkStreamer::~ChunkStreamer() {
+  while (running_jobs_.load() > 0) {
+    std::this_thread::yield();
+  }
+}
+
+void ChunkStreamer::Update(const glm::vec3& camera_position) {
+  CollectFinishedLoads();
+  EvictChunks(camera_position);
+  RequestLoads(camera_position);
+}
+
+const Chunk* ChunkStreamer::FindChunk(const glm::ivec2& coordinate) const {
+  const auto it = loaded_chunks_.find(coordinate);
+  return it == loaded_chunks_.end() ? nullptr : it->second.get();
+}
+
+const std::unordered_map<glm::ivec2, std::unique_ptr<Chunk>>&
+ChunkStreamer::GetLoadedChunks() const {
+  return loaded_chunks_;
+}
+
+std::size_t ChunkStreamer::GetMemoryUsage() const { return memory_usage_; }
+
+std::size_t ChunkStreamer::GetPendingLoadCount() const {
+  return pending_chunks_.size();
+}
+
+void ChunkStreamer::SetTile(const glm::ivec2& tile_position,
+                            const Tile& tile) {
+  Tile generated;
+  if (!ReadGeneratedTile(tile_position, generated)) {
+    // どのチャンクにも含まれないタイル
+    return;
+  }
+
+  const auto owner = GetTileChunk(tile_position);
+  for (int dy = -1; dy <= 1; ++dy) {
+    for (int dx = -1; dx <= 1; ++dx) {
+      const auto coordinate = owner + glm::ivec2(dx, dy);
+      glm::ivec2 local;
+      if (!GetLocalTile(coordinate, tile_position, local)) {
+        continue;
+      }
+
+      auto& overrides = tile_overrides_[coordinate];
+      const auto entry = std::find_if(
+          overrides.begin(), overrides.end(),
+          [&](const auto& o) { return o.position == tile_position; });
+      if (tile == generated) {
+        if (entry != overrides.end()) {
+          overrides.erase(entry);
+        }
+      } else if (entry != overrides.end()) {
+        entry->tile = tile;
+      } else {
+        overrides.push_back({tile_position, tile, generated});
+      }
+      if (overrides.empty()) {
+        tile_overrides_.erase(coordinate);
+      }
+
+      const auto it = loaded_chunks_.find(coordinate);
+      if (it == loaded_chunks_.end()) {
+        continue;
+      }
+      auto& chunk = *it->second;
+      auto& current = chunk.tiles[GetChunkTileIndex(local.x, local.y)];
+      if (current != tile) {
+        current = tile;
+        RebuildChunkMesh(chunk);
+      }
+    }
+  }
+}
+
+bool ChunkStreamer::ReadGeneratedTile(const glm::ivec2& tile_position,
+                                      Tile& tile) const {
+  const auto owner = GetTileChunk(tile_position);
+  // 書き換え済みなら元のタイルを覚えている
+  const auto overrides = tile_overrides_.find(owner);
+  if (overrides != tile_overrides_.end()) {
+    for (const auto& o : overrides->second) {
+      if (o.position == tile_position) {
+        tile = o.generated;
+        return true;
+      }
+    }
+  }
+
+  // 書き換えていないタイルは読み込み済みのチャンクならファイルの内容のまま
+  for (int dy = -1; dy <= 1; ++dy) {
+    for (int dx = -1; dx <= 1; ++dx) {
+      const auto it = loaded_chunks_.find(owner + glm::ivec2(dx, dy));
+      glm::ivec2 local;
+      if (it != loaded_chunks_.end() &&
+          GetLocalTile(it->first, tile_position, local)) {
+        tile = it->second->tiles[GetChunkTileIndex(local.x, local.y)];
+        return true;
+      }
+    }
+  }
+
+  // 読み込んでいなければファイルから読む。マップの外は隣のチャンクの
+  // エプロンにだけ含まれる
+  std::vector<Tile> tiles;
+  std::vector<PointLight> lights;
+  for (int dy = -1; dy <= 1; ++dy) {
+    for (int dx = -1; dx <= 1; ++dx) {
+      const auto coordinate = owner + glm::ivec2(dx, dy);
+      glm::ivec2 local;
+      if (GetLocalTile(coordinate, tile_position, local) &&
+          map_.ReadChunk(coordinate, tiles, lights)) {
+        tile = tiles[GetChunkTileIndex(local.x, local.y)];
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool ChunkStreamer::ApplyTileOverrides(Chunk& chunk) const {
+  const auto overrides = tile_overrides_.find(chunk.coordinate);
+  if (overrides == tile_overrides_.end()) {
+    return false;
+  }
+  bool changed = false;
+  for (const auto& o : overrides->second) {
+    glm::ivec2 local;
+    GetLocalTile(chunk.coordinate, o.position, local);
+    auto& current = chunk.tiles[GetChunkTileIndex(local.x, local.y)];
+    if (current != o.tile) {
+      current = o.tile;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+void ChunkStreamer::RebuildChunkMesh(Chunk& chunk) {
+  memory_usage_ -= chunk.GetMemorySize();
+  chunk.mesh = BuildChunkMesh(chunk.coordinate, chunk.tiles);
+  chunk.bounds = chunk.mesh.bounds;
+  ++chunk.revision;
+  memory_usage_ += chunk.GetMemorySize();
+}
+
+void ChunkStreamer::CollectFinishedLoads() {
+  std::vector<std::pair<glm::ivec2, std::unique_ptr<Chunk>>> finished;
+  {
+    std::lock_guard<std::mutex> lock(finished_mutex_);
+    finished.swap(finished_chunks_);
+  }
+  for (auto& [coordinate, chunk] : finished) {
+    pending_chunks_.erase(coordinate);
+    if (!chunk) {
+      continue;
+    }
+    memory_usage_ += chunk->GetMemorySize();
+    // 書き換えたタイルを含むチャンクだけメインスレッドで作り直す
+    if (ApplyTileOverrides(*chunk)) {
+      RebuildChunkMesh(*chunk);
+    }
+    loaded_chunks_[coordinate] = std::move(chunk);
+  }
+}
+
+void ChunkStreamer::EvictChunks(const glm::vec3& camera_position) {
+  std::vector<std::pair<float, glm::ivec2>> by_distance;
+  by_distance.reserve(loaded_chunks_.size());
+  for (const auto& [coordinate, chunk] : loaded_chunks_) {
+    by_distance.emplace_back(GetDistanceToChunk(camera_position, coordinate),
+                             coordinate);
+  }
+  std::sort(by_distance.begin(), by_distance.end(),
+            [](const auto& a, const auto& b) { return a.first > b.first; });
+
+  // 範囲外のチャンクと、予算を超えた分の遠いチャンクを捨てる
+  for (const auto& [distance, coordinate] : by_distance) {
+    if (distance <= settings_.load_radius + kEvictionMargin &&
+        memory_usage_ <= settings_.memory_budget) {
+      break;
+    }
+    const auto it = loaded_chunks_.find(coordinate);
+    memory_usage_ -= it->second->GetMemorySize();
+    loaded_chunks_.erase(it);
+  }
+}
+
+void ChunkStreamer::RequestLoads(const glm::vec3& camera_position) {
+  const auto size_in_chunks = map_.GetSizeInChunks();
+  const float chunk_world_size = kChunkSize * kTileWorldSize;
+  const int radius_in_chunks =
+      static_cast<int>(std::ceil(settings_.load_radius / chunk_world_size));
+  const auto center = WorldToChunk(camera_position);
+  const auto min = glm::max(center - radius_in_chunks, glm::ivec2(0));
+  const auto max = glm::min(center + radius_in_chunks, size_in_chunks - 1);
+
+  std::vector<std::pair<float, glm::ivec2>> candidates;
+  for (int y = min.y; y <= max.y; ++y) {
+    for (int x = min.x; x <= max.x; ++x) {
+      const glm::ivec2 coordinate(x, y);
+      const float distance = GetDistanceToChunk(camera_position, coordinate);
+      if (distance > settings_.load_radius ||
+          loaded_chunks_.count(coordinate) > 0 ||
+          pending_chunks_.count(coordinate) > 0) {
+        continue;
+      }
+      candidates.emplace_back(distance, coordinate);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  // 予算を超えそうなら読み込まない
+  const std::size_t estimated_chunk_size =
+      loaded_chunks_.empty() ? 0 : memory_usage_ / loaded_chunks_.size();
+  for (const auto& [distance, coordinate] : candidates) {
+    const auto pending = pending_chunks_.size();
+    if (pending >= static_cast<std::size_t>(settings_.max_pending_loads) ||
+        memory_usage_ + (pending + 1) * estimated_chunk_size >
+            settings_.memory_budget) {
+      break;
+    }
+    pending_chunks_.insert(coordinate);
+    ++running_jobs_;
+    job_system_.Schedule([this, coordinate] {
+      auto chunk = LoadChunk(coordinate);
+      {
+        std::lock_guard<std::mutex> lock(finished_mutex_);
+        finished_chunks_.emplace_back(coordinate, std::move(chunk));
+      }
+      --running_jobs_;
+    });
+  }
+}
+
+std::unique_ptr<Chunk> ChunkStreamer::LoadChunk(
+    const glm::ivec2& coordinate) const {
+  auto chunk = std::make_unique<Chunk>();
+  chunk->coordinate = coordinate;
+  if (!map_.ReadChunk(coordinate, chunk->tiles, chunk->lights)) {
+    return nullptr;
+  }
+  chunk->mesh = BuildChunkMesh(coordinate, chunk->tiles);
+  chunk->bounds = chunk->mesh.bounds;
+  return chunk;
+}
+
+}  // namespace game
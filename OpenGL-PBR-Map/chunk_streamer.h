@@ -0,0 +1,158 @@
+#ifndef OPENGL_PBR_MAP_CHUNK_STREAMER_H_
+#define OPENGL_PBR_MAP_CHUNK_STREAMER_H_
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/glm.hpp>
+#include <glm/gtx/hash.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "aabb.h"
+#include "chunk_mesher.h"
+#include "dungeon_map.h"
+#include "light.h"
+
+namespace game {
+
+class JobSystem;
+
+/**
+ * @brief 読み込んで調理済みのチャンク
+ */
+struct Chunk {
+  glm::ivec2 coordinate;
+  // エプロン込みのタイル
+  std::vector<Tile> tiles;
+  ChunkMesh mesh;
+  std::vector<PointLight> lights;
+  AABB bounds;
+  // タイルの変更でメッシュを作り直すたびに増える
+  std::uint32_t revision = 0;
+
+  /**
+   * @brief チャンクが使っているメモリ量を見積もる
+   * @return バイト数
+   */
+  std::size_t GetMemorySize() const;
+};
+
+/**
+ * @brief カメラの周囲のチャンクを非同期に読み込み、遠くのチャンクを捨てる
+ *
+ * マップ全体の大きさに関わらず、メモリ上にあるのはカメラから
+ * load_radius以内でメモリ予算に収まる分のチャンクだけになる。
+ */
+class ChunkStreamer {
+ public:
+  struct Settings {
+    // カメラからこの距離以内のチャンクを読み込む
+    float load_radius = 96.0f;
+    // 読み込み済みのチャンクのメモリ量の上限
+    std::size_t memory_budget = 256u << 20u;
+    // 同時に読み込み中にするチャンクの数
+    int max_pending_loads = 8;
+  };
+
+  /**
+   * @brief コンストラクタ
+   * @param map 読み込むマップ、ChunkStreamerより長く生存すること
+   * @param settings ストリーミングの設定
+   * @param job_system 読み込みと調理を実行するJobSystem
+   */
+  ChunkStreamer(const DungeonMapFile& map, const Settings& settings,
+                JobSystem& job_system);
+
+  /**
+   * @brief デストラクタ
+   *
+   * 読み込み中のジョブが終わるまで待つ。
+   */
+  ~ChunkStreamer();
+
+  ChunkStreamer(const ChunkStreamer&) = delete;
+  ChunkStreamer& operator=(const ChunkStreamer&) = delete;
+
+  /**
+   * @brief 読み込みの完了を反映し、新しい読み込みと破棄を行う
+   * @param camera_position カメラのワールド座標
+   *
+   * メインスレッドから毎フレーム呼ぶ。
+   */
+  void Update(const glm::vec3& camera_position);
+
+  /**
+   * @brief 読み込み済みのチャンクを探す
+   * @param coordinate チャンクの座標
+   * @return チャンク、読み込まれていなければnullptr
+   */
+  const Chunk* FindChunk(const glm::ivec2& coordinate) const;
+
+  const std::unordered_map<glm::ivec2, std::unique_ptr<Chunk>>&
+  GetLoadedChunks() const;
+
+  std::size_t GetMemoryUsage() const;
+
+  std::size_t GetPendingLoadCount() const;
+
+  /**
+   * @brief タイルを書き換えて影響するチャンクのメッシュだけを作り直す
+   * @param tile_position マップ上のタイル座標
+   * @param tile 新しいタイル
+   *
+   * 変更は破棄したチャンクを読み直したときにも反映される。
+   * タイルをエプロンに持つ隣のチャンクも作り直す。
+   * ファイルの内容に戻したタイルは変更として覚えておかない。
+   */
+  void SetTile(const glm::ivec2& tile_position, const Tile& tile);
+
+ private:
+  // ファイルの内容から書き換えた1タイル
+  struct TileOverride {
+    glm::ivec2 position;
+    Tile tile;
+    // ファイルに書かれていたタイル
+    Tile generated;
+  };
+
+  bool ReadGeneratedTile(const glm::ivec2& tile_position, Tile& tile) const;
+  bool ApplyTileOverrides(Chunk& chunk) const;
+  void RebuildChunkMesh(Chunk& chunk);
+  void CollectFinishedLoads();
+  void EvictChunks(const glm::vec3& camera_position);
+  void RequestLoads(const glm::vec3& camera_position);
+  std::unique_ptr<Chunk> LoadChunk(const glm::ivec2& coordinate) const;
+
+  const DungeonMapFile& map_;
+  Settings settings_;
+  JobSystem& job_system_;
+
+  std::unordered_map<glm::ivec2, std::unique_ptr<Chunk>> loaded_chunks_;
+  std::unordered_set<glm::ivec2> pending_chunks_;
+  std::size_t memory_usage_;
+  // チャンクの座標ごとの書き換えたタイル。エプロンに持つチャンクにも入れる
+  std::unordered_map<glm::ivec2, std::vector<TileOverride>> tile_overrides_;
+
+  // ワーカースレッドから渡される読み込み結果
+  std::mutex finished_mutex_;
+  std::vector<std::pair<glm::ivec2, std::unique_ptr<Chunk>>> finished_chunks_;
+  std::atomic<int> running_jobs_;
+};
+
+/**
+ * @brief カメラからチャンクまでの水平距離を求める
+ * @param camera_position カメラのワールド座標
+ * @param chunk チャンクの座標
+ * @return チャンクの矩形の最も近い点までの距離
+ */
+float GetDistanceToChunk(const glm::vec3& camera_position,
+                         const glm::ivec2& chunk);
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_CHUNK_STREAMER_H_
@@ -0,0 +1,279 @@
+#include "clustered_lighting.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "job_system.h"
+
+namespace game {
+
+namespace {
+
+GLintptr AlignUp(GLintptr value, GLintptr alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// 球と箱の最も近い点までの距離で判定する
+bool SphereIntersectsBox(const glm::vec3& center, float radius,
+                         const AABB& bounds) {
+  const auto closest = glm::clamp(center, bounds.min, bounds.max);
+  const auto offset = center - closest;
+  return glm::dot(offset, offset) <= radius * radius;
+}
+
+}  // namespace
+
+ClusteredLighting::ClusteredLighting(const glm::ivec3& grid_size,
+                                     int max_lights_per_cluster,
+                                     int max_light_count)
+    : grid_size_(grid_size),
+      max_lights_per_cluster_(max_lights_per_cluster),
+      max_light_count_(max_light_count),
+      header_(),
+      dropped_light_count_(0),
+      buffer_(0),
+      mapped_(nullptr),
+      frame_size_(0),
+      cluster_offset_(0),
+      index_offset_(0),
+      fences_(),
+      frame_index_(0) {
+  clusters_.resize(GetClusterCount(), LightCluster{0, 0});
+}
+
+ClusteredLighting::~ClusteredLighting() {
+  if (buffer_ == 0) {
+    return;
+  }
+  for (const auto fence : fences_) {
+    if (fence != nullptr) {
+      glDeleteSync(fence);
+    }
+  }
+  glUnmapNamedBuffer(buffer_);
+  glDeleteBuffers(1, &buffer_);
+}
+
+void ClusteredLighting::Update(const std::vector<PointLight>& lights,
+                               const glm::mat4& view,
+                               const glm::mat4& projection, float near_plane,
+                               float far_plane,
+                               const glm::ivec2& viewport_size,
+                               JobSystem& job_system) {
+  // スライスの番号は log(深度) * scale - biasの整数部分になる
+  const float slice_scale = static_cast<float>(grid_size_.z) /
+                            std::log(far_plane / near_plane);
+  const float slice_bias = std::log(near_plane) * slice_scale;
+  header_.grid_size = glm::uvec4(glm::uvec3(grid_size_),
+                                 static_cast<std::uint32_t>(
+                                     max_lights_per_cluster_));
+  const auto tile_size =
+      (viewport_size + glm::ivec2(grid_size_) - 1) / glm::ivec2(grid_size_);
+  header_.tile_and_slice =
+      glm::vec4(glm::vec2(tile_size), slice_scale, slice_bias);
+
+  // タイルの角を通る視線を求める。画面の端のタイルははみ出してよい
+  const auto inverse_projection = glm::inverse(projection);
+  corner_rays_.resize((grid_size_.x + 1) * (grid_size_.y + 1));
+  for (int y = 0; y <= grid_size_.y; ++y) {
+    for (int x = 0; x <= grid_size_.x; ++x) {
+      const auto pixel = glm::vec2(x, y) * glm::vec2(tile_size);
+      const auto ndc = pixel / glm::vec2(viewport_size) * 2.0f - 1.0f;
+      const auto point = inverse_projection * glm::vec4(ndc, -1.0f, 1.0f);
+      const auto view_point = glm::vec3(point) / point.w;
+      corner_rays_[y * (grid_size_.x + 1) + x] = view_point / -view_point.z;
+    }
+  }
+  slice_depths_.resize(grid_size_.z + 1);
+  for (int z = 0; z <= grid_size_.z; ++z) {
+    slice_depths_[z] =
+        near_plane * std::pow(far_plane / near_plane,
+                              static_cast<float>(z) / grid_size_.z);
+  }
+
+  // ライトをビュー空間に移し、xyzに位置、wに範囲を持つ
+  const auto light_count =
+      std::min(lights.size(), static_cast<std::size_t>(max_light_count_));
+  lights_.assign(lights.begin(), lights.begin() + light_count);
+  std::vector<glm::vec4> view_lights(light_count);
+  for (std::size_t i = 0; i < light_count; ++i) {
+    view_lights[i] = glm::vec4(
+        glm::vec3(view * glm::vec4(lights_[i].position, 1.0f)),
+        lights_[i].range);
+  }
+
+  std::vector<std::vector<std::uint32_t>> slice_indices(grid_size_.z);
+  std::vector<std::size_t> slice_dropped(grid_size_.z, 0);
+  job_system.ParallelFor(
+      grid_size_.z, 1, [&](std::size_t begin, std::size_t end) {
+        for (auto z = begin; z < end; ++z) {
+          AssignSlice(static_cast<int>(z), view_lights, clusters_,
+                      slice_indices[z], slice_dropped[z]);
+        }
+      });
+
+  // スライスの順につなげ、番号の位置をずらす
+  light_indices_.clear();
+  dropped_light_count_ = 0;
+  const auto slice_cluster_count =
+      static_cast<std::size_t>(grid_size_.x) * grid_size_.y;
+  for (int z = 0; z < grid_size_.z; ++z) {
+    const auto base = static_cast<std::uint32_t>(light_indices_.size());
+    for (std::size_t i = 0; i < slice_cluster_count; ++i) {
+      clusters_[z * slice_cluster_count + i].offset += base;
+    }
+    light_indices_.insert(light_indices_.end(), slice_indices[z].begin(),
+                          slice_indices[z].end());
+    dropped_light_count_ += slice_dropped[z];
+  }
+}
+
+void ClusteredLighting::AssignSlice(int z,
+                                    const std::vector<glm::vec4>& view_lights,
+                                    std::vector<LightCluster>& clusters,
+                                    std::vector<std::uint32_t>& indices,
+                                    std::size_t& dropped) const {
+  const float near_depth = slice_depths_[z];
+  const float far_depth = slice_depths_[z + 1];
+
+  // スライスの深度の範囲と重なるライトに絞る
+  std::vector<std::uint32_t> candidates;
+  for (std::size_t i = 0; i < view_lights.size(); ++i) {
+    const float depth = -view_lights[i].z;
+    const float range = view_lights[i].w;
+    if (depth + range >= near_depth && depth - range <= far_depth) {
+      candidates.push_back(static_cast<std::uint32_t>(i));
+    }
+  }
+
+  indices.clear();
+  const auto row_size = grid_size_.x + 1;
+  for (int y = 0; y < grid_size_.y; ++y) {
+    for (int x = 0; x < grid_size_.x; ++x) {
+      // タイルの4つの角の視線を手前と奥の深度まで伸ばした8点を囲む
+      AABB bounds;
+      for (int corner = 0; corner < 4; ++corner) {
+        const auto& ray =
+            corner_rays_[(y + corner / 2) * row_size + x + corner % 2];
+        bounds.Extend(ray * near_depth);
+        bounds.Extend(ray * far_depth);
+      }
+
+      auto& cluster = clusters[GetClusterIndex(x, y, z)];
+      cluster.offset = static_cast<std::uint32_t>(indices.size());
+      cluster.count = 0;
+      for (const auto light : candidates) {
+        const auto& view_light = view_lights[light];
+        if (!SphereIntersectsBox(glm::vec3(view_light), view_light.w,
+                                 bounds)) {
+          continue;
+        }
+        if (cluster.count == static_cast<std::uint32_t>(
+                                 max_lights_per_cluster_)) {
+          ++dropped;
+          continue;
+        }
+        indices.push_back(light);
+        ++cluster.count;
+      }
+    }
+  }
+}
+
+void ClusteredLighting::Upload() {
+  if (buffer_ == 0) {
+    CreateBuffer();
+  }
+  frame_index_ = (frame_index_ + 1) % kFrameCount;
+  auto& fence = fences_[frame_index_];
+  if (fence != nullptr) {
+    // 普通は既に終わっているので、待つのは描画が数フレーム遅れたときだけ
+    while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) ==
+           GL_TIMEOUT_EXPIRED) {
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+  }
+
+  auto* frame = mapped_ + frame_index_ * frame_size_;
+  std::memcpy(frame, lights_.data(), lights_.size() * sizeof(PointLight));
+  std::memcpy(frame + cluster_offset_, &header_, sizeof(header_));
+  std::memcpy(frame + cluster_offset_ + sizeof(header_), clusters_.data(),
+              clusters_.size() * sizeof(LightCluster));
+  std::memcpy(frame + index_offset_, light_indices_.data(),
+              light_indices_.size() * sizeof(std::uint32_t));
+}
+
+void ClusteredLighting::Bind() const {
+  const auto frame_offset = frame_index_ * frame_size_;
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, kLightBufferBinding, buffer_,
+                    frame_offset, cluster_offset_);
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, kClusterBufferBinding, buffer_,
+                    frame_offset + cluster_offset_,
+                    index_offset_ - cluster_offset_);
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, kLightIndexBufferBinding,
+                    buffer_, frame_offset + index_offset_,
+                    frame_size_ - index_offset_);
+}
+
+void ClusteredLighting::EndFrame() {
+  auto& fence = fences_[frame_index_];
+  if (fence != nullptr) {
+    glDeleteSync(fence);
+  }
+  fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+std::size_t ClusteredLighting::GetClusterCount() const {
+  return static_cast<std::size_t>(grid_size_.x) * grid_size_.y *
+         grid_size_.z;
+}
+
+const glm::ivec3& ClusteredLighting::GetGridSize() const {
+  return grid_size_;
+}
+
+const LightClusterHeader& ClusteredLighting::GetHeader() const {
+  return header_;
+}
+
+const std::vector<LightCluster>& ClusteredLighting::GetClusters() const {
+  return clusters_;
+}
+
+const std::vector<std::uint32_t>& ClusteredLighting::GetLightIndices()
+    const {
+  return light_indices_;
+}
+
+std::size_t ClusteredLighting::GetDroppedLightCount() const {
+  return dropped_light_count_;
+}
+
+std::size_t ClusteredLighting::GetClusterIndex(int x, int y, int z) const {
+  return x + (y + static_cast<std::size_t>(z) * grid_size_.y) * grid_size_.x;
+}
+
+void ClusteredLighting::CreateBuffer() {
+  // 各配列の先頭はSSBOのオフセットの制約に揃える
+  GLint alignment;
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  cluster_offset_ = AlignUp(max_light_count_ * sizeof(PointLight), alignment);
+  index_offset_ = AlignUp(cluster_offset_ + sizeof(LightClusterHeader) +
+                              GetClusterCount() * sizeof(LightCluster),
+                          alignment);
+  frame_size_ = AlignUp(index_offset_ + GetClusterCount() *
+                                            max_lights_per_cluster_ *
+                                            sizeof(std::uint32_t),
+                        alignment);
+
+  const GLbitfield flags =
+      GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  glCreateBuffers(1, &buffer_);
+  glNamedBufferStorage(buffer_, frame_size_ * kFrameCount, nullptr, flags);
+  mapped_ = static_cast<std::uint8_t*>(
+      glMapNamedBufferRange(buffer_, 0, frame_size_ * kFrameCount, flags));
+}
+
+}  // namespace game
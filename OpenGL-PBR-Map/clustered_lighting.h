@@ -0,0 +1,158 @@
+#ifndef OPENGL_PBR_MAP_CLUSTERED_LIGHTING_H_
+#define OPENGL_PBR_MAP_CLUSTERED_LIGHTING_H_
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "aabb.h"
+#include "light.h"
+
+namespace game {
+
+class JobSystem;
+
+/**
+ * @brief クラスターに含まれるライトの番号の範囲
+ */
+struct LightCluster {
+  std::uint32_t offset;
+  std::uint32_t count;
+};
+
+/**
+ * @brief シェーダーがクラスターを探すための値 (std430)
+ */
+struct LightClusterHeader {
+  // xyzがクラスターの数、wはクラスターあたりのライトの上限
+  glm::uvec4 grid_size;
+  // xyがタイルのピクセル数、zwは深度からスライスを求める係数と切片
+  glm::vec4 tile_and_slice;
+};
+
+/**
+ * @brief 画面をタイルと対数の深度スライスで区切ったクラスターごとに
+ *        影響するライトを集める
+ *
+ * ライトの影響範囲の球とクラスターのビュー空間のバウンディングボックスを
+ * 比べ、クラスターごとのライトの番号の配列を作る。スライスごとに並列に
+ * 処理し、結果はスライスの順につなげる。シェーダーはフラグメントの
+ * クラスターのライトだけを調べればよいので (shaders/clustered_lighting.glsl)、
+ * 費用はライトの総数ではなくその場所のライトの密度で決まる。
+ *
+ * GPUのバッファは永続的にマップし、kFrameCountフレーム分の領域を
+ * フェンスで待ちながら順に使い回す。
+ */
+class ClusteredLighting {
+ public:
+  static constexpr GLuint kLightBufferBinding = 2;
+  static constexpr GLuint kClusterBufferBinding = 3;
+  static constexpr GLuint kLightIndexBufferBinding = 4;
+  // GPUが読んでいる間に書き換えないよう使い回す領域の数
+  static constexpr int kFrameCount = 3;
+
+  /**
+   * @brief コンストラクタ
+   * @param grid_size 横、縦、深度方向のクラスターの数
+   * @param max_lights_per_cluster クラスターあたりのライトの上限
+   * @param max_light_count ライトの総数の上限
+   */
+  ClusteredLighting(const glm::ivec3& grid_size = glm::ivec3(16, 9, 24),
+                    int max_lights_per_cluster = 64,
+                    int max_light_count = 1024);
+  ~ClusteredLighting();
+
+  ClusteredLighting(const ClusteredLighting&) = delete;
+  ClusteredLighting& operator=(const ClusteredLighting&) = delete;
+
+  /**
+   * @brief ライトをクラスターに割り当てる
+   * @param lights ワールド空間の点光源
+   * @param view ビュー行列
+   * @param projection 透視投影行列
+   * @param near_plane 近クリップ面までの距離
+   * @param far_plane 遠クリップ面までの距離
+   * @param viewport_size 画面のピクセル数
+   * @param job_system スライスの並列化に使うJobSystem
+   *
+   * max_light_countを超えた分のライトは無視する。
+   */
+  void Update(const std::vector<PointLight>& lights, const glm::mat4& view,
+              const glm::mat4& projection, float near_plane, float far_plane,
+              const glm::ivec2& viewport_size, JobSystem& job_system);
+
+  /**
+   * @brief 次の領域にライト、クラスター、番号の配列を書き込む
+   *
+   * kFrameCountフレーム前にその領域を読んだ描画が終わっていなければ待つ。
+   */
+  void Upload();
+
+  /**
+   * @brief 最後にUploadした領域をSSBOとしてバインドする
+   */
+  void Bind() const;
+
+  /**
+   * @brief 最後にUploadした領域を読む描画の後に呼び、フェンスを置く
+   */
+  void EndFrame();
+
+  std::size_t GetClusterCount() const;
+  const glm::ivec3& GetGridSize() const;
+  const LightClusterHeader& GetHeader() const;
+  const std::vector<LightCluster>& GetClusters() const;
+  const std::vector<std::uint32_t>& GetLightIndices() const;
+
+  /**
+   * @brief 上限を超えてクラスターに入らなかったライトの数を取得する
+   * @return 直前のUpdateでの全クラスターの合計
+   */
+  std::size_t GetDroppedLightCount() const;
+
+  /**
+   * @brief クラスターの番号を求める
+   * @param x 横の番号
+   * @param y 縦の番号
+   * @param z 深度スライスの番号
+   * @return x + (y + z * 縦) * 横
+   */
+  std::size_t GetClusterIndex(int x, int y, int z) const;
+
+ private:
+  void CreateBuffer();
+  void AssignSlice(int z, const std::vector<glm::vec4>& view_lights,
+                   std::vector<LightCluster>& clusters,
+                   std::vector<std::uint32_t>& indices,
+                   std::size_t& dropped) const;
+
+  glm::ivec3 grid_size_;
+  int max_lights_per_cluster_;
+  int max_light_count_;
+
+  LightClusterHeader header_;
+  // タイルの角を通る視線のz = -1での点。(横 + 1) * (縦 + 1)個
+  std::vector<glm::vec3> corner_rays_;
+  // スライスの境界の深度、スライス数 + 1個
+  std::vector<float> slice_depths_;
+  std::vector<PointLight> lights_;
+  std::vector<LightCluster> clusters_;
+  std::vector<std::uint32_t> light_indices_;
+  std::size_t dropped_light_count_;
+
+  GLuint buffer_;
+  std::uint8_t* mapped_;
+  // 1フレーム分の領域の大きさと、その中のクラスターと番号の配列の位置
+  GLsizeiptr frame_size_;
+  GLintptr cluster_offset_;
+  GLintptr index_offset_;
+  std::array<GLsync, kFrameCount> fences_;
+  int frame_index_;
+};
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_CLUSTERED_LIGHTING_H_
@@ -0,0 +1,182 @@
+#include "deferred_renderer.h"
+
+#include <algorithm>
+
+#include "gl_state_cache.h"
+#include "shader_program.h"
+
+namespace game {
+
+namespace {
+
+GLuint CreateTarget(GLenum format, int width, int height) {
+  GLuint texture;
+  glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+  glTextureStorage2D(texture, 1, format, width, height);
+  glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  return texture;
+}
+
+}  // namespace
+
+DeferredRenderer::DeferredRenderer()
+    : width_(0),
+      height_(0),
+      program_(0),
+      framebuffer_(0),
+      normal_texture_(0),
+      base_color_texture_(0),
+      material_texture_(0),
+      depth_texture_(0),
+      lighting_texture_(0),
+      light_buffer_(0),
+      white_texture_(0),
+      light_buffer_size_(0) {}
+
+DeferredRenderer::~DeferredRenderer() {
+  DeleteTargets();
+  if (program_ != 0) {
+    glDeleteProgram(program_);
+    glDeleteBuffers(1, &light_buffer_);
+    GlStateCache::GetInstance().DeleteTextures(1, &white_texture_);
+  }
+}
+
+bool DeferredRenderer::Initialize(const std::string& shader_directory) {
+  program_ = LoadShaderProgram(
+      {{GL_COMPUTE_SHADER, shader_directory + "/tiled_deferred.comp"}});
+  if (program_ == 0) {
+    return false;
+  }
+  glCreateBuffers(1, &light_buffer_);
+  white_texture_ = CreateTarget(GL_R8, 1, 1);
+  const GLubyte white = 255;
+  glTextureSubImage2D(white_texture_, 0, 0, 0, 1, 1, GL_RED, GL_UNSIGNED_BYTE,
+                      &white);
+  return true;
+}
+
+void DeferredRenderer::Resize(int width, int height) {
+  if (width == width_ && height == height_) {
+    return;
+  }
+  DeleteTargets();
+  width_ = width;
+  height_ = height;
+
+  normal_texture_ = CreateTarget(GL_RG16_SNORM, width, height);
+  base_color_texture_ = CreateTarget(GL_SRGB8_ALPHA8, width, height);
+  material_texture_ = CreateTarget(GL_RGBA8, width, height);
+  depth_texture_ = CreateTarget(GL_DEPTH_COMPONENT32F, width, height);
+  lighting_texture_ = CreateTarget(GL_RGBA16F, width, height);
+
+  glCreateFramebuffers(1, &framebuffer_);
+  glNamedFramebufferTexture(framebuffer_, GL_COLOR_ATTACHMENT0,
+                            normal_texture_, 0);
+  glNamedFramebufferTexture(framebuffer_, GL_COLOR_ATTACHMENT1,
+                            base_color_texture_, 0);
+  glNamedFramebufferTexture(framebuffer_, GL_COLOR_ATTACHMENT2,
+                            material_texture_, 0);
+  glNamedFramebufferTexture(framebuffer_, GL_DEPTH_ATTACHMENT, depth_texture_,
+                            0);
+  const GLenum draw_buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1,
+                                 GL_COLOR_ATTACHMENT2};
+  glNamedFramebufferDrawBuffers(framebuffer_, 3, draw_buffers);
+}
+
+void DeferredRenderer::BeginGeometryPass() {
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+  glViewport(0, 0, width_, height_);
+  GLfloat zero[] = {0.0f, 0.0f, 0.0f, 0.0f};
+  GLfloat far_depth = 1.0f;
+  for (GLint buffer = 0; buffer < 3; ++buffer) {
+    glClearNamedFramebufferfv(framebuffer_, GL_COLOR, buffer, zero);
+  }
+  glClearNamedFramebufferfv(framebuffer_, GL_DEPTH, 0, &far_depth);
+}
+
+void DeferredRenderer::EndGeometryPass() {
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void DeferredRenderer::Shade(const std::vector<PointLight>& lights,
+                             const glm::mat4& view,
+                             const glm::mat4& projection,
+                             const glm::vec3& ambient,
+                             GLuint ambient_occlusion_texture) {
+  const auto size =
+      static_cast<GLsizeiptr>(lights.size() * sizeof(PointLight));
+  if (size > light_buffer_size_) {
+    light_buffer_size_ = std::max(size, light_buffer_size_ * 2);
+    glNamedBufferData(light_buffer_, light_buffer_size_, nullptr,
+                      GL_DYNAMIC_DRAW);
+  }
+  if (size > 0) {
+    glNamedBufferSubData(light_buffer_, 0, size, lights.data());
+  }
+
+  auto& state = GlStateCache::GetInstance();
+  // G-bufferはフレームバッファとして書いたので、テクスチャとして読むのに
+  // バリアは要らない
+  state.UseProgram(program_);
+  glProgramUniformMatrix4fv(program_, glGetUniformLocation(program_, "view"),
+                            1, GL_FALSE, &view[0][0]);
+  const auto inverse_projection = glm::inverse(projection);
+  glProgramUniformMatrix4fv(
+      program_, glGetUniformLocation(program_, "inverse_projection"), 1,
+      GL_FALSE, &inverse_projection[0][0]);
+  const auto inverse_view = glm::inverse(view);
+  glProgramUniformMatrix4fv(program_,
+                            glGetUniformLocation(program_, "inverse_view"), 1,
+                            GL_FALSE, &inverse_view[0][0]);
+  glProgramUniform1ui(program_, glGetUniformLocation(program_, "light_count"),
+                      static_cast<GLuint>(lights.size()));
+  glProgramUniform3fv(program_, glGetUniformLocation(program_, "ambient"), 1,
+                      &ambient[0]);
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kLightBufferBinding,
+                   light_buffer_);
+  state.BindTextureUnit(0, depth_texture_);
+  state.BindTextureUnit(1, normal_texture_);
+  state.BindTextureUnit(2, base_color_texture_);
+  state.BindTextureUnit(3, material_texture_);
+  state.BindTextureUnit(4, ambient_occlusion_texture != 0
+                              ? ambient_occlusion_texture
+                              : white_texture_);
+  glBindImageTexture(0, lighting_texture_, 0, GL_FALSE, 0, GL_WRITE_ONLY,
+                     GL_RGBA16F);
+  glDispatchCompute((width_ + kTileSize - 1) / kTileSize,
+                    (height_ + kTileSize - 1) / kTileSize, 1);
+
+  // 後続のパスが結果をテクスチャとして読めるようにする
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT |
+                  GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+GLuint DeferredRenderer::GetLightingTexture() const {
+  return lighting_texture_;
+}
+
+GLuint DeferredRenderer::GetDepthTexture() const { return depth_texture_; }
+
+std::size_t DeferredRenderer::GetMemorySize() const {
+  // 法線4、ベースカラー4、マテリアル4、深度4、結果8バイト
+  return static_cast<std::size_t>(width_) * height_ * (4 + 4 + 4 + 4 + 8);
+}
+
+void DeferredRenderer::DeleteTargets() {
+  if (framebuffer_ == 0) {
+    return;
+  }
+  glDeleteFramebuffers(1, &framebuffer_);
+  const GLuint textures[] = {normal_texture_, base_color_texture_,
+                             material_texture_, depth_texture_,
+                             lighting_texture_};
+  GlStateCache::GetInstance().DeleteTextures(5, textures);
+  framebuffer_ = 0;
+}
+
+}  // namespace game
@@ -0,0 +1,115 @@
+#ifndef OPENGL_PBR_MAP_DEFERRED_RENDERER_H_
+#define OPENGL_PBR_MAP_DEFERRED_RENDERER_H_
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+#include "light.h"
+
+namespace game {
+
+/**
+ * @brief G-bufferとコンピュートシェーダーによるタイルベースの
+ *        ディファードシェーディング
+ *
+ * G-bufferは1ピクセルあたり16バイトに抑える。
+ * 0: 八面体写像した法線 (RG16_SNORM)
+ * 1: ベースカラー (SRGB8_ALPHA8)
+ * 2: metallic, roughness, AO (RGBA8)
+ * 深度: DEPTH_COMPONENT32F
+ * ライティングは16x16ピクセルのタイルごとのワークグループで、タイルの
+ * 深度の範囲と視錐台でライトを選んでから同じディスパッチの中で照らし、
+ * 結果をRGBA16Fのテクスチャに書く (shaders/tiled_deferred.comp)。
+ * フィルレートが支配的な場面ではフォワード描画より安くなる。
+ */
+class DeferredRenderer {
+ public:
+  static constexpr int kTileSize = 16;
+  // ライトのSSBOのバインディング番号
+  static constexpr GLuint kLightBufferBinding = 5;
+
+  DeferredRenderer();
+  ~DeferredRenderer();
+
+  DeferredRenderer(const DeferredRenderer&) = delete;
+  DeferredRenderer& operator=(const DeferredRenderer&) = delete;
+
+  /**
+   * @brief シェーダーを読み込む
+   * @param shader_directory shadersディレクトリのパス (末尾の区切りなし)
+   * @return 成功すればtrue
+   */
+  bool Initialize(const std::string& shader_directory);
+
+  /**
+   * @brief 画面の大きさに合わせてG-bufferを作り直す
+   * @param width 幅
+   * @param height 高さ
+   */
+  void Resize(int width, int height);
+
+  /**
+   * @brief G-bufferをバインドして消去する
+   *
+   * この後に描くジオメトリのフラグメントシェーダーは
+   * shaders/gbuffer.fragのように3つのカラーアタッチメントに書き込む。
+   * ベースカラーはGL_FRAMEBUFFER_SRGBを有効にして書く。
+   */
+  void BeginGeometryPass();
+
+  /**
+   * @brief デフォルトのフレームバッファに戻す
+   */
+  void EndGeometryPass();
+
+  /**
+   * @brief タイルごとにライトを選んでG-bufferを照らす
+   * @param lights ワールド空間の点光源
+   * @param view ビュー行列
+   * @param projection 射影行列
+   * @param ambient 全体に足す環境光
+   * @param ambient_occlusion_texture 環境光に掛ける可視率のテクスチャ
+   *        (GroundTruthAmbientOcclusion::GetTexture)、0なら掛けない
+   */
+  void Shade(const std::vector<PointLight>& lights, const glm::mat4& view,
+             const glm::mat4& projection, const glm::vec3& ambient,
+             GLuint ambient_occlusion_texture = 0);
+
+  /**
+   * @brief ライティングの結果を取得する
+   * @return RGBA16Fのテクスチャ
+   */
+  GLuint GetLightingTexture() const;
+
+  GLuint GetDepthTexture() const;
+
+  /**
+   * @brief G-bufferと結果のテクスチャのバイト数を取得する
+   * @return バイト数
+   */
+  std::size_t GetMemorySize() const;
+
+ private:
+  void DeleteTargets();
+
+  int width_;
+  int height_;
+  GLuint program_;
+  GLuint framebuffer_;
+  GLuint normal_texture_;
+  GLuint base_color_texture_;
+  GLuint material_texture_;
+  GLuint depth_texture_;
+  GLuint lighting_texture_;
+  GLuint light_buffer_;
+  // アンビエントオクルージョンがないときに代わりに読む白の1x1
+  GLuint white_texture_;
+  GLsizeiptr light_buffer_size_;
+};
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_DEFERRED_RENDERER_H_
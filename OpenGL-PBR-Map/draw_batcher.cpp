@@ -0,0 +1,160 @@
+#include "draw_batcher.h"
+
+#include <algorithm>
+
+namespace game {
+
+namespace {
+
+// キーの各フィールドのビット数
+constexpr int kMaterialBits = 24;
+constexpr int kMeshBits = 24;
+
+std::uint64_t MakeKey(std::uint32_t pipeline, std::uint32_t mesh,
+                      std::uint32_t material) {
+  return (static_cast<std::uint64_t>(pipeline) << (kMeshBits + kMaterialBits)) |
+         (static_cast<std::uint64_t>(mesh) << kMaterialBits) | material;
+}
+
+std::uint32_t GetKeyPipeline(std::uint64_t key) {
+  return static_cast<std::uint32_t>(key >> (kMeshBits + kMaterialBits));
+}
+
+std::uint32_t GetKeyMesh(std::uint64_t key) {
+  return static_cast<std::uint32_t>(key >> kMaterialBits) &
+         ((1u << kMeshBits) - 1);
+}
+
+std::uint32_t GetKeyMaterial(std::uint64_t key) {
+  return static_cast<std::uint32_t>(key) & ((1u << kMaterialBits) - 1);
+}
+
+// 足りなければバッファを作り直してからデータを書き込む
+void WriteBuffer(GLuint buffer, GLsizeiptr& capacity, const void* data,
+                 GLsizeiptr size) {
+  if (size > capacity) {
+    // 毎フレーム少しずつ増えても作り直しが続かないよう余裕を持たせる
+    capacity = std::max(size, capacity * 2);
+    glNamedBufferData(buffer, capacity, nullptr, GL_DYNAMIC_DRAW);
+  }
+  if (size > 0) {
+    glNamedBufferSubData(buffer, 0, size, data);
+  }
+}
+
+}  // namespace
+
+DrawBatcher::DrawBatcher()
+    : command_buffer_(0),
+      instance_buffer_(0),
+      command_buffer_size_(0),
+      instance_buffer_size_(0) {}
+
+DrawBatcher::~DrawBatcher() {
+  if (command_buffer_ != 0) {
+    glDeleteBuffers(1, &command_buffer_);
+    glDeleteBuffers(1, &instance_buffer_);
+  }
+}
+
+std::uint32_t DrawBatcher::RegisterMesh(const DrawMesh& mesh) {
+  meshes_.push_back(mesh);
+  return static_cast<std::uint32_t>(meshes_.size() - 1);
+}
+
+void DrawBatcher::Begin() {
+  pending_.clear();
+  pending_models_.clear();
+}
+
+void DrawBatcher::Add(std::uint32_t mesh, std::uint32_t material,
+                      std::uint32_t pipeline, const glm::mat4& model) {
+  pending_.push_back({MakeKey(pipeline, mesh, material),
+                      static_cast<std::uint32_t>(pending_.size())});
+  pending_models_.push_back(model);
+}
+
+void DrawBatcher::Build() {
+  commands_.clear();
+  instances_.clear();
+  groups_.clear();
+
+  // 同じキーの中では追加した順を保つ
+  std::sort(pending_.begin(), pending_.end(),
+            [](const PendingInstance& a, const PendingInstance& b) {
+              return a.key < b.key || (a.key == b.key && a.index < b.index);
+            });
+
+  instances_.reserve(pending_.size());
+  for (std::size_t begin = 0; begin < pending_.size();) {
+    const auto key = pending_[begin].key;
+    auto end = begin;
+    for (; end < pending_.size() && pending_[end].key == key; ++end) {
+      DrawInstanceData instance = {};
+      instance.model = pending_models_[pending_[end].index];
+      instance.material = GetKeyMaterial(key);
+      instances_.push_back(instance);
+    }
+
+    const auto pipeline = GetKeyPipeline(key);
+    if (groups_.empty() || groups_.back().pipeline != pipeline) {
+      groups_.push_back(
+          {pipeline, static_cast<std::uint32_t>(commands_.size()), 0});
+    }
+    ++groups_.back().command_count;
+
+    const auto& mesh = meshes_[GetKeyMesh(key)];
+    DrawElementsIndirectCommand command;
+    command.count = mesh.index_count;
+    command.instance_count = static_cast<GLuint>(end - begin);
+    command.first_index = mesh.first_index;
+    command.base_vertex = mesh.base_vertex;
+    command.base_instance = static_cast<GLuint>(begin);
+    commands_.push_back(command);
+    begin = end;
+  }
+}
+
+void DrawBatcher::Upload() {
+  if (command_buffer_ == 0) {
+    glCreateBuffers(1, &command_buffer_);
+    glCreateBuffers(1, &instance_buffer_);
+  }
+  WriteBuffer(command_buffer_, command_buffer_size_, commands_.data(),
+              commands_.size() * sizeof(DrawElementsIndirectCommand));
+  WriteBuffer(instance_buffer_, instance_buffer_size_, instances_.data(),
+              instances_.size() * sizeof(DrawInstanceData));
+}
+
+bool DrawBatcher::Draw(std::uint32_t pipeline) const {
+  const auto group =
+      std::find_if(groups_.begin(), groups_.end(),
+                   [&](const DrawGroup& g) { return g.pipeline == pipeline; });
+  if (group == groups_.end()) {
+    return false;
+  }
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kInstanceBufferBinding,
+                   instance_buffer_);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer_);
+  glMultiDrawElementsIndirect(
+      GL_TRIANGLES, GL_UNSIGNED_INT,
+      reinterpret_cast<const void*>(group->first_command *
+                                    sizeof(DrawElementsIndirectCommand)),
+      group->command_count, sizeof(DrawElementsIndirectCommand));
+  return true;
+}
+
+const std::vector<DrawElementsIndirectCommand>& DrawBatcher::GetCommands()
+    const {
+  return commands_;
+}
+
+const std::vector<DrawInstanceData>& DrawBatcher::GetInstances() const {
+  return instances_;
+}
+
+const std::vector<DrawGroup>& DrawBatcher::GetGroups() const {
+  return groups_;
+}
+
+}  // namespace game
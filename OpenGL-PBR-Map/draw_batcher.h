@@ -0,0 +1,146 @@
+#ifndef OPENGL_PBR_MAP_DRAW_BATCHER_H_
+#define OPENGL_PBR_MAP_DRAW_BATCHER_H_
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace game {
+
+/**
+ * @brief glMultiDrawElementsIndirectが読むコマンド
+ */
+struct DrawElementsIndirectCommand {
+  GLuint count;
+  GLuint instance_count;
+  GLuint first_index;
+  GLint base_vertex;
+  GLuint base_instance;
+};
+
+/**
+ * @brief 共有の頂点バッファとインデックスバッファの中のメッシュの範囲
+ */
+struct DrawMesh {
+  std::uint32_t first_index;
+  std::uint32_t index_count;
+  std::int32_t base_vertex;
+};
+
+/**
+ * @brief シェーダーがSSBOから読むインスタンスごとの値 (std430)
+ */
+struct DrawInstanceData {
+  glm::mat4 model;
+  std::uint32_t material;
+  std::uint32_t padding[3];
+};
+
+/**
+ * @brief 同じパイプラインで1回のglMultiDrawElementsIndirectで描くコマンドの範囲
+ */
+struct DrawGroup {
+  std::uint32_t pipeline;
+  std::uint32_t first_command;
+  std::uint32_t command_count;
+};
+
+/**
+ * @brief 見えるインスタンスをまとめてインスタンス描画のコマンドを作る
+ *
+ * Addで集めたインスタンスを (パイプライン, メッシュ, マテリアル) で並べ替え、
+ * 同じ組をインスタンス数を持つ1つのコマンドにまとめる。インスタンスの
+ * 変換行列とマテリアルの番号はコマンドの順にSSBOへ並べ、シェーダーは
+ * gl_BaseInstance + gl_InstanceIDで自分の値を読む
+ * (shaders/draw_instances.glsl)。
+ * パイプラインごとに1回のglMultiDrawElementsIndirectで描けるので、
+ * 描画の呼び出しの数はインスタンスやメッシュの数に依らない。
+ *
+ * 1フレームの使い方はBegin、Addを見えるインスタンスの数だけ、Build、
+ * Uploadの順に呼んだ後、パイプラインごとにシェーダーと頂点配列を
+ * バインドしてDrawを呼ぶ。
+ */
+class DrawBatcher {
+ public:
+  // インスタンスのSSBOのバインディング番号
+  static constexpr GLuint kInstanceBufferBinding = 0;
+
+  DrawBatcher();
+  ~DrawBatcher();
+
+  DrawBatcher(const DrawBatcher&) = delete;
+  DrawBatcher& operator=(const DrawBatcher&) = delete;
+
+  /**
+   * @brief メッシュを登録する
+   * @param mesh 共有バッファの中の範囲
+   * @return メッシュの番号
+   */
+  std::uint32_t RegisterMesh(const DrawMesh& mesh);
+
+  /**
+   * @brief 集めたインスタンスを消してフレームを始める
+   */
+  void Begin();
+
+  /**
+   * @brief 描くインスタンスを追加する
+   * @param mesh RegisterMeshで登録したメッシュの番号
+   * @param material マテリアルの番号
+   * @param pipeline パイプライン (シェーダーと描画状態の組) の番号
+   * @param model モデル行列
+   */
+  void Add(std::uint32_t mesh, std::uint32_t material, std::uint32_t pipeline,
+           const glm::mat4& model);
+
+  /**
+   * @brief インスタンスを並べ替えてコマンドとインスタンスの値を作る
+   */
+  void Build();
+
+  /**
+   * @brief コマンドとインスタンスの値をGPUのバッファに書き込む
+   *
+   * バッファは足りなくなったときだけ作り直す。
+   */
+  void Upload();
+
+  /**
+   * @brief パイプラインのコマンドを1回の呼び出しで描く
+   * @param pipeline パイプラインの番号
+   * @return 描いたコマンドがあればtrue
+   *
+   * 呼び出し側でパイプラインのシェーダーと、登録したメッシュの
+   * 頂点配列をバインドしておくこと。
+   */
+  bool Draw(std::uint32_t pipeline) const;
+
+  const std::vector<DrawElementsIndirectCommand>& GetCommands() const;
+  const std::vector<DrawInstanceData>& GetInstances() const;
+  const std::vector<DrawGroup>& GetGroups() const;
+
+ private:
+  struct PendingInstance {
+    // パイプライン、メッシュ、マテリアルの順に上位から詰めたキー
+    std::uint64_t key;
+    std::uint32_t index;
+  };
+
+  std::vector<DrawMesh> meshes_;
+  std::vector<PendingInstance> pending_;
+  std::vector<glm::mat4> pending_models_;
+  std::vector<DrawElementsIndirectCommand> commands_;
+  std::vector<DrawInstanceData> instances_;
+  std::vector<DrawGroup> groups_;
+
+  GLuint command_buffer_;
+  GLuint instance_buffer_;
+  GLsizeiptr command_buffer_size_;
+  GLsizeiptr instance_buffer_size_;
+};
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_DRAW_BATCHER_H_
@@ -0,0 +1,486 @@
+#include "dungeon_generator.h"
+
+#include <glm/gtc/noise.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "job_system.h"
+#include "sampling.h"
+
+namespace game {
+
+namespace {
+
+enum class Cell : std::uint8_t {
+  kSolid,
+  kRoom,
+  kCorridor,
+  kCave,
+  // 部屋の中の柱
+  kPillar,
+};
+
+// [min, max)の長方形
+struct Rect {
+  glm::ivec2 min;
+  glm::ivec2 max;
+
+  glm::ivec2 GetSize() const { return max - min; }
+  glm::ivec2 GetCenter() const { return (min + max) / 2; }
+};
+
+// 生成中の1領域。座標は領域内のローカル座標
+struct Region {
+  glm::ivec2 origin;
+  glm::ivec2 size;
+  std::vector<Cell> cells;
+  std::vector<Rect> rooms;
+  std::vector<PointLight> lights;
+
+  Cell& At(const glm::ivec2& p) {
+    return cells[static_cast<std::size_t>(p.y) * size.x + p.x];
+  }
+  Cell Get(const glm::ivec2& p) const {
+    if (p.x < 0 || p.y < 0 || p.x >= size.x || p.y >= size.y) {
+      return Cell::kSolid;
+    }
+    return cells[static_cast<std::size_t>(p.y) * size.x + p.x];
+  }
+};
+
+// SplitMix64で値を混ぜてシードを派生させる
+std::uint64_t MixSeed(std::uint64_t seed, std::uint64_t value) {
+  auto z = seed + 0x9e3779b97f4a7c15ull * (value + 1);
+  z = (z ^ (z >> 30u)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27u)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31u);
+}
+
+// [min, max]の一様な整数
+int NextInt(Pcg32& random, int min, int max) {
+  return min + static_cast<int>(random.NextUint() %
+                                static_cast<std::uint32_t>(max - min + 1));
+}
+
+// 岩のタイルだけを通路にしながらL字に掘る
+void CarveCorridor(Region& region, const glm::ivec2& from,
+                   const glm::ivec2& to, bool horizontal_first) {
+  const glm::ivec2 corner =
+      horizontal_first ? glm::ivec2(to.x, from.y) : glm::ivec2(from.x, to.y);
+  auto carve_line = [&region](glm::ivec2 a, const glm::ivec2& b) {
+    const auto step = glm::sign(b - a);
+    while (true) {
+      auto& cell = region.At(a);
+      if (cell == Cell::kSolid) {
+        cell = Cell::kCorridor;
+      }
+      if (a == b) {
+        break;
+      }
+      a += step;
+    }
+  };
+  carve_line(from, corner);
+  carve_line(corner, to);
+}
+
+// 区画を再帰的に分割して部屋を置き、兄弟の部屋を通路でつなぐ。
+// 戻り値は部分木の代表にする部屋の番号
+std::size_t PartitionRooms(Region& region, Pcg32& random, const Rect& rect,
+                           const DungeonGeneratorSettings& settings) {
+  const auto size = rect.GetSize();
+  const int min_size = settings.min_partition_size;
+  const bool can_split_x = size.x >= min_size * 2;
+  const bool can_split_y = size.y >= min_size * 2;
+  if (!can_split_x && !can_split_y) {
+    // 区画の内側に1タイルの壁を残して部屋を置く
+    const auto max_room = glm::max(size - 2, glm::ivec2(1));
+    const auto min_room = glm::min(glm::ivec2(settings.min_room_size),
+                                   max_room);
+    const glm::ivec2 room_size(NextInt(random, min_room.x, max_room.x),
+                               NextInt(random, min_room.y, max_room.y));
+    const auto room_min =
+        rect.min + 1 +
+        glm::ivec2(NextInt(random, 0, max_room.x - room_size.x),
+                   NextInt(random, 0, max_room.y - room_size.y));
+    const Rect room{room_min, room_min + room_size};
+    for (int y = room.min.y; y < room.max.y; ++y) {
+      for (int x = room.min.x; x < room.max.x; ++x) {
+        region.At({x, y}) = Cell::kRoom;
+      }
+    }
+    region.rooms.push_back(room);
+    return region.rooms.size() - 1;
+  }
+
+  // 長い方の軸で分ける
+  const bool split_x = can_split_x && (!can_split_y || size.x >= size.y);
+  const int axis = split_x ? 0 : 1;
+  const int split =
+      rect.min[axis] + NextInt(random, min_size, size[axis] - min_size);
+  auto first = rect;
+  auto second = rect;
+  first.max[axis] = split;
+  second.min[axis] = split;
+  const auto first_room = PartitionRooms(region, random, first, settings);
+  const auto second_room = PartitionRooms(region, random, second, settings);
+  CarveCorridor(region, region.rooms[first_room].GetCenter(),
+                region.rooms[second_room].GetCenter(),
+                (random.NextUint() & 1u) != 0);
+  return (random.NextUint() & 1u) != 0 ? first_room : second_room;
+}
+
+// セルオートマトンで洞窟を作り、最大の連結成分だけを残す
+void GenerateCave(Region& region, Pcg32& random,
+                  const DungeonGeneratorSettings& settings) {
+  const auto& size = region.size;
+  for (int y = 1; y < size.y - 1; ++y) {
+    for (int x = 1; x < size.x - 1; ++x) {
+      region.At({x, y}) = random.NextFloat() < settings.cave_fill_ratio
+                              ? Cell::kSolid
+                              : Cell::kCave;
+    }
+  }
+
+  // 周囲3x3のうち5つ以上が岩なら岩にする。領域の外は岩として扱う
+  std::vector<Cell> next(region.cells.size(), Cell::kSolid);
+  for (int iteration = 0; iteration < settings.cave_iterations; ++iteration) {
+    for (int y = 1; y < size.y - 1; ++y) {
+      for (int x = 1; x < size.x - 1; ++x) {
+        int solid_count = 0;
+        for (int dy = -1; dy <= 1; ++dy) {
+          for (int dx = -1; dx <= 1; ++dx) {
+            solid_count += region.Get({x + dx, y + dy}) == Cell::kSolid;
+          }
+        }
+        next[static_cast<std::size_t>(y) * size.x + x] =
+            solid_count >= 5 ? Cell::kSolid : Cell::kCave;
+      }
+    }
+    region.cells.swap(next);
+  }
+
+  // 4近傍の連結成分を塗り分ける
+  std::vector<int> labels(region.cells.size(), -1);
+  std::vector<std::size_t> component_sizes;
+  std::vector<glm::ivec2> stack;
+  for (int y = 1; y < size.y - 1; ++y) {
+    for (int x = 1; x < size.x - 1; ++x) {
+      const auto start = static_cast<std::size_t>(y) * size.x + x;
+      if (region.cells[start] != Cell::kCave || labels[start] >= 0) {
+        continue;
+      }
+      const int label = static_cast<int>(component_sizes.size());
+      component_sizes.push_back(0);
+      labels[start] = label;
+      stack.push_back({x, y});
+      while (!stack.empty()) {
+        const auto p = stack.back();
+        stack.pop_back();
+        ++component_sizes.back();
+        const glm::ivec2 neighbors[] = {
+            p + glm::ivec2(1, 0), p - glm::ivec2(1, 0),
+            p + glm::ivec2(0, 1), p - glm::ivec2(0, 1)};
+        for (const auto& n : neighbors) {
+          if (region.Get(n) != Cell::kCave) {
+            continue;
+          }
+          const auto index = static_cast<std::size_t>(n.y) * size.x + n.x;
+          if (labels[index] < 0) {
+            labels[index] = label;
+            stack.push_back(n);
+          }
+        }
+      }
+    }
+  }
+
+  if (component_sizes.empty()) {
+    // 全部岩になったら中央に小さな空洞を開ける
+    const auto center = size / 2;
+    for (int y = center.y - 1; y <= center.y + 1; ++y) {
+      for (int x = center.x - 1; x <= center.x + 1; ++x) {
+        region.At({x, y}) = Cell::kCave;
+      }
+    }
+    return;
+  }
+  const int largest = static_cast<int>(
+      std::max_element(component_sizes.begin(), component_sizes.end()) -
+      component_sizes.begin());
+  for (std::size_t i = 0; i < region.cells.size(); ++i) {
+    if (region.cells[i] == Cell::kCave && labels[i] != largest) {
+      region.cells[i] = Cell::kSolid;
+    }
+  }
+}
+
+// 出入り口から掘る通路の行き先を探す
+glm::ivec2 FindAnchor(const Region& region, const glm::ivec2& from) {
+  if (!region.rooms.empty()) {
+    auto best = region.rooms.front().GetCenter();
+    int best_distance = std::numeric_limits<int>::max();
+    for (const auto& room : region.rooms) {
+      const auto d = glm::abs(room.GetCenter() - from);
+      if (d.x + d.y < best_distance) {
+        best_distance = d.x + d.y;
+        best = room.GetCenter();
+      }
+    }
+    return best;
+  }
+  // 洞窟は出入り口に一番近い空洞のタイル
+  auto best = region.size / 2;
+  int best_distance = std::numeric_limits<int>::max();
+  for (int y = 0; y < region.size.y; ++y) {
+    for (int x = 0; x < region.size.x; ++x) {
+      if (region.Get({x, y}) != Cell::kCave) {
+        continue;
+      }
+      const auto d = glm::abs(glm::ivec2(x, y) - from);
+      if (d.x + d.y < best_distance) {
+        best_distance = d.x + d.y;
+        best = {x, y};
+      }
+    }
+  }
+  return best;
+}
+
+// 広い部屋に一定間隔で柱を立てる。ノイズで柱のある部屋を選ぶ
+// 中央のタイルとその周りには立てない。中央は光源と通路の接続先になる
+void PlacePillars(Region& region, const DungeonGeneratorSettings& settings) {
+  for (const auto& room : region.rooms) {
+    const auto size = room.GetSize();
+    if (size.x < 7 || size.y < 7) {
+      continue;
+    }
+    const auto center = room.GetCenter();
+    const auto world = glm::vec2(region.origin + center);
+    if (glm::simplex(world * settings.decoration_frequency * 4.0f) < 0.2f) {
+      continue;
+    }
+    for (int y = room.min.y + 2; y < room.max.y - 2; y += 3) {
+      for (int x = room.min.x + 2; x < room.max.x - 2; x += 3) {
+        const auto d = glm::abs(glm::ivec2(x, y) - center);
+        if (d.x <= 1 && d.y <= 1) {
+          continue;
+        }
+        region.At({x, y}) = Cell::kPillar;
+      }
+    }
+  }
+}
+
+// 光源を置く。部屋は中央に1つ、洞窟は一定間隔の格子ごとに空洞の上に置く
+void PlaceLights(Region& region, Pcg32& random,
+                 const DungeonGeneratorSettings& settings) {
+  auto add_light = [&](const glm::vec2& tile, float range) {
+    PointLight light;
+    const auto world = (glm::vec2(region.origin) + tile) * kTileWorldSize;
+    light.position = glm::vec3(world.x, kWallHeight * 0.8f, world.y);
+    light.range = range;
+    light.intensity =
+        settings.light_intensity * (0.75f + 0.5f * random.NextFloat());
+    region.lights.push_back(light);
+  };
+
+  for (const auto& room : region.rooms) {
+    const auto size = glm::vec2(room.GetSize());
+    add_light(glm::vec2(room.min) + size * 0.5f,
+              (glm::length(size) * 0.75f + 2.0f) * kTileWorldSize);
+  }
+  if (!region.rooms.empty()) {
+    return;
+  }
+  constexpr int kCaveLightSpacing = 12;
+  for (int y = 0; y + kCaveLightSpacing <= region.size.y;
+       y += kCaveLightSpacing) {
+    for (int x = 0; x + kCaveLightSpacing <= region.size.x;
+         x += kCaveLightSpacing) {
+      const glm::ivec2 p(x + NextInt(random, 0, kCaveLightSpacing - 1),
+                         y + NextInt(random, 0, kCaveLightSpacing - 1));
+      if (region.Get(p) == Cell::kCave) {
+        add_light(glm::vec2(p) + 0.5f, kCaveLightSpacing * kTileWorldSize);
+      }
+    }
+  }
+}
+
+// ノイズの値[-1, 1]をマテリアルの番号に量子化する
+std::uint8_t NoiseToMaterial(float noise, int material_count) {
+  const int material = static_cast<int>((noise * 0.5f + 0.5f) *
+                                        static_cast<float>(material_count));
+  return static_cast<std::uint8_t>(
+      glm::clamp(material, 0, material_count - 1));
+}
+
+// 領域のセルをタイルにしてマップに書く
+void WriteRegion(const Region& region,
+                 const DungeonGeneratorSettings& settings, TileMap& map) {
+  const float frequency = settings.decoration_frequency;
+  const int material_count = std::max(settings.material_count, 1);
+
+  // 部屋の床はマテリアルを部屋全体でそろえる
+  std::vector<std::uint8_t> room_materials(region.cells.size(), 0);
+  for (const auto& room : region.rooms) {
+    const auto center = glm::vec2(region.origin + room.GetCenter());
+    const auto material =
+        NoiseToMaterial(glm::perlin(center * frequency), material_count);
+    for (int y = room.min.y; y < room.max.y; ++y) {
+      for (int x = room.min.x; x < room.max.x; ++x) {
+        room_materials[static_cast<std::size_t>(y) * region.size.x + x] =
+            material;
+      }
+    }
+  }
+
+  for (int y = 0; y < region.size.y; ++y) {
+    for (int x = 0; x < region.size.x; ++x) {
+      const glm::ivec2 local(x, y);
+      const auto world = glm::vec2(region.origin + local);
+      const auto cell = region.Get(local);
+      Tile tile;
+      switch (cell) {
+        case Cell::kSolid:
+        case Cell::kPillar:
+          // 壁は低い周波数のノイズで大きな塊ごとに変える
+          tile.type = TileType::kSolid;
+          tile.material = NoiseToMaterial(
+              glm::simplex(world * frequency * 0.5f + 17.0f), material_count);
+          break;
+        case Cell::kRoom:
+          tile.type = TileType::kFloor;
+          tile.material =
+              room_materials[static_cast<std::size_t>(y) * region.size.x + x];
+          break;
+        case Cell::kCorridor: {
+          // 部屋に入るところで両脇が岩なら出入り口にする
+          const bool horizontal_wall =
+              region.Get(local + glm::ivec2(0, 1)) == Cell::kSolid &&
+              region.Get(local - glm::ivec2(0, 1)) == Cell::kSolid;
+          const bool vertical_wall =
+              region.Get(local + glm::ivec2(1, 0)) == Cell::kSolid &&
+              region.Get(local - glm::ivec2(1, 0)) == Cell::kSolid;
+          const bool enters_room_x =
+              region.Get(local + glm::ivec2(1, 0)) == Cell::kRoom ||
+              region.Get(local - glm::ivec2(1, 0)) == Cell::kRoom;
+          const bool enters_room_y =
+              region.Get(local + glm::ivec2(0, 1)) == Cell::kRoom ||
+              region.Get(local - glm::ivec2(0, 1)) == Cell::kRoom;
+          const bool is_door = (horizontal_wall && enters_room_x) ||
+                               (vertical_wall && enters_room_y);
+          tile.type = is_door ? TileType::kDoor : TileType::kFloor;
+          tile.material =
+              NoiseToMaterial(glm::perlin(world * frequency), material_count);
+          break;
+        }
+        case Cell::kCave:
+          tile.type = TileType::kFloor;
+          tile.material = NoiseToMaterial(
+              glm::perlin(world * frequency * 2.0f), material_count);
+          break;
+      }
+      map.Set(region.origin.x + x, region.origin.y + y, tile);
+    }
+  }
+}
+
+}  // namespace
+
+TileMap GenerateDungeon(const DungeonGeneratorSettings& settings,
+                        JobSystem& job_system) {
+  TileMap map(settings.size.x, settings.size.y);
+  const int region_size =
+      std::max(settings.region_size, settings.min_partition_size + 2);
+  // 端の半端なタイルは最後の領域に含めて小さすぎる領域を作らない
+  const auto region_count =
+      glm::max(settings.size / region_size, glm::ivec2(1));
+  std::vector<std::vector<PointLight>> region_lights(
+      static_cast<std::size_t>(region_count.x) * region_count.y);
+
+  // 辺の上の出入り口の位置。両側の領域が同じ値を求める
+  auto get_edge_offset = [&](const glm::ivec2& region, int axis, int length) {
+    const auto edge =
+        (static_cast<std::uint64_t>(region.y) * region_count.x + region.x) *
+            2 +
+        axis;
+    return 1 + static_cast<int>(
+                   MixSeed(settings.seed, edge) %
+                   static_cast<std::uint64_t>(std::max(length - 2, 1)));
+  };
+
+  job_system.ParallelFor(
+      region_lights.size(), 1, [&](std::size_t begin, std::size_t end) {
+        for (auto index = begin; index < end; ++index) {
+          const glm::ivec2 coordinate(
+              static_cast<int>(index % region_count.x),
+              static_cast<int>(index / region_count.x));
+          Region region;
+          region.origin = coordinate * region_size;
+          region.size = glm::ivec2(region_size);
+          for (int axis = 0; axis < 2; ++axis) {
+            if (coordinate[axis] + 1 == region_count[axis]) {
+              region.size[axis] = settings.size[axis] - region.origin[axis];
+            }
+          }
+          region.cells.assign(
+              static_cast<std::size_t>(region.size.x) * region.size.y,
+              Cell::kSolid);
+          Pcg32 random(MixSeed(settings.seed, index), index);
+
+          if (random.NextFloat() < settings.cave_ratio) {
+            GenerateCave(region, random, settings);
+          } else {
+            const Rect interior{glm::ivec2(0), region.size};
+            PartitionRooms(region, random, interior, settings);
+            PlacePillars(region, settings);
+          }
+
+          // 隣の領域に向かう出入り口を四辺に掘る
+          struct Connector {
+            glm::ivec2 position;
+            bool horizontal;
+          };
+          std::vector<Connector> connectors;
+          if (coordinate.x > 0) {
+            const int y = get_edge_offset(coordinate - glm::ivec2(1, 0), 0,
+                                          region.size.y);
+            connectors.push_back({{0, y}, true});
+          }
+          if (coordinate.x + 1 < region_count.x) {
+            const int y = get_edge_offset(coordinate, 0, region.size.y);
+            connectors.push_back({{region.size.x - 1, y}, true});
+          }
+          if (coordinate.y > 0) {
+            const int x = get_edge_offset(coordinate - glm::ivec2(0, 1), 1,
+                                          region.size.x);
+            connectors.push_back({{x, 0}, false});
+          }
+          if (coordinate.y + 1 < region_count.y) {
+            const int x = get_edge_offset(coordinate, 1, region.size.x);
+            connectors.push_back({{x, region.size.y - 1}, false});
+          }
+          for (const auto& connector : connectors) {
+            CarveCorridor(region, connector.position,
+                          FindAnchor(region, connector.position),
+                          connector.horizontal);
+          }
+
+          PlaceLights(region, random, settings);
+          WriteRegion(region, settings, map);
+          region_lights[index] = std::move(region.lights);
+        }
+      });
+
+  // 光源は領域の順に並べて並列でも順番を変えない
+  auto& lights = map.GetLights();
+  for (const auto& region : region_lights) {
+    lights.insert(lights.end(), region.begin(), region.end());
+  }
+  return map;
+}
+
+}  // namespace game
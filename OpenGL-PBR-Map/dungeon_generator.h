@@ -0,0 +1,56 @@
+#ifndef OPENGL_PBR_MAP_DUNGEON_GENERATOR_H_
+#define OPENGL_PBR_MAP_DUNGEON_GENERATOR_H_
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+#include "dungeon_map.h"
+
+namespace game {
+
+class JobSystem;
+
+/**
+ * @brief ダンジョン生成の設定
+ */
+struct DungeonGeneratorSettings {
+  std::uint64_t seed = 1;
+  // マップのタイル数
+  glm::ivec2 size{1024, 1024};
+  // 並列に生成する領域の一辺のタイル数
+  int region_size = 64;
+  // BSPでこれより小さい区画は分割しない
+  int min_partition_size = 10;
+  int min_room_size = 4;
+  // 部屋の代わりに洞窟にする領域の割合
+  float cave_ratio = 0.25f;
+  // セルオートマトンの初期状態で岩にするタイルの割合
+  float cave_fill_ratio = 0.45f;
+  int cave_iterations = 4;
+  // 床と壁に使うマテリアルの種類数
+  int material_count = 4;
+  // 装飾に使うノイズの周波数 (1 / タイル)
+  float decoration_frequency = 0.03f;
+  // 部屋や洞窟に置く光源の強さ
+  glm::vec3 light_intensity{40.0f, 34.0f, 26.0f};
+};
+
+/**
+ * @brief シードからダンジョンのマップを生成する
+ * @param settings 生成の設定
+ * @param job_system 領域ごとの生成に使うジョブシステム
+ * @return 生成したマップ
+ *
+ * マップをregion_size四方の領域に分け、領域ごとにBSPで部屋と通路を作るか
+ * セルオートマトンで洞窟を作る。領域は自分の範囲のタイルだけを書き、
+ * 乱数はシードと領域の番号から作るので、並列に生成しても同じシードなら
+ * 常に同じマップになる。隣の領域との出入り口は共有する辺から決まる位置に
+ * 両側から通路を掘ってつなぐ。
+ */
+TileMap GenerateDungeon(const DungeonGeneratorSettings& settings,
+                        JobSystem& job_system);
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_DUNGEON_GENERATOR_H_
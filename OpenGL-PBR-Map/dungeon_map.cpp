@@ -0,0 +1,210 @@
+#include "dungeon_map.h"
+
+#include <fstream>
+#include <iostream>
+
+namespace game {
+
+namespace {
+
+struct DungeonMapFileHeader {
+  std::uint32_t magic;
+  std::uint32_t version;
+  std::uint32_t width;
+  std::uint32_t height;
+  std::uint32_t chunk_size;
+  std::uint32_t chunk_apron;
+};
+
+// ランレングス圧縮の1区間
+struct TileRun {
+  std::uint16_t count;
+  TileType type;
+  std::uint8_t material;
+};
+
+static_assert(sizeof(TileRun) == 4, "TileRun must be tightly packed.");
+static_assert(sizeof(PointLight) == 32, "PointLight must be tightly packed.");
+
+}  // namespace
+
+TileMap::TileMap(int width, int height)
+    : width_(width),
+      height_(height),
+      tiles_(static_cast<std::size_t>(width) * height) {}
+
+int TileMap::GetWidth() const { return width_; }
+
+int TileMap::GetHeight() const { return height_; }
+
+glm::ivec2 TileMap::GetSizeInChunks() const {
+  return glm::ivec2((width_ + kChunkSize - 1) / kChunkSize,
+                    (height_ + kChunkSize - 1) / kChunkSize);
+}
+
+Tile TileMap::Get(int x, int y) const {
+  if (x < 0 || y < 0 || x >= width_ || y >= height_) {
+    return Tile();
+  }
+  return tiles_[static_cast<std::size_t>(y) * width_ + x];
+}
+
+void TileMap::Set(int x, int y, const Tile& tile) {
+  tiles_[static_cast<std::size_t>(y) * width_ + x] = tile;
+}
+
+void TileMap::CopyChunkTiles(const glm::ivec2& chunk,
+                             std::vector<Tile>& tiles) const {
+  tiles.resize(kChunkSizeWithApron * kChunkSizeWithApron);
+  const auto origin = chunk * kChunkSize - kChunkApron;
+  for (int y = 0; y < kChunkSizeWithApron; ++y) {
+    for (int x = 0; x < kChunkSizeWithApron; ++x) {
+      tiles[GetChunkTileIndex(x, y)] = Get(origin.x + x, origin.y + y);
+    }
+  }
+}
+
+std::vector<PointLight>& TileMap::GetLights() { return lights_; }
+
+const std::vector<PointLight>& TileMap::GetLights() const { return lights_; }
+
+bool SaveDungeonMap(const TileMap& map, const std::string& path) {
+  const auto size_in_chunks = map.GetSizeInChunks();
+  const auto chunk_count =
+      static_cast<std::size_t>(size_in_chunks.x) * size_in_chunks.y;
+
+  // 光源をチャンクごとに振り分ける
+  std::vector<std::vector<PointLight>> chunk_lights(chunk_count);
+  for (const auto& light : map.GetLights()) {
+    const auto chunk = glm::clamp(WorldToChunk(light.position), glm::ivec2(0),
+                                  size_in_chunks - 1);
+    chunk_lights[static_cast<std::size_t>(chunk.y) * size_in_chunks.x +
+                 chunk.x]
+        .push_back(light);
+  }
+
+  std::vector<std::vector<TileRun>> chunk_runs(chunk_count);
+  std::vector<Tile> tiles;
+  for (int cy = 0; cy < size_in_chunks.y; ++cy) {
+    for (int cx = 0; cx < size_in_chunks.x; ++cx) {
+      map.CopyChunkTiles(glm::ivec2(cx, cy), tiles);
+      auto& runs = chunk_runs[static_cast<std::size_t>(cy) * size_in_chunks.x +
+                              cx];
+      for (const auto& tile : tiles) {
+        if (!runs.empty() && runs.back().type == tile.type &&
+            runs.back().material == tile.material &&
+            runs.back().count < 0xffff) {
+          ++runs.back().count;
+        } else {
+          runs.push_back({1, tile.type, tile.material});
+        }
+      }
+    }
+  }
+
+  DungeonMapFileHeader header;
+  header.magic = DungeonMapFile::kMagic;
+  header.version = DungeonMapFile::kVersion;
+  header.width = static_cast<std::uint32_t>(map.GetWidth());
+  header.height = static_cast<std::uint32_t>(map.GetHeight());
+  header.chunk_size = kChunkSize;
+  header.chunk_apron = kChunkApron;
+
+  std::ofstream output(path, std::ios::binary);
+  if (!output) {
+    std::cerr << "Can't open dungeon map: " << path << std::endl;
+    return false;
+  }
+  output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  // 目次の後ろにチャンクのデータを順に並べる
+  std::uint64_t offset =
+      sizeof(header) + chunk_count * (sizeof(std::uint64_t) +
+                                      sizeof(std::uint32_t) * 2);
+  for (std::size_t i = 0; i < chunk_count; ++i) {
+    const auto run_count = static_cast<std::uint32_t>(chunk_runs[i].size());
+    const auto light_count = static_cast<std::uint32_t>(chunk_lights[i].size());
+    output.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+    output.write(reinterpret_cast<const char*>(&run_count), sizeof(run_count));
+    output.write(reinterpret_cast<const char*>(&light_count),
+                 sizeof(light_count));
+    offset += run_count * sizeof(TileRun) + light_count * sizeof(PointLight);
+  }
+  for (std::size_t i = 0; i < chunk_count; ++i) {
+    output.write(reinterpret_cast<const char*>(chunk_runs[i].data()),
+                 chunk_runs[i].size() * sizeof(TileRun));
+    output.write(reinterpret_cast<const char*>(chunk_lights[i].data()),
+                 chunk_lights[i].size() * sizeof(PointLight));
+  }
+  if (!output) {
+    std::cerr << "Can't write dungeon map: " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool DungeonMapFile::Open(const std::string& path) {
+  std::ifstream input(path, std::ios::binary);
+  DungeonMapFileHeader header;
+  if (!input.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      header.magic != kMagic || header.version != kVersion ||
+      header.chunk_size != kChunkSize || header.chunk_apron != kChunkApron) {
+    std::cerr << "Invalid dungeon map: " << path << std::endl;
+    return false;
+  }
+
+  path_ = path;
+  size_in_chunks_ =
+      glm::ivec2((header.width + kChunkSize - 1) / kChunkSize,
+                 (header.height + kChunkSize - 1) / kChunkSize);
+  chunks_.resize(static_cast<std::size_t>(size_in_chunks_.x) *
+                 size_in_chunks_.y);
+  for (auto& chunk : chunks_) {
+    input.read(reinterpret_cast<char*>(&chunk.offset), sizeof(chunk.offset));
+    input.read(reinterpret_cast<char*>(&chunk.run_count),
+               sizeof(chunk.run_count));
+    input.read(reinterpret_cast<char*>(&chunk.light_count),
+               sizeof(chunk.light_count));
+  }
+  if (!input) {
+    std::cerr << "Truncated dungeon map: " << path << std::endl;
+    chunks_.clear();
+    return false;
+  }
+  return true;
+}
+
+glm::ivec2 DungeonMapFile::GetSizeInChunks() const { return size_in_chunks_; }
+
+bool DungeonMapFile::ReadChunk(const glm::ivec2& chunk,
+                               std::vector<Tile>& tiles,
+                               std::vector<PointLight>& lights) const {
+  if (glm::any(glm::lessThan(chunk, glm::ivec2(0))) ||
+      glm::any(glm::greaterThanEqual(chunk, size_in_chunks_))) {
+    return false;
+  }
+  const auto& entry =
+      chunks_[static_cast<std::size_t>(chunk.y) * size_in_chunks_.x + chunk.x];
+
+  // スレッドごとに別のストリームで読むのでロックはいらない
+  std::ifstream input(path_, std::ios::binary);
+  input.seekg(static_cast<std::streamoff>(entry.offset));
+  std::vector<TileRun> runs(entry.run_count);
+  lights.resize(entry.light_count);
+  input.read(reinterpret_cast<char*>(runs.data()),
+             runs.size() * sizeof(TileRun));
+  input.read(reinterpret_cast<char*>(lights.data()),
+             lights.size() * sizeof(PointLight));
+  if (!input) {
+    return false;
+  }
+
+  tiles.clear();
+  tiles.reserve(kChunkSizeWithApron * kChunkSizeWithApron);
+  for (const auto& run : runs) {
+    tiles.insert(tiles.end(), run.count, Tile{run.type, run.material});
+  }
+  return tiles.size() == kChunkSizeWithApron * kChunkSizeWithApron;
+}
+
+}  // namespace game
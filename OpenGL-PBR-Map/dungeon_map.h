@@ -0,0 +1,171 @@
+#ifndef OPENGL_PBR_MAP_DUNGEON_MAP_H_
+#define OPENGL_PBR_MAP_DUNGEON_MAP_H_
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "light.h"
+
+namespace game {
+
+// チャンクの一辺のタイル数
+constexpr int kChunkSize = 32;
+// チャンクの周囲に一緒に持つ隣のチャンクのタイル数
+constexpr int kChunkApron = 1;
+constexpr int kChunkSizeWithApron = kChunkSize + kChunkApron * 2;
+// タイル1枚のワールド座標での一辺の長さ
+constexpr float kTileWorldSize = 2.0f;
+// 床から天井までの高さ
+constexpr float kWallHeight = 3.0f;
+
+enum class TileType : std::uint8_t {
+  // 岩盤や壁で埋まったタイル
+  kSolid,
+  // 歩ける床
+  kFloor,
+  // 部屋と通路をつなぐ出入り口の床
+  kDoor,
+};
+
+/**
+ * @brief マップの1タイル
+ */
+struct Tile {
+  TileType type = TileType::kSolid;
+  // 床や壁に使うマテリアルの番号
+  std::uint8_t material = 0;
+
+  bool IsSolid() const { return type == TileType::kSolid; }
+
+  bool operator==(const Tile& other) const {
+    return type == other.type && material == other.material;
+  }
+  bool operator!=(const Tile& other) const { return !(*this == other); }
+};
+
+/**
+ * @brief タイルの格子で表したダンジョンのマップ全体
+ *
+ * 生成や編集に使うメモリ上の表現。ゲーム中はSaveDungeonMapで書き出した
+ * チャンク単位のファイルをDungeonMapFileから必要な分だけ読む。
+ * タイル(x, y)はワールド座標のXZ平面上で
+ * [x, x + 1) * kTileWorldSize, [y, y + 1) * kTileWorldSizeを占める。
+ */
+class TileMap {
+ public:
+  TileMap(int width, int height);
+
+  int GetWidth() const;
+  int GetHeight() const;
+
+  /**
+   * @brief チャンク単位の大きさを取得する
+   * @return 幅と高さのチャンク数
+   */
+  glm::ivec2 GetSizeInChunks() const;
+
+  /**
+   * @brief タイルを取得する
+   * @param x X座標
+   * @param y Y座標
+   * @return タイル、マップの外ならkSolid
+   */
+  Tile Get(int x, int y) const;
+
+  void Set(int x, int y, const Tile& tile);
+
+  /**
+   * @brief チャンクのタイルを周囲のエプロンも含めて取り出す
+   * @param chunk チャンクの座標
+   * @param tiles kChunkSizeWithApronの2乗個のタイルの出力
+   */
+  void CopyChunkTiles(const glm::ivec2& chunk, std::vector<Tile>& tiles) const;
+
+  std::vector<PointLight>& GetLights();
+  const std::vector<PointLight>& GetLights() const;
+
+ private:
+  int width_;
+  int height_;
+  std::vector<Tile> tiles_;
+  std::vector<PointLight> lights_;
+};
+
+/**
+ * @brief チャンクのタイル配列での添字を求める
+ * @param x エプロンを含めたチャンク内のX座標
+ * @param y エプロンを含めたチャンク内のY座標
+ * @return 添字
+ */
+inline std::size_t GetChunkTileIndex(int x, int y) {
+  return static_cast<std::size_t>(y) * kChunkSizeWithApron + x;
+}
+
+/**
+ * @brief ワールド座標からチャンクの座標を求める
+ * @param position ワールド座標
+ * @return チャンクの座標
+ */
+inline glm::ivec2 WorldToChunk(const glm::vec3& position) {
+  return glm::ivec2(glm::floor(glm::vec2(position.x, position.z) /
+                               (kTileWorldSize * kChunkSize)));
+}
+
+/**
+ * @brief マップをチャンク単位で読めるファイルに書き出す
+ * @param map 書き出すマップ
+ * @param path ファイルのパス
+ * @return 書き出せたかどうか
+ *
+ * 各チャンクはエプロン込みのタイルをランレングス圧縮したものと、
+ * そのチャンクに含まれる光源を持つ。
+ */
+bool SaveDungeonMap(const TileMap& map, const std::string& path);
+
+/**
+ * @brief SaveDungeonMapで書き出したファイルからチャンクを読む
+ *
+ * Openの後はReadChunkを複数スレッドから同時に呼んでよい。
+ */
+class DungeonMapFile {
+ public:
+  static constexpr std::uint32_t kMagic = 0x50414d44;  // "DMAP"
+  static constexpr std::uint32_t kVersion = 1;
+
+  /**
+   * @brief ファイルを開いてチャンクの目次を読む
+   * @param path ファイルのパス
+   * @return 読めたかどうか
+   */
+  bool Open(const std::string& path);
+
+  glm::ivec2 GetSizeInChunks() const;
+
+  /**
+   * @brief チャンクを読む
+   * @param chunk チャンクの座標
+   * @param tiles エプロン込みのタイルの出力
+   * @param lights チャンクに含まれる光源の出力
+   * @return 読めたかどうか
+   */
+  bool ReadChunk(const glm::ivec2& chunk, std::vector<Tile>& tiles,
+                 std::vector<PointLight>& lights) const;
+
+ private:
+  struct ChunkEntry {
+    std::uint64_t offset;
+    std::uint32_t run_count;
+    std::uint32_t light_count;
+  };
+
+  std::string path_;
+  glm::ivec2 size_in_chunks_{0};
+  std::vector<ChunkEntry> chunks_;
+};
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_DUNGEON_MAP_H_
@@ -0,0 +1,527 @@
+#include "ecs.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+
+#include "job_system.h"
+#include "sampling.h"
+
+namespace game {
+
+namespace {
+
+struct ComponentInfo {
+  std::size_t size;
+  std::size_t alignment;
+};
+
+// 登録済みの型の情報。登録は各型の最初の呼び出しで1回だけ行われ、
+// どのスレッドからも起こりうるので排他する。番号を得た後の読み出しは
+// 登録より後に起こるので排他しない
+std::mutex component_infos_mutex;
+std::array<ComponentInfo, kMaxComponentTypes> component_infos;
+std::size_t component_info_count = 0;
+
+std::size_t AlignUp(std::size_t value, std::size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// CommandBufferの仮のエンティティの世代
+constexpr std::uint32_t kPendingGeneration = 0xffffffffu;
+
+}  // namespace
+
+ComponentType RegisterComponentType(std::size_t size, std::size_t alignment) {
+  std::lock_guard<std::mutex> lock(component_infos_mutex);
+  if (component_info_count >= kMaxComponentTypes) {
+    std::cerr << "Can't register more than " << kMaxComponentTypes
+              << " component types" << std::endl;
+    std::abort();
+  }
+  component_infos[component_info_count] = {size, alignment};
+  return static_cast<ComponentType>(component_info_count++);
+}
+
+std::size_t GetComponentSize(ComponentType type) {
+  return component_infos[type].size;
+}
+
+ChunkView::ChunkView(const Archetype* archetype, std::size_t chunk_index,
+                     std::size_t query_chunk_index)
+    : archetype_(archetype),
+      chunk_index_(chunk_index),
+      query_chunk_index_(query_chunk_index) {}
+
+std::size_t ChunkView::GetCount() const {
+  return archetype_->GetChunkEntityCount(chunk_index_);
+}
+
+const Entity* ChunkView::GetEntities() const {
+  return archetype_->GetEntities(chunk_index_);
+}
+
+std::size_t ChunkView::GetIndex() const { return query_chunk_index_; }
+
+void* ChunkView::GetColumn(ComponentType type) const {
+  return archetype_->GetColumn(chunk_index_, type);
+}
+
+Archetype::Archetype(const ComponentMask& mask)
+    : mask_(mask),
+      column_offsets_(kMaxComponentTypes, 0),
+      column_sizes_(kMaxComponentTypes, 0),
+      entity_count_(0) {
+  std::size_t row_size = sizeof(Entity);
+  for (ComponentType type = 0; type < kMaxComponentTypes; ++type) {
+    if (mask_.test(type)) {
+      types_.push_back(type);
+      column_sizes_[type] = component_infos[type].size;
+      row_size += column_sizes_[type];
+    }
+  }
+
+  // エンティティの配列の後に型ごとの配列を並べ、アラインメントの詰め物で
+  // はみ出すなら1つ減らす
+  chunk_capacity_ = kChunkSize / row_size;
+  for (;; --chunk_capacity_) {
+    auto offset = sizeof(Entity) * chunk_capacity_;
+    for (const auto type : types_) {
+      offset = AlignUp(offset, component_infos[type].alignment);
+      column_offsets_[type] = offset;
+      offset += column_sizes_[type] * chunk_capacity_;
+    }
+    if (offset <= kChunkSize) {
+      break;
+    }
+  }
+}
+
+const ComponentMask& Archetype::GetMask() const { return mask_; }
+
+std::size_t Archetype::GetEntityCount() const { return entity_count_; }
+
+std::size_t Archetype::GetChunkCount() const { return chunks_.size(); }
+
+std::size_t Archetype::GetChunkCapacity() const { return chunk_capacity_; }
+
+std::size_t Archetype::GetChunkEntityCount(std::size_t chunk_index) const {
+  return std::min(chunk_capacity_,
+                  entity_count_ - chunk_index * chunk_capacity_);
+}
+
+std::byte* Archetype::GetColumn(std::size_t chunk_index,
+                                ComponentType type) const {
+  if (!mask_.test(type)) {
+    return nullptr;
+  }
+  return chunks_[chunk_index].get() + column_offsets_[type];
+}
+
+Entity* Archetype::GetEntities(std::size_t chunk_index) const {
+  return reinterpret_cast<Entity*>(chunks_[chunk_index].get());
+}
+
+std::uint32_t Archetype::PushBack(Entity entity) {
+  const auto row = entity_count_++;
+  if (row / chunk_capacity_ >= chunks_.size()) {
+    chunks_.emplace_back(new std::byte[kChunkSize]);
+  }
+  GetEntities(row / chunk_capacity_)[row % chunk_capacity_] = entity;
+  return static_cast<std::uint32_t>(row);
+}
+
+bool Archetype::SwapRemove(std::uint32_t row, Entity& moved) {
+  const auto last = static_cast<std::uint32_t>(--entity_count_);
+  const bool has_moved = row != last;
+  if (has_moved) {
+    auto& entity = GetEntities(row / chunk_capacity_)[row % chunk_capacity_];
+    entity = GetEntities(last / chunk_capacity_)[last % chunk_capacity_];
+    moved = entity;
+    for (const auto type : types_) {
+      std::memcpy(GetComponent(row, type), GetComponent(last, type),
+                  column_sizes_[type]);
+    }
+  }
+  // 空になったチャンクは解放する
+  if (chunks_.size() * chunk_capacity_ >= entity_count_ + chunk_capacity_) {
+    chunks_.pop_back();
+  }
+  return has_moved;
+}
+
+std::byte* Archetype::GetComponent(std::uint32_t row,
+                                   ComponentType type) const {
+  return GetColumn(row / chunk_capacity_, type) +
+         row % chunk_capacity_ * column_sizes_[type];
+}
+
+World::World() : entity_count_(0) {
+  // 0番は何も持たないエンティティのアーキタイプ
+  FindOrCreateArchetype(ComponentMask());
+}
+
+Entity World::Create() { return CreateWithMask(ComponentMask()); }
+
+Entity World::CreateWithMask(const ComponentMask& mask) {
+  Entity entity;
+  if (free_indices_.empty()) {
+    entity = {static_cast<std::uint32_t>(records_.size()), 0};
+    records_.push_back({0, 0, 0, false});
+  } else {
+    const auto index = free_indices_.back();
+    free_indices_.pop_back();
+    entity = {index, records_[index].generation};
+  }
+  const auto archetype_index = FindOrCreateArchetype(mask);
+  auto& record = records_[entity.index];
+  record.archetype = archetype_index;
+  record.row = archetypes_[archetype_index]->PushBack(entity);
+  record.alive = true;
+  ++entity_count_;
+  return entity;
+}
+
+void World::Destroy(Entity entity) {
+  if (!IsAlive(entity)) {
+    return;
+  }
+  auto& record = records_[entity.index];
+  RemoveRow(record.archetype, record.row);
+  record.alive = false;
+  ++record.generation;
+  free_indices_.push_back(entity.index);
+  --entity_count_;
+}
+
+bool World::IsAlive(Entity entity) const {
+  return entity.index < records_.size() &&
+         records_[entity.index].alive &&
+         records_[entity.index].generation == entity.generation;
+}
+
+void World::AddComponent(Entity entity, ComponentType type,
+                         const void* value) {
+  if (!IsAlive(entity)) {
+    return;
+  }
+  const auto& record = records_[entity.index];
+  auto mask = archetypes_[record.archetype]->GetMask();
+  if (!mask.test(type)) {
+    mask.set(type);
+    MoveEntity(entity, FindOrCreateArchetype(mask));
+  }
+  std::memcpy(GetComponent(entity, type), value, GetComponentSize(type));
+}
+
+void World::RemoveComponent(Entity entity, ComponentType type) {
+  if (!IsAlive(entity)) {
+    return;
+  }
+  auto mask = archetypes_[records_[entity.index].archetype]->GetMask();
+  if (mask.test(type)) {
+    mask.reset(type);
+    MoveEntity(entity, FindOrCreateArchetype(mask));
+  }
+}
+
+void* World::GetComponent(Entity entity, ComponentType type) const {
+  if (!IsAlive(entity)) {
+    return nullptr;
+  }
+  const auto& record = records_[entity.index];
+  const auto& archetype = *archetypes_[record.archetype];
+  if (!archetype.GetMask().test(type)) {
+    return nullptr;
+  }
+  return archetype.GetComponent(record.row, type);
+}
+
+std::size_t World::GetEntityCount() const { return entity_count_; }
+
+std::size_t World::GetArchetypeCount() const { return archetypes_.size(); }
+
+const Archetype& World::GetArchetype(std::size_t index) const {
+  return *archetypes_[index];
+}
+
+std::uint32_t World::FindOrCreateArchetype(const ComponentMask& mask) {
+  const auto found = archetype_lookup_.find(mask);
+  if (found != archetype_lookup_.end()) {
+    return found->second;
+  }
+  const auto index = static_cast<std::uint32_t>(archetypes_.size());
+  archetypes_.emplace_back(new Archetype(mask));
+  archetype_lookup_.emplace(mask, index);
+  return index;
+}
+
+void World::MoveEntity(Entity entity, std::uint32_t archetype_index) {
+  auto& record = records_[entity.index];
+  const auto& source = *archetypes_[record.archetype];
+  auto& destination = *archetypes_[archetype_index];
+  const auto row = destination.PushBack(entity);
+  for (const auto type : destination.types_) {
+    if (source.GetMask().test(type)) {
+      std::memcpy(destination.GetComponent(row, type),
+                  source.GetComponent(record.row, type),
+                  destination.column_sizes_[type]);
+    }
+  }
+  RemoveRow(record.archetype, record.row);
+  record.archetype = archetype_index;
+  record.row = row;
+}
+
+void World::RemoveRow(std::uint32_t archetype_index, std::uint32_t row) {
+  Entity moved;
+  if (archetypes_[archetype_index]->SwapRemove(row, moved)) {
+    records_[moved.index].row = row;
+  }
+}
+
+CommandBuffer::CommandBuffer() : pending_count_(0) {}
+
+Entity CommandBuffer::Create() {
+  const Entity entity = {pending_count_++, kPendingGeneration};
+  commands_.push_back({CommandKind::kCreate, 0, entity, 0});
+  return entity;
+}
+
+void CommandBuffer::Destroy(Entity entity) {
+  commands_.push_back({CommandKind::kDestroy, 0, entity, 0});
+}
+
+void CommandBuffer::AddComponent(Entity entity, ComponentType type,
+                                 const void* value) {
+  const auto offset = data_.size();
+  const auto size = GetComponentSize(type);
+  data_.resize(offset + size);
+  std::memcpy(data_.data() + offset, value, size);
+  commands_.push_back({CommandKind::kAdd, type, entity, offset});
+}
+
+void CommandBuffer::RemoveComponent(Entity entity, ComponentType type) {
+  commands_.push_back({CommandKind::kRemove, type, entity, 0});
+}
+
+bool CommandBuffer::IsEmpty() const { return commands_.empty(); }
+
+void CommandBuffer::Playback(World& world) {
+  // 仮のエンティティを作成したエンティティに置き換えながら適用する
+  std::vector<Entity> created;
+  created.reserve(pending_count_);
+  for (const auto& command : commands_) {
+    auto entity = command.entity;
+    if (command.kind != CommandKind::kCreate &&
+        entity.generation == kPendingGeneration) {
+      entity = created[entity.index];
+    }
+    switch (command.kind) {
+      case CommandKind::kCreate:
+        created.push_back(world.Create());
+        break;
+      case CommandKind::kDestroy:
+        world.Destroy(entity);
+        break;
+      case CommandKind::kAdd:
+        world.AddComponent(entity, command.type,
+                           data_.data() + command.data_offset);
+        break;
+      case CommandKind::kRemove:
+        world.RemoveComponent(entity, command.type);
+        break;
+    }
+  }
+  commands_.clear();
+  data_.clear();
+  pending_count_ = 0;
+}
+
+Query::Query(World& world, const ComponentMask& all,
+             const ComponentMask& none)
+    : world_(&world), all_(all), none_(none), checked_archetype_count_(0) {}
+
+std::size_t Query::GetEntityCount() {
+  Refresh();
+  std::size_t count = 0;
+  for (const auto index : archetypes_) {
+    count += world_->GetArchetype(index).GetEntityCount();
+  }
+  return count;
+}
+
+std::size_t Query::GetChunkCount() {
+  Refresh();
+  std::size_t count = 0;
+  for (const auto index : archetypes_) {
+    count += world_->GetArchetype(index).GetChunkCount();
+  }
+  return count;
+}
+
+void Query::ForEachChunk(const std::function<void(const ChunkView&)>& func) {
+  Refresh();
+  std::size_t query_chunk_index = 0;
+  for (const auto index : archetypes_) {
+    const auto& archetype = world_->GetArchetype(index);
+    for (std::size_t chunk = 0; chunk < archetype.GetChunkCount(); ++chunk) {
+      func(ChunkView(&archetype, chunk, query_chunk_index++));
+    }
+  }
+}
+
+void Query::ParallelForEachChunk(
+    JobSystem& job_system,
+    const std::function<void(const ChunkView&)>& func) {
+  std::vector<ChunkView> chunks;
+  ForEachChunk([&](const ChunkView& chunk) { chunks.push_back(chunk); });
+  job_system.ParallelFor(chunks.size(), 1,
+                         [&](std::size_t begin, std::size_t end) {
+                           for (auto i = begin; i < end; ++i) {
+                             func(chunks[i]);
+                           }
+                         });
+}
+
+void Query::Refresh() {
+  // アーキタイプは削除されないので、増えた分だけ調べればよい
+  const auto archetype_count = world_->GetArchetypeCount();
+  for (auto index = checked_archetype_count_; index < archetype_count;
+       ++index) {
+    const auto& mask = world_->GetArchetype(index).GetMask();
+    if ((mask & all_) == all_ && (mask & none_).none()) {
+      archetypes_.push_back(static_cast<std::uint32_t>(index));
+    }
+  }
+  checked_archetype_count_ = archetype_count;
+}
+
+namespace {
+
+constexpr float kBenchmarkDeltaTime = 1.0f / 60.0f;
+
+struct BenchmarkPosition {
+  glm::vec3 value;
+};
+
+struct BenchmarkVelocity {
+  glm::vec3 value;
+};
+
+struct BenchmarkHealth {
+  float value;
+};
+
+// 従来のゲームオブジェクトに相当する、個別に確保するオブジェクト
+struct BenchmarkObject {
+  glm::vec3 position;
+  glm::vec3 velocity;
+  float health;
+  // 更新に使わないメンバーもキャッシュラインを占める
+  char name[32];
+  glm::mat4 transform;
+};
+
+}  // namespace
+
+EcsBenchmark RunEcsBenchmark(std::size_t entity_count, int iteration_count,
+                             JobSystem& job_system) {
+  // 4体に1体は体力も持たせ、アーキタイプを2つにする
+  World world;
+  std::vector<Entity> entities(entity_count);
+  std::vector<std::unique_ptr<BenchmarkObject>> objects(entity_count);
+  Pcg32 random(entity_count);
+  for (std::size_t i = 0; i < entity_count; ++i) {
+    const glm::vec3 position(random.NextFloat(), random.NextFloat(),
+                             random.NextFloat());
+    const glm::vec3 velocity(random.NextFloat() - 0.5f,
+                             random.NextFloat() - 0.5f,
+                             random.NextFloat() - 0.5f);
+    if (i % 4 == 0) {
+      entities[i] = world.Create(BenchmarkPosition{position},
+                                 BenchmarkVelocity{velocity},
+                                 BenchmarkHealth{100.0f});
+    } else {
+      entities[i] = world.Create(BenchmarkPosition{position},
+                                 BenchmarkVelocity{velocity});
+    }
+    objects[i].reset(new BenchmarkObject());
+    objects[i]->position = position;
+    objects[i]->velocity = velocity;
+    objects[i]->health = 100.0f;
+  }
+
+  // ポインタの配列はたどる順を混ぜ、メモリ上の並びと一致しないようにする
+  std::vector<BenchmarkObject*> object_order(entity_count);
+  for (std::size_t i = 0; i < entity_count; ++i) {
+    object_order[i] = objects[i].get();
+  }
+  for (auto i = entity_count; i > 1; --i) {
+    std::swap(object_order[i - 1], object_order[random.NextUint() % i]);
+  }
+
+  Query query(world, MakeComponentMask<BenchmarkPosition, BenchmarkVelocity>());
+  const auto update = [](BenchmarkPosition& position,
+                         const BenchmarkVelocity& velocity) {
+    position.value += velocity.value * kBenchmarkDeltaTime;
+  };
+  const auto update_objects = [&]() {
+    for (auto* object : object_order) {
+      object->position += object->velocity * kBenchmarkDeltaTime;
+    }
+  };
+  const auto results_match = [&]() {
+    for (std::size_t i = 0; i < entity_count; ++i) {
+      if (world.Get<BenchmarkPosition>(entities[i])->value !=
+          objects[i]->position) {
+        return false;
+      }
+    }
+    return true;
+  };
+  using Clock = std::chrono::steady_clock;
+  const auto to_milliseconds = [&](Clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count() /
+           iteration_count;
+  };
+
+  // メモリの並びの違いだけを比べるため、どちらも1スレッドで回す
+  const auto ecs_start = Clock::now();
+  for (int i = 0; i < iteration_count; ++i) {
+    query.ForEach<BenchmarkPosition, BenchmarkVelocity>(update);
+  }
+  const auto pointer_start = Clock::now();
+  for (int i = 0; i < iteration_count; ++i) {
+    update_objects();
+  }
+  const auto pointer_end = Clock::now();
+
+  EcsBenchmark result;
+  result.entity_count = entity_count;
+  result.ecs_milliseconds = to_milliseconds(pointer_start - ecs_start);
+  result.pointer_milliseconds = to_milliseconds(pointer_end - pointer_start);
+  result.results_match = results_match();
+
+  // 並列の更新は別に測り、ポインタの側も同じ回数だけ進めてから比べる
+  const auto parallel_start = Clock::now();
+  for (int i = 0; i < iteration_count; ++i) {
+    query.ParallelForEach<BenchmarkPosition, BenchmarkVelocity>(job_system,
+                                                                update);
+  }
+  result.ecs_parallel_milliseconds =
+      to_milliseconds(Clock::now() - parallel_start);
+  for (int i = 0; i < iteration_count; ++i) {
+    update_objects();
+  }
+  result.results_match = result.results_match && results_match();
+  return result;
+}
+
+}  // namespace game
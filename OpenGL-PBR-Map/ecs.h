@@ -0,0 +1,425 @@
+#ifndef OPENGL_PBR_MAP_ECS_H_
+#define OPENGL_PBR_MAP_ECS_H_
+
+#include <bitset>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace game {
+
+class JobSystem;
+class World;
+
+using ComponentType = std::uint32_t;
+constexpr std::size_t kMaxComponentTypes = 64;
+using ComponentMask = std::bitset<kMaxComponentTypes>;
+
+/**
+ * @brief エンティティの識別子
+ *
+ * 削除された番号は再利用されるので、世代で古い識別子を見分ける。
+ */
+struct Entity {
+  std::uint32_t index;
+  std::uint32_t generation;
+
+  bool operator==(const Entity& other) const {
+    return index == other.index && generation == other.generation;
+  }
+  bool operator!=(const Entity& other) const { return !(*this == other); }
+};
+
+/**
+ * @brief コンポーネントの型を登録する
+ * @param size 型の大きさ
+ * @param alignment 型のアラインメント
+ * @return 型の番号
+ */
+ComponentType RegisterComponentType(std::size_t size, std::size_t alignment);
+
+std::size_t GetComponentSize(ComponentType type);
+
+/**
+ * @brief コンポーネントの型の番号を取得する
+ * @return 型の番号、初めて呼ばれたときに登録する
+ *
+ * チャンク間の移動はmemcpyで行うので、コンポーネントは
+ * トリビアルにコピーできる型に限る。
+ */
+template <typename T>
+ComponentType GetComponentType() {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "Component must be trivially copyable");
+  static_assert(alignof(T) <= alignof(std::max_align_t),
+                "Component alignment is too large");
+  static const ComponentType type =
+      RegisterComponentType(sizeof(T), alignof(T));
+  return type;
+}
+
+template <typename... Ts>
+ComponentMask MakeComponentMask() {
+  ComponentMask mask;
+  const ComponentType types[] = {GetComponentType<Ts>()..., 0};
+  for (std::size_t i = 0; i < sizeof...(Ts); ++i) {
+    mask.set(types[i]);
+  }
+  return mask;
+}
+
+class Archetype;
+
+/**
+ * @brief 1つのチャンクに並ぶエンティティとコンポーネントの配列
+ */
+class ChunkView {
+ public:
+  ChunkView(const Archetype* archetype, std::size_t chunk_index,
+            std::size_t query_chunk_index);
+
+  std::size_t GetCount() const;
+  const Entity* GetEntities() const;
+
+  /**
+   * @brief クエリが返すチャンクの中での通し番号を取得する
+   * @return 0からQuery::GetChunkCount() - 1までの番号
+   */
+  std::size_t GetIndex() const;
+
+  /**
+   * @brief コンポーネントの配列を取得する
+   * @return 配列の先頭、アーキタイプが持たない型ならnullptr
+   */
+  void* GetColumn(ComponentType type) const;
+
+  template <typename T>
+  T* Get() const {
+    return static_cast<T*>(GetColumn(GetComponentType<T>()));
+  }
+
+ private:
+  const Archetype* archetype_;
+  std::size_t chunk_index_;
+  std::size_t query_chunk_index_;
+};
+
+/**
+ * @brief 同じコンポーネントの組を持つエンティティの集まり
+ *
+ * エンティティは固定の大きさのチャンクに詰めて持ち、チャンクの中では
+ * コンポーネントごとの配列 (SoA) に並べる。削除では末尾のエンティティで
+ * 穴を埋めるので、最後のチャンク以外は常に満杯になる。
+ */
+class Archetype {
+ public:
+  // 1つのチャンクのバイト数
+  static constexpr std::size_t kChunkSize = 16 * 1024;
+
+  explicit Archetype(const ComponentMask& mask);
+
+  const ComponentMask& GetMask() const;
+  std::size_t GetEntityCount() const;
+  std::size_t GetChunkCount() const;
+  std::size_t GetChunkCapacity() const;
+  std::size_t GetChunkEntityCount(std::size_t chunk_index) const;
+
+  /**
+   * @brief コンポーネントの配列を取得する
+   * @param chunk_index チャンクの番号
+   * @param type コンポーネントの型
+   * @return 配列の先頭、持たない型ならnullptr
+   */
+  std::byte* GetColumn(std::size_t chunk_index, ComponentType type) const;
+
+  Entity* GetEntities(std::size_t chunk_index) const;
+
+ private:
+  friend class World;
+
+  std::uint32_t PushBack(Entity entity);
+  // rowを末尾のエンティティで埋める。移動したエンティティを返す
+  bool SwapRemove(std::uint32_t row, Entity& moved);
+  std::byte* GetComponent(std::uint32_t row, ComponentType type) const;
+
+  ComponentMask mask_;
+  std::vector<ComponentType> types_;
+  // 型の番号からチャンク内の配列の位置への対応
+  std::vector<std::size_t> column_offsets_;
+  std::vector<std::size_t> column_sizes_;
+  std::size_t chunk_capacity_;
+  std::vector<std::unique_ptr<std::byte[]>> chunks_;
+  std::size_t entity_count_;
+};
+
+/**
+ * @brief エンティティとコンポーネントを持つ
+ *
+ * 構造の変更 (作成、削除、コンポーネントの追加と削除) はエンティティを
+ * アーキタイプの間で移動させるので、クエリで反復している間はせず、
+ * CommandBufferに記録して後でまとめて適用する。
+ */
+class World {
+ public:
+  World();
+
+  /**
+   * @brief コンポーネントを持たないエンティティを作る
+   * @return エンティティ
+   */
+  Entity Create();
+
+  /**
+   * @brief コンポーネントを持つエンティティを作る
+   * @param components コンポーネントの値
+   * @return エンティティ
+   *
+   * 最初から目的のアーキタイプに置くので、Addを繰り返すより速い。
+   */
+  template <typename... Ts>
+  Entity Create(const Ts&... components) {
+    const auto entity = CreateWithMask(MakeComponentMask<Ts...>());
+    int expand[] = {
+        (*static_cast<Ts*>(GetComponent(entity, GetComponentType<Ts>())) =
+             components,
+         0)...,
+        0};
+    static_cast<void>(expand);
+    return entity;
+  }
+
+  /**
+   * @brief エンティティを削除する
+   * @param entity エンティティ、削除済みなら何もしない
+   */
+  void Destroy(Entity entity);
+
+  bool IsAlive(Entity entity) const;
+
+  /**
+   * @brief コンポーネントを追加する
+   * @param entity エンティティ
+   * @param type コンポーネントの型
+   * @param value 値、既に持っていれば上書きする
+   */
+  void AddComponent(Entity entity, ComponentType type, const void* value);
+
+  void RemoveComponent(Entity entity, ComponentType type);
+
+  /**
+   * @brief コンポーネントを取得する
+   * @return コンポーネント、持たないか削除済みならnullptr
+   */
+  void* GetComponent(Entity entity, ComponentType type) const;
+
+  template <typename T>
+  void Add(Entity entity, const T& value) {
+    AddComponent(entity, GetComponentType<T>(), &value);
+  }
+
+  template <typename T>
+  void Remove(Entity entity) {
+    RemoveComponent(entity, GetComponentType<T>());
+  }
+
+  template <typename T>
+  T* Get(Entity entity) const {
+    return static_cast<T*>(GetComponent(entity, GetComponentType<T>()));
+  }
+
+  template <typename T>
+  bool Has(Entity entity) const {
+    return Get<T>(entity) != nullptr;
+  }
+
+  std::size_t GetEntityCount() const;
+  std::size_t GetArchetypeCount() const;
+  const Archetype& GetArchetype(std::size_t index) const;
+
+ private:
+  struct EntityRecord {
+    std::uint32_t archetype;
+    std::uint32_t row;
+    std::uint32_t generation;
+    bool alive;
+  };
+
+  Entity CreateWithMask(const ComponentMask& mask);
+  std::uint32_t FindOrCreateArchetype(const ComponentMask& mask);
+  // エンティティを別のアーキタイプに移し、共通のコンポーネントを写す
+  void MoveEntity(Entity entity, std::uint32_t archetype_index);
+  void RemoveRow(std::uint32_t archetype_index, std::uint32_t row);
+
+  std::vector<std::unique_ptr<Archetype>> archetypes_;
+  std::unordered_map<ComponentMask, std::uint32_t> archetype_lookup_;
+  std::vector<EntityRecord> records_;
+  std::vector<std::uint32_t> free_indices_;
+  std::size_t entity_count_;
+};
+
+/**
+ * @brief 構造の変更を記録して後でWorldに適用する
+ *
+ * ジョブから使う場合はジョブ (チャンク) ごとに別のバッファに記録し、
+ * 決まった順にPlaybackすれば結果がスレッドの数に依らなくなる。
+ */
+class CommandBuffer {
+ public:
+  CommandBuffer();
+
+  /**
+   * @brief エンティティの作成を記録する
+   * @return 仮のエンティティ、このバッファのAddとDestroyにだけ使える
+   */
+  Entity Create();
+
+  void Destroy(Entity entity);
+
+  void AddComponent(Entity entity, ComponentType type, const void* value);
+  void RemoveComponent(Entity entity, ComponentType type);
+
+  template <typename T>
+  void Add(Entity entity, const T& value) {
+    AddComponent(entity, GetComponentType<T>(), &value);
+  }
+
+  template <typename T>
+  void Remove(Entity entity) {
+    RemoveComponent(entity, GetComponentType<T>());
+  }
+
+  bool IsEmpty() const;
+
+  /**
+   * @brief 記録した順に変更を適用してバッファを空にする
+   * @param world 適用先のWorld
+   */
+  void Playback(World& world);
+
+ private:
+  enum class CommandKind : std::uint8_t { kCreate, kDestroy, kAdd, kRemove };
+
+  struct Command {
+    CommandKind kind;
+    ComponentType type;
+    Entity entity;
+    std::size_t data_offset;
+  };
+
+  std::vector<Command> commands_;
+  std::vector<std::byte> data_;
+  std::uint32_t pending_count_;
+};
+
+/**
+ * @brief コンポーネントの組で絞り込んだチャンクの列
+ *
+ * 条件に合うアーキタイプの一覧を持ち、反復のたびに前回以降に
+ * 作られたアーキタイプだけを調べて追加する。
+ */
+class Query {
+ public:
+  /**
+   * @brief コンストラクタ
+   * @param world 対象のWorld
+   * @param all 全て持つべきコンポーネント
+   * @param none 1つも持ってはいけないコンポーネント
+   */
+  Query(World& world, const ComponentMask& all,
+        const ComponentMask& none = ComponentMask());
+
+  std::size_t GetEntityCount();
+  std::size_t GetChunkCount();
+
+  /**
+   * @brief 条件に合うチャンクを順に処理する
+   * @param func func(const ChunkView&)の形で呼び出される関数
+   */
+  void ForEachChunk(const std::function<void(const ChunkView&)>& func);
+
+  /**
+   * @brief 条件に合うチャンクを並列に処理する
+   * @param job_system 処理に使うジョブシステム
+   * @param func func(const ChunkView&)の形で呼び出される関数
+   *
+   * 同じチャンクが2つのジョブに渡ることはない。
+   */
+  void ParallelForEachChunk(
+      JobSystem& job_system,
+      const std::function<void(const ChunkView&)>& func);
+
+  /**
+   * @brief エンティティごとにコンポーネントの参照を渡して処理する
+   * @param func func(Ts&...)の形で呼び出される関数
+   */
+  template <typename... Ts, typename Function>
+  void ForEach(Function func) {
+    ForEachChunk([&](const ChunkView& chunk) {
+      ForEachInChunk<Ts...>(chunk, func);
+    });
+  }
+
+  template <typename... Ts, typename Function>
+  void ParallelForEach(JobSystem& job_system, Function func) {
+    ParallelForEachChunk(job_system, [&](const ChunkView& chunk) {
+      ForEachInChunk<Ts...>(chunk, func);
+    });
+  }
+
+ private:
+  template <typename... Ts, typename Function>
+  void ForEachInChunk(const ChunkView& chunk, Function& func) const {
+    assert((all_ & MakeComponentMask<Ts...>()) == MakeComponentMask<Ts...>());
+    const auto columns = std::make_tuple(chunk.Get<Ts>()...);
+    for (std::size_t i = 0; i < chunk.GetCount(); ++i) {
+      func(std::get<Ts*>(columns)[i]...);
+    }
+  }
+
+  void Refresh();
+
+  World* world_;
+  ComponentMask all_;
+  ComponentMask none_;
+  std::vector<std::uint32_t> archetypes_;
+  std::size_t checked_archetype_count_;
+};
+
+/**
+ * @brief ECSのベンチマークの結果
+ */
+struct EcsBenchmark {
+  std::size_t entity_count;
+  // 1スレッドでECSを更新した1回あたりの平均時間 (ミリ秒)
+  double ecs_milliseconds;
+  // 個別に確保したオブジェクトを1スレッドでポインタでたどる場合の時間
+  double pointer_milliseconds;
+  // ECSの更新をジョブシステムで並列に行った場合の時間。
+  // スレッド数の効果も含むので、上の2つとは別に比べる
+  double ecs_parallel_milliseconds;
+  // 両方の結果が一致したかどうか
+  bool results_match;
+};
+
+/**
+ * @brief 位置を速度で進める更新をECSとポインタの配列で比べる
+ * @param entity_count エンティティの数
+ * @param iteration_count 計測の繰り返し回数
+ * @param job_system ECSの並列の更新に使うジョブシステム
+ *
+ * メモリの並びの違いだけを比べるため、ecs_millisecondsと
+ * pointer_millisecondsはどちらも1スレッドで測る。
+ * @return 計測結果
+ */
+EcsBenchmark RunEcsBenchmark(std::size_t entity_count, int iteration_count,
+                             JobSystem& job_system);
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_ECS_H_
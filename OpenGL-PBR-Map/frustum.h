@@ -0,0 +1,76 @@
+#ifndef OPENGL_PBR_MAP_FRUSTUM_H_
+#define OPENGL_PBR_MAP_FRUSTUM_H_
+
+#include <glm/glm.hpp>
+
+#include <array>
+
+#include "aabb.h"
+
+namespace game {
+
+/**
+ * @brief 視錐台
+ *
+ * 各平面はdot(plane.xyz, p) + plane.w >= 0が内側で、xyzは正規化してある。
+ * 順番は左、右、下、上、近、遠。
+ */
+struct Frustum {
+  std::array<glm::vec4, 6> planes;
+
+  /**
+   * @brief ビュー射影行列から視錐台を作る
+   * @param view_projection ビュー射影行列 (クリップ空間のzは[-w, w])
+   * @return ワールド空間の視錐台
+   */
+  static Frustum FromMatrix(const glm::mat4& view_projection) {
+    // 行列の行同士の和と差が各平面になる
+    const auto m = glm::transpose(view_projection);
+    Frustum frustum;
+    frustum.planes = {m[3] + m[0], m[3] - m[0], m[3] + m[1],
+                      m[3] - m[1], m[3] + m[2], m[3] - m[2]};
+    for (auto& plane : frustum.planes) {
+      plane /= glm::length(glm::vec3(plane));
+    }
+    return frustum;
+  }
+
+  /**
+   * @brief バウンディングボックスが視錐台と重なる可能性があるか
+   * @param bounds バウンディングボックス
+   * @return 完全に外側でなければtrue
+   *
+   * 平面ごとに法線方向に最も遠い頂点だけを調べる保守的な判定。
+   */
+  bool Intersects(const AABB& bounds) const {
+    for (const auto& plane : planes) {
+      const glm::vec3 normal(plane);
+      const auto farthest = glm::mix(bounds.min, bounds.max,
+                                     glm::greaterThanEqual(normal,
+                                                           glm::vec3(0.0f)));
+      if (glm::dot(normal, farthest) + plane.w < 0.0f) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * @brief 球が視錐台と重なる可能性があるか
+   * @param center 中心
+   * @param radius 半径
+   * @return 完全に外側でなければtrue
+   */
+  bool Intersects(const glm::vec3& center, float radius) const {
+    for (const auto& plane : planes) {
+      if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_FRUSTUM_H_
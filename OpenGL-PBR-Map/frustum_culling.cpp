@@ -0,0 +1,284 @@
+#include "frustum_culling.h"
+
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "job_system.h"
+#include "sampling.h"
+#include "simd.h"
+
+namespace game {
+
+namespace {
+
+// 1つのジョブで判定する箱の数 (8の倍数)
+constexpr std::size_t kCullingGrainSize = 4096;
+
+// [begin, end)の箱を判定して見えるものの番号を追加する
+void CullRange(const InstanceBounds& bounds, const Frustum& frustum,
+               std::size_t begin, std::size_t end,
+               std::vector<std::uint32_t>& visible) {
+  const float* cx = bounds.GetCenters(0);
+  const float* cy = bounds.GetCenters(1);
+  const float* cz = bounds.GetCenters(2);
+  const float* ex = bounds.GetExtents(0);
+  const float* ey = bounds.GetExtents(1);
+  const float* ez = bounds.GetExtents(2);
+  auto i = begin;
+
+#if defined(GAME_SIMD_AVX2)
+  __m256 normals[6][3];
+  __m256 abs_normals[6][3];
+  __m256 distances[6];
+  for (int p = 0; p < 6; ++p) {
+    for (int axis = 0; axis < 3; ++axis) {
+      normals[p][axis] = _mm256_set1_ps(frustum.planes[p][axis]);
+      abs_normals[p][axis] =
+          _mm256_set1_ps(std::abs(frustum.planes[p][axis]));
+    }
+    distances[p] = _mm256_set1_ps(frustum.planes[p].w);
+  }
+  const __m256 zero = _mm256_setzero_ps();
+  for (; i + 8 <= end; i += 8) {
+    const __m256 x = _mm256_loadu_ps(cx + i);
+    const __m256 y = _mm256_loadu_ps(cy + i);
+    const __m256 z = _mm256_loadu_ps(cz + i);
+    const __m256 hx = _mm256_loadu_ps(ex + i);
+    const __m256 hy = _mm256_loadu_ps(ey + i);
+    const __m256 hz = _mm256_loadu_ps(ez + i);
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (int p = 0; p < 6; ++p) {
+      const __m256 distance = _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(normals[p][0], x),
+                        _mm256_mul_ps(normals[p][1], y)),
+          _mm256_add_ps(_mm256_mul_ps(normals[p][2], z), distances[p]));
+      const __m256 radius = _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(abs_normals[p][0], hx),
+                        _mm256_mul_ps(abs_normals[p][1], hy)),
+          _mm256_mul_ps(abs_normals[p][2], hz));
+      inside = _mm256_and_ps(
+          inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), zero,
+                                _CMP_GE_OQ));
+    }
+    const int mask = _mm256_movemask_ps(inside);
+    for (int lane = 0; mask != 0 && lane < 8; ++lane) {
+      if (mask & (1 << lane)) {
+        visible.push_back(static_cast<std::uint32_t>(i + lane));
+      }
+    }
+  }
+#elif defined(GAME_SIMD_SSE2)
+  __m128 normals[6][3];
+  __m128 abs_normals[6][3];
+  __m128 distances[6];
+  for (int p = 0; p < 6; ++p) {
+    for (int axis = 0; axis < 3; ++axis) {
+      normals[p][axis] = _mm_set1_ps(frustum.planes[p][axis]);
+      abs_normals[p][axis] = _mm_set1_ps(std::abs(frustum.planes[p][axis]));
+    }
+    distances[p] = _mm_set1_ps(frustum.planes[p].w);
+  }
+  const __m128 zero = _mm_setzero_ps();
+  for (; i + 4 <= end; i += 4) {
+    const __m128 x = _mm_loadu_ps(cx + i);
+    const __m128 y = _mm_loadu_ps(cy + i);
+    const __m128 z = _mm_loadu_ps(cz + i);
+    const __m128 hx = _mm_loadu_ps(ex + i);
+    const __m128 hy = _mm_loadu_ps(ey + i);
+    const __m128 hz = _mm_loadu_ps(ez + i);
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (int p = 0; p < 6; ++p) {
+      const __m128 distance = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(normals[p][0], x),
+                     _mm_mul_ps(normals[p][1], y)),
+          _mm_add_ps(_mm_mul_ps(normals[p][2], z), distances[p]));
+      const __m128 radius = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(abs_normals[p][0], hx),
+                     _mm_mul_ps(abs_normals[p][1], hy)),
+          _mm_mul_ps(abs_normals[p][2], hz));
+      inside = _mm_and_ps(
+          inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+    }
+    const int mask = _mm_movemask_ps(inside);
+    for (int lane = 0; mask != 0 && lane < 4; ++lane) {
+      if (mask & (1 << lane)) {
+        visible.push_back(static_cast<std::uint32_t>(i + lane));
+      }
+    }
+  }
+#endif
+
+  for (; i < end; ++i) {
+    bool inside = true;
+    for (const auto& plane : frustum.planes) {
+      const float distance =
+          plane.x * cx[i] + plane.y * cy[i] + plane.z * cz[i] + plane.w;
+      const float radius = std::abs(plane.x) * ex[i] +
+                           std::abs(plane.y) * ey[i] +
+                           std::abs(plane.z) * ez[i];
+      inside = inside && distance + radius >= 0.0f;
+    }
+    if (inside) {
+      visible.push_back(static_cast<std::uint32_t>(i));
+    }
+  }
+}
+
+}  // namespace
+
+std::uint32_t InstanceBounds::Add(const AABB& bounds) {
+  const auto index = static_cast<std::uint32_t>(GetCount());
+  for (int axis = 0; axis < 3; ++axis) {
+    centers_[axis].push_back(0.0f);
+    extents_[axis].push_back(0.0f);
+  }
+  Set(index, bounds);
+  return index;
+}
+
+void InstanceBounds::Set(std::uint32_t index, const AABB& bounds) {
+  const auto center = bounds.GetCenter();
+  const auto extent = bounds.GetSize() * 0.5f;
+  for (int axis = 0; axis < 3; ++axis) {
+    centers_[axis][index] = center[axis];
+    extents_[axis][index] = extent[axis];
+  }
+}
+
+void InstanceBounds::Clear() {
+  for (int axis = 0; axis < 3; ++axis) {
+    centers_[axis].clear();
+    extents_[axis].clear();
+  }
+}
+
+std::size_t InstanceBounds::GetCount() const { return centers_[0].size(); }
+
+const float* InstanceBounds::GetCenters(int axis) const {
+  return centers_[axis].data();
+}
+
+const float* InstanceBounds::GetExtents(int axis) const {
+  return extents_[axis].data();
+}
+
+void CullInstances(const InstanceBounds& bounds, const Frustum& frustum,
+                   std::vector<std::uint32_t>& visible,
+                   JobSystem& job_system) {
+  visible.clear();
+  const auto count = bounds.GetCount();
+  if (count <= kCullingGrainSize) {
+    CullRange(bounds, frustum, 0, count, visible);
+    return;
+  }
+
+  // ジョブごとに別の配列に書いてから順番につなげる
+  std::vector<std::vector<std::uint32_t>> partials(
+      (count + kCullingGrainSize - 1) / kCullingGrainSize);
+  job_system.ParallelFor(
+      count, kCullingGrainSize, [&](std::size_t begin, std::size_t end) {
+        for (auto chunk_begin = begin; chunk_begin < end;
+             chunk_begin += kCullingGrainSize) {
+          auto& partial = partials[chunk_begin / kCullingGrainSize];
+          partial.clear();
+          CullRange(bounds, frustum, chunk_begin,
+                    std::min(chunk_begin + kCullingGrainSize, end), partial);
+        }
+      });
+  std::size_t visible_count = 0;
+  for (const auto& partial : partials) {
+    visible_count += partial.size();
+  }
+  visible.reserve(visible_count);
+  for (const auto& partial : partials) {
+    visible.insert(visible.end(), partial.begin(), partial.end());
+  }
+}
+
+void CullInstancesNaive(const InstanceBounds& bounds, const Frustum& frustum,
+                        std::vector<std::uint32_t>& visible) {
+  visible.clear();
+  for (std::size_t i = 0; i < bounds.GetCount(); ++i) {
+    const glm::vec3 center(bounds.GetCenters(0)[i], bounds.GetCenters(1)[i],
+                           bounds.GetCenters(2)[i]);
+    const glm::vec3 extent(bounds.GetExtents(0)[i], bounds.GetExtents(1)[i],
+                           bounds.GetExtents(2)[i]);
+    bool inside = true;
+    for (const auto& plane : frustum.planes) {
+      const glm::vec3 normal(plane);
+      if (glm::dot(normal, center) + plane.w +
+              glm::dot(glm::abs(normal), extent) <
+          0.0f) {
+        inside = false;
+        break;
+      }
+    }
+    if (inside) {
+      visible.push_back(static_cast<std::uint32_t>(i));
+    }
+  }
+}
+
+FrustumCullingBenchmark RunFrustumCullingBenchmark(std::size_t instance_count,
+                                                   int iteration_count,
+                                                   JobSystem& job_system) {
+  // 1km四方にランダムに箱を置き、中央から見る
+  InstanceBounds bounds;
+  Pcg32 random(instance_count);
+  for (std::size_t i = 0; i < instance_count; ++i) {
+    const auto center =
+        glm::vec3(random.NextFloat(), random.NextFloat() * 0.05f,
+                  random.NextFloat()) *
+        1000.0f;
+    const auto extent = glm::vec3(0.5f + random.NextFloat() * 2.0f);
+    bounds.Add(AABB(center - extent, center + extent));
+  }
+  const auto projection =
+      glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 500.0f);
+  const auto view = glm::lookAt(glm::vec3(500.0f, 20.0f, 500.0f),
+                                glm::vec3(800.0f, 0.0f, 700.0f),
+                                glm::vec3(0.0f, 1.0f, 0.0f));
+  const auto frustum = Frustum::FromMatrix(projection * view);
+
+  using Clock = std::chrono::steady_clock;
+  const auto to_milliseconds = [&](Clock::time_point start,
+                                   Clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - start).count() /
+           iteration_count;
+  };
+  std::vector<std::uint32_t> naive_visible;
+  std::vector<std::uint32_t> simd_visible;
+  std::vector<std::uint32_t> parallel_visible;
+  const auto naive_start = Clock::now();
+  for (int i = 0; i < iteration_count; ++i) {
+    CullInstancesNaive(bounds, frustum, naive_visible);
+  }
+  // SIMDの効果だけを比べるため、全範囲を1スレッドで判定する
+  const auto simd_start = Clock::now();
+  for (int i = 0; i < iteration_count; ++i) {
+    simd_visible.clear();
+    CullRange(bounds, frustum, 0, instance_count, simd_visible);
+  }
+  const auto parallel_start = Clock::now();
+  for (int i = 0; i < iteration_count; ++i) {
+    CullInstances(bounds, frustum, parallel_visible, job_system);
+  }
+  const auto parallel_end = Clock::now();
+
+  FrustumCullingBenchmark result;
+  result.instance_count = instance_count;
+  result.visible_count = simd_visible.size();
+  result.naive_milliseconds = to_milliseconds(naive_start, simd_start);
+  result.simd_milliseconds = to_milliseconds(simd_start, parallel_start);
+  result.simd_parallel_milliseconds =
+      to_milliseconds(parallel_start, parallel_end);
+  result.results_match =
+      naive_visible == simd_visible && naive_visible == parallel_visible;
+  return result;
+}
+
+}  // namespace game
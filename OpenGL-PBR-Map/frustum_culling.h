@@ -0,0 +1,102 @@
+#ifndef OPENGL_PBR_MAP_FRUSTUM_CULLING_H_
+#define OPENGL_PBR_MAP_FRUSTUM_CULLING_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "aabb.h"
+#include "frustum.h"
+
+namespace game {
+
+class JobSystem;
+
+/**
+ * @brief インスタンスのバウンディングボックスを成分ごとの配列で持つ
+ *
+ * 中心と半分の大きさをX, Y, Zの別々の配列に並べ、SIMDで連続する
+ * 4個または8個の箱をまとめて読めるようにする。
+ */
+class InstanceBounds {
+ public:
+  /**
+   * @brief 箱を追加する
+   * @param bounds バウンディングボックス
+   * @return 追加した箱の番号
+   */
+  std::uint32_t Add(const AABB& bounds);
+
+  /**
+   * @brief 箱を更新する
+   * @param index 箱の番号
+   * @param bounds バウンディングボックス
+   */
+  void Set(std::uint32_t index, const AABB& bounds);
+
+  void Clear();
+
+  std::size_t GetCount() const;
+
+  const float* GetCenters(int axis) const;
+  const float* GetExtents(int axis) const;
+
+ private:
+  std::vector<float> centers_[3];
+  std::vector<float> extents_[3];
+};
+
+/**
+ * @brief 視錐台と重なる箱の番号を集める
+ * @param bounds インスタンスのバウンディングボックス
+ * @param frustum 視錐台
+ * @param visible 見える箱の番号の出力 (番号の昇順)
+ * @param job_system 判定に使うジョブシステム
+ *
+ * 箱の中心の平面からの距離に、箱の半分の大きさを平面の法線に射影した
+ * 長さを足して負なら外側とする。AVX2なら8個、SSE2なら4個ずつ判定する。
+ */
+void CullInstances(const InstanceBounds& bounds, const Frustum& frustum,
+                   std::vector<std::uint32_t>& visible, JobSystem& job_system);
+
+/**
+ * @brief 1個ずつglm::dotで判定する比較用のカリング
+ * @param bounds インスタンスのバウンディングボックス
+ * @param frustum 視錐台
+ * @param visible 見える箱の番号の出力 (番号の昇順)
+ */
+void CullInstancesNaive(const InstanceBounds& bounds, const Frustum& frustum,
+                        std::vector<std::uint32_t>& visible);
+
+/**
+ * @brief 視錐台カリングのベンチマークの結果
+ */
+struct FrustumCullingBenchmark {
+  std::size_t instance_count;
+  std::size_t visible_count;
+  // 1スレッドで判定した1回あたりの平均時間 (ミリ秒)
+  double naive_milliseconds;
+  double simd_milliseconds;
+  // CullInstancesでジョブシステムを使って判定した場合の時間。
+  // スレッド数の効果も含むので、上の2つとは別に比べる
+  double simd_parallel_milliseconds;
+  // すべての結果が一致したかどうか
+  bool results_match;
+};
+
+/**
+ * @brief ランダムに置いた箱でCullInstancesとCullInstancesNaiveを比べる
+ * @param instance_count 箱の数
+ * @param iteration_count 計測の繰り返し回数
+ * @param job_system CullInstancesの並列の判定に使うジョブシステム
+ * @return 計測結果
+ *
+ * SIMDの効果だけを比べるため、naive_millisecondsと
+ * simd_millisecondsはどちらも1スレッドで測る。
+ */
+FrustumCullingBenchmark RunFrustumCullingBenchmark(std::size_t instance_count,
+                                                   int iteration_count,
+                                                   JobSystem& job_system);
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_FRUSTUM_CULLING_H_
@@ -0,0 +1,154 @@
+#include "gl_state_cache.h"
+
+#include <algorithm>
+#include <string>
+
+#include "gpu_profiler.h"
+
+namespace game {
+
+namespace {
+
+const char* const kCallNames[] = {"program", "vertex array", "texture",
+                                  "blend", "depth"};
+
+}  // namespace
+
+GlStateCache& GlStateCache::GetInstance() {
+  static GlStateCache instance;
+  return instance;
+}
+
+GlStateCache::GlStateCache() {
+  Invalidate();
+  counts_.fill({});
+  frame_counts_.fill({});
+}
+
+void GlStateCache::UseProgram(GLuint program) {
+  if (Update(GlStateCall::kProgram, program_, program)) {
+    glUseProgram(program);
+  }
+}
+
+void GlStateCache::BindVertexArray(GLuint vertex_array) {
+  if (Update(GlStateCall::kVertexArray, vertex_array_, vertex_array)) {
+    glBindVertexArray(vertex_array);
+  }
+}
+
+void GlStateCache::BindTextureUnit(GLuint unit, GLuint texture) {
+  if (unit >= kTextureUnitCount) {
+    ++counts_[static_cast<int>(GlStateCall::kTexture)].issued;
+    glBindTextureUnit(unit, texture);
+    return;
+  }
+  if (Update(GlStateCall::kTexture, textures_[unit], texture)) {
+    glBindTextureUnit(unit, texture);
+  }
+}
+
+void GlStateCache::DeleteTextures(GLsizei count, const GLuint* textures) {
+  // 削除したテクスチャを束ねていたユニットは0に戻る
+  for (auto& bound : textures_) {
+    if (std::find(textures, textures + count, bound) != textures + count) {
+      bound = 0;
+    }
+  }
+  glDeleteTextures(count, textures);
+}
+
+void GlStateCache::SetBlend(bool enabled) {
+  if (Update(GlStateCall::kBlend, blend_, enabled ? 1 : 0)) {
+    if (enabled) {
+      glEnable(GL_BLEND);
+    } else {
+      glDisable(GL_BLEND);
+    }
+  }
+}
+
+void GlStateCache::BlendFunc(GLenum source_factor,
+                             GLenum destination_factor) {
+  auto& count = counts_[static_cast<int>(GlStateCall::kBlend)];
+  if (blend_source_factor_ == source_factor &&
+      blend_destination_factor_ == destination_factor) {
+    ++count.elided;
+    return;
+  }
+  ++count.issued;
+  blend_source_factor_ = source_factor;
+  blend_destination_factor_ = destination_factor;
+  glBlendFunc(source_factor, destination_factor);
+}
+
+void GlStateCache::SetDepthTest(bool enabled) {
+  if (Update(GlStateCall::kDepth, depth_test_, enabled ? 1 : 0)) {
+    if (enabled) {
+      glEnable(GL_DEPTH_TEST);
+    } else {
+      glDisable(GL_DEPTH_TEST);
+    }
+  }
+}
+
+void GlStateCache::SetDepthMask(bool enabled) {
+  if (Update(GlStateCall::kDepth, depth_mask_, enabled ? 1 : 0)) {
+    glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+  }
+}
+
+void GlStateCache::DepthFunc(GLenum func) {
+  if (Update(GlStateCall::kDepth, depth_func_, func)) {
+    glDepthFunc(func);
+  }
+}
+
+void GlStateCache::Invalidate() {
+  program_ = kUnknown;
+  vertex_array_ = kUnknown;
+  textures_.fill(kUnknown);
+  blend_ = kUnknown;
+  blend_source_factor_ = kUnknown;
+  blend_destination_factor_ = kUnknown;
+  depth_test_ = kUnknown;
+  depth_mask_ = kUnknown;
+  depth_func_ = kUnknown;
+}
+
+void GlStateCache::EndFrame(GpuProfiler* profiler) {
+  frame_counts_ = counts_;
+  counts_.fill({});
+  if (profiler == nullptr) {
+    return;
+  }
+  std::uint64_t issued = 0;
+  std::uint64_t elided = 0;
+  for (int i = 0; i < kCallCount; ++i) {
+    const auto& count = frame_counts_[i];
+    const auto prefix = std::string("GL ") + kCallNames[i];
+    profiler->SetCounter(prefix + " issued", count.issued);
+    profiler->SetCounter(prefix + " elided", count.elided);
+    issued += count.issued;
+    elided += count.elided;
+  }
+  profiler->SetCounter("GL state issued", issued);
+  profiler->SetCounter("GL state elided", elided);
+}
+
+GlStateCallCount GlStateCache::GetFrameCount(GlStateCall call) const {
+  return frame_counts_[static_cast<int>(call)];
+}
+
+bool GlStateCache::Update(GlStateCall call, GLuint& current, GLuint value) {
+  auto& count = counts_[static_cast<int>(call)];
+  if (current == value) {
+    ++count.elided;
+    return false;
+  }
+  ++count.issued;
+  current = value;
+  return true;
+}
+
+}  // namespace game
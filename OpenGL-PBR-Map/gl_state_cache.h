@@ -0,0 +1,122 @@
+#ifndef OPENGL_PBR_MAP_GL_STATE_CACHE_H_
+#define OPENGL_PBR_MAP_GL_STATE_CACHE_H_
+
+#include <GL/glew.h>
+
+#include <array>
+#include <cstdint>
+
+namespace game {
+
+class GpuProfiler;
+
+/**
+ * @brief GlStateCacheが数える呼び出しの種類
+ */
+enum class GlStateCall {
+  kProgram,
+  kVertexArray,
+  kTexture,
+  kBlend,
+  kDepth,
+  kCount,
+};
+
+/**
+ * @brief 1種類の呼び出しを発行した回数と省いた回数
+ */
+struct GlStateCallCount {
+  std::uint32_t issued = 0;
+  std::uint32_t elided = 0;
+};
+
+/**
+ * @brief OpenGLの状態の写しを持ち、値の変わらない呼び出しを省く
+ *
+ * シェーダー、頂点配列、テクスチャユニット、ブレンドと深度の状態を
+ * 変える呼び出しはこのクラスを通す。写しは最初は不明で、最初の呼び出しは
+ * 必ず発行する。このクラスを通さずに状態を変えたときはInvalidateを呼ぶ。
+ *
+ * 削除したテクスチャの名前は再利用されるので、テクスチャの削除は
+ * DeleteTexturesを通し、その名前を束ねていたユニットの写しを忘れる。
+ * メインスレッドからだけ呼ぶ。
+ */
+class GlStateCache {
+ public:
+  // 写しを持つテクスチャユニットの数。これ以降のユニットは常に発行する
+  static constexpr GLuint kTextureUnitCount = 16;
+
+  /**
+   * @brief プロセス全体で共有するGlStateCacheを取得する
+   */
+  static GlStateCache& GetInstance();
+
+  GlStateCache();
+
+  GlStateCache(const GlStateCache&) = delete;
+  GlStateCache& operator=(const GlStateCache&) = delete;
+
+  void UseProgram(GLuint program);
+  void BindVertexArray(GLuint vertex_array);
+  void BindTextureUnit(GLuint unit, GLuint texture);
+
+  /**
+   * @brief テクスチャを削除し、束ねていたユニットを空として扱う
+   * @param count テクスチャの数
+   * @param textures テクスチャ
+   */
+  void DeleteTextures(GLsizei count, const GLuint* textures);
+
+  void SetBlend(bool enabled);
+  void BlendFunc(GLenum source_factor, GLenum destination_factor);
+  void SetDepthTest(bool enabled);
+  void SetDepthMask(bool enabled);
+  void DepthFunc(GLenum func);
+
+  /**
+   * @brief 写しをすべて不明に戻す
+   */
+  void Invalidate();
+
+  /**
+   * @brief このフレームの回数をGpuProfilerのカウンターに記録し、0に戻す
+   * @param profiler 記録先、nullptrなら記録せずに0に戻す
+   *
+   * カウンターは"GL <種類> issued"と"GL <種類> elided"、
+   * 全種類の合計の"GL state issued"と"GL state elided"。
+   */
+  void EndFrame(GpuProfiler* profiler);
+
+  /**
+   * @brief 最後に終えたフレームの回数を取得する
+   * @param call 種類
+   * @return 発行した回数と省いた回数
+   */
+  GlStateCallCount GetFrameCount(GlStateCall call) const;
+
+ private:
+  static constexpr int kCallCount = static_cast<int>(GlStateCall::kCount);
+  // 写しの値が不明であることを表す。どの名前や列挙値とも重ならない
+  static constexpr GLuint kUnknown = 0xffffffffu;
+
+  // 値が変わるならtrueを返して写しを更新し、回数を数える
+  bool Update(GlStateCall call, GLuint& current, GLuint value);
+
+  GLuint program_;
+  GLuint vertex_array_;
+  std::array<GLuint, kTextureUnitCount> textures_;
+  // 有効かどうかの状態は0か1
+  GLuint blend_;
+  GLuint blend_source_factor_;
+  GLuint blend_destination_factor_;
+  GLuint depth_test_;
+  GLuint depth_mask_;
+  GLuint depth_func_;
+
+  std::array<GlStateCallCount, kCallCount> counts_;
+  std::array<GlStateCallCount, kCallCount> frame_counts_;
+};
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_GL_STATE_CACHE_H_
@@ -0,0 +1,96 @@
+#include "gpu_profiler.h"
+
+#include <algorithm>
+
+namespace game {
+
+GpuProfiler::GpuProfiler() : frame_index_(0), scope_open_(false) {
+  for (auto& frame : frames_) {
+    frame.queries.fill(0);
+  }
+}
+
+GpuProfiler::~GpuProfiler() {
+  for (auto& frame : frames_) {
+    if (frame.queries[0] != 0) {
+      glDeleteQueries(static_cast<GLsizei>(frame.queries.size()),
+                      frame.queries.data());
+    }
+  }
+}
+
+void GpuProfiler::BeginFrame() {
+  frame_index_ = (frame_index_ + 1) % kFrameCount;
+  auto& frame = frames_[frame_index_];
+  if (frame.queries[0] == 0) {
+    glCreateQueries(GL_TIMESTAMP, static_cast<GLsizei>(frame.queries.size()),
+                    frame.queries.data());
+  }
+  if (frame.names.empty()) {
+    return;
+  }
+
+  // 最後のクエリの結果が出ていれば、それより前のものも出ている
+  const auto last = frame.queries[frame.names.size() * 2 - 1];
+  GLuint available = GL_FALSE;
+  glGetQueryObjectuiv(last, GL_QUERY_RESULT_AVAILABLE, &available);
+  if (available == GL_TRUE) {
+    timings_.clear();
+    for (std::size_t i = 0; i < frame.names.size(); ++i) {
+      GLuint64 begin;
+      GLuint64 end;
+      glGetQueryObjectui64v(frame.queries[i * 2], GL_QUERY_RESULT, &begin);
+      glGetQueryObjectui64v(frame.queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+      timings_.push_back({frame.names[i], (end - begin) * 1.0e-6});
+    }
+  }
+  frame.names.clear();
+}
+
+void GpuProfiler::Begin(const std::string& name) {
+  auto& frame = frames_[frame_index_];
+  if (frame.queries[0] == 0 || frame.names.size() >= kMaxScopeCount) {
+    return;
+  }
+  glQueryCounter(frame.queries[frame.names.size() * 2], GL_TIMESTAMP);
+  frame.names.push_back(name);
+  scope_open_ = true;
+}
+
+void GpuProfiler::End() {
+  if (!scope_open_) {
+    return;
+  }
+  auto& frame = frames_[frame_index_];
+  glQueryCounter(frame.queries[frame.names.size() * 2 - 1], GL_TIMESTAMP);
+  scope_open_ = false;
+}
+
+const std::vector<GpuTiming>& GpuProfiler::GetTimings() const {
+  return timings_;
+}
+
+double GpuProfiler::GetTotalMilliseconds() const {
+  double total = 0.0;
+  for (const auto& timing : timings_) {
+    total += timing.milliseconds;
+  }
+  return total;
+}
+
+void GpuProfiler::SetCounter(const std::string& name, std::uint64_t value) {
+  const auto it = std::find_if(
+      counters_.begin(), counters_.end(),
+      [&](const ProfilerCounter& counter) { return counter.name == name; });
+  if (it != counters_.end()) {
+    it->value = value;
+  } else {
+    counters_.push_back({name, value});
+  }
+}
+
+const std::vector<ProfilerCounter>& GpuProfiler::GetCounters() const {
+  return counters_;
+}
+
+}  // namespace game
@@ -0,0 +1,133 @@
+#ifndef OPENGL_PBR_MAP_GPU_PROFILER_H_
+#define OPENGL_PBR_MAP_GPU_PROFILER_H_
+
+#include <GL/glew.h>
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace game {
+
+/**
+ * @brief 1つの区間のGPUでの時間
+ */
+struct GpuTiming {
+  std::string name;
+  double milliseconds;
+};
+
+/**
+ * @brief フレームごとの回数などのCPU側の値
+ */
+struct ProfilerCounter {
+  std::string name;
+  std::uint64_t value;
+};
+
+/**
+ * @brief タイムスタンプクエリで区間ごとのGPUの時間を測る
+ *
+ * 結果はkFrameCountフレーム後に、そのフレームの領域を使い回すときに
+ * 読む。その時点でまだ結果が出ていなければ待たずに捨てる。
+ * 時間と並べて見たいCPU側の値はSetCounterで記録する。
+ */
+class GpuProfiler {
+ public:
+  static constexpr int kFrameCount = 3;
+  // 1フレームで測れる区間の数
+  static constexpr int kMaxScopeCount = 32;
+
+  GpuProfiler();
+  ~GpuProfiler();
+
+  GpuProfiler(const GpuProfiler&) = delete;
+  GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+  /**
+   * @brief 次のフレームの領域に切り替え、その領域の前回の結果を読む
+   */
+  void BeginFrame();
+
+  /**
+   * @brief 区間の開始のタイムスタンプを記録する
+   * @param name 区間の名前
+   *
+   * 区間は入れ子にできない。kMaxScopeCountを超えた区間は測らない。
+   */
+  void Begin(const std::string& name);
+
+  /**
+   * @brief 区間の終了のタイムスタンプを記録する
+   */
+  void End();
+
+  /**
+   * @brief 最後に結果が出たフレームの区間ごとの時間を取得する
+   * @return 記録した順の時間
+   */
+  const std::vector<GpuTiming>& GetTimings() const;
+
+  /**
+   * @brief 最後に結果が出たフレームの全区間の合計を取得する
+   * @return ミリ秒
+   */
+  double GetTotalMilliseconds() const;
+
+  /**
+   * @brief カウンターの値を記録する
+   * @param name カウンターの名前
+   * @param value 値。同じ名前の前の値を置き換える
+   */
+  void SetCounter(const std::string& name, std::uint64_t value);
+
+  /**
+   * @brief カウンターの値を取得する
+   * @return 最初に記録した順の値
+   */
+  const std::vector<ProfilerCounter>& GetCounters() const;
+
+ private:
+  struct Frame {
+    std::array<GLuint, kMaxScopeCount * 2> queries;
+    std::vector<std::string> names;
+  };
+
+  std::array<Frame, kFrameCount> frames_;
+  int frame_index_;
+  bool scope_open_;
+  std::vector<GpuTiming> timings_;
+  std::vector<ProfilerCounter> counters_;
+};
+
+/**
+ * @brief スコープの間をGpuProfilerで測る
+ *
+ * profilerがnullptrなら何もしない。
+ */
+class GpuProfileScope {
+ public:
+  GpuProfileScope(GpuProfiler* profiler, const std::string& name)
+      : profiler_(profiler) {
+    if (profiler_ != nullptr) {
+      profiler_->Begin(name);
+    }
+  }
+
+  ~GpuProfileScope() {
+    if (profiler_ != nullptr) {
+      profiler_->End();
+    }
+  }
+
+  GpuProfileScope(const GpuProfileScope&) = delete;
+  GpuProfileScope& operator=(const GpuProfileScope&) = delete;
+
+ private:
+  GpuProfiler* profiler_;
+};
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_GPU_PROFILER_H_
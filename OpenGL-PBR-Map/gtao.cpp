@@ -0,0 +1,291 @@
+#include "gtao.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "gl_state_cache.h"
+#include "gpu_profiler.h"
+#include "shader_program.h"
+
+namespace game {
+
+namespace {
+
+constexpr int kGroupSize = 8;
+// 向きを回す量。黄金比の小数部分ずつ回すとフレームの間で偏らない
+constexpr float kNoiseRotation = 0.618034f;
+
+GLuint DispatchCount(int size) {
+  return static_cast<GLuint>((size + kGroupSize - 1) / kGroupSize);
+}
+
+GLuint CreateTexture(GLenum format, int levels, const glm::ivec2& size) {
+  GLuint texture;
+  glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+  glTextureStorage2D(texture, levels, format, size.x, size.y);
+  glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER,
+                      levels > 1 ? GL_NEAREST_MIPMAP_NEAREST : GL_NEAREST);
+  glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  return texture;
+}
+
+}  // namespace
+
+AmbientOcclusionPreset GetAmbientOcclusionPreset(
+    AmbientOcclusionQuality quality) {
+  switch (quality) {
+    case AmbientOcclusionQuality::kLow:
+      return {1, 4, 1};
+    case AmbientOcclusionQuality::kHigh:
+      return {3, 8, 2};
+    case AmbientOcclusionQuality::kMedium:
+    default:
+      return {2, 6, 1};
+  }
+}
+
+GroundTruthAmbientOcclusion::GroundTruthAmbientOcclusion()
+    : width_(0),
+      height_(0),
+      half_size_(0),
+      frame_index_(0),
+      projection_(1.0f),
+      previous_view_projection_(1.0f),
+      history_valid_(false),
+      history_index_(0),
+      depth_program_(0),
+      occlusion_program_(0),
+      denoise_program_(0),
+      temporal_program_(0),
+      upsample_program_(0),
+      linear_sampler_(0),
+      depth_pyramid_(0),
+      occlusion_textures_{0, 0},
+      history_textures_{0, 0},
+      output_texture_(0) {}
+
+GroundTruthAmbientOcclusion::~GroundTruthAmbientOcclusion() {
+  DeleteTargets();
+  const GLuint programs[] = {depth_program_, occlusion_program_,
+                             denoise_program_, temporal_program_,
+                             upsample_program_};
+  for (const auto program : programs) {
+    if (program != 0) {
+      glDeleteProgram(program);
+    }
+  }
+  if (linear_sampler_ != 0) {
+    glDeleteSamplers(1, &linear_sampler_);
+  }
+}
+
+bool GroundTruthAmbientOcclusion::Initialize(
+    const std::string& shader_directory) {
+  auto load = [&](const char* name) {
+    return LoadShaderProgram(
+        {{GL_COMPUTE_SHADER, shader_directory + "/" + name}});
+  };
+  depth_program_ = load("gtao_depth.comp");
+  occlusion_program_ = load("gtao.comp");
+  denoise_program_ = load("gtao_denoise.comp");
+  temporal_program_ = load("gtao_temporal.comp");
+  upsample_program_ = load("gtao_upsample.comp");
+  if (depth_program_ == 0 || occlusion_program_ == 0 ||
+      denoise_program_ == 0 || temporal_program_ == 0 ||
+      upsample_program_ == 0) {
+    return false;
+  }
+  // 履歴の再投影はピクセルの間をバイリニアで読む
+  glCreateSamplers(1, &linear_sampler_);
+  glSamplerParameteri(linear_sampler_, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glSamplerParameteri(linear_sampler_, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glSamplerParameteri(linear_sampler_, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glSamplerParameteri(linear_sampler_, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  return true;
+}
+
+void GroundTruthAmbientOcclusion::Resize(int width, int height) {
+  if (width == width_ && height == height_) {
+    return;
+  }
+  DeleteTargets();
+  width_ = width;
+  height_ = height;
+  half_size_ = glm::max(glm::ivec2(width, height) / 2, glm::ivec2(1));
+
+  const auto max_levels = static_cast<int>(
+      std::log2(std::max(half_size_.x, half_size_.y))) + 1;
+  depth_pyramid_ = CreateTexture(GL_R32F, std::min(kDepthMipCount, max_levels),
+                                 half_size_);
+  for (int i = 0; i < 2; ++i) {
+    occlusion_textures_[i] = CreateTexture(GL_RG16F, 1, half_size_);
+    history_textures_[i] = CreateTexture(GL_RG16F, 1, half_size_);
+  }
+  output_texture_ = CreateTexture(GL_R8, 1, glm::ivec2(width, height));
+  ResetHistory();
+}
+
+void GroundTruthAmbientOcclusion::Render(
+    GLuint depth_texture, const glm::mat4& view, const glm::mat4& projection,
+    const AmbientOcclusionSettings& settings, GpuProfiler* profiler) {
+  ++frame_index_;
+  projection_ = projection;
+  const auto preset = GetAmbientOcclusionPreset(settings.quality);
+  {
+    GpuProfileScope scope(profiler, "GTAO depth");
+    BuildDepthPyramid(depth_texture);
+  }
+  {
+    GpuProfileScope scope(profiler, "GTAO");
+    ComputeOcclusion(settings, preset);
+  }
+  {
+    GpuProfileScope scope(profiler, "GTAO denoise");
+    AccumulateHistory(Denoise(preset.denoise_pass_count), view);
+  }
+  {
+    GpuProfileScope scope(profiler, "GTAO upsample");
+    Upsample(depth_texture);
+  }
+}
+
+GLuint GroundTruthAmbientOcclusion::GetTexture() const {
+  return output_texture_;
+}
+
+void GroundTruthAmbientOcclusion::ResetHistory() { history_valid_ = false; }
+
+void GroundTruthAmbientOcclusion::DeleteTargets() {
+  if (depth_pyramid_ == 0) {
+    return;
+  }
+  auto& state = GlStateCache::GetInstance();
+  state.DeleteTextures(1, &depth_pyramid_);
+  state.DeleteTextures(2, occlusion_textures_.data());
+  state.DeleteTextures(2, history_textures_.data());
+  state.DeleteTextures(1, &output_texture_);
+  depth_pyramid_ = 0;
+}
+
+void GroundTruthAmbientOcclusion::BuildDepthPyramid(GLuint depth_texture) {
+  auto& state = GlStateCache::GetInstance();
+  state.UseProgram(depth_program_);
+  // 深度バッファの値から線形の深度を求める係数
+  glProgramUniform2f(depth_program_,
+                     glGetUniformLocation(depth_program_, "depth_parameters"),
+                     projection_[3][2], projection_[2][2]);
+  state.BindTextureUnit(0, depth_texture);
+  state.BindTextureUnit(1, depth_pyramid_);
+  GLint level_count;
+  glGetTextureParameteriv(depth_pyramid_, GL_TEXTURE_IMMUTABLE_LEVELS,
+                          &level_count);
+  for (int level = 0; level < level_count; ++level) {
+    glProgramUniform1i(depth_program_,
+                       glGetUniformLocation(depth_program_, "level"), level);
+    glBindImageTexture(0, depth_pyramid_, level, GL_FALSE, 0, GL_WRITE_ONLY,
+                       GL_R32F);
+    glDispatchCompute(DispatchCount(std::max(half_size_.x >> level, 1)),
+                      DispatchCount(std::max(half_size_.y >> level, 1)), 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+  }
+}
+
+void GroundTruthAmbientOcclusion::ComputeOcclusion(
+    const AmbientOcclusionSettings& settings,
+    const AmbientOcclusionPreset& preset) {
+  auto& state = GlStateCache::GetInstance();
+  state.UseProgram(occlusion_program_);
+  auto location = [&](const char* name) {
+    return glGetUniformLocation(occlusion_program_, name);
+  };
+  // 深度1でのビュー空間の大きさと、半分の解像度でのピクセル数の比
+  glProgramUniform2f(occlusion_program_, location("view_scale"),
+                     1.0f / projection_[0][0], 1.0f / projection_[1][1]);
+  glProgramUniform1f(occlusion_program_, location("pixels_per_unit"),
+                     0.5f * half_size_.y * projection_[1][1]);
+  glProgramUniform1f(occlusion_program_, location("radius"), settings.radius);
+  glProgramUniform1f(occlusion_program_, location("power"), settings.power);
+  glProgramUniform1i(occlusion_program_, location("slice_count"),
+                     preset.slice_count);
+  glProgramUniform1i(occlusion_program_, location("step_count"),
+                     preset.step_count);
+  const auto rotation = frame_index_ * kNoiseRotation;
+  glProgramUniform1f(occlusion_program_, location("noise_offset"),
+                     rotation - std::floor(rotation));
+  state.BindTextureUnit(0, depth_pyramid_);
+  glBindImageTexture(0, occlusion_textures_[0], 0, GL_FALSE, 0,
+                     GL_WRITE_ONLY, GL_RG16F);
+  glDispatchCompute(DispatchCount(half_size_.x), DispatchCount(half_size_.y),
+                    1);
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+GLuint GroundTruthAmbientOcclusion::Denoise(int pass_count) {
+  auto& state = GlStateCache::GetInstance();
+  state.UseProgram(denoise_program_);
+  int source = 0;
+  for (int pass = 0; pass < pass_count; ++pass) {
+    state.BindTextureUnit(0, occlusion_textures_[source]);
+    glBindImageTexture(0, occlusion_textures_[1 - source], 0, GL_FALSE, 0,
+                       GL_WRITE_ONLY, GL_RG16F);
+    glDispatchCompute(DispatchCount(half_size_.x),
+                      DispatchCount(half_size_.y), 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    source = 1 - source;
+  }
+  return occlusion_textures_[source];
+}
+
+void GroundTruthAmbientOcclusion::AccumulateHistory(GLuint source,
+                                                    const glm::mat4& view) {
+  const auto view_projection = projection_ * view;
+  if (!history_valid_) {
+    previous_view_projection_ = view_projection;
+  }
+  const auto reprojection = previous_view_projection_ * glm::inverse(view);
+
+  auto& state = GlStateCache::GetInstance();
+  state.UseProgram(temporal_program_);
+  glProgramUniform2f(temporal_program_,
+                     glGetUniformLocation(temporal_program_, "view_scale"),
+                     1.0f / projection_[0][0], 1.0f / projection_[1][1]);
+  glProgramUniformMatrix4fv(
+      temporal_program_, glGetUniformLocation(temporal_program_,
+                                              "reprojection"),
+      1, GL_FALSE, &reprojection[0][0]);
+  glProgramUniform1i(temporal_program_,
+                     glGetUniformLocation(temporal_program_, "history_valid"),
+                     history_valid_ ? 1 : 0);
+  state.BindTextureUnit(0, source);
+  state.BindTextureUnit(1, history_textures_[history_index_]);
+  glBindSampler(1, linear_sampler_);
+  glBindImageTexture(0, history_textures_[1 - history_index_], 0, GL_FALSE, 0,
+                     GL_WRITE_ONLY, GL_RG16F);
+  glDispatchCompute(DispatchCount(half_size_.x), DispatchCount(half_size_.y),
+                    1);
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+  glBindSampler(1, 0);
+
+  history_index_ = 1 - history_index_;
+  history_valid_ = true;
+  previous_view_projection_ = view_projection;
+}
+
+void GroundTruthAmbientOcclusion::Upsample(GLuint depth_texture) {
+  auto& state = GlStateCache::GetInstance();
+  state.UseProgram(upsample_program_);
+  glProgramUniform2f(
+      upsample_program_,
+      glGetUniformLocation(upsample_program_, "depth_parameters"),
+      projection_[3][2], projection_[2][2]);
+  state.BindTextureUnit(0, depth_texture);
+  state.BindTextureUnit(1, history_textures_[history_index_]);
+  glBindImageTexture(0, output_texture_, 0, GL_FALSE, 0, GL_WRITE_ONLY,
+                     GL_R8);
+  glDispatchCompute(DispatchCount(width_), DispatchCount(height_), 1);
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+}  // namespace game
@@ -0,0 +1,157 @@
+#ifndef OPENGL_PBR_MAP_GTAO_H_
+#define OPENGL_PBR_MAP_GTAO_H_
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace game {
+
+class GpuProfiler;
+
+/**
+ * @brief アンビエントオクルージョンの品質
+ */
+enum class AmbientOcclusionQuality {
+  kLow,
+  kMedium,
+  kHigh,
+};
+
+/**
+ * @brief 品質ごとのサンプル数
+ */
+struct AmbientOcclusionPreset {
+  // 1ピクセルあたりの画面上の向きの数
+  int slice_count;
+  // 向きの片側あたりの深度のサンプル数
+  int step_count;
+  // 空間方向のぼかしの回数
+  int denoise_pass_count;
+};
+
+/**
+ * @brief 品質に対応するサンプル数を取得する
+ * @param quality 品質
+ * @return サンプル数
+ */
+AmbientOcclusionPreset GetAmbientOcclusionPreset(
+    AmbientOcclusionQuality quality);
+
+/**
+ * @brief アンビエントオクルージョンの調整値
+ */
+struct AmbientOcclusionSettings {
+  AmbientOcclusionQuality quality = AmbientOcclusionQuality::kMedium;
+  // 遮蔽を探すワールド空間の半径
+  float radius = 0.5f;
+  // 遮蔽の強さ。可視率をこの値で累乗する
+  float power = 1.0f;
+};
+
+/**
+ * @brief 半分の解像度で求めるGround Truth Ambient Occlusion (GTAO)
+ *
+ * 1. 深度を線形にしてから半分の解像度に縮め、さらに2x2の最小値で
+ *    ミップマップを作る (shaders/gtao_depth.comp)
+ * 2. 画面上のいくつかの向きで両側の地平線の角度を探し、法線の周りの
+ *    余弦で重みをつけた可視率を解析的に積分する (shaders/gtao.comp)。
+ *    遠くのサンプルほど粗いミップマップを読み、帯域を抑える
+ * 3. 深度が近いピクセルだけを混ぜる3x3のぼかし (shaders/gtao_denoise.comp)
+ * 4. 向きをフレームごとに回し、再投影した前のフレームの結果と混ぜる。
+ *    深度が食い違うピクセルは履歴を捨てる (shaders/gtao_temporal.comp)
+ * 5. 元の解像度の深度に近い半分の解像度のピクセルに重みを寄せる
+ *    バイリニア補間で戻す (shaders/gtao_upsample.comp)
+ *
+ * 結果はR8のテクスチャで、DeferredRenderer::Shadeに渡すと環境光に掛かる。
+ * フォワード描画ではshaders/ambient_occlusion.glslの関数で環境光と
+ * IBLの鏡面反射に掛ける。
+ */
+class GroundTruthAmbientOcclusion {
+ public:
+  static constexpr int kDepthMipCount = 4;
+
+  GroundTruthAmbientOcclusion();
+  ~GroundTruthAmbientOcclusion();
+
+  GroundTruthAmbientOcclusion(const GroundTruthAmbientOcclusion&) = delete;
+  GroundTruthAmbientOcclusion& operator=(const GroundTruthAmbientOcclusion&) =
+      delete;
+
+  /**
+   * @brief シェーダーを読み込む
+   * @param shader_directory shadersディレクトリのパス (末尾の区切りなし)
+   * @return 成功すればtrue
+   */
+  bool Initialize(const std::string& shader_directory);
+
+  /**
+   * @brief 画面の大きさに合わせてテクスチャを作り直す
+   * @param width 幅
+   * @param height 高さ
+   */
+  void Resize(int width, int height);
+
+  /**
+   * @brief アンビエントオクルージョンを求める
+   * @param depth_texture シーンの深度 (Resizeした大きさ)
+   * @param view ビュー行列
+   * @param projection 対称な透視投影行列 (TAAでずらす前)
+   * @param settings 調整値
+   * @param profiler 各段の時間を記録するGpuProfiler、nullptrなら測らない
+   */
+  void Render(GLuint depth_texture, const glm::mat4& view,
+              const glm::mat4& projection,
+              const AmbientOcclusionSettings& settings,
+              GpuProfiler* profiler);
+
+  /**
+   * @brief 結果を取得する
+   * @return 元の解像度のR8のテクスチャ。1が遮蔽なし
+   */
+  GLuint GetTexture() const;
+
+  /**
+   * @brief 前のフレームの結果を捨てる
+   */
+  void ResetHistory();
+
+ private:
+  void DeleteTargets();
+  void BuildDepthPyramid(GLuint depth_texture);
+  void ComputeOcclusion(const AmbientOcclusionSettings& settings,
+                        const AmbientOcclusionPreset& preset);
+  GLuint Denoise(int pass_count);
+  void AccumulateHistory(GLuint source, const glm::mat4& view);
+  void Upsample(GLuint depth_texture);
+
+  int width_;
+  int height_;
+  glm::ivec2 half_size_;
+  std::uint32_t frame_index_;
+  glm::mat4 projection_;
+  glm::mat4 previous_view_projection_;
+  bool history_valid_;
+  int history_index_;
+
+  GLuint depth_program_;
+  GLuint occlusion_program_;
+  GLuint denoise_program_;
+  GLuint temporal_program_;
+  GLuint upsample_program_;
+  GLuint linear_sampler_;
+
+  // 線形の深度のミップマップ (R32F)
+  GLuint depth_pyramid_;
+  // 可視率と線形の深度 (RG16F)。ぼかしで交互に使う
+  std::array<GLuint, 2> occlusion_textures_;
+  std::array<GLuint, 2> history_textures_;
+  GLuint output_texture_;
+};
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_GTAO_H_
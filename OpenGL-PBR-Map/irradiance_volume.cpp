@@ -0,0 +1,272 @@
+#include "irradiance_volume.h"
+
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+#include "job_system.h"
+#include "path_tracer.h"
+#include "sampling.h"
+
+namespace game {
+
+namespace {
+
+glm::ivec3 GetProbeCoordinate(const IrradianceVolume::Room& room,
+                              std::size_t local_index) {
+  const auto count = room.probe_count;
+  const auto i = static_cast<int>(local_index);
+  return glm::ivec3(i % count.x, (i / count.x) % count.y,
+                    i / (count.x * count.y));
+}
+
+std::size_t GetProbeIndex(const IrradianceVolume::Room& room,
+                          const glm::ivec3& coordinate) {
+  const auto count = room.probe_count;
+  return room.first_probe +
+         static_cast<std::size_t>(
+             (coordinate.z * count.y + coordinate.y) * count.x +
+             coordinate.x);
+}
+
+// 裏面に当たるレイが多ければ壁の中に埋まっているとみなす
+bool IsProbeOutsideGeometry(const PathTracer& path_tracer,
+                            const glm::vec3& position, int ray_count,
+                            float backface_threshold) {
+  int backface_count = 0;
+  Ray ray;
+  ray.origin = position;
+  for (int i = 0; i < ray_count; ++i) {
+    ray.direction = SampleUniformSphere(Hammersley(
+        static_cast<std::uint32_t>(i), static_cast<std::uint32_t>(ray_count)));
+    SurfaceHit hit;
+    if (path_tracer.TraceSurface(ray, hit) && !hit.front_face) {
+      ++backface_count;
+    }
+  }
+  return static_cast<float>(backface_count) <=
+         backface_threshold * static_cast<float>(ray_count);
+}
+
+}  // namespace
+
+void IrradianceVolume::Bake(const std::vector<AABB>& rooms,
+                            const PathTracer& path_tracer,
+                            const BakeSettings& settings,
+                            JobSystem& job_system) {
+  rooms_.clear();
+  atlas_size_ = glm::ivec3(0);
+  std::size_t probe_count = 0;
+  std::vector<int> probe_rooms;
+  for (const auto& bounds : rooms) {
+    Room room;
+    room.bounds = bounds;
+    room.probe_count = glm::max(
+        glm::ivec3(glm::ceil(bounds.GetSize() / settings.probe_spacing)),
+        glm::ivec3(1));
+    // 部屋同士はアトラスのX方向に並べる
+    room.atlas_offset = glm::ivec3(atlas_size_.x, 0, 0);
+    room.first_probe = probe_count;
+    atlas_size_.x += room.probe_count.x;
+    atlas_size_.y = std::max(atlas_size_.y, room.probe_count.y);
+    atlas_size_.z = std::max(atlas_size_.z, room.probe_count.z);
+
+    const auto room_probe_count = static_cast<std::size_t>(
+        room.probe_count.x * room.probe_count.y * room.probe_count.z);
+    probe_count += room_probe_count;
+    probe_rooms.insert(probe_rooms.end(), room_probe_count,
+                       static_cast<int>(rooms_.size()));
+    rooms_.push_back(room);
+  }
+
+  probes_.assign(probe_count, SphericalHarmonicsL2());
+  valid_.assign(probe_count, 0);
+
+  job_system.ParallelFor(probe_count, 1, [&](std::size_t begin,
+                                             std::size_t end) {
+    for (auto probe = begin; probe < end; ++probe) {
+      const auto& room = rooms_[probe_rooms[probe]];
+      const auto position = GetProbePosition(
+          room, GetProbeCoordinate(room, probe - room.first_probe));
+      if (!IsProbeOutsideGeometry(path_tracer, position,
+                                  settings.validity_ray_count,
+                                  settings.backface_threshold)) {
+        continue;
+      }
+      valid_[probe] = 1;
+
+      // プローブごとにシードを固定してスレッド数に依らない結果にする
+      Pcg32 random(probe);
+      const auto shift = random.NextVec2();
+      SphericalHarmonicsL2 radiance;
+      Ray ray;
+      ray.origin = position;
+      for (int i = 0; i < settings.sample_count; ++i) {
+        ray.direction = SampleUniformSphere(glm::fract(
+            Hammersley(static_cast<std::uint32_t>(i),
+                       static_cast<std::uint32_t>(settings.sample_count)) +
+            shift));
+        const auto sample = path_tracer.TraceRadiance(ray, random);
+        const auto basis = EvaluateSHBasis(ray.direction);
+        for (int j = 0; j < 9; ++j) {
+          radiance.coefficients[j] += sample * basis[j];
+        }
+      }
+      radiance *=
+          4.0f * glm::pi<float>() / static_cast<float>(settings.sample_count);
+      probes_[probe] = ConvolveSHWithCosineLobe(radiance);
+    }
+  });
+
+  FillInvalidProbes();
+}
+
+void IrradianceVolume::FillInvalidProbes() {
+  // 壁に埋まったプローブは補間で光が漏れないよう隣の有効なプローブの
+  // 平均で埋める。埋めたプローブもその次の周回では隣として使う。
+  const glm::ivec3 offsets[6] = {{1, 0, 0},  {-1, 0, 0}, {0, 1, 0},
+                                 {0, -1, 0}, {0, 0, 1},  {0, 0, -1}};
+  std::vector<std::uint8_t> filled = valid_;
+  for (const auto& room : rooms_) {
+    const auto room_probe_count = static_cast<std::size_t>(
+        room.probe_count.x * room.probe_count.y * room.probe_count.z);
+    for (bool changed = true; changed;) {
+      changed = false;
+      auto next_filled = filled;
+      for (std::size_t i = 0; i < room_probe_count; ++i) {
+        const auto probe = room.first_probe + i;
+        if (filled[probe]) {
+          continue;
+        }
+        const auto coordinate = GetProbeCoordinate(room, i);
+        SphericalHarmonicsL2 sum;
+        int neighbor_count = 0;
+        for (const auto& offset : offsets) {
+          const auto neighbor = coordinate + offset;
+          if (glm::any(glm::lessThan(neighbor, glm::ivec3(0))) ||
+              glm::any(glm::greaterThanEqual(neighbor, room.probe_count))) {
+            continue;
+          }
+          const auto neighbor_probe = GetProbeIndex(room, neighbor);
+          if (filled[neighbor_probe]) {
+            sum += probes_[neighbor_probe];
+            ++neighbor_count;
+          }
+        }
+        if (neighbor_count > 0) {
+          sum *= 1.0f / static_cast<float>(neighbor_count);
+          probes_[probe] = sum;
+          next_filled[probe] = 1;
+          changed = true;
+        }
+      }
+      filled.swap(next_filled);
+    }
+  }
+}
+
+int IrradianceVolume::FindRoom(const glm::vec3& position) const {
+  for (std::size_t i = 0; i < rooms_.size(); ++i) {
+    if (rooms_[i].bounds.Contains(position)) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+glm::vec3 IrradianceVolume::SampleIrradiance(int room_index,
+                                             const glm::vec3& position,
+                                             const glm::vec3& normal) const {
+  const auto& room = rooms_[room_index];
+  const auto count = glm::vec3(room.probe_count);
+  // プローブはセルの中心にあるので、半セル内側でクランプしてから補間する
+  auto cell = (position - room.bounds.min) / room.bounds.GetSize() * count;
+  cell = glm::clamp(cell, glm::vec3(0.5f), count - 0.5f) - 0.5f;
+  const auto base = glm::min(glm::ivec3(cell), room.probe_count - 1);
+  const auto fraction = cell - glm::vec3(base);
+
+  SphericalHarmonicsL2 irradiance;
+  for (int corner = 0; corner < 8; ++corner) {
+    const glm::ivec3 offset(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1);
+    const auto coordinate = glm::min(base + offset, room.probe_count - 1);
+    const auto weights = glm::mix(1.0f - fraction, fraction, glm::vec3(offset));
+    auto probe = probes_[GetProbeIndex(room, coordinate)];
+    probe *= weights.x * weights.y * weights.z;
+    irradiance += probe;
+  }
+  return glm::max(EvaluateSH(irradiance, normal), glm::vec3(0.0f));
+}
+
+bool IrradianceVolume::IsProbeValid(std::size_t probe) const {
+  return valid_[probe] != 0;
+}
+
+const std::vector<IrradianceVolume::Room>& IrradianceVolume::GetRooms()
+    const {
+  return rooms_;
+}
+
+std::vector<IrradianceVolume::RoomGpuData> IrradianceVolume::GetRoomGpuData()
+    const {
+  std::vector<RoomGpuData> data;
+  data.reserve(rooms_.size());
+  for (const auto& room : rooms_) {
+    data.push_back({glm::vec4(room.bounds.min, 0.0f),
+                    glm::vec4(room.bounds.max, 0.0f),
+                    glm::vec4(glm::vec3(room.atlas_offset), 0.0f),
+                    glm::vec4(glm::vec3(room.probe_count), 0.0f)});
+  }
+  return data;
+}
+
+glm::ivec3 IrradianceVolume::GetAtlasSize() const { return atlas_size_; }
+
+std::array<GLuint, IrradianceVolume::kAtlasTextureCount>
+IrradianceVolume::CreateAtlasTextures() const {
+  const auto texel_count =
+      static_cast<std::size_t>(atlas_size_.x) * atlas_size_.y * atlas_size_.z;
+  std::array<std::vector<glm::vec4>, kAtlasTextureCount> texels;
+  for (auto& layer : texels) {
+    layer.assign(texel_count, glm::vec4(0.0f));
+  }
+  for (const auto& room : rooms_) {
+    const auto room_probe_count = static_cast<std::size_t>(
+        room.probe_count.x * room.probe_count.y * room.probe_count.z);
+    for (std::size_t i = 0; i < room_probe_count; ++i) {
+      const auto texel = room.atlas_offset + GetProbeCoordinate(room, i);
+      const auto index = (static_cast<std::size_t>(texel.z) * atlas_size_.y +
+                          texel.y) * atlas_size_.x + texel.x;
+      const auto packed = PackSHForUniformBuffer(probes_[room.first_probe + i]);
+      for (int layer = 0; layer < kAtlasTextureCount; ++layer) {
+        texels[layer][index] = packed[layer];
+      }
+    }
+  }
+
+  std::array<GLuint, kAtlasTextureCount> textures;
+  glCreateTextures(GL_TEXTURE_3D, kAtlasTextureCount, textures.data());
+  for (int layer = 0; layer < kAtlasTextureCount; ++layer) {
+    const auto texture = textures[layer];
+    glTextureStorage3D(texture, 1, GL_RGBA16F, atlas_size_.x, atlas_size_.y,
+                       atlas_size_.z);
+    glTextureSubImage3D(texture, 0, 0, 0, 0, atlas_size_.x, atlas_size_.y,
+                        atlas_size_.z, GL_RGBA, GL_FLOAT,
+                        texels[layer].data());
+    glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(texture, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+  }
+  return textures;
+}
+
+glm::vec3 IrradianceVolume::GetProbePosition(
+    const Room& room, const glm::ivec3& coordinate) const {
+  return room.bounds.min + (glm::vec3(coordinate) + 0.5f) *
+                               room.bounds.GetSize() /
+                               glm::vec3(room.probe_count);
+}
+
+}  // namespace game
@@ -0,0 +1,131 @@
+#ifndef OPENGL_PBR_MAP_IRRADIANCE_VOLUME_H_
+#define OPENGL_PBR_MAP_IRRADIANCE_VOLUME_H_
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "aabb.h"
+#include "spherical_harmonics.h"
+
+namespace game {
+
+class JobSystem;
+class PathTracer;
+
+/**
+ * @brief 部屋ごとに格子状に並べた放射照度プローブ
+ *
+ * 各プローブはコサインローブで畳み込み済みのL2 SHを持つ。点光源からの
+ * 直接光は実行時に計算するので、プローブには面で反射した間接光だけが入る。
+ * GPU側では7枚のRGBA16Fの3Dテクスチャに全ての部屋を並べたアトラスとして
+ * 持ち、ハードウェアのトライリニア補間で参照する
+ * (shaders/irradiance_volume.glsl)。
+ */
+class IrradianceVolume {
+ public:
+  /**
+   * @brief ベイクの設定
+   */
+  struct BakeSettings {
+    // プローブの間隔
+    float probe_spacing = 1.0f;
+    // プローブあたりのパストレーシングのサンプル数
+    int sample_count = 256;
+    // 壁に埋まっているかを調べるレイの数
+    int validity_ray_count = 64;
+    // 裏面に当たったレイがこの割合を超えたら壁の中とみなす
+    float backface_threshold = 0.25f;
+  };
+
+  /**
+   * @brief 部屋ごとのプローブ格子
+   *
+   * プローブは部屋のバウンディングボックスをprobe_countで分割した
+   * セルの中心に置かれる。
+   */
+  struct Room {
+    AABB bounds;
+    glm::ivec3 probe_count;
+    // アトラス内でのこの部屋の最初のテクセル
+    glm::ivec3 atlas_offset;
+    // probes_内でのこの部屋の最初のプローブ
+    std::size_t first_probe;
+  };
+
+  /**
+   * @brief std140のUniform Bufferに詰める部屋の情報
+   */
+  struct RoomGpuData {
+    glm::vec4 bounds_min;
+    glm::vec4 bounds_max;
+    glm::vec4 atlas_offset;
+    glm::vec4 probe_count;
+  };
+
+  static constexpr int kAtlasTextureCount = 7;
+
+  /**
+   * @brief 部屋ごとにプローブを置いてベイクする
+   * @param rooms 部屋のバウンディングボックス
+   * @param path_tracer シーンを追跡するパストレーサー
+   * @param settings ベイクの設定
+   * @param job_system プローブ単位の並列化に使うJobSystem
+   */
+  void Bake(const std::vector<AABB>& rooms, const PathTracer& path_tracer,
+            const BakeSettings& settings, JobSystem& job_system);
+
+  /**
+   * @brief 点を含む部屋を探す
+   * @param position ワールド座標
+   * @return 部屋のインデックス、どの部屋にも含まれなければ-1
+   */
+  int FindRoom(const glm::vec3& position) const;
+
+  /**
+   * @brief 周囲8個のプローブをトライリニア補間して放射照度を求める
+   * @param room 部屋のインデックス
+   * @param position ワールド座標
+   * @param normal 面の法線
+   * @return 放射照度
+   */
+  glm::vec3 SampleIrradiance(int room, const glm::vec3& position,
+                             const glm::vec3& normal) const;
+
+  /**
+   * @brief プローブが壁の外にあって有効かどうか
+   * @param probe プローブのインデックス
+   * @return 有効かどうか
+   */
+  bool IsProbeValid(std::size_t probe) const;
+
+  const std::vector<Room>& GetRooms() const;
+
+  std::vector<RoomGpuData> GetRoomGpuData() const;
+
+  glm::ivec3 GetAtlasSize() const;
+
+  /**
+   * @brief アトラスの3Dテクスチャを作成する
+   * @return 7枚のテクスチャの名前、呼び出し側で
+   *         GlStateCache::GetInstance().DeleteTexturesで削除すること
+   */
+  std::array<GLuint, kAtlasTextureCount> CreateAtlasTextures() const;
+
+ private:
+  glm::vec3 GetProbePosition(const Room& room,
+                             const glm::ivec3& coordinate) const;
+  void FillInvalidProbes();
+
+  std::vector<Room> rooms_;
+  std::vector<SphericalHarmonicsL2> probes_;
+  std::vector<std::uint8_t> valid_;
+  glm::ivec3 atlas_size_{0};
+};
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_IRRADIANCE_VOLUME_H_
@@ -0,0 +1,128 @@
+#include "job_system.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace game {
+
+JobSystem& JobSystem::GetInstance() {
+  static JobSystem instance(
+      std::max(1u, std::thread::hardware_concurrency()) - 1);
+  return instance;
+}
+
+JobSystem::JobSystem(std::size_t worker_count) : stopping_(false) {
+  workers_.reserve(worker_count);
+  for (std::size_t i = 0; i < worker_count; ++i) {
+    workers_.emplace_back([this] { WorkerLoop(); });
+  }
+}
+
+JobSystem::~JobSystem() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  condition_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+std::size_t JobSystem::GetWorkerCount() const { return workers_.size(); }
+
+void JobSystem::Schedule(std::function<void()> job) {
+  if (workers_.empty()) {
+    job();
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.push_back(std::move(job));
+  }
+  condition_.notify_one();
+}
+
+void JobSystem::ParallelFor(
+    std::size_t count, std::size_t grain_size,
+    const std::function<void(std::size_t, std::size_t)>& func) {
+  if (count == 0) {
+    return;
+  }
+  grain_size = std::max<std::size_t>(grain_size, 1);
+  const std::size_t chunk_count = (count + grain_size - 1) / grain_size;
+  if (chunk_count == 1 || workers_.empty()) {
+    func(0, count);
+    return;
+  }
+
+  // ヘルパージョブは呼び出しから戻った後に起動することもあるので
+  // 共有状態はshared_ptrで持つ
+  struct State {
+    std::atomic<std::size_t> next_chunk{0};
+    std::atomic<std::size_t> finished_chunks{0};
+    const std::function<void(std::size_t, std::size_t)>* func;
+  };
+  auto state = std::make_shared<State>();
+  state->func = &func;
+
+  auto run_chunks = [state, count, grain_size, chunk_count] {
+    for (;;) {
+      const auto chunk = state->next_chunk.fetch_add(1);
+      if (chunk >= chunk_count) {
+        return;
+      }
+      const auto begin = chunk * grain_size;
+      const auto end = std::min(begin + grain_size, count);
+      (*state->func)(begin, end);
+      state->finished_chunks.fetch_add(1, std::memory_order_release);
+    }
+  };
+
+  const auto helper_count = std::min(workers_.size(), chunk_count - 1);
+  for (std::size_t i = 0; i < helper_count; ++i) {
+    Schedule(run_chunks);
+  }
+  run_chunks();
+
+  // 他のスレッドが処理中のチャンクを待つ間は別のジョブを手伝う
+  while (state->finished_chunks.load(std::memory_order_acquire) <
+         chunk_count) {
+    if (!TryRunOneJob()) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+bool JobSystem::TryRunOneJob() {
+  std::function<void()> job;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (jobs_.empty()) {
+      return false;
+    }
+    job = std::move(jobs_.front());
+    jobs_.pop_front();
+  }
+  job();
+  return true;
+}
+
+void JobSystem::WorkerLoop() {
+  for (;;) {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+      if (stopping_ && jobs_.empty()) {
+        return;
+      }
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+    job();
+  }
+}
+
+}  // namespace game
@@ -0,0 +1,76 @@
+#ifndef OPENGL_PBR_MAP_JOB_SYSTEM_H_
+#define OPENGL_PBR_MAP_JOB_SYSTEM_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace game {
+
+/**
+ * @brief ワーカースレッドにジョブを配るスレッドプール
+ *
+ * ParallelForの呼び出し元スレッドも処理に参加し、待機中は他のジョブを
+ * 実行するので、ジョブの中から入れ子でParallelForを呼んでも詰まらない。
+ */
+class JobSystem {
+ public:
+  /**
+   * @brief プロセス全体で共有するJobSystemを取得する
+   * @return ハードウェアスレッド数 - 1 個のワーカーを持つJobSystem
+   */
+  static JobSystem& GetInstance();
+
+  /**
+   * @brief コンストラクタ
+   * @param worker_count ワーカースレッド数、0なら全てを呼び出し元で実行する
+   */
+  explicit JobSystem(std::size_t worker_count);
+
+  ~JobSystem();
+
+  JobSystem(const JobSystem&) = delete;
+  JobSystem& operator=(const JobSystem&) = delete;
+
+  /**
+   * @brief ワーカースレッド数を取得する
+   * @return ワーカースレッド数
+   */
+  std::size_t GetWorkerCount() const;
+
+  /**
+   * @brief ジョブをキューに積む
+   * @param job 実行するジョブ
+   */
+  void Schedule(std::function<void()> job);
+
+  /**
+   * @brief [0, count)をgrain_size個ずつの範囲に分けて並列に処理する
+   * @param count 要素数
+   * @param grain_size 1回の呼び出しで処理する要素数
+   * @param func func(begin, end)の形で呼び出される関数
+   *
+   * 全ての範囲の処理が終わるまで戻らない。
+   */
+  void ParallelFor(
+      std::size_t count, std::size_t grain_size,
+      const std::function<void(std::size_t, std::size_t)>& func);
+
+ private:
+  bool TryRunOneJob();
+  void WorkerLoop();
+
+  std::vector<std::thread> workers_;
+  std::deque<std::function<void()>> jobs_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  bool stopping_;
+};
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_JOB_SYSTEM_H_
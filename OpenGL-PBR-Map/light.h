@@ -0,0 +1,39 @@
+#ifndef OPENGL_PBR_MAP_LIGHT_H_
+#define OPENGL_PBR_MAP_LIGHT_H_
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+
+namespace game {
+
+/**
+ * @brief 点光源
+ *
+ * std430のバッファにそのまま詰められるよう32バイトにしている。
+ */
+struct PointLight {
+  glm::vec3 position;
+  // この距離で減衰が0になる
+  float range;
+  // 光度 (cd) にあたる色付きの強さ
+  glm::vec3 intensity;
+  float padding = 0.0f;
+};
+
+/**
+ * @brief 点光源の距離減衰を計算する
+ * @param distance 光源からの距離
+ * @param range 光源の影響範囲
+ * @return 逆2乗則にrangeで0になる窓関数を掛けた値
+ */
+inline float EvaluatePointLightFalloff(float distance, float range) {
+  const float ratio = distance / range;
+  const float ratio4 = ratio * ratio * ratio * ratio;
+  const float window = std::max(0.0f, 1.0f - ratio4);
+  return window * window / std::max(distance * distance, 1.0e-4f);
+}
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_LIGHT_H_
@@ -0,0 +1,460 @@
+#include "lightmap_baker.h"
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtc/packing.hpp>
+#include <glm/gtx/hash.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <unordered_map>
+
+#include "job_system.h"
+#include "path_tracer.h"
+#include "sampling.h"
+#include "texel_rasterizer.h"
+
+namespace game {
+
+namespace {
+
+constexpr int kTileSize = 16;
+// 壁の中に入り込んだテクセルを探すレイの数
+constexpr int kValidityRayCount = 8;
+
+// 主軸ごとの投影に使う2軸
+const int kProjectionAxes[3][2] = {{2, 1}, {0, 2}, {0, 1}};
+
+class UnionFind {
+ public:
+  explicit UnionFind(std::size_t size) : parents_(size) {
+    std::iota(parents_.begin(), parents_.end(), 0u);
+  }
+
+  std::uint32_t Find(std::uint32_t i) {
+    while (parents_[i] != i) {
+      parents_[i] = parents_[parents_[i]];
+      i = parents_[i];
+    }
+    return i;
+  }
+
+  void Unite(std::uint32_t a, std::uint32_t b) {
+    parents_[Find(a)] = Find(b);
+  }
+
+ private:
+  std::vector<std::uint32_t> parents_;
+};
+
+struct Chart {
+  std::vector<std::uint32_t> triangles;
+  int axis;
+  glm::vec2 min{std::numeric_limits<float>::infinity()};
+  glm::vec2 max{-std::numeric_limits<float>::infinity()};
+  float scale;
+  glm::ivec2 size;
+  glm::ivec2 offset;
+};
+
+// 法線の主軸と符号から6方向のどれかを返す
+int ClassifyDirection(const glm::vec3& normal) {
+  const auto a = glm::abs(normal);
+  const int axis = a.x >= a.y && a.x >= a.z ? 0 : (a.y >= a.z ? 1 : 2);
+  return axis * 2 + (normal[axis] < 0.0f ? 1 : 0);
+}
+
+glm::vec2 Project(const glm::vec3& position, int axis) {
+  return glm::vec2(position[kProjectionAxes[axis][0]],
+                   position[kProjectionAxes[axis][1]]);
+}
+
+float Luminance(const glm::vec3& color) {
+  return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+// ライトマップのテクセルに対応する面上の点
+struct LightmapTexels {
+  int width;
+  int height;
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec3> normals;
+  std::vector<std::int32_t> charts;
+  std::vector<std::uint8_t> valid;
+};
+
+LightmapTexels RasterizeTexels(const LightmapMesh& mesh) {
+  LightmapTexels texels;
+  texels.width = mesh.atlas_width;
+  texels.height = mesh.atlas_height;
+  const auto count = static_cast<std::size_t>(texels.width) * texels.height;
+  texels.positions.assign(count, glm::vec3(0.0f));
+  texels.normals.assign(count, glm::vec3(0.0f));
+  texels.charts.assign(count, -1);
+  texels.valid.assign(count, 0);
+
+  const glm::vec2 atlas_size(texels.width, texels.height);
+  for (std::size_t triangle = 0; triangle < mesh.indices.size() / 3;
+       ++triangle) {
+    const auto* index = &mesh.indices[triangle * 3];
+    const glm::vec2 uv[3] = {mesh.lightmap_uvs[index[0]] * atlas_size,
+                             mesh.lightmap_uvs[index[1]] * atlas_size,
+                             mesh.lightmap_uvs[index[2]] * atlas_size};
+    RasterizeTriangleTexels(
+        uv, texels.width, texels.height,
+        [&](int x, int y, const glm::vec3& w) {
+          const auto texel = static_cast<std::size_t>(y) * texels.width + x;
+          if (texels.charts[texel] >= 0) {
+            return;
+          }
+          texels.positions[texel] = mesh.positions[index[0]] * w.x +
+                                    mesh.positions[index[1]] * w.y +
+                                    mesh.positions[index[2]] * w.z;
+          texels.normals[texel] =
+              glm::normalize(mesh.normals[index[0]] * w.x +
+                             mesh.normals[index[1]] * w.y +
+                             mesh.normals[index[2]] * w.z);
+          texels.charts[texel] =
+              static_cast<std::int32_t>(mesh.triangle_charts[triangle]);
+          texels.valid[texel] = 1;
+        });
+  }
+  return texels;
+}
+
+// 面のすぐ近くで裏面に当たるならテクセルは壁の中に入り込んでいる
+bool IsTexelOutsideGeometry(const PathTracer& path_tracer,
+                            const glm::vec3& position,
+                            const glm::vec3& normal, float texel_world_size) {
+  glm::vec3 tangent;
+  glm::vec3 bitangent;
+  BuildOrthonormalBasis(normal, tangent, bitangent);
+  Ray ray;
+  ray.origin = OffsetRayOrigin(position, normal);
+  ray.t_max = texel_world_size;
+  for (int i = 0; i < kValidityRayCount; ++i) {
+    const auto local = SampleCosineHemisphere(
+        Hammersley(static_cast<std::uint32_t>(i), kValidityRayCount));
+    ray.direction = tangent * local.x + bitangent * local.y + normal * local.z;
+    SurfaceHit hit;
+    if (path_tracer.TraceSurface(ray, hit) && !hit.front_face) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// 法線と位置を案内に使うバイラテラルフィルタ
+std::vector<glm::vec3> DenoiseLightmap(const LightmapTexels& texels,
+                                       const std::vector<glm::vec3>& input,
+                                       float texel_world_size,
+                                       const LightmapSettings& settings,
+                                       JobSystem& job_system) {
+  std::vector<glm::vec3> output = input;
+  const int radius = settings.denoise_radius;
+  const float spatial = 1.0f / (2.0f * settings.denoise_sigma_spatial *
+                                settings.denoise_sigma_spatial);
+  const float luminance_scale =
+      1.0f / (2.0f * settings.denoise_sigma_luminance *
+              settings.denoise_sigma_luminance);
+  // 位置の差はフィルタ半径のテクセル分を基準にする
+  const float position_scale =
+      1.0f / (texel_world_size * texel_world_size * radius * radius + 1e-8f);
+
+  job_system.ParallelFor(
+      static_cast<std::size_t>(texels.height), 4,
+      [&](std::size_t begin, std::size_t end) {
+        for (auto y = static_cast<int>(begin); y < static_cast<int>(end);
+             ++y) {
+          for (int x = 0; x < texels.width; ++x) {
+            const auto center = static_cast<std::size_t>(y) * texels.width + x;
+            if (!texels.valid[center]) {
+              continue;
+            }
+            const float center_luminance = Luminance(input[center]);
+            glm::vec3 sum(0.0f);
+            float weight_sum = 0.0f;
+            for (int dy = -radius; dy <= radius; ++dy) {
+              for (int dx = -radius; dx <= radius; ++dx) {
+                const int sx = x + dx;
+                const int sy = y + dy;
+                if (sx < 0 || sy < 0 || sx >= texels.width ||
+                    sy >= texels.height) {
+                  continue;
+                }
+                const auto sample =
+                    static_cast<std::size_t>(sy) * texels.width + sx;
+                if (!texels.valid[sample] ||
+                    texels.charts[sample] != texels.charts[center]) {
+                  continue;
+                }
+                const float normal_difference =
+                    1.0f -
+                    glm::dot(texels.normals[center], texels.normals[sample]);
+                const auto position_difference =
+                    texels.positions[center] - texels.positions[sample];
+                const float luminance_difference =
+                    Luminance(input[sample]) - center_luminance;
+                const float weight = std::exp(
+                    -static_cast<float>(dx * dx + dy * dy) * spatial -
+                    normal_difference / settings.denoise_sigma_normal -
+                    glm::dot(position_difference, position_difference) *
+                        position_scale -
+                    luminance_difference * luminance_difference *
+                        luminance_scale);
+                sum += input[sample] * weight;
+                weight_sum += weight;
+              }
+            }
+            output[center] = sum / weight_sum;
+          }
+        }
+      });
+  return output;
+}
+
+// 有効なテクセルの値を同じチャートの空のテクセルに広げ、
+// バイリニア補間でチャートの外の黒が混ざらないようにする
+void DilateLightmap(LightmapTexels& texels, std::vector<glm::vec3>& values,
+                    int iterations) {
+  for (int iteration = 0; iteration < iterations; ++iteration) {
+    auto next_values = values;
+    auto next_valid = texels.valid;
+    auto next_charts = texels.charts;
+    for (int y = 0; y < texels.height; ++y) {
+      for (int x = 0; x < texels.width; ++x) {
+        const auto texel = static_cast<std::size_t>(y) * texels.width + x;
+        if (texels.valid[texel]) {
+          continue;
+        }
+        glm::vec3 sum(0.0f);
+        int count = 0;
+        std::int32_t chart = texels.charts[texel];
+        for (int dy = -1; dy <= 1; ++dy) {
+          for (int dx = -1; dx <= 1; ++dx) {
+            const int sx = x + dx;
+            const int sy = y + dy;
+            if (sx < 0 || sy < 0 || sx >= texels.width ||
+                sy >= texels.height) {
+              continue;
+            }
+            const auto sample =
+                static_cast<std::size_t>(sy) * texels.width + sx;
+            if (!texels.valid[sample] ||
+                (chart >= 0 && texels.charts[sample] != chart)) {
+              continue;
+            }
+            chart = texels.charts[sample];
+            sum += values[sample];
+            ++count;
+          }
+        }
+        if (count > 0) {
+          next_values[texel] = sum / static_cast<float>(count);
+          next_valid[texel] = 1;
+          next_charts[texel] = chart;
+        }
+      }
+    }
+    values.swap(next_values);
+    texels.valid.swap(next_valid);
+    texels.charts.swap(next_charts);
+  }
+}
+
+}  // namespace
+
+LightmapMesh UnwrapLightmap(const std::vector<glm::vec3>& positions,
+                            const std::vector<glm::vec3>& normals,
+                            const std::vector<std::uint32_t>& indices,
+                            const LightmapSettings& settings) {
+  const auto triangle_count = indices.size() / 3;
+
+  // 三角形ごとの向き
+  std::vector<int> directions(triangle_count);
+  for (std::size_t i = 0; i < triangle_count; ++i) {
+    const auto& p0 = positions[indices[i * 3 + 0]];
+    const auto& p1 = positions[indices[i * 3 + 1]];
+    const auto& p2 = positions[indices[i * 3 + 2]];
+    directions[i] = ClassifyDirection(glm::cross(p1 - p0, p2 - p0));
+  }
+
+  // 頂点インデックスが分かれていても同じ位置の頂点は同じとみなす
+  std::unordered_map<glm::ivec3, std::uint32_t> welded_ids;
+  std::vector<std::uint32_t> welded(positions.size());
+  for (std::size_t i = 0; i < positions.size(); ++i) {
+    const glm::ivec3 key(glm::round(positions[i] * 1024.0f));
+    welded[i] = welded_ids.emplace(key, static_cast<std::uint32_t>(
+                                            welded_ids.size()))
+                    .first->second;
+  }
+
+  // 辺を共有する同じ向きの三角形をまとめる
+  UnionFind union_find(triangle_count);
+  std::unordered_map<std::uint64_t, std::uint32_t> edges;
+  for (std::size_t i = 0; i < triangle_count; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      const std::uint64_t a = welded[indices[i * 3 + j]];
+      const std::uint64_t b = welded[indices[i * 3 + (j + 1) % 3]];
+      const auto key = (std::min(a, b) << 32u) | std::max(a, b);
+      const auto result =
+          edges.emplace(key, static_cast<std::uint32_t>(i));
+      if (!result.second &&
+          directions[result.first->second] == directions[i]) {
+        union_find.Unite(result.first->second, static_cast<std::uint32_t>(i));
+      }
+    }
+  }
+
+  std::vector<Chart> charts;
+  std::unordered_map<std::uint32_t, std::uint32_t> chart_ids;
+  std::vector<std::uint32_t> triangle_charts(triangle_count);
+  for (std::size_t i = 0; i < triangle_count; ++i) {
+    const auto root = union_find.Find(static_cast<std::uint32_t>(i));
+    const auto result = chart_ids.emplace(
+        root, static_cast<std::uint32_t>(charts.size()));
+    if (result.second) {
+      charts.emplace_back();
+      charts.back().axis = directions[i] / 2;
+    }
+    auto& chart = charts[result.first->second];
+    chart.triangles.push_back(static_cast<std::uint32_t>(i));
+    triangle_charts[i] = result.first->second;
+    for (int j = 0; j < 3; ++j) {
+      const auto uv = Project(positions[indices[i * 3 + j]], chart.axis);
+      chart.min = glm::min(chart.min, uv);
+      chart.max = glm::max(chart.max, uv);
+    }
+  }
+
+  // 高さの順にシェルフ法で詰める
+  const int padding = settings.padding;
+  const int max_content_width = settings.atlas_width - padding * 2;
+  for (auto& chart : charts) {
+    const auto extent = chart.max - chart.min;
+    chart.scale = settings.texels_per_unit;
+    // アトラスより広いチャートだけは解像度を落とす
+    if (extent.x * chart.scale > static_cast<float>(max_content_width)) {
+      chart.scale = static_cast<float>(max_content_width) / extent.x;
+    }
+    chart.size = glm::max(glm::ivec2(glm::ceil(extent * chart.scale)),
+                          glm::ivec2(1)) +
+                 padding * 2;
+  }
+  std::vector<std::uint32_t> order(charts.size());
+  std::iota(order.begin(), order.end(), 0u);
+  std::sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b) {
+    return charts[a].size.y > charts[b].size.y;
+  });
+  glm::ivec2 cursor(0);
+  int shelf_height = 0;
+  for (const auto id : order) {
+    auto& chart = charts[id];
+    if (cursor.x + chart.size.x > settings.atlas_width) {
+      cursor = glm::ivec2(0, cursor.y + shelf_height);
+      shelf_height = 0;
+    }
+    chart.offset = cursor;
+    cursor.x += chart.size.x;
+    shelf_height = std::max(shelf_height, chart.size.y);
+  }
+
+  LightmapMesh mesh;
+  mesh.atlas_width = settings.atlas_width;
+  mesh.atlas_height = (cursor.y + shelf_height + 3) / 4 * 4;
+  mesh.triangle_charts = triangle_charts;
+  mesh.indices.resize(indices.size());
+  const glm::vec2 atlas_size(mesh.atlas_width, mesh.atlas_height);
+
+  // 元の頂点とチャートの組ごとに頂点を作る
+  std::unordered_map<std::uint64_t, std::uint32_t> vertex_ids;
+  for (std::size_t i = 0; i < triangle_count; ++i) {
+    const auto& chart = charts[triangle_charts[i]];
+    for (int j = 0; j < 3; ++j) {
+      const auto source = indices[i * 3 + j];
+      const auto key = (static_cast<std::uint64_t>(triangle_charts[i]) << 32u) |
+                       source;
+      const auto result = vertex_ids.emplace(
+          key, static_cast<std::uint32_t>(mesh.positions.size()));
+      if (result.second) {
+        const auto texel =
+            glm::vec2(chart.offset + padding) +
+            (Project(positions[source], chart.axis) - chart.min) * chart.scale;
+        mesh.positions.push_back(positions[source]);
+        mesh.normals.push_back(normals[source]);
+        mesh.lightmap_uvs.push_back(texel / atlas_size);
+      }
+      mesh.indices[i * 3 + j] = result.first->second;
+    }
+  }
+  return mesh;
+}
+
+Lightmap BakeLightmap(const LightmapMesh& mesh, const PathTracer& path_tracer,
+                      const LightmapSettings& settings,
+                      JobSystem& job_system) {
+  auto texels = RasterizeTexels(mesh);
+  const float texel_world_size = 1.0f / settings.texels_per_unit;
+  std::vector<glm::vec3> irradiance(texels.positions.size(), glm::vec3(0.0f));
+
+  const int tile_count_x = (texels.width + kTileSize - 1) / kTileSize;
+  const int tile_count_y = (texels.height + kTileSize - 1) / kTileSize;
+  job_system.ParallelFor(
+      static_cast<std::size_t>(tile_count_x) * tile_count_y, 1,
+      [&](std::size_t begin, std::size_t end) {
+        for (auto tile = begin; tile < end; ++tile) {
+          const int tile_x = static_cast<int>(tile) % tile_count_x * kTileSize;
+          const int tile_y = static_cast<int>(tile) / tile_count_x * kTileSize;
+          for (int y = tile_y; y < std::min(tile_y + kTileSize, texels.height);
+               ++y) {
+            for (int x = tile_x;
+                 x < std::min(tile_x + kTileSize, texels.width); ++x) {
+              const auto texel = static_cast<std::size_t>(y) * texels.width + x;
+              if (!texels.valid[texel]) {
+                continue;
+              }
+              const auto& position = texels.positions[texel];
+              const auto& normal = texels.normals[texel];
+              if (!IsTexelOutsideGeometry(path_tracer, position, normal,
+                                          texel_world_size)) {
+                // 壁に埋まったテクセルは後で周囲から埋める
+                texels.valid[texel] = 0;
+                continue;
+              }
+              Pcg32 random(texel);
+              irradiance[texel] = path_tracer.EstimateIrradiance(
+                  position, normal, settings.sample_count, random);
+            }
+          }
+        }
+      });
+
+  irradiance = DenoiseLightmap(texels, irradiance, texel_world_size, settings,
+                               job_system);
+  DilateLightmap(texels, irradiance, settings.dilation_iterations);
+
+  Lightmap lightmap;
+  lightmap.width = texels.width;
+  lightmap.height = texels.height;
+  lightmap.texels.resize(irradiance.size());
+  for (std::size_t i = 0; i < irradiance.size(); ++i) {
+    lightmap.texels[i] = glm::packF3x9_E1x5(irradiance[i]);
+  }
+  return lightmap;
+}
+
+GLuint CreateLightmapTexture(const Lightmap& lightmap) {
+  GLuint texture;
+  glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+  glTextureStorage2D(texture, 1, GL_RGB9_E5, lightmap.width, lightmap.height);
+  glTextureSubImage2D(texture, 0, 0, 0, lightmap.width, lightmap.height,
+                      GL_RGB, GL_UNSIGNED_INT_5_9_9_9_REV,
+                      lightmap.texels.data());
+  glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  return texture;
+}
+
+}  // namespace game
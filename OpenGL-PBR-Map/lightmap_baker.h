@@ -0,0 +1,100 @@
+#ifndef OPENGL_PBR_MAP_LIGHTMAP_BAKER_H_
+#define OPENGL_PBR_MAP_LIGHTMAP_BAKER_H_
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace game {
+
+class JobSystem;
+class PathTracer;
+
+/**
+ * @brief ライトマップのベイクの設定
+ */
+struct LightmapSettings {
+  // ワールド座標の1単位あたりのテクセル数
+  float texels_per_unit = 8.0f;
+  int atlas_width = 1024;
+  // チャートの周囲に空けるテクセル数
+  int padding = 2;
+  // テクセルあたりの間接光のサンプル数
+  int sample_count = 128;
+  // 有効なテクセルを周囲に広げる回数
+  int dilation_iterations = 4;
+  // バイラテラルフィルタの半径とパラメータ
+  int denoise_radius = 2;
+  float denoise_sigma_spatial = 1.5f;
+  float denoise_sigma_normal = 0.1f;
+  float denoise_sigma_luminance = 0.5f;
+};
+
+/**
+ * @brief ライトマップUVを展開したメッシュ
+ *
+ * 三角形の順番は展開前と同じで、頂点はチャートの境界で複製される。
+ */
+struct LightmapMesh {
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec3> normals;
+  // アトラス全体を[0, 1]とするUV
+  std::vector<glm::vec2> lightmap_uvs;
+  std::vector<std::uint32_t> indices;
+  // 三角形ごとのチャート番号
+  std::vector<std::uint32_t> triangle_charts;
+  int atlas_width = 0;
+  int atlas_height = 0;
+};
+
+/**
+ * @brief RGB9E5で詰めた放射照度のライトマップ
+ */
+struct Lightmap {
+  int width = 0;
+  int height = 0;
+  std::vector<std::uint32_t> texels;
+};
+
+/**
+ * @brief ライトマップUVを自動で展開し、チャートをアトラスに詰める
+ * @param positions 頂点座標
+ * @param normals 頂点法線
+ * @param indices 三角形リストのインデックス
+ * @param settings ベイクの設定
+ * @return 展開したメッシュ
+ *
+ * 辺を共有し主軸の向きが同じ三角形を1つのチャートにまとめて主軸方向に
+ * 投影し、シェルフ法でアトラスに並べる。
+ */
+LightmapMesh UnwrapLightmap(const std::vector<glm::vec3>& positions,
+                            const std::vector<glm::vec3>& normals,
+                            const std::vector<std::uint32_t>& indices,
+                            const LightmapSettings& settings);
+
+/**
+ * @brief ライトマップをベイクする
+ * @param mesh UnwrapLightmapで展開したメッシュ
+ * @param path_tracer meshと同じ三角形の並びのシーンを持つパストレーサー
+ * @param settings ベイクの設定
+ * @param job_system タイル単位の並列化に使うJobSystem
+ * @return 放射照度のライトマップ
+ *
+ * シェーダーではalbedo / pi * 放射照度が静的な光源による拡散反射になる。
+ */
+Lightmap BakeLightmap(const LightmapMesh& mesh, const PathTracer& path_tracer,
+                      const LightmapSettings& settings, JobSystem& job_system);
+
+/**
+ * @brief ライトマップからGL_RGB9_E5のテクスチャを作成する
+ * @param lightmap アップロードするライトマップ
+ * @return テクスチャの名前、呼び出し側で
+ *         GlStateCache::GetInstance().DeleteTexturesで削除すること
+ */
+GLuint CreateLightmapTexture(const Lightmap& lightmap);
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_LIGHTMAP_BAKER_H_
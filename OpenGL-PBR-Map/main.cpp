@@ -1,9 +1,254 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <glm/gtc/matrix_transform.hpp>
 
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
+#include <string>
+#include <vector>
+
+#include "chunk_mesher.h"
+#include "draw_batcher.h"
+#include "dungeon_generator.h"
+#include "ecs.h"
+#include "frustum_culling.h"
+#include "gl_state_cache.h"
+#include "gpu_profiler.h"
+#include "job_system.h"
+#include "material_table.h"
+#include "post_process.h"
+#include "scene_renderer.h"
+
+namespace {
+
+// ウィンドウを作らずにCPUのベンチマークだけを実行するオプション
+constexpr char kBenchmarkOption[] = "--benchmark";
+// 描画方式を切り替えるキー
+constexpr int kRenderPathKey = GLFW_KEY_F1;
+// GPUの時間を書き出す間隔のフレーム数
+constexpr int kTimingReportInterval = 120;
+
+// 生成したダンジョンの全チャンクのメッシュを1つの頂点配列にまとめたもの
+struct DungeonScene {
+  GLuint vertex_buffer = 0;
+  GLuint index_buffer = 0;
+  GLuint vertex_array = 0;
+  std::vector<game::PointLight> lights;
+};
+
+// 全チャンクのメッシュを作り、マテリアルごとの範囲をDrawBatcherに積む
+DungeonScene CreateDungeonScene(const game::TileMap& map,
+                                game::DrawBatcher& batcher) {
+  std::vector<game::ChunkVertex> vertices;
+  std::vector<std::uint32_t> indices;
+  std::vector<game::Tile> tiles;
+  batcher.Begin();
+  const auto size_in_chunks = map.GetSizeInChunks();
+  for (int y = 0; y < size_in_chunks.y; ++y) {
+    for (int x = 0; x < size_in_chunks.x; ++x) {
+      const glm::ivec2 chunk(x, y);
+      map.CopyChunkTiles(chunk, tiles);
+      const auto mesh = game::BuildChunkMesh(chunk, tiles);
+      const auto base_vertex = static_cast<std::int32_t>(vertices.size());
+      const auto first_index = static_cast<std::uint32_t>(indices.size());
+      vertices.insert(vertices.end(), mesh.vertices.begin(),
+                      mesh.vertices.end());
+      indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+      // 頂点はワールド座標なのでモデル行列は単位行列
+      for (const auto& batch : mesh.batches) {
+        const auto id = batcher.RegisterMesh(
+            {first_index + batch.first_index, batch.index_count, base_vertex});
+        batcher.Add(id, batch.material, 0, glm::mat4(1.0f));
+      }
+    }
+  }
+  batcher.Build();
+  batcher.Upload();
+
+  DungeonScene scene;
+  glCreateBuffers(1, &scene.vertex_buffer);
+  glNamedBufferStorage(scene.vertex_buffer,
+                       vertices.size() * sizeof(game::ChunkVertex),
+                       vertices.data(), 0);
+  glCreateBuffers(1, &scene.index_buffer);
+  glNamedBufferStorage(scene.index_buffer,
+                       indices.size() * sizeof(std::uint32_t), indices.data(),
+                       0);
+  glCreateVertexArrays(1, &scene.vertex_array);
+  glVertexArrayVertexBuffer(scene.vertex_array, 0, scene.vertex_buffer, 0,
+                            sizeof(game::ChunkVertex));
+  glVertexArrayElementBuffer(scene.vertex_array, scene.index_buffer);
+  const GLuint offsets[] = {offsetof(game::ChunkVertex, position),
+                            offsetof(game::ChunkVertex, normal),
+                            offsetof(game::ChunkVertex, uv)};
+  const GLint sizes[] = {3, 3, 2};
+  for (GLuint attribute = 0; attribute < 3; ++attribute) {
+    glEnableVertexArrayAttrib(scene.vertex_array, attribute);
+    glVertexArrayAttribFormat(scene.vertex_array, attribute, sizes[attribute],
+                              GL_FLOAT, GL_FALSE, offsets[attribute]);
+    glVertexArrayAttribBinding(scene.vertex_array, attribute, 0);
+  }
+  scene.lights = map.GetLights();
+  return scene;
+}
+
+void DeleteDungeonScene(DungeonScene& scene) {
+  glDeleteVertexArrays(1, &scene.vertex_array);
+  glDeleteBuffers(1, &scene.vertex_buffer);
+  glDeleteBuffers(1, &scene.index_buffer);
+}
+
+// 視錐台カリングとECSのベンチマークを実行して結果を書き出す
+void RunBenchmarks() {
+  auto& job_system = game::JobSystem::GetInstance();
+  const auto culling =
+      game::RunFrustumCullingBenchmark(1000000, 20, job_system);
+  std::cout << "Frustum culling: " << culling.instance_count
+            << " instances, " << culling.visible_count << " visible"
+            << std::endl
+            << "  naive " << culling.naive_milliseconds << " ms, simd "
+            << culling.simd_milliseconds << " ms, simd parallel "
+            << culling.simd_parallel_milliseconds << " ms"
+            << (culling.results_match ? "" : " (results differ)")
+            << std::endl;
+
+  const auto ecs = game::RunEcsBenchmark(1000000, 20, job_system);
+  std::cout << "ECS: " << ecs.entity_count << " entities" << std::endl
+            << "  pointer " << ecs.pointer_milliseconds << " ms, ecs "
+            << ecs.ecs_milliseconds << " ms, ecs parallel "
+            << ecs.ecs_parallel_milliseconds << " ms"
+            << (ecs.results_match ? "" : " (results differ)") << std::endl;
+}
+
+const char* GetRenderPathName(game::RenderPath path) {
+  return path == game::RenderPath::kForward ? "forward" : "tiled deferred";
+}
+
+// ダンジョンを生成して、ウィンドウが閉じられるまで描く
+// kRenderPathKeyで描画方式を切り替え、同じ視点のGPUの時間を比べられる
+bool RunDungeonScene(GLFWwindow* window, int width, int height) {
+  const std::string shader_directory = "shaders";
+  auto& job_system = game::JobSystem::GetInstance();
+
+  game::DungeonGeneratorSettings dungeon_settings;
+  dungeon_settings.size = glm::ivec2(256, 256);
+  const auto map = game::GenerateDungeon(dungeon_settings, job_system);
+
+  // 床と壁のマテリアルの番号ごとに色を変える
+  game::MaterialTable materials;
+  const glm::vec3 colors[] = {{0.8f, 0.75f, 0.7f},
+                              {0.55f, 0.5f, 0.45f},
+                              {0.6f, 0.65f, 0.7f},
+                              {0.7f, 0.55f, 0.4f}};
+  for (int i = 0; i < dungeon_settings.material_count; ++i) {
+    game::MaterialDesc material;
+    material.base_color = glm::vec4(colors[i % 4], 1.0f);
+    material.roughness = 0.8f;
+    materials.AddMaterial(material);
+  }
+  materials.Upload();
+
+  game::SceneRenderer renderer;
+  game::PostProcess post_process;
+  if (!renderer.Initialize(shader_directory, materials.IsBindless()) ||
+      !post_process.Initialize(shader_directory)) {
+    std::cerr << "Can't load shaders." << std::endl;
+    return false;
+  }
+  renderer.Resize(width, height);
+  post_process.Resize(width, height);
+
+  game::DrawBatcher batcher;
+  auto scene = CreateDungeonScene(map, batcher);
+
+  glfwSetWindowUserPointer(window, &renderer);
+  glfwSetKeyCallback(window, [](GLFWwindow* window, int key, int scancode,
+                                int action, int mods) {
+    if (key != kRenderPathKey || action != GLFW_PRESS) {
+      return;
+    }
+    auto* renderer =
+        static_cast<game::SceneRenderer*>(glfwGetWindowUserPointer(window));
+    renderer->SetRenderPath(
+        renderer->GetRenderPath() == game::RenderPath::kForward
+            ? game::RenderPath::kTiledDeferred
+            : game::RenderPath::kForward);
+    std::cout << "Render path: "
+              << GetRenderPathName(renderer->GetRenderPath()) << std::endl;
+  });
+
+  // 最初の光源の下から見回す
+  auto eye = scene.lights.empty()
+                 ? glm::vec3(dungeon_settings.size.x, 0.0f,
+                             dungeon_settings.size.y) *
+                       (game::kTileWorldSize * 0.5f)
+                 : scene.lights.front().position;
+  eye.y = game::kWallHeight * 0.5f;
+  game::SceneView view;
+  view.near_plane = 0.1f;
+  view.far_plane = 200.0f;
+  view.projection = glm::perspective(
+      glm::radians(60.0f), static_cast<float>(width) / height,
+      view.near_plane, view.far_plane);
+  const glm::vec3 ambient(0.03f);
+  game::PostProcessSettings post_settings;
+  game::GpuProfiler profiler;
+  auto& state = game::GlStateCache::GetInstance();
+
+  auto previous_time = glfwGetTime();
+  for (int frame = 1; glfwWindowShouldClose(window) == GL_FALSE; ++frame) {
+    const auto time = glfwGetTime();
+    const auto delta_time = static_cast<float>(time - previous_time);
+    previous_time = time;
+    profiler.BeginFrame();
+
+    const auto yaw = static_cast<float>(time) * 0.2f;
+    view.view =
+        glm::lookAt(eye, eye + glm::vec3(std::cos(yaw), 0.0f, std::sin(yaw)),
+                    glm::vec3(0.0f, 1.0f, 0.0f));
+
+    const auto scene_texture = renderer.Render(
+        view, scene.lights, ambient,
+        [&] {
+          materials.Bind();
+          state.BindVertexArray(scene.vertex_array);
+          batcher.Draw(0);
+        },
+        job_system, &profiler);
+    post_process.Apply(scene_texture, 0, delta_time, post_settings, &profiler);
+    state.EndFrame(&profiler);
+
+    if (frame % kTimingReportInterval == 0) {
+      std::cout << GetRenderPathName(renderer.GetRenderPath()) << ":";
+      for (const auto& timing : profiler.GetTimings()) {
+        std::cout << " " << timing.name << " " << timing.milliseconds
+                  << " ms,";
+      }
+      std::cout << " total " << profiler.GetTotalMilliseconds() << " ms"
+                << std::endl;
+    }
+
+    glfwSwapBuffers(window);
+    glfwPollEvents();
+  }
+
+  glfwSetKeyCallback(window, nullptr);
+  DeleteDungeonScene(scene);
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  for (int i = 1; i < argc; ++i) {
+    if (std::string(argv[i]) == kBenchmarkOption) {
+      RunBenchmarks();
+      return 0;
+    }
+  }
 
-int main() {
   // GLFW エラーのコールバック
   glfwSetErrorCallback(
       [](auto id, auto description) { std::cerr << description << std::endl; });
@@ -56,9 +301,11 @@ int main() {
       0);
 
   // メインループ
-  while (glfwWindowShouldClose(window) == GL_FALSE) {
-    glfwSwapBuffers(window);
-    glfwPollEvents();
+  // GLのオブジェクトはRunDungeonSceneの中で作って消すので、
+  // glfwTerminateより前に全て削除される
+  if (!RunDungeonScene(window, width, height)) {
+    glfwTerminate();
+    return false;
   }
 
   glfwTerminate();
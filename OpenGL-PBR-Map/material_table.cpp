@@ -0,0 +1,201 @@
+#include "material_table.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "gl_state_cache.h"
+
+namespace game {
+
+MaterialTable::MaterialTable(int array_texture_size, int array_layer_count)
+    : array_texture_size_(array_texture_size),
+      array_layer_count_(array_layer_count),
+      initialized_(false),
+      bindless_(false),
+      dirty_(false),
+      material_buffer_(0),
+      material_buffer_size_(0),
+      color_array_(0),
+      data_array_(0),
+      color_layer_count_(0),
+      data_layer_count_(0),
+      read_framebuffer_(0),
+      draw_framebuffer_(0),
+      arrays_dirty_(false) {}
+
+MaterialTable::~MaterialTable() {
+  if (!initialized_) {
+    return;
+  }
+  if (bindless_) {
+    for (const auto& texture : textures_) {
+      glMakeTextureHandleNonResidentARB(texture.handle);
+    }
+  } else {
+    auto& state = GlStateCache::GetInstance();
+    state.DeleteTextures(1, &color_array_);
+    state.DeleteTextures(1, &data_array_);
+    glDeleteFramebuffers(1, &read_framebuffer_);
+    glDeleteFramebuffers(1, &draw_framebuffer_);
+  }
+  glDeleteBuffers(1, &material_buffer_);
+}
+
+std::uint32_t MaterialTable::AddTexture(GLuint texture, bool color) {
+  if (!initialized_) {
+    Initialize();
+  }
+
+  TextureEntry entry = {0, -1, color};
+  if (bindless_) {
+    // ハンドルを作った後はテクスチャの状態を変えられないので、
+    // 呼び出し側でミップマップまで作っておくこと
+    entry.handle = glGetTextureHandleARB(texture);
+    glMakeTextureHandleResidentARB(entry.handle);
+  } else {
+    auto& layer_count = color ? color_layer_count_ : data_layer_count_;
+    if (layer_count >= array_layer_count_) {
+      std::cerr << "Can't add texture " << texture
+                << ": material texture array is full." << std::endl;
+      return kNoMaterialTexture;
+    }
+    entry.layer = layer_count++;
+
+    // 大きさの違うテクスチャもあるので、ブリットで拡大縮小して写す。
+    // GL_FRAMEBUFFER_SRGBが無効ならsRGBの値はそのまま写る
+    GLint width;
+    GLint height;
+    glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_HEIGHT, &height);
+    glNamedFramebufferTexture(read_framebuffer_, GL_COLOR_ATTACHMENT0, texture,
+                              0);
+    glNamedFramebufferTextureLayer(draw_framebuffer_, GL_COLOR_ATTACHMENT0,
+                                   color ? color_array_ : data_array_, 0,
+                                   entry.layer);
+    glBlitNamedFramebuffer(read_framebuffer_, draw_framebuffer_, 0, 0, width,
+                           height, 0, 0, array_texture_size_,
+                           array_texture_size_, GL_COLOR_BUFFER_BIT,
+                           GL_LINEAR);
+    arrays_dirty_ = true;
+  }
+  textures_.push_back(entry);
+  return static_cast<std::uint32_t>(textures_.size() - 1);
+}
+
+std::uint32_t MaterialTable::AddMaterial(const MaterialDesc& material) {
+  materials_.push_back(material);
+  dirty_ = true;
+  return static_cast<std::uint32_t>(materials_.size() - 1);
+}
+
+void MaterialTable::SetMaterial(std::uint32_t index,
+                                const MaterialDesc& material) {
+  materials_[index] = material;
+  dirty_ = true;
+}
+
+const MaterialDesc& MaterialTable::GetMaterial(std::uint32_t index) const {
+  return materials_[index];
+}
+
+std::size_t MaterialTable::GetMaterialCount() const {
+  return materials_.size();
+}
+
+void MaterialTable::Upload() {
+  if (!initialized_) {
+    Initialize();
+  }
+  if (arrays_dirty_) {
+    glGenerateTextureMipmap(color_array_);
+    glGenerateTextureMipmap(data_array_);
+    arrays_dirty_ = false;
+  }
+  if (!dirty_) {
+    return;
+  }
+  dirty_ = false;
+
+  std::vector<GpuMaterial> gpu_materials;
+  gpu_materials.reserve(materials_.size());
+  for (const auto& material : materials_) {
+    gpu_materials.push_back(ToGpuMaterial(material));
+  }
+  const auto size =
+      static_cast<GLsizeiptr>(gpu_materials.size() * sizeof(GpuMaterial));
+  if (size > material_buffer_size_) {
+    material_buffer_size_ = std::max(size, material_buffer_size_ * 2);
+    glNamedBufferData(material_buffer_, material_buffer_size_, nullptr,
+                      GL_DYNAMIC_DRAW);
+  }
+  if (size > 0) {
+    glNamedBufferSubData(material_buffer_, 0, size, gpu_materials.data());
+  }
+}
+
+void MaterialTable::Bind() const {
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kMaterialBufferBinding,
+                   material_buffer_);
+  if (!bindless_) {
+    auto& state = GlStateCache::GetInstance();
+    state.BindTextureUnit(kColorArrayUnit, color_array_);
+    state.BindTextureUnit(kDataArrayUnit, data_array_);
+  }
+}
+
+bool MaterialTable::IsBindless() const { return bindless_; }
+
+GpuMaterial MaterialTable::ToGpuMaterial(const MaterialDesc& material) const {
+  GpuMaterial gpu_material = {};
+  gpu_material.base_color = material.base_color;
+  gpu_material.emissive = glm::vec4(material.emissive, 0.0f);
+  gpu_material.metallic = material.metallic;
+  gpu_material.roughness = material.roughness;
+  gpu_material.occlusion_strength = material.occlusion_strength;
+  gpu_material.flags = material.flags;
+  for (int slot = 0; slot < kMaterialTextureSlotCount; ++slot) {
+    const auto index = material.textures[slot];
+    if (index == kNoMaterialTexture) {
+      gpu_material.texture_handles[slot] = glm::uvec2(0);
+      gpu_material.texture_layers[slot] = -1;
+      continue;
+    }
+    const auto& texture = textures_[index];
+    gpu_material.texture_handles[slot] =
+        glm::uvec2(static_cast<std::uint32_t>(texture.handle),
+                   static_cast<std::uint32_t>(texture.handle >> 32));
+    gpu_material.texture_layers[slot] = texture.layer;
+  }
+  return gpu_material;
+}
+
+void MaterialTable::Initialize() {
+  initialized_ = true;
+  bindless_ = GLEW_ARB_bindless_texture != GL_FALSE;
+  glCreateBuffers(1, &material_buffer_);
+  if (bindless_) {
+    return;
+  }
+
+  const auto level_count =
+      static_cast<GLsizei>(std::log2(array_texture_size_)) + 1;
+  glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &color_array_);
+  glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &data_array_);
+  glTextureStorage3D(color_array_, level_count, GL_SRGB8_ALPHA8,
+                     array_texture_size_, array_texture_size_,
+                     array_layer_count_);
+  glTextureStorage3D(data_array_, level_count, GL_RGBA8, array_texture_size_,
+                     array_texture_size_, array_layer_count_);
+  for (const auto texture : {color_array_, data_array_}) {
+    glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER,
+                        GL_LINEAR_MIPMAP_LINEAR);
+    glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  }
+  glCreateFramebuffers(1, &read_framebuffer_);
+  glCreateFramebuffers(1, &draw_framebuffer_);
+}
+
+}  // namespace game
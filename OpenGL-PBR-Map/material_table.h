@@ -0,0 +1,170 @@
+#ifndef OPENGL_PBR_MAP_MATERIAL_TABLE_H_
+#define OPENGL_PBR_MAP_MATERIAL_TABLE_H_
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace game {
+
+/**
+ * @brief マテリアルが参照するテクスチャの種類
+ */
+enum class MaterialTextureSlot {
+  kBaseColor,
+  kNormal,
+  kMetallicRoughness,
+  kOcclusion,
+};
+
+constexpr int kMaterialTextureSlotCount = 4;
+
+// マテリアルのフラグ
+constexpr std::uint32_t kMaterialAlphaTest = 1u << 0;
+constexpr std::uint32_t kMaterialDoubleSided = 1u << 1;
+
+// テクスチャを持たないことを表すテクスチャの番号
+constexpr std::uint32_t kNoMaterialTexture = 0xffffffffu;
+
+/**
+ * @brief マテリアルの係数と参照するテクスチャ
+ */
+struct MaterialDesc {
+  glm::vec4 base_color{1.0f};
+  glm::vec3 emissive{0.0f};
+  float metallic = 0.0f;
+  float roughness = 1.0f;
+  float occlusion_strength = 1.0f;
+  std::uint32_t flags = 0;
+  // MaterialTable::AddTextureが返した番号をスロットの順に並べる
+  std::array<std::uint32_t, kMaterialTextureSlotCount> textures{
+      kNoMaterialTexture, kNoMaterialTexture, kNoMaterialTexture,
+      kNoMaterialTexture};
+};
+
+/**
+ * @brief シェーダーがSSBOから読むマテリアル (std430)
+ *
+ * テクスチャはbindlessならハンドルを、そうでなければテクスチャ配列の
+ * レイヤーを持ち、持たないスロットはハンドルが0でレイヤーが-1になる。
+ */
+struct GpuMaterial {
+  glm::vec4 base_color;
+  // xyzが発光、wは未使用
+  glm::vec4 emissive;
+  float metallic;
+  float roughness;
+  float occlusion_strength;
+  std::uint32_t flags;
+  // 64ビットのハンドルを下位、上位の順に2つの32ビットに分けたもの
+  glm::uvec2 texture_handles[kMaterialTextureSlotCount];
+  glm::ivec4 texture_layers;
+};
+
+/**
+ * @brief 全てのマテリアルを1つのSSBOに置き、描画の間のテクスチャの
+ *        バインドをなくす
+ *
+ * シェーダーはDrawBatcherのインスタンスが持つマテリアルの番号で
+ * マテリアルを読み (shaders/materials.glsl)、ARB_bindless_textureが
+ * 使えればテクスチャのハンドルから直接サンプリングする。使えなければ
+ * テクスチャをカラー用 (sRGB) とデータ用 (線形) の2つのテクスチャ配列に
+ * 写し、レイヤーの番号でサンプリングする。どちらの場合もパス全体を
+ * glBindTextureなしで描ける。
+ */
+class MaterialTable {
+ public:
+  // マテリアルのSSBOのバインディング番号
+  static constexpr GLuint kMaterialBufferBinding = 1;
+  // テクスチャ配列を使う場合のテクスチャユニット
+  static constexpr GLuint kColorArrayUnit = 8;
+  static constexpr GLuint kDataArrayUnit = 9;
+
+  /**
+   * @brief コンストラクタ
+   * @param array_texture_size テクスチャ配列の一辺の解像度
+   * @param array_layer_count テクスチャ配列1つあたりのレイヤー数
+   *
+   * bindlessが使えるかどうかは最初のAddTextureで調べる。
+   */
+  explicit MaterialTable(int array_texture_size = 1024,
+                         int array_layer_count = 64);
+  ~MaterialTable();
+
+  MaterialTable(const MaterialTable&) = delete;
+  MaterialTable& operator=(const MaterialTable&) = delete;
+
+  /**
+   * @brief テクスチャを登録する
+   * @param texture 2Dテクスチャの名前、ミップマップを持つこと
+   * @param color sRGBのカラーテクスチャならtrue
+   * @return テクスチャの番号、レイヤーが足りなければkNoMaterialTexture
+   *
+   * テクスチャ配列を使う場合はこの時点で配列に写すので、元のテクスチャは
+   * 削除してよい。bindlessの場合は削除してはいけない。
+   */
+  std::uint32_t AddTexture(GLuint texture, bool color);
+
+  /**
+   * @brief マテリアルを追加する
+   * @param material マテリアル
+   * @return マテリアルの番号
+   */
+  std::uint32_t AddMaterial(const MaterialDesc& material);
+
+  void SetMaterial(std::uint32_t index, const MaterialDesc& material);
+  const MaterialDesc& GetMaterial(std::uint32_t index) const;
+  std::size_t GetMaterialCount() const;
+
+  /**
+   * @brief 変更があればマテリアルをSSBOに書き込む
+   */
+  void Upload();
+
+  /**
+   * @brief SSBOと、テクスチャ配列を使う場合は配列をバインドする
+   *
+   * パスの最初に1回だけ呼べばよい。
+   */
+  void Bind() const;
+
+  bool IsBindless() const;
+
+ private:
+  struct TextureEntry {
+    GLuint64 handle;
+    int layer;
+    bool color;
+  };
+
+  GpuMaterial ToGpuMaterial(const MaterialDesc& material) const;
+  // bindlessが使えるか調べ、バッファと必要ならテクスチャ配列を作る
+  void Initialize();
+
+  int array_texture_size_;
+  int array_layer_count_;
+  bool initialized_;
+  bool bindless_;
+  std::vector<TextureEntry> textures_;
+  std::vector<MaterialDesc> materials_;
+  bool dirty_;
+
+  GLuint material_buffer_;
+  GLsizeiptr material_buffer_size_;
+  // テクスチャ配列と、レイヤーに写すためのフレームバッファ
+  GLuint color_array_;
+  GLuint data_array_;
+  int color_layer_count_;
+  int data_layer_count_;
+  GLuint read_framebuffer_;
+  GLuint draw_framebuffer_;
+  // 写した後にミップマップを作り直す必要があるか
+  bool arrays_dirty_;
+};
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_MATERIAL_TABLE_H_
@@ -0,0 +1,295 @@
+#include "occlusion_culler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "job_system.h"
+#include "simd.h"
+
+namespace game {
+
+namespace {
+
+// 近クリップ面で切り取った多角形の最大頂点数
+constexpr int kMaxClippedVertices = 4;
+// 被遮蔽物の矩形が階層の1段でまたいでよいタイル数
+constexpr int kMaxTestSpan = 4;
+
+// 三角形をz >= -wの側で切り取る
+int ClipNear(const glm::vec4 (&input)[3],
+             glm::vec4 (&output)[kMaxClippedVertices]) {
+  int count = 0;
+  for (int i = 0; i < 3; ++i) {
+    const auto& a = input[i];
+    const auto& b = input[(i + 1) % 3];
+    const float da = a.z + a.w;
+    const float db = b.z + b.w;
+    if (da >= 0.0f) {
+      output[count++] = a;
+    }
+    if ((da >= 0.0f) != (db >= 0.0f)) {
+      output[count++] = glm::mix(a, b, da / (da - db));
+    }
+  }
+  return count;
+}
+
+}  // namespace
+
+OcclusionCuller::OcclusionCuller(int width, int height)
+    : width_((width + kTileSize - 1) / kTileSize * kTileSize),
+      height_((height + kTileSize - 1) / kTileSize * kTileSize),
+      view_projection_(1.0f),
+      depth_(static_cast<std::size_t>(width_) * height_, 1.0f) {
+  auto size = glm::ivec2(width_, height_) / kTileSize;
+  while (true) {
+    hierarchy_sizes_.push_back(size);
+    hierarchy_.emplace_back(static_cast<std::size_t>(size.x) * size.y, 1.0f);
+    if (size.x == 1 && size.y == 1) {
+      break;
+    }
+    size = glm::max((size + 1) / 2, glm::ivec2(1));
+  }
+}
+
+void OcclusionCuller::BeginFrame(const glm::mat4& view_projection) {
+  view_projection_ = view_projection;
+  std::fill(depth_.begin(), depth_.end(), 1.0f);
+}
+
+void OcclusionCuller::RenderOccluder(
+    const std::vector<glm::vec3>& positions,
+    const std::vector<std::uint32_t>& indices) {
+  const glm::vec2 viewport(static_cast<float>(width_),
+                           static_cast<float>(height_));
+  // クリップ座標をピクセル単位の画面座標と[0, 1]の深度にする
+  auto to_screen = [&viewport](const glm::vec4& clip) {
+    const auto ndc = glm::vec3(clip) / clip.w;
+    return glm::vec3((glm::vec2(ndc) * 0.5f + 0.5f) * viewport,
+                     ndc.z * 0.5f + 0.5f);
+  };
+
+  for (std::size_t i = 0; i + 2 < indices.size(); i += 3) {
+    const glm::vec4 clip[3] = {
+        view_projection_ * glm::vec4(positions[indices[i + 0]], 1.0f),
+        view_projection_ * glm::vec4(positions[indices[i + 1]], 1.0f),
+        view_projection_ * glm::vec4(positions[indices[i + 2]], 1.0f)};
+    if (clip[0].z >= -clip[0].w && clip[1].z >= -clip[1].w &&
+        clip[2].z >= -clip[2].w) {
+      RasterizeTriangle(to_screen(clip[0]), to_screen(clip[1]),
+                        to_screen(clip[2]));
+      continue;
+    }
+    glm::vec4 clipped[kMaxClippedVertices];
+    const int count = ClipNear(clip, clipped);
+    for (int j = 2; j < count; ++j) {
+      RasterizeTriangle(to_screen(clipped[0]), to_screen(clipped[j - 1]),
+                        to_screen(clipped[j]));
+    }
+  }
+}
+
+void OcclusionCuller::RasterizeTriangle(const glm::vec3& v0,
+                                        const glm::vec3& v1,
+                                        const glm::vec3& v2) {
+  const float area = (v1.x - v0.x) * (v2.y - v0.y) -
+                     (v2.x - v0.x) * (v1.y - v0.y);
+  // 裏面と面積のない三角形は描かない
+  if (!(area > 0.0f)) {
+    return;
+  }
+
+  const auto min = glm::min(glm::min(v0, v1), v2);
+  const auto max = glm::max(glm::max(v0, v1), v2);
+  const int x_begin = std::max(static_cast<int>(std::floor(min.x)), 0);
+  const int y_begin = std::max(static_cast<int>(std::floor(min.y)), 0);
+  const int x_end = std::min(static_cast<int>(std::ceil(max.x)), width_);
+  const int y_end = std::min(static_cast<int>(std::ceil(max.y)), height_);
+  if (x_begin >= x_end || y_begin >= y_end) {
+    return;
+  }
+
+  // 辺関数 e = a * x + b * y + cが全ての辺で0以上なら内側
+  const glm::vec3 edge_a(v0.y - v1.y, v1.y - v2.y, v2.y - v0.y);
+  const glm::vec3 edge_b(v1.x - v0.x, v2.x - v1.x, v0.x - v2.x);
+  const glm::vec3 edge_c(-(edge_a.x * v0.x + edge_b.x * v0.y),
+                         -(edge_a.y * v1.x + edge_b.y * v1.y),
+                         -(edge_a.z * v2.x + edge_b.z * v2.y));
+  // 深度は画面上で線形なので平面の式で求める
+  const float inverse_area = 1.0f / area;
+  const float depth_dx =
+      ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) *
+      inverse_area;
+  const float depth_dy =
+      ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) *
+      inverse_area;
+  const float depth_c = v0.z - depth_dx * v0.x - depth_dy * v0.y;
+
+  // 4ピクセル単位で処理するので開始位置をそろえる (幅は8の倍数)
+  const int x_aligned = x_begin & ~3;
+  for (int y = y_begin; y < y_end; ++y) {
+    const float py = static_cast<float>(y) + 0.5f;
+    float* row = depth_.data() + static_cast<std::size_t>(y) * width_;
+    const auto row_edge = edge_b * py + edge_c;
+    const float row_depth = depth_dy * py + depth_c;
+    int x = x_aligned;
+#ifdef GAME_SIMD_SSE2
+    const __m128 lane_offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+    const __m128 zero = _mm_setzero_ps();
+    for (; x < x_end; x += 4) {
+      const __m128 px =
+          _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), lane_offsets);
+      const __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edge_a.x), px),
+                                   _mm_set1_ps(row_edge.x));
+      const __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edge_a.y), px),
+                                   _mm_set1_ps(row_edge.y));
+      const __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edge_a.z), px),
+                                   _mm_set1_ps(row_edge.z));
+      const __m128 inside = _mm_and_ps(
+          _mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)),
+          _mm_cmpge_ps(e2, zero));
+      if (_mm_movemask_ps(inside) == 0) {
+        continue;
+      }
+      const __m128 depth = _mm_add_ps(
+          _mm_mul_ps(_mm_set1_ps(depth_dx), px), _mm_set1_ps(row_depth));
+      const __m128 old_depth = _mm_loadu_ps(row + x);
+      const __m128 new_depth = _mm_min_ps(old_depth, depth);
+      _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, new_depth),
+                                      _mm_andnot_ps(inside, old_depth)));
+    }
+#endif
+    for (; x < x_end; ++x) {
+      const float px = static_cast<float>(x) + 0.5f;
+      const auto e = edge_a * px + row_edge;
+      if (e.x >= 0.0f && e.y >= 0.0f && e.z >= 0.0f) {
+        row[x] = std::min(row[x], depth_dx * px + row_depth);
+      }
+    }
+  }
+}
+
+void OcclusionCuller::Finish() {
+  // 0段目はタイル内のピクセルの最大深度
+  const auto& base_size = hierarchy_sizes_[0];
+  auto& base = hierarchy_[0];
+  for (int ty = 0; ty < base_size.y; ++ty) {
+    for (int tx = 0; tx < base_size.x; ++tx) {
+      float max_depth = 0.0f;
+      for (int y = ty * kTileSize; y < (ty + 1) * kTileSize; ++y) {
+        const float* row =
+            depth_.data() + static_cast<std::size_t>(y) * width_ +
+            tx * kTileSize;
+        for (int x = 0; x < kTileSize; ++x) {
+          max_depth = std::max(max_depth, row[x]);
+        }
+      }
+      base[static_cast<std::size_t>(ty) * base_size.x + tx] = max_depth;
+    }
+  }
+
+  for (std::size_t level = 1; level < hierarchy_.size(); ++level) {
+    const auto& source_size = hierarchy_sizes_[level - 1];
+    const auto& source = hierarchy_[level - 1];
+    const auto& size = hierarchy_sizes_[level];
+    auto& destination = hierarchy_[level];
+    for (int y = 0; y < size.y; ++y) {
+      for (int x = 0; x < size.x; ++x) {
+        float max_depth = 0.0f;
+        for (int sy = y * 2; sy < std::min(y * 2 + 2, source_size.y); ++sy) {
+          for (int sx = x * 2; sx < std::min(x * 2 + 2, source_size.x);
+               ++sx) {
+            max_depth = std::max(
+                max_depth,
+                source[static_cast<std::size_t>(sy) * source_size.x + sx]);
+          }
+        }
+        destination[static_cast<std::size_t>(y) * size.x + x] = max_depth;
+      }
+    }
+  }
+}
+
+bool OcclusionCuller::IsVisible(const AABB& bounds) const {
+  // 8頂点を投影して画面上の矩形と最も手前の深度を求める
+  glm::vec2 screen_min(std::numeric_limits<float>::infinity());
+  glm::vec2 screen_max(-std::numeric_limits<float>::infinity());
+  float nearest_depth = 1.0f;
+  int behind_count = 0;
+  for (int i = 0; i < 8; ++i) {
+    const glm::vec3 corner((i & 1) ? bounds.max.x : bounds.min.x,
+                           (i & 2) ? bounds.max.y : bounds.min.y,
+                           (i & 4) ? bounds.max.z : bounds.min.z);
+    const auto clip = view_projection_ * glm::vec4(corner, 1.0f);
+    if (clip.z < -clip.w) {
+      ++behind_count;
+      continue;
+    }
+    const auto ndc = glm::vec3(clip) / clip.w;
+    screen_min = glm::min(screen_min, glm::vec2(ndc));
+    screen_max = glm::max(screen_max, glm::vec2(ndc));
+    nearest_depth = std::min(nearest_depth, ndc.z * 0.5f + 0.5f);
+  }
+  // 全て近クリップ面の後ろなら見えず、またぐ箱は視点のすぐ近くなので
+  // 見えるとする
+  if (behind_count > 0) {
+    return behind_count < 8;
+  }
+  const glm::vec2 viewport(static_cast<float>(width_),
+                           static_cast<float>(height_));
+  screen_min = (screen_min * 0.5f + 0.5f) * viewport;
+  screen_max = (screen_max * 0.5f + 0.5f) * viewport;
+  const glm::ivec2 pixel_min = glm::max(
+      glm::ivec2(glm::floor(screen_min)), glm::ivec2(0));
+  const glm::ivec2 pixel_max = glm::min(
+      glm::ivec2(glm::ceil(screen_max)) - 1,
+      glm::ivec2(width_ - 1, height_ - 1));
+  if (pixel_min.x > pixel_max.x || pixel_min.y > pixel_max.y) {
+    return false;
+  }
+
+  // 矩形が数タイルに収まる段で、手前の深度より奥のタイルしかなければ隠れている
+  std::size_t level = 0;
+  auto tile_min = pixel_min / kTileSize;
+  auto tile_max = pixel_max / kTileSize;
+  while (level + 1 < hierarchy_.size() &&
+         glm::any(glm::greaterThanEqual(tile_max - tile_min,
+                                        glm::ivec2(kMaxTestSpan)))) {
+    ++level;
+    tile_min /= 2;
+    tile_max /= 2;
+  }
+  const auto& size = hierarchy_sizes_[level];
+  const auto& tiles = hierarchy_[level];
+  for (int y = tile_min.y; y <= tile_max.y; ++y) {
+    for (int x = tile_min.x; x <= tile_max.x; ++x) {
+      if (nearest_depth <= tiles[static_cast<std::size_t>(y) * size.x + x]) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void OcclusionCuller::TestVisibility(const std::vector<AABB>& bounds,
+                                     std::vector<std::uint8_t>& visible,
+                                     JobSystem& job_system) const {
+  visible.resize(bounds.size());
+  job_system.ParallelFor(bounds.size(), 256,
+                         [&](std::size_t begin, std::size_t end) {
+                           for (auto i = begin; i < end; ++i) {
+                             visible[i] = IsVisible(bounds[i]) ? 1 : 0;
+                           }
+                         });
+}
+
+int OcclusionCuller::GetWidth() const { return width_; }
+
+int OcclusionCuller::GetHeight() const { return height_; }
+
+float OcclusionCuller::GetDepth(int x, int y) const {
+  return depth_[static_cast<std::size_t>(y) * width_ + x];
+}
+
+}  // namespace game
@@ -0,0 +1,104 @@
+#ifndef OPENGL_PBR_MAP_OCCLUSION_CULLER_H_
+#define OPENGL_PBR_MAP_OCCLUSION_CULLER_H_
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "aabb.h"
+
+namespace game {
+
+class JobSystem;
+
+/**
+ * @brief CPUでの深度ラスタライズによるオクルージョンカリング
+ *
+ * 遮蔽物の簡略メッシュを小さな深度バッファに描き、8x8ピクセルのタイルごとの
+ * 最大深度からなる階層を作る。被遮蔽物のバウンディングボックスは投影した
+ * 矩形の最も手前の深度を階層の最大深度と比べて判定する。
+ * GPUからの読み戻しがないので遅延がなく、ウィンドウなしでも動く。
+ *
+ * 1フレームの使い方はBeginFrame、RenderOccluderを遮蔽物の数だけ、
+ * Finishの順に呼んだ後、IsVisibleかTestVisibilityで判定する。
+ */
+class OcclusionCuller {
+ public:
+  // 階層の最下段のタイルの一辺のピクセル数
+  static constexpr int kTileSize = 8;
+
+  /**
+   * @brief コンストラクタ
+   * @param width 深度バッファの幅 (kTileSizeの倍数に切り上げる)
+   * @param height 深度バッファの高さ (kTileSizeの倍数に切り上げる)
+   */
+  OcclusionCuller(int width, int height);
+
+  /**
+   * @brief 深度バッファを消去してフレームを始める
+   * @param view_projection ビュー射影行列 (クリップ空間のzは[-w, w])
+   */
+  void BeginFrame(const glm::mat4& view_projection);
+
+  /**
+   * @brief 遮蔽物を深度バッファに描く
+   * @param positions ワールド座標の頂点
+   * @param indices 三角形リストのインデックス
+   *
+   * 反時計回りを表とし、裏面は描かない。近クリップ面と交わる三角形は
+   * 切り取ってから描く。
+   */
+  void RenderOccluder(const std::vector<glm::vec3>& positions,
+                      const std::vector<std::uint32_t>& indices);
+
+  /**
+   * @brief 深度バッファから最大深度の階層を作る
+   */
+  void Finish();
+
+  /**
+   * @brief バウンディングボックスが見える可能性があるか
+   * @param bounds ワールド座標のバウンディングボックス
+   * @return 遮蔽物に完全に隠れているか画面外ならfalse
+   */
+  bool IsVisible(const AABB& bounds) const;
+
+  /**
+   * @brief 複数のバウンディングボックスを並列に判定する
+   * @param bounds ワールド座標のバウンディングボックス
+   * @param visible 見える可能性があれば1、なければ0の出力
+   * @param job_system 判定に使うジョブシステム
+   */
+  void TestVisibility(const std::vector<AABB>& bounds,
+                      std::vector<std::uint8_t>& visible,
+                      JobSystem& job_system) const;
+
+  int GetWidth() const;
+  int GetHeight() const;
+
+  /**
+   * @brief ピクセルの深度を取得する
+   * @param x X座標
+   * @param y Y座標 (下が0)
+   * @return [0, 1]の深度、遮蔽物がなければ1
+   */
+  float GetDepth(int x, int y) const;
+
+ private:
+  void RasterizeTriangle(const glm::vec3& v0, const glm::vec3& v1,
+                         const glm::vec3& v2);
+
+  int width_;
+  int height_;
+  glm::mat4 view_projection_;
+  // 下の行から順に並べたピクセルの深度
+  std::vector<float> depth_;
+  // 各段のタイルの最大深度。0段目がkTileSize四方で、以降は2x2ずつまとめる
+  std::vector<std::vector<float>> hierarchy_;
+  std::vector<glm::ivec2> hierarchy_sizes_;
+};
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_OCCLUSION_CULLER_H_
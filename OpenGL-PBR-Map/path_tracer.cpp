@@ -0,0 +1,155 @@
+#include "path_tracer.h"
+
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace game {
+
+namespace {
+
+constexpr float kRayOffset = 1.0e-3f;
+// この反射回数以降はロシアンルーレットで打ち切る
+constexpr int kRussianRouletteBounce = 2;
+
+}  // namespace
+
+glm::vec3 OffsetRayOrigin(const glm::vec3& position,
+                          const glm::vec3& normal) {
+  return position + normal * kRayOffset;
+}
+
+PathTracer::PathTracer(const BakeScene& scene, int max_bounces)
+    : scene_(scene), max_bounces_(max_bounces) {
+  const auto triangle_count = scene.bvh.GetTriangleCount();
+  triangle_normals_.resize(triangle_count);
+  for (std::size_t i = 0; i < triangle_count; ++i) {
+    glm::vec3 v[3];
+    scene.bvh.GetTriangle(static_cast<std::uint32_t>(i), v);
+    const auto n = glm::cross(v[1] - v[0], v[2] - v[0]);
+    const float length = glm::length(n);
+    triangle_normals_[i] = length > 0.0f ? n / length : glm::vec3(0.0f);
+  }
+}
+
+bool PathTracer::TraceSurface(const Ray& ray, SurfaceHit& hit) const {
+  RayHit ray_hit;
+  if (!scene_.bvh.Intersect(ray, ray_hit)) {
+    return false;
+  }
+  hit.position = ray.origin + ray.direction * ray_hit.t;
+  hit.normal = triangle_normals_[ray_hit.triangle];
+  hit.triangle = ray_hit.triangle;
+  hit.t = ray_hit.t;
+  hit.front_face = glm::dot(hit.normal, ray.direction) < 0.0f;
+  return true;
+}
+
+glm::vec3 PathTracer::TraceRadiance(const Ray& ray, Pcg32& random) const {
+  glm::vec3 radiance(0.0f);
+  glm::vec3 throughput(1.0f);
+  Ray current = ray;
+
+  for (int bounce = 0;; ++bounce) {
+    SurfaceHit hit;
+    if (!TraceSurface(current, hit)) {
+      radiance += throughput * scene_.sky_radiance;
+      break;
+    }
+    if (!scene_.emission.empty()) {
+      radiance += throughput * scene_.emission[hit.triangle];
+    }
+
+    // 面は両面とも同じLambert面として扱う
+    const auto normal = hit.front_face ? hit.normal : -hit.normal;
+    const auto& albedo = scene_.albedo[hit.triangle];
+    radiance += throughput * albedo * glm::one_over_pi<float>() *
+                ComputeDirectIrradiance(hit.position, normal);
+
+    if (bounce >= max_bounces_) {
+      break;
+    }
+
+    // コサイン分布のpdfとLambertのBRDFが打ち消し合ってalbedoだけが残る
+    throughput *= albedo;
+    if (bounce >= kRussianRouletteBounce) {
+      const float survival = std::min(
+          std::max(std::max(throughput.r, throughput.g), throughput.b), 0.95f);
+      if (random.NextFloat() >= survival) {
+        break;
+      }
+      throughput /= survival;
+    }
+
+    glm::vec3 tangent;
+    glm::vec3 bitangent;
+    BuildOrthonormalBasis(normal, tangent, bitangent);
+    const auto local = SampleCosineHemisphere(random.NextVec2());
+    current.origin = OffsetRayOrigin(hit.position, normal);
+    current.direction =
+        tangent * local.x + bitangent * local.y + normal * local.z;
+    current.t_min = 0.0f;
+    current.t_max = std::numeric_limits<float>::infinity();
+  }
+  return radiance;
+}
+
+glm::vec3 PathTracer::ComputeDirectIrradiance(const glm::vec3& position,
+                                              const glm::vec3& normal) const {
+  glm::vec3 irradiance(0.0f);
+  const auto origin = OffsetRayOrigin(position, normal);
+  for (const auto& light : scene_.lights) {
+    const auto to_light = light.position - origin;
+    const float distance = glm::length(to_light);
+    if (distance >= light.range || distance <= 0.0f) {
+      continue;
+    }
+    const auto direction = to_light / distance;
+    const float cos_theta = glm::dot(normal, direction);
+    if (cos_theta <= 0.0f) {
+      continue;
+    }
+    Ray shadow_ray;
+    shadow_ray.origin = origin;
+    shadow_ray.direction = direction;
+    shadow_ray.t_max = distance - kRayOffset;
+    if (scene_.bvh.IsOccluded(shadow_ray)) {
+      continue;
+    }
+    irradiance += light.intensity *
+                  EvaluatePointLightFalloff(distance, light.range) * cos_theta;
+  }
+  return irradiance;
+}
+
+glm::vec3 PathTracer::EstimateIrradiance(const glm::vec3& position,
+                                         const glm::vec3& normal,
+                                         int sample_count,
+                                         Pcg32& random) const {
+  glm::vec3 tangent;
+  glm::vec3 bitangent;
+  BuildOrthonormalBasis(normal, tangent, bitangent);
+
+  // 層化したHammersley点列をランダムにずらして使う
+  const auto shift = random.NextVec2();
+  glm::vec3 indirect(0.0f);
+  Ray ray;
+  ray.origin = OffsetRayOrigin(position, normal);
+  for (int i = 0; i < sample_count; ++i) {
+    const auto u = glm::fract(
+        Hammersley(static_cast<std::uint32_t>(i),
+                   static_cast<std::uint32_t>(sample_count)) +
+        shift);
+    const auto local = SampleCosineHemisphere(u);
+    ray.direction = tangent * local.x + bitangent * local.y + normal * local.z;
+    indirect += TraceRadiance(ray, random);
+  }
+  // pdf = cos / piなので放射照度はpi * 平均放射輝度
+  indirect *= glm::pi<float>() / static_cast<float>(sample_count);
+  return ComputeDirectIrradiance(position, normal) + indirect;
+}
+
+const BakeScene& PathTracer::GetScene() const { return scene_; }
+
+}  // namespace game
@@ -0,0 +1,114 @@
+#ifndef OPENGL_PBR_MAP_PATH_TRACER_H_
+#define OPENGL_PBR_MAP_PATH_TRACER_H_
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "bvh.h"
+#include "light.h"
+#include "sampling.h"
+
+namespace game {
+
+/**
+ * @brief ベイクに使う静的なシーン
+ *
+ * 面は全てLambert面として扱う。
+ */
+struct BakeScene {
+  Bvh bvh;
+  // 三角形ごとのアルベド
+  std::vector<glm::vec3> albedo;
+  // 三角形ごとの放射輝度、空なら自己発光なし
+  std::vector<glm::vec3> emission;
+  std::vector<PointLight> lights;
+  // 何にも当たらなかったレイが受け取る放射輝度
+  glm::vec3 sky_radiance{0.0f};
+};
+
+/**
+ * @brief レイが当たった面の情報
+ */
+struct SurfaceHit {
+  glm::vec3 position;
+  // 三角形の巻き順から求めた幾何法線
+  glm::vec3 normal;
+  std::uint32_t triangle;
+  float t;
+  // レイが法線の反対側から当たったかどうか
+  bool front_face;
+};
+
+/**
+ * @brief CPUで動くパストレーサー
+ *
+ * 点光源は次イベント推定で、それ以外の間接光はコサイン分布の
+ * 重点的サンプリングで追跡する。複数スレッドから同時に使ってよい。
+ */
+class PathTracer {
+ public:
+  /**
+   * @brief コンストラクタ
+   * @param scene 追跡するシーン、PathTracerより長く生存すること
+   * @param max_bounces 間接光の最大反射回数
+   */
+  PathTracer(const BakeScene& scene, int max_bounces);
+
+  /**
+   * @brief レイが最初に当たる面を求める
+   * @param ray 半直線
+   * @param hit 当たった場合の面の情報
+   * @return 当たったかどうか
+   */
+  bool TraceSurface(const Ray& ray, SurfaceHit& hit) const;
+
+  /**
+   * @brief レイの原点に向かって届く放射輝度を推定する
+   * @param ray 半直線
+   * @param random 乱数生成器
+   * @return 放射輝度
+   */
+  glm::vec3 TraceRadiance(const Ray& ray, Pcg32& random) const;
+
+  /**
+   * @brief 面上の点が点光源から直接受ける放射照度を求める
+   * @param position 面上の点
+   * @param normal 面の法線
+   * @return 遮蔽を考慮した放射照度
+   */
+  glm::vec3 ComputeDirectIrradiance(const glm::vec3& position,
+                                    const glm::vec3& normal) const;
+
+  /**
+   * @brief 面上の点が受ける直接光と間接光の放射照度を推定する
+   * @param position 面上の点
+   * @param normal 面の法線
+   * @param sample_count 間接光のサンプル数
+   * @param random 乱数生成器
+   * @return 放射照度
+   */
+  glm::vec3 EstimateIrradiance(const glm::vec3& position,
+                               const glm::vec3& normal, int sample_count,
+                               Pcg32& random) const;
+
+  const BakeScene& GetScene() const;
+
+ private:
+  const BakeScene& scene_;
+  int max_bounces_;
+  std::vector<glm::vec3> triangle_normals_;
+};
+
+/**
+ * @brief 自己交差を避けるため面から法線方向にずらしたレイの原点
+ * @param position 面上の点
+ * @param normal 面の法線
+ * @return ずらした原点
+ */
+glm::vec3 OffsetRayOrigin(const glm::vec3& position, const glm::vec3& normal);
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_PATH_TRACER_H_
@@ -0,0 +1,274 @@
+#include "post_process.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "gl_state_cache.h"
+#include "gpu_profiler.h"
+#include "shader_program.h"
+
+namespace game {
+
+namespace {
+
+// ヒストグラムとブルームのワークグループの一辺のピクセル数
+constexpr int kGroupSize = 16;
+// ブルームの最も小さい段の短辺のピクセル数の下限
+constexpr int kMinBloomSize = 8;
+
+GLuint DispatchCount(int size) {
+  return static_cast<GLuint>((size + kGroupSize - 1) / kGroupSize);
+}
+
+}  // namespace
+
+PostProcess::PostProcess()
+    : width_(0),
+      height_(0),
+      bloom_level_count_(0),
+      histogram_program_(0),
+      exposure_program_(0),
+      downsample_program_(0),
+      upsample_program_(0),
+      tonemap_program_(0),
+      empty_vertex_array_(0),
+      linear_sampler_(0),
+      exposure_buffer_(0),
+      scene_framebuffer_(0),
+      scene_texture_(0),
+      scene_depth_texture_(0),
+      bloom_texture_(0) {}
+
+PostProcess::~PostProcess() {
+  DeleteTargets();
+  const GLuint programs[] = {histogram_program_, exposure_program_,
+                             downsample_program_, upsample_program_,
+                             tonemap_program_};
+  for (const auto program : programs) {
+    if (program != 0) {
+      glDeleteProgram(program);
+    }
+  }
+  if (exposure_buffer_ != 0) {
+    glDeleteVertexArrays(1, &empty_vertex_array_);
+    glDeleteSamplers(1, &linear_sampler_);
+    glDeleteBuffers(1, &exposure_buffer_);
+  }
+}
+
+bool PostProcess::Initialize(const std::string& shader_directory) {
+  const auto bloom_path = shader_directory + "/bloom.comp";
+  histogram_program_ = LoadShaderProgram(
+      {{GL_COMPUTE_SHADER, shader_directory + "/luminance_histogram.comp"}});
+  exposure_program_ = LoadShaderProgram(
+      {{GL_COMPUTE_SHADER, shader_directory + "/auto_exposure.comp"}});
+  downsample_program_ = LoadShaderProgram({{GL_COMPUTE_SHADER, bloom_path}},
+                                          "#define DOWNSAMPLE");
+  upsample_program_ = LoadShaderProgram({{GL_COMPUTE_SHADER, bloom_path}},
+                                        "#define UPSAMPLE");
+  tonemap_program_ = LoadShaderProgram(
+      {{GL_VERTEX_SHADER, shader_directory + "/fullscreen.vert"},
+       {GL_FRAGMENT_SHADER, shader_directory + "/tonemap.frag"}});
+  if (histogram_program_ == 0 || exposure_program_ == 0 ||
+      downsample_program_ == 0 || upsample_program_ == 0 ||
+      tonemap_program_ == 0) {
+    return false;
+  }
+
+  // 全画面の三角形は頂点番号から作るので頂点属性はない
+  glCreateVertexArrays(1, &empty_vertex_array_);
+  // シーンのテクスチャの設定に関わらずバイリニアで読む
+  glCreateSamplers(1, &linear_sampler_);
+  glSamplerParameteri(linear_sampler_, GL_TEXTURE_MIN_FILTER,
+                      GL_LINEAR_MIPMAP_NEAREST);
+  glSamplerParameteri(linear_sampler_, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glSamplerParameteri(linear_sampler_, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glSamplerParameteri(linear_sampler_, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  // ヒストグラム、平均輝度、露出。平均輝度が0なら最初のフレームとみなす
+  const std::vector<GLuint> initial(kHistogramBinCount + 2, 0);
+  glCreateBuffers(1, &exposure_buffer_);
+  glNamedBufferStorage(exposure_buffer_, initial.size() * sizeof(GLuint),
+                       initial.data(), 0);
+  return true;
+}
+
+void PostProcess::Resize(int width, int height) {
+  if (width == width_ && height == height_) {
+    return;
+  }
+  DeleteTargets();
+  width_ = width;
+  height_ = height;
+
+  glCreateTextures(GL_TEXTURE_2D, 1, &scene_texture_);
+  glTextureStorage2D(scene_texture_, 1, GL_R11F_G11F_B10F, width, height);
+  glCreateTextures(GL_TEXTURE_2D, 1, &scene_depth_texture_);
+  glTextureStorage2D(scene_depth_texture_, 1, GL_DEPTH_COMPONENT32F, width,
+                     height);
+  glCreateFramebuffers(1, &scene_framebuffer_);
+  glNamedFramebufferTexture(scene_framebuffer_, GL_COLOR_ATTACHMENT0,
+                            scene_texture_, 0);
+  glNamedFramebufferTexture(scene_framebuffer_, GL_DEPTH_ATTACHMENT,
+                            scene_depth_texture_, 0);
+
+  // ブルームは半分の解像度から短辺がkMinBloomSizeになるまで縮める
+  bloom_level_count_ = 1;
+  auto short_side = std::min(width, height) / 2;
+  while (bloom_level_count_ < kMaxBloomLevelCount &&
+         short_side / 2 >= kMinBloomSize) {
+    short_side /= 2;
+    ++bloom_level_count_;
+  }
+  glCreateTextures(GL_TEXTURE_2D, 1, &bloom_texture_);
+  glTextureStorage2D(bloom_texture_, bloom_level_count_, GL_R11F_G11F_B10F,
+                     std::max(width / 2, 1), std::max(height / 2, 1));
+}
+
+GLuint PostProcess::GetSceneFramebuffer() const { return scene_framebuffer_; }
+
+GLuint PostProcess::GetSceneTexture() const { return scene_texture_; }
+
+void PostProcess::Apply(GLuint scene_texture, GLuint output_framebuffer,
+                        float delta_time, const PostProcessSettings& settings,
+                        GpuProfiler* profiler) {
+  {
+    GpuProfileScope scope(profiler, "Luminance histogram");
+    BuildHistogram(scene_texture, settings);
+  }
+  {
+    GpuProfileScope scope(profiler, "Auto exposure");
+    UpdateExposure(delta_time, settings);
+  }
+  {
+    GpuProfileScope scope(profiler, "Bloom");
+    RenderBloom(scene_texture);
+  }
+  {
+    GpuProfileScope scope(profiler, "Tonemap");
+    Tonemap(scene_texture, output_framebuffer, settings);
+  }
+}
+
+std::size_t PostProcess::GetMemorySize() const {
+  // シーン4 + 深度4バイト、ブルームは半分の解像度のミップマップで約3分の1
+  const auto pixels = static_cast<std::size_t>(width_) * height_;
+  return pixels * 8 + pixels / 4 * 4 * 4 / 3;
+}
+
+void PostProcess::DeleteTargets() {
+  if (scene_framebuffer_ == 0) {
+    return;
+  }
+  glDeleteFramebuffers(1, &scene_framebuffer_);
+  const GLuint textures[] = {scene_texture_, scene_depth_texture_,
+                             bloom_texture_};
+  GlStateCache::GetInstance().DeleteTextures(3, textures);
+  scene_framebuffer_ = 0;
+}
+
+void PostProcess::BuildHistogram(GLuint scene_texture,
+                                 const PostProcessSettings& settings) {
+  auto& state = GlStateCache::GetInstance();
+  state.UseProgram(histogram_program_);
+  glProgramUniform1f(histogram_program_,
+                     glGetUniformLocation(histogram_program_,
+                                          "min_log_luminance"),
+                     settings.min_log_luminance);
+  glProgramUniform1f(
+      histogram_program_,
+      glGetUniformLocation(histogram_program_, "inverse_log_luminance_range"),
+      1.0f / (settings.max_log_luminance - settings.min_log_luminance));
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kExposureBufferBinding,
+                   exposure_buffer_);
+  state.BindTextureUnit(0, scene_texture);
+  glDispatchCompute(DispatchCount(width_), DispatchCount(height_), 1);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void PostProcess::UpdateExposure(float delta_time,
+                                 const PostProcessSettings& settings) {
+  GlStateCache::GetInstance().UseProgram(exposure_program_);
+  auto set_float = [&](const char* name, float value) {
+    glProgramUniform1f(exposure_program_,
+                       glGetUniformLocation(exposure_program_, name), value);
+  };
+  set_float("min_log_luminance", settings.min_log_luminance);
+  set_float("log_luminance_range",
+            settings.max_log_luminance - settings.min_log_luminance);
+  set_float("low_percentile", settings.low_percentile);
+  set_float("high_percentile", settings.high_percentile);
+  // 時間の刻みに依存しないよう指数関数で近づける
+  set_float("adaptation",
+            1.0f - std::exp(-delta_time * settings.adaptation_rate));
+  set_float("exposure_scale", std::exp2(settings.exposure_compensation));
+  glDispatchCompute(1, 1, 1);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void PostProcess::RenderBloom(GLuint scene_texture) {
+  auto& state = GlStateCache::GetInstance();
+  // 縮小はシーンから半分の解像度の0段目へ、その後は1段ずつ小さい段へ
+  state.UseProgram(downsample_program_);
+  glBindSampler(0, linear_sampler_);
+  for (int level = 0; level < bloom_level_count_; ++level) {
+    const auto source = level == 0 ? scene_texture : bloom_texture_;
+    const auto source_level = std::max(level - 1, 0);
+    glProgramUniform1f(downsample_program_,
+                       glGetUniformLocation(downsample_program_,
+                                            "source_level"),
+                       static_cast<float>(source_level));
+    state.BindTextureUnit(0, source);
+    glBindImageTexture(0, bloom_texture_, level, GL_FALSE, 0, GL_WRITE_ONLY,
+                       GL_R11F_G11F_B10F);
+    glDispatchCompute(DispatchCount(std::max(width_ >> (level + 1), 1)),
+                      DispatchCount(std::max(height_ >> (level + 1), 1)), 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+  }
+
+  // 拡大は小さい段をぼかしながらその1つ上の段に足していく
+  state.UseProgram(upsample_program_);
+  state.BindTextureUnit(0, bloom_texture_);
+  for (int level = bloom_level_count_ - 2; level >= 0; --level) {
+    glProgramUniform1f(upsample_program_,
+                       glGetUniformLocation(upsample_program_,
+                                            "source_level"),
+                       static_cast<float>(level + 1));
+    glBindImageTexture(0, bloom_texture_, level, GL_FALSE, 0, GL_READ_WRITE,
+                       GL_R11F_G11F_B10F);
+    glDispatchCompute(DispatchCount(std::max(width_ >> (level + 1), 1)),
+                      DispatchCount(std::max(height_ >> (level + 1), 1)), 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT |
+                    GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+  }
+  glBindSampler(0, 0);
+}
+
+void PostProcess::Tonemap(GLuint scene_texture, GLuint output_framebuffer,
+                          const PostProcessSettings& settings) {
+  glBindFramebuffer(GL_FRAMEBUFFER, output_framebuffer);
+  glViewport(0, 0, width_, height_);
+  auto& state = GlStateCache::GetInstance();
+  state.SetDepthTest(false);
+  state.SetBlend(false);
+  state.UseProgram(tonemap_program_);
+  glProgramUniform1f(tonemap_program_,
+                     glGetUniformLocation(tonemap_program_,
+                                          "bloom_intensity"),
+                     settings.bloom_intensity);
+  glProgramUniform1f(tonemap_program_,
+                     glGetUniformLocation(tonemap_program_, "bloom_scale"),
+                     1.0f / bloom_level_count_);
+  state.BindTextureUnit(0, scene_texture);
+  state.BindTextureUnit(1, bloom_texture_);
+  glBindSampler(1, linear_sampler_);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kExposureBufferBinding,
+                   exposure_buffer_);
+  state.BindVertexArray(empty_vertex_array_);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  state.BindVertexArray(0);
+  glBindSampler(1, 0);
+}
+
+}  // namespace game
@@ -0,0 +1,128 @@
+#ifndef OPENGL_PBR_MAP_POST_PROCESS_H_
+#define OPENGL_PBR_MAP_POST_PROCESS_H_
+
+#include <GL/glew.h>
+
+#include <string>
+
+namespace game {
+
+class GpuProfiler;
+
+/**
+ * @brief ポストプロセスの調整値
+ */
+struct PostProcessSettings {
+  // ヒストグラムに入れる輝度の範囲 (log2)
+  float min_log_luminance = -10.0f;
+  float max_log_luminance = 6.0f;
+  // 平均に使う画素の範囲。暗い側と明るい側の外れ値を除く
+  float low_percentile = 0.5f;
+  float high_percentile = 0.95f;
+  // 明るさに目が慣れる速さ (1/秒)
+  float adaptation_rate = 1.5f;
+  // 露出の補正 (EV)
+  float exposure_compensation = 0.0f;
+  // ブルームを足す割合
+  float bloom_intensity = 0.04f;
+};
+
+/**
+ * @brief HDRのシーンに自動露出、ブルーム、トーンマッピングをかける
+ *
+ * 1. 輝度のヒストグラム (shaders/luminance_histogram.comp)
+ * 2. 外れ値を除いた平均輝度から露出を求め、時間をかけて近づける
+ *    (shaders/auto_exposure.comp)。露出はGPUのバッファにだけ置き、
+ *    CPUには読み戻さない
+ * 3. 半分の解像度から始めるデュアルKawaseフィルターのブルーム
+ *    (shaders/bloom.comp)。縮小と拡大を同じミップマップの各段で行う
+ * 4. 露出、ブルーム、ACESの近似式、sRGBへの変換を1回の全画面描画で行う
+ *    (shaders/tonemap.frag)
+ *
+ * シーンはR11G11B10Fのターゲットに描くと帯域が半分で済む。
+ * 各段の時間はGpuProfilerを渡せば区間ごとに記録する。
+ */
+class PostProcess {
+ public:
+  static constexpr int kHistogramBinCount = 256;
+  // ヒストグラムと露出のSSBOのバインディング番号
+  static constexpr GLuint kExposureBufferBinding = 9;
+  static constexpr int kMaxBloomLevelCount = 6;
+
+  PostProcess();
+  ~PostProcess();
+
+  PostProcess(const PostProcess&) = delete;
+  PostProcess& operator=(const PostProcess&) = delete;
+
+  /**
+   * @brief シェーダーを読み込む
+   * @param shader_directory shadersディレクトリのパス (末尾の区切りなし)
+   * @return 成功すればtrue
+   */
+  bool Initialize(const std::string& shader_directory);
+
+  /**
+   * @brief 画面の大きさに合わせてシーンのターゲットとブルームを作り直す
+   * @param width 幅
+   * @param height 高さ
+   */
+  void Resize(int width, int height);
+
+  /**
+   * @brief シーンを描くフレームバッファを取得する
+   * @return R11G11B10FとDEPTH_COMPONENT32Fのフレームバッファ
+   */
+  GLuint GetSceneFramebuffer() const;
+
+  GLuint GetSceneTexture() const;
+
+  /**
+   * @brief シーンにポストプロセスをかけて出力先に描く
+   * @param scene_texture リニアなHDRのシーン (Resizeした大きさ)
+   * @param output_framebuffer 出力先のフレームバッファ
+   * @param delta_time 前のフレームからの秒数
+   * @param settings 調整値
+   * @param profiler 各段の時間を記録するGpuProfiler、nullptrなら測らない
+   */
+  void Apply(GLuint scene_texture, GLuint output_framebuffer,
+             float delta_time, const PostProcessSettings& settings,
+             GpuProfiler* profiler);
+
+  /**
+   * @brief シーンのターゲットとブルームのテクスチャのバイト数を取得する
+   * @return バイト数
+   */
+  std::size_t GetMemorySize() const;
+
+ private:
+  void DeleteTargets();
+  void BuildHistogram(GLuint scene_texture,
+                      const PostProcessSettings& settings);
+  void UpdateExposure(float delta_time, const PostProcessSettings& settings);
+  void RenderBloom(GLuint scene_texture);
+  void Tonemap(GLuint scene_texture, GLuint output_framebuffer,
+               const PostProcessSettings& settings);
+
+  int width_;
+  int height_;
+  int bloom_level_count_;
+
+  GLuint histogram_program_;
+  GLuint exposure_program_;
+  GLuint downsample_program_;
+  GLuint upsample_program_;
+  GLuint tonemap_program_;
+  GLuint empty_vertex_array_;
+  GLuint linear_sampler_;
+  GLuint exposure_buffer_;
+
+  GLuint scene_framebuffer_;
+  GLuint scene_texture_;
+  GLuint scene_depth_texture_;
+  GLuint bloom_texture_;
+};
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_POST_PROCESS_H_
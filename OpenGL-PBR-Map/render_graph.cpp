@@ -0,0 +1,586 @@
+#include "render_graph.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iomanip>
+#include <set>
+
+#include "gl_state_cache.h"
+#include "gpu_profiler.h"
+
+namespace game {
+
+namespace {
+
+std::size_t GetBytesPerPixel(GLenum format) {
+  switch (format) {
+    case GL_R8:
+      return 1;
+    case GL_RG8:
+    case GL_R16F:
+    case GL_DEPTH_COMPONENT16:
+      return 2;
+    case GL_RGBA16F:
+    case GL_RG32F:
+    case GL_DEPTH32F_STENCIL8:
+      return 8;
+    case GL_RGBA32F:
+      return 16;
+    default:
+      // RGBA8、RG16F、R32F、R11G11B10F、DEPTH_COMPONENT32Fなど
+      return 4;
+  }
+}
+
+bool IsDepthFormat(GLenum format) {
+  return format == GL_DEPTH_COMPONENT16 || format == GL_DEPTH_COMPONENT24 ||
+         format == GL_DEPTH_COMPONENT32F || format == GL_DEPTH24_STENCIL8 ||
+         format == GL_DEPTH32F_STENCIL8;
+}
+
+bool HasStencil(GLenum format) {
+  return format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+}
+
+const char* GetFormatName(GLenum format) {
+  switch (format) {
+    case GL_R8:
+      return "R8";
+    case GL_RG8:
+      return "RG8";
+    case GL_RGBA8:
+      return "RGBA8";
+    case GL_SRGB8_ALPHA8:
+      return "SRGB8_ALPHA8";
+    case GL_RG16_SNORM:
+      return "RG16_SNORM";
+    case GL_R16F:
+      return "R16F";
+    case GL_RG16F:
+      return "RG16F";
+    case GL_RGBA16F:
+      return "RGBA16F";
+    case GL_R32F:
+      return "R32F";
+    case GL_RG32F:
+      return "RG32F";
+    case GL_RGBA32F:
+      return "RGBA32F";
+    case GL_R11F_G11F_B10F:
+      return "R11G11B10F";
+    case GL_DEPTH_COMPONENT32F:
+      return "D32F";
+    case GL_DEPTH24_STENCIL8:
+      return "D24S8";
+    default:
+      return "?";
+  }
+}
+
+// パスが使う前に発行するバリアのビット
+GLbitfield GetBarrierBit(RenderGraphUsage usage) {
+  switch (usage) {
+    case RenderGraphUsage::kSampled:
+      return GL_TEXTURE_FETCH_BARRIER_BIT;
+    case RenderGraphUsage::kImage:
+      return GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+    case RenderGraphUsage::kStorageBuffer:
+      return GL_SHADER_STORAGE_BARRIER_BIT;
+    case RenderGraphUsage::kIndirectCommand:
+      return GL_COMMAND_BARRIER_BIT;
+    case RenderGraphUsage::kFramebuffer:
+    default:
+      return GL_FRAMEBUFFER_BARRIER_BIT;
+  }
+}
+
+// イメージとSSBOへの書き込みだけは後の読み書きから見えるのにバリアが要る
+bool IsIncoherentWrite(RenderGraphUsage usage) {
+  return usage == RenderGraphUsage::kImage ||
+         usage == RenderGraphUsage::kStorageBuffer;
+}
+
+constexpr GLbitfield kAllBarrierBits =
+    GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT |
+    GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT |
+    GL_FRAMEBUFFER_BARRIER_BIT;
+
+double ToMegabytes(std::size_t bytes) {
+  return static_cast<double>(bytes) / (1024.0 * 1024.0);
+}
+
+}  // namespace
+
+std::size_t GetTextureMemorySize(const RenderGraphTextureDesc& desc) {
+  std::size_t size = 0;
+  for (int level = 0; level < desc.levels; ++level) {
+    size += static_cast<std::size_t>(std::max(desc.width >> level, 1)) *
+            std::max(desc.height >> level, 1);
+  }
+  return size * GetBytesPerPixel(desc.format);
+}
+
+RenderGraphHandle RenderGraph::Builder::CreateTexture(
+    const std::string& name, const RenderGraphTextureDesc& desc) {
+  return graph_->AddResource(name, desc, true, 0);
+}
+
+RenderGraphHandle RenderGraph::Builder::Read(RenderGraphHandle handle,
+                                             RenderGraphUsage usage) {
+  assert(handle.IsValid());
+  graph_->passes_[pass_].reads.push_back({handle.index, usage});
+  return handle;
+}
+
+RenderGraphHandle RenderGraph::Builder::Write(RenderGraphHandle handle,
+                                              RenderGraphUsage usage) {
+  assert(handle.IsValid());
+  const auto resource_index = graph_->nodes_[handle.index].resource;
+  auto& resource = graph_->resources_[resource_index];
+  // 古い版に書くと、後の版を読むパスとの順序が決まらない
+  assert(resource.latest_node == handle.index);
+  const auto node = static_cast<int>(graph_->nodes_.size());
+  graph_->nodes_.push_back({resource_index, pass_, 0});
+  resource.latest_node = node;
+
+  auto& pass = graph_->passes_[pass_];
+  pass.writes.push_back({node, usage});
+  // グラフの外で作ったリソースはフレームの後で使われる
+  if (resource.imported) {
+    pass.side_effect = true;
+  }
+  return {node};
+}
+
+void RenderGraph::Builder::SetSideEffect() {
+  graph_->passes_[pass_].side_effect = true;
+}
+
+GLuint RenderGraph::Resources::GetTexture(RenderGraphHandle handle) const {
+  const auto& resource =
+      graph_->resources_[graph_->nodes_[handle.index].resource];
+  assert(resource.is_texture);
+  return resource.object;
+}
+
+GLuint RenderGraph::Resources::GetBuffer(RenderGraphHandle handle) const {
+  const auto& resource =
+      graph_->resources_[graph_->nodes_[handle.index].resource];
+  assert(!resource.is_texture);
+  return resource.object;
+}
+
+GLuint RenderGraph::Resources::GetFramebuffer() const {
+  return graph_->passes_[pass_].framebuffer;
+}
+
+RenderGraph::RenderGraph() : frame_index_(0) {}
+
+RenderGraph::~RenderGraph() {
+  for (const auto& pooled : pool_) {
+    GlStateCache::GetInstance().DeleteTextures(1, &pooled.texture);
+  }
+  for (const auto& entry : framebuffers_) {
+    glDeleteFramebuffers(1, &entry.second.framebuffer);
+  }
+  DeleteFrameFramebuffers();
+}
+
+void RenderGraph::Reset() {
+  DeleteFrameFramebuffers();
+  passes_.clear();
+  resources_.clear();
+  nodes_.clear();
+  order_.clear();
+  ++frame_index_;
+}
+
+RenderGraphHandle RenderGraph::ImportTexture(
+    const std::string& name, GLuint texture,
+    const RenderGraphTextureDesc& desc) {
+  return AddResource(name, desc, true, texture);
+}
+
+RenderGraphHandle RenderGraph::ImportBuffer(const std::string& name,
+                                            GLuint buffer) {
+  return AddResource(name, RenderGraphTextureDesc(), false, buffer);
+}
+
+void RenderGraph::AddPass(const std::string& name,
+                          const std::function<void(Builder&)>& setup,
+                          std::function<void(const Resources&)> execute) {
+  Pass pass;
+  pass.name = name;
+  pass.execute = std::move(execute);
+  pass.side_effect = false;
+  pass.reference_count = 0;
+  pass.barriers = 0;
+  pass.framebuffer = 0;
+  pass.width = 0;
+  pass.height = 0;
+  passes_.push_back(std::move(pass));
+
+  Builder builder(this, static_cast<int>(passes_.size()) - 1);
+  setup(builder);
+}
+
+void RenderGraph::Compile() {
+  ReleaseUnused();
+  CullPasses();
+  AssignTextures();
+  ComputeBarriers();
+  AssignFramebuffers();
+}
+
+void RenderGraph::Execute(GpuProfiler* profiler) {
+  for (const auto pass_index : order_) {
+    const auto& pass = passes_[pass_index];
+    if (pass.barriers != 0) {
+      glMemoryBarrier(pass.barriers);
+    }
+    GpuProfileScope scope(profiler, pass.name);
+    if (pass.framebuffer != 0) {
+      glBindFramebuffer(GL_FRAMEBUFFER, pass.framebuffer);
+      glViewport(0, 0, pass.width, pass.height);
+    }
+    pass.execute(Resources(this, pass_index));
+    if (pass.framebuffer != 0) {
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+  }
+}
+
+std::size_t RenderGraph::GetRequestedMemorySize() const {
+  std::size_t size = 0;
+  for (const auto& resource : resources_) {
+    if (resource.pool_index >= 0) {
+      size += GetTextureMemorySize(resource.desc);
+    }
+  }
+  return size;
+}
+
+std::size_t RenderGraph::GetAllocatedMemorySize() const {
+  std::set<int> used;
+  for (const auto& resource : resources_) {
+    if (resource.pool_index >= 0) {
+      used.insert(resource.pool_index);
+    }
+  }
+  std::size_t size = 0;
+  for (const auto index : used) {
+    size += GetTextureMemorySize(pool_[index].desc);
+  }
+  return size;
+}
+
+void RenderGraph::PrintMemoryReport(std::ostream& out) const {
+  const auto culled_count = passes_.size() - order_.size();
+  out << "Render graph: " << order_.size() << " passes (" << culled_count
+      << " culled)\n";
+  for (std::size_t i = 0; i < order_.size(); ++i) {
+    out << "  " << std::setw(2) << i << " " << passes_[order_[i]].name
+        << "\n";
+  }
+  for (std::size_t i = 0; i < passes_.size(); ++i) {
+    if (std::find(order_.begin(), order_.end(), static_cast<int>(i)) ==
+        order_.end()) {
+      out << "  -- " << passes_[i].name << " (culled)\n";
+    }
+  }
+
+  out << "Transient textures:\n";
+  const auto flags = out.flags();
+  const auto precision = out.precision();
+  out << std::fixed << std::setprecision(2);
+  for (const auto& resource : resources_) {
+    if (resource.imported || !resource.is_texture) {
+      continue;
+    }
+    out << "  " << std::left << std::setw(24) << resource.name << std::right
+        << std::setw(13) << GetFormatName(resource.desc.format) << " "
+        << resource.desc.width << "x" << resource.desc.height;
+    if (resource.pool_index < 0) {
+      out << "  unused\n";
+      continue;
+    }
+    out << "  " << std::setw(8)
+        << ToMegabytes(GetTextureMemorySize(resource.desc)) << " MiB  passes "
+        << resource.first_use << "-" << resource.last_use << "  slot "
+        << resource.pool_index << "\n";
+  }
+  const auto requested = GetRequestedMemorySize();
+  const auto allocated = GetAllocatedMemorySize();
+  out << "Requested " << ToMegabytes(requested) << " MiB, allocated "
+      << ToMegabytes(allocated) << " MiB";
+  if (requested > 0) {
+    out << " (" << 100.0 * (1.0 - static_cast<double>(allocated) / requested)
+        << "% saved by aliasing)";
+  }
+  out << "\n";
+  out.flags(flags);
+  out.precision(precision);
+}
+
+RenderGraphHandle RenderGraph::AddResource(const std::string& name,
+                                           const RenderGraphTextureDesc& desc,
+                                           bool is_texture, GLuint object) {
+  const auto node = static_cast<int>(nodes_.size());
+  Resource resource;
+  resource.name = name;
+  resource.desc = desc;
+  resource.is_texture = is_texture;
+  resource.imported = object != 0;
+  resource.object = object;
+  resource.latest_node = node;
+  resource.first_use = -1;
+  resource.last_use = -1;
+  resource.pool_index = -1;
+  resources_.push_back(resource);
+  nodes_.push_back({static_cast<int>(resources_.size()) - 1, -1, 0});
+  return {node};
+}
+
+void RenderGraph::CullPasses() {
+  // 書いた版を読むパスの数を数え、読まれない版から書いたパスへ遡って
+  // 参照を外していく
+  for (auto& node : nodes_) {
+    node.reference_count = 0;
+  }
+  for (auto& pass : passes_) {
+    pass.reference_count = static_cast<int>(pass.writes.size());
+    for (const auto& read : pass.reads) {
+      ++nodes_[read.node].reference_count;
+    }
+  }
+  std::vector<int> unreferenced;
+  for (std::size_t i = 0; i < nodes_.size(); ++i) {
+    if (nodes_[i].reference_count == 0 && nodes_[i].producer >= 0) {
+      unreferenced.push_back(static_cast<int>(i));
+    }
+  }
+  while (!unreferenced.empty()) {
+    const auto node = unreferenced.back();
+    unreferenced.pop_back();
+    auto& producer = passes_[nodes_[node].producer];
+    if (producer.side_effect || --producer.reference_count > 0) {
+      continue;
+    }
+    for (const auto& read : producer.reads) {
+      auto& source = nodes_[read.node];
+      if (--source.reference_count == 0 && source.producer >= 0) {
+        unreferenced.push_back(read.node);
+      }
+    }
+  }
+
+  order_.clear();
+  for (std::size_t i = 0; i < passes_.size(); ++i) {
+    if (passes_[i].side_effect || passes_[i].reference_count > 0) {
+      order_.push_back(static_cast<int>(i));
+    }
+  }
+}
+
+void RenderGraph::AssignTextures() {
+  const auto pass_count = static_cast<int>(order_.size());
+  for (int i = 0; i < pass_count; ++i) {
+    const auto& pass = passes_[order_[i]];
+    auto use = [&](const Access& access) {
+      auto& resource = resources_[nodes_[access.node].resource];
+      if (resource.first_use < 0) {
+        resource.first_use = i;
+      }
+      resource.last_use = i;
+    };
+    std::for_each(pass.reads.begin(), pass.reads.end(), use);
+    std::for_each(pass.writes.begin(), pass.writes.end(), use);
+  }
+
+  std::vector<std::vector<int>> acquires(pass_count);
+  std::vector<std::vector<int>> releases(pass_count);
+  for (std::size_t i = 0; i < resources_.size(); ++i) {
+    const auto& resource = resources_[i];
+    if (resource.imported || !resource.is_texture || resource.first_use < 0) {
+      continue;
+    }
+    acquires[resource.first_use].push_back(static_cast<int>(i));
+    releases[resource.last_use].push_back(static_cast<int>(i));
+  }
+
+  // 実行順に寿命の始まったテクスチャへ空いている同じ形式のテクスチャを渡し、
+  // 寿命の終わったテクスチャをプールに返す
+  std::vector<bool> busy(pool_.size(), false);
+  for (int i = 0; i < pass_count; ++i) {
+    for (const auto index : acquires[i]) {
+      auto& resource = resources_[index];
+      int slot = -1;
+      for (std::size_t j = 0; j < pool_.size(); ++j) {
+        if (!busy[j] && pool_[j].desc == resource.desc) {
+          slot = static_cast<int>(j);
+          break;
+        }
+      }
+      if (slot < 0) {
+        PooledTexture pooled;
+        pooled.desc = resource.desc;
+        glCreateTextures(GL_TEXTURE_2D, 1, &pooled.texture);
+        glTextureStorage2D(pooled.texture, resource.desc.levels,
+                           resource.desc.format, resource.desc.width,
+                           resource.desc.height);
+        glTextureParameteri(pooled.texture, GL_TEXTURE_MIN_FILTER,
+                            resource.desc.levels > 1 ? GL_LINEAR_MIPMAP_LINEAR
+                                                     : GL_LINEAR);
+        glTextureParameteri(pooled.texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTextureParameteri(pooled.texture, GL_TEXTURE_WRAP_S,
+                            GL_CLAMP_TO_EDGE);
+        glTextureParameteri(pooled.texture, GL_TEXTURE_WRAP_T,
+                            GL_CLAMP_TO_EDGE);
+        pool_.push_back(pooled);
+        busy.push_back(false);
+        slot = static_cast<int>(pool_.size()) - 1;
+      }
+      busy[slot] = true;
+      pool_[slot].last_used_frame = frame_index_;
+      resource.pool_index = slot;
+      resource.object = pool_[slot].texture;
+    }
+    for (const auto index : releases[i]) {
+      busy[resources_[index].pool_index] = false;
+    }
+  }
+}
+
+void RenderGraph::ComputeBarriers() {
+  // リソースごとに、最後のイメージやSSBOへの書き込みの後でまだ発行して
+  // いないバリアのビット
+  std::vector<GLbitfield> pending(resources_.size(), 0);
+  for (const auto pass_index : order_) {
+    auto& pass = passes_[pass_index];
+    pass.barriers = 0;
+    auto require = [&](const Access& access) {
+      const auto resource = nodes_[access.node].resource;
+      pass.barriers |= pending[resource] & GetBarrierBit(access.usage);
+    };
+    std::for_each(pass.reads.begin(), pass.reads.end(), require);
+    std::for_each(pass.writes.begin(), pass.writes.end(), require);
+    // バリアはすべてのリソースに効く
+    for (auto& bits : pending) {
+      bits &= ~pass.barriers;
+    }
+    for (const auto& write : pass.writes) {
+      if (IsIncoherentWrite(write.usage)) {
+        pending[nodes_[write.node].resource] = kAllBarrierBits;
+      }
+    }
+  }
+}
+
+void RenderGraph::AssignFramebuffers() {
+  for (const auto pass_index : order_) {
+    auto& pass = passes_[pass_index];
+    std::vector<GLuint> attachments;
+    const Resource* first = nullptr;
+    bool has_imported = false;
+    for (const auto& write : pass.writes) {
+      if (write.usage != RenderGraphUsage::kFramebuffer) {
+        continue;
+      }
+      const auto& resource = resources_[nodes_[write.node].resource];
+      attachments.push_back(resource.object);
+      has_imported = has_imported || resource.imported;
+      if (first == nullptr) {
+        first = &resource;
+      }
+    }
+    if (first == nullptr) {
+      pass.framebuffer = 0;
+      continue;
+    }
+    pass.width = first->desc.width;
+    pass.height = first->desc.height;
+
+    // 取り込んだテクスチャはグラフの外で削除されて名前が再利用されうるので、
+    // 名前をキーにしたキャッシュは古いテクスチャを付けたままのものを返す。
+    // 毎フレーム作り、Resetで削除する
+    if (has_imported) {
+      pass.framebuffer = CreateFramebuffer(pass);
+      frame_framebuffers_.push_back(pass.framebuffer);
+      continue;
+    }
+    auto it = framebuffers_.find(attachments);
+    if (it == framebuffers_.end()) {
+      it = framebuffers_
+               .emplace(attachments,
+                        CachedFramebuffer{CreateFramebuffer(pass), 0})
+               .first;
+    }
+    it->second.last_used_frame = frame_index_;
+    pass.framebuffer = it->second.framebuffer;
+  }
+}
+
+GLuint RenderGraph::CreateFramebuffer(const Pass& pass) const {
+  GLuint framebuffer;
+  glCreateFramebuffers(1, &framebuffer);
+  std::vector<GLenum> draw_buffers;
+  for (const auto& write : pass.writes) {
+    if (write.usage != RenderGraphUsage::kFramebuffer) {
+      continue;
+    }
+    const auto& resource = resources_[nodes_[write.node].resource];
+    const auto format = resource.desc.format;
+    GLenum attachment;
+    if (IsDepthFormat(format)) {
+      attachment = HasStencil(format) ? GL_DEPTH_STENCIL_ATTACHMENT
+                                      : GL_DEPTH_ATTACHMENT;
+    } else {
+      attachment =
+          GL_COLOR_ATTACHMENT0 + static_cast<GLenum>(draw_buffers.size());
+      draw_buffers.push_back(attachment);
+    }
+    glNamedFramebufferTexture(framebuffer, attachment, resource.object, 0);
+  }
+  if (draw_buffers.empty()) {
+    glNamedFramebufferDrawBuffer(framebuffer, GL_NONE);
+  } else {
+    glNamedFramebufferDrawBuffers(framebuffer,
+                                  static_cast<GLsizei>(draw_buffers.size()),
+                                  draw_buffers.data());
+  }
+  return framebuffer;
+}
+
+void RenderGraph::DeleteFrameFramebuffers() {
+  if (!frame_framebuffers_.empty()) {
+    glDeleteFramebuffers(static_cast<GLsizei>(frame_framebuffers_.size()),
+                         frame_framebuffers_.data());
+    frame_framebuffers_.clear();
+  }
+}
+
+void RenderGraph::ReleaseUnused() {
+  auto expired = [&](std::uint32_t last_used_frame) {
+    return frame_index_ - last_used_frame > kMaxUnusedFrameCount;
+  };
+  // 削除するテクスチャを付けたフレームバッファも同じ期間使われていない
+  for (auto it = framebuffers_.begin(); it != framebuffers_.end();) {
+    if (expired(it->second.last_used_frame)) {
+      glDeleteFramebuffers(1, &it->second.framebuffer);
+      it = framebuffers_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  const auto end =
+      std::remove_if(pool_.begin(), pool_.end(), [&](const PooledTexture& p) {
+        if (!expired(p.last_used_frame)) {
+          return false;
+        }
+        GlStateCache::GetInstance().DeleteTextures(1, &p.texture);
+        return true;
+      });
+  pool_.erase(end, pool_.end());
+}
+
+}  // namespace game
@@ -0,0 +1,317 @@
+#ifndef OPENGL_PBR_MAP_RENDER_GRAPH_H_
+#define OPENGL_PBR_MAP_RENDER_GRAPH_H_
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace game {
+
+class GpuProfiler;
+
+/**
+ * @brief レンダーグラフのリソースの識別子
+ *
+ * 書き込むたびに新しい版の識別子になり、読むパスはどの版を読むかで
+ * 書いたパスに依存する。
+ */
+struct RenderGraphHandle {
+  int index = -1;
+
+  bool IsValid() const { return index >= 0; }
+};
+
+/**
+ * @brief パスがリソースをどう使うか。バリアのビットを決める
+ */
+enum class RenderGraphUsage {
+  // サンプラーで読む
+  kSampled,
+  // イメージのロードとストア
+  kImage,
+  // SSBO
+  kStorageBuffer,
+  // 間接描画と間接ディスパッチの引数
+  kIndirectCommand,
+  // フレームバッファのアタッチメント
+  kFramebuffer,
+};
+
+/**
+ * @brief グラフが作るテクスチャの形式
+ */
+struct RenderGraphTextureDesc {
+  GLenum format = GL_RGBA8;
+  int width = 0;
+  int height = 0;
+  int levels = 1;
+
+  bool operator==(const RenderGraphTextureDesc& other) const {
+    return format == other.format && width == other.width &&
+           height == other.height && levels == other.levels;
+  }
+};
+
+/**
+ * @brief テクスチャの形式が占めるバイト数を取得する
+ * @param desc 形式
+ * @return 全ミップマップの合計のバイト数。知らない形式は4バイト/ピクセル
+ */
+std::size_t GetTextureMemorySize(const RenderGraphTextureDesc& desc);
+
+/**
+ * @brief 1フレームの描画をパスとリソースのグラフとして組み立てて実行する
+ *
+ * 1. AddPassで各パスが作る、読む、書くリソースを宣言する
+ * 2. Compileで結果が使われないパスを除き、一時テクスチャの寿命から
+ *    プールのテクスチャを割り当て、パスの間に要るglMemoryBarrierを決める
+ * 3. Executeで残ったパスを順に実行する
+ *
+ * パスは宣言した順に実行する。リソースの識別子は書くパスを宣言した後で
+ * しか得られないので、宣言の順は依存の順になっている。
+ * 取り込んだ (Import) リソースに書くパスと、SetSideEffectを呼んだパスが
+ * 出力になり、そこから読まれないパスは除かれる。
+ *
+ * 一時テクスチャは寿命が重ならず形式が同じなら同じテクスチャを使い回す。
+ * OpenGLではテクスチャの記憶域を別のテクスチャと共有できないので、
+ * 形式ごとのプールで使い回すことで寿命の重ならないリソースを重ねる。
+ * プールはフレームをまたいで残し、kMaxUnusedFrameCountフレーム使われ
+ * なかったテクスチャを削除する。フレームバッファも一時テクスチャだけを
+ * 付けたものは残すが、取り込んだテクスチャを付けたものは毎フレーム作る。
+ *
+ * 1フレームの使い方はReset、AddPass、Compile、Executeの順。
+ */
+class RenderGraph {
+ public:
+  // 使われないプールのテクスチャとフレームバッファを残すフレーム数
+  static constexpr std::uint32_t kMaxUnusedFrameCount = 3;
+
+  /**
+   * @brief パスの宣言でリソースを作り、読み書きを登録する
+   */
+  class Builder {
+   public:
+    /**
+     * @brief 一時テクスチャを作る
+     * @param name 名前
+     * @param desc 形式
+     * @return 書き込む前の版。このパスでWriteして使う
+     */
+    RenderGraphHandle CreateTexture(const std::string& name,
+                                    const RenderGraphTextureDesc& desc);
+
+    /**
+     * @brief リソースを読む
+     * @param handle 読む版
+     * @param usage 使い方
+     * @return handle
+     */
+    RenderGraphHandle Read(RenderGraphHandle handle, RenderGraphUsage usage);
+
+    /**
+     * @brief リソースに書く
+     * @param handle 最新の版
+     * @param usage 使い方。kFramebufferならこのパスのフレームバッファに
+     *              宣言した順でアタッチする
+     * @return 書いた後の版
+     *
+     * 前の内容に重ねて描くときは同じ版をReadもする。
+     */
+    RenderGraphHandle Write(RenderGraphHandle handle, RenderGraphUsage usage);
+
+    /**
+     * @brief 結果が読まれなくてもパスを除かない
+     *
+     * デフォルトのフレームバッファに描くパスやCPUに読み戻すパスで呼ぶ。
+     */
+    void SetSideEffect();
+
+   private:
+    friend class RenderGraph;
+
+    Builder(RenderGraph* graph, int pass) : graph_(graph), pass_(pass) {}
+
+    RenderGraph* graph_;
+    int pass_;
+  };
+
+  /**
+   * @brief パスの実行中にリソースの実体を取得する
+   */
+  class Resources {
+   public:
+    GLuint GetTexture(RenderGraphHandle handle) const;
+    GLuint GetBuffer(RenderGraphHandle handle) const;
+
+    /**
+     * @brief このパスのフレームバッファを取得する
+     * @return kFramebufferで書くリソースをアタッチしたフレームバッファ。
+     *         実行の前にバインドとビューポートの設定を済ませてある
+     */
+    GLuint GetFramebuffer() const;
+
+   private:
+    friend class RenderGraph;
+
+    Resources(const RenderGraph* graph, int pass)
+        : graph_(graph), pass_(pass) {}
+
+    const RenderGraph* graph_;
+    int pass_;
+  };
+
+  RenderGraph();
+  ~RenderGraph();
+
+  RenderGraph(const RenderGraph&) = delete;
+  RenderGraph& operator=(const RenderGraph&) = delete;
+
+  /**
+   * @brief 前のフレームのパスとリソースを捨てる。プールは残す
+   */
+  void Reset();
+
+  /**
+   * @brief グラフの外で作ったテクスチャを取り込む
+   * @param name 名前
+   * @param texture テクスチャ
+   * @param desc 形式 (メモリの集計とフレームバッファの大きさに使う)
+   * @return 最初の版
+   */
+  RenderGraphHandle ImportTexture(const std::string& name, GLuint texture,
+                                  const RenderGraphTextureDesc& desc);
+
+  /**
+   * @brief グラフの外で作ったバッファを取り込む
+   * @param name 名前
+   * @param buffer バッファ
+   * @return 最初の版
+   */
+  RenderGraphHandle ImportBuffer(const std::string& name, GLuint buffer);
+
+  /**
+   * @brief パスを追加する
+   * @param name 名前。GpuProfilerの区間の名前にもなる
+   * @param setup すぐに呼ばれ、Builderでリソースを宣言する
+   * @param execute Executeのときに呼ばれ、描画やディスパッチを発行する
+   */
+  void AddPass(const std::string& name,
+               const std::function<void(Builder&)>& setup,
+               std::function<void(const Resources&)> execute);
+
+  /**
+   * @brief パスを除き、テクスチャを割り当て、バリアを決める
+   */
+  void Compile();
+
+  /**
+   * @brief 残ったパスを実行する
+   * @param profiler パスごとの時間を記録するGpuProfiler、nullptrなら測らない
+   */
+  void Execute(GpuProfiler* profiler);
+
+  /**
+   * @brief 一時テクスチャを重ねずに確保した場合のバイト数を取得する
+   * @return バイト数
+   */
+  std::size_t GetRequestedMemorySize() const;
+
+  /**
+   * @brief このフレームで割り当てたプールのテクスチャのバイト数を取得する
+   * @return バイト数
+   */
+  std::size_t GetAllocatedMemorySize() const;
+
+  /**
+   * @brief パスと一時テクスチャの割り当てを書き出す
+   * @param out 出力先
+   */
+  void PrintMemoryReport(std::ostream& out) const;
+
+ private:
+  struct Access {
+    int node;
+    RenderGraphUsage usage;
+  };
+
+  struct Pass {
+    std::string name;
+    std::function<void(const Resources&)> execute;
+    std::vector<Access> reads;
+    std::vector<Access> writes;
+    bool side_effect;
+    int reference_count;
+    // 実行の前に発行するglMemoryBarrierのビット
+    GLbitfield barriers;
+    GLuint framebuffer;
+    int width;
+    int height;
+  };
+
+  // 物理的なリソース
+  struct Resource {
+    std::string name;
+    RenderGraphTextureDesc desc;
+    bool is_texture;
+    bool imported;
+    GLuint object;
+    // 最新の版
+    int latest_node;
+    // 残ったパスで最初と最後に使う実行順の番号
+    int first_use;
+    int last_use;
+    int pool_index;
+  };
+
+  // リソースの版
+  struct Node {
+    int resource;
+    int producer;
+    int reference_count;
+  };
+
+  struct PooledTexture {
+    RenderGraphTextureDesc desc;
+    GLuint texture;
+    std::uint32_t last_used_frame;
+  };
+
+  struct CachedFramebuffer {
+    GLuint framebuffer;
+    std::uint32_t last_used_frame;
+  };
+
+  RenderGraphHandle AddResource(const std::string& name,
+                                const RenderGraphTextureDesc& desc,
+                                bool is_texture, GLuint object);
+  void CullPasses();
+  void AssignTextures();
+  void ComputeBarriers();
+  void AssignFramebuffers();
+  GLuint CreateFramebuffer(const Pass& pass) const;
+  void DeleteFrameFramebuffers();
+  void ReleaseUnused();
+
+  std::vector<Pass> passes_;
+  std::vector<Resource> resources_;
+  std::vector<Node> nodes_;
+  // 残ったパスの実行順
+  std::vector<int> order_;
+
+  std::vector<PooledTexture> pool_;
+  // 一時テクスチャだけを付けたフレームバッファ。キーは付けたテクスチャ
+  std::map<std::vector<GLuint>, CachedFramebuffer> framebuffers_;
+  // 取り込んだテクスチャを付けたこのフレームだけのフレームバッファ
+  std::vector<GLuint> frame_framebuffers_;
+  std::uint32_t frame_index_;
+};
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_RENDER_GRAPH_H_
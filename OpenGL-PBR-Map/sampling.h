@@ -0,0 +1,153 @@
+#ifndef OPENGL_PBR_MAP_SAMPLING_H_
+#define OPENGL_PBR_MAP_SAMPLING_H_
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace game {
+
+/**
+ * @brief Van der Corput列の基数2の根基逆関数
+ * @param bits インデックス
+ * @return [0, 1)の値
+ */
+inline float RadicalInverse(std::uint32_t bits) {
+  bits = (bits << 16u) | (bits >> 16u);
+  bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+  bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+  bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+  bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+  return static_cast<float>(bits) * 2.3283064365386963e-10f;
+}
+
+/**
+ * @brief Hammersley点列のi番目の点
+ * @param i インデックス
+ * @param count 点の総数
+ * @return [0, 1)^2の点
+ */
+inline glm::vec2 Hammersley(std::uint32_t i, std::uint32_t count) {
+  return glm::vec2(static_cast<float>(i) / static_cast<float>(count),
+                   RadicalInverse(i));
+}
+
+/**
+ * @brief Halton列のi番目の値
+ * @param i インデックス (1から始めると0を避けられる)
+ * @param base 基数 (素数)
+ * @return [0, 1)の値
+ */
+inline float Halton(std::uint32_t i, std::uint32_t base) {
+  float result = 0.0f;
+  float fraction = 1.0f;
+  while (i > 0) {
+    fraction /= static_cast<float>(base);
+    result += fraction * static_cast<float>(i % base);
+    i /= base;
+  }
+  return result;
+}
+
+/**
+ * @brief PCG32による軽量な疑似乱数生成器
+ *
+ * シードが同じなら実行するスレッドに関わらず同じ列を返す。
+ */
+class Pcg32 {
+ public:
+  explicit Pcg32(std::uint64_t seed, std::uint64_t sequence = 1)
+      : state_(0), increment_((sequence << 1u) | 1u) {
+    NextUint();
+    state_ += seed;
+    NextUint();
+  }
+
+  std::uint32_t NextUint() {
+    const auto old_state = state_;
+    state_ = old_state * 6364136223846793005ull + increment_;
+    const auto xor_shifted =
+        static_cast<std::uint32_t>(((old_state >> 18u) ^ old_state) >> 27u);
+    const auto rotation = static_cast<std::uint32_t>(old_state >> 59u);
+    return (xor_shifted >> rotation) |
+           (xor_shifted << ((32u - rotation) & 31u));
+  }
+
+  /**
+   * @brief [0, 1)の一様乱数
+   */
+  float NextFloat() {
+    return static_cast<float>(NextUint() >> 8u) * (1.0f / 16777216.0f);
+  }
+
+  glm::vec2 NextVec2() {
+    const float x = NextFloat();
+    return glm::vec2(x, NextFloat());
+  }
+
+ private:
+  std::uint64_t state_;
+  std::uint64_t increment_;
+};
+
+/**
+ * @brief 法線を+Zとする接空間の基底を作る
+ * @param n 正規化された法線
+ * @param tangent 接線の出力
+ * @param bitangent 従接線の出力
+ */
+inline void BuildOrthonormalBasis(const glm::vec3& n, glm::vec3& tangent,
+                                  glm::vec3& bitangent) {
+  // Duff et al. 2017, "Building an Orthonormal Basis, Revisited"
+  const float sign = std::copysign(1.0f, n.z);
+  const float a = -1.0f / (sign + n.z);
+  const float b = n.x * n.y * a;
+  tangent = glm::vec3(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+  bitangent = glm::vec3(b, sign + n.y * n.y * a, -n.y);
+}
+
+/**
+ * @brief 接空間でコサイン分布に従う方向をサンプリングする
+ * @param u [0, 1)^2の乱数
+ * @return +Z半球上の方向、pdfはcos / pi
+ */
+inline glm::vec3 SampleCosineHemisphere(const glm::vec2& u) {
+  const float r = std::sqrt(u.x);
+  const float phi = glm::two_pi<float>() * u.y;
+  return glm::vec3(r * std::cos(phi), r * std::sin(phi),
+                   std::sqrt(std::max(0.0f, 1.0f - u.x)));
+}
+
+/**
+ * @brief 単位球面上で一様な方向をサンプリングする
+ * @param u [0, 1)^2の乱数
+ * @return 単位球面上の方向、pdfは1 / (4 * pi)
+ */
+inline glm::vec3 SampleUniformSphere(const glm::vec2& u) {
+  const float z = 1.0f - 2.0f * u.x;
+  const float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+  const float phi = glm::two_pi<float>() * u.y;
+  return glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+/**
+ * @brief 接空間でGGXの法線分布に従うハーフベクトルをサンプリングする
+ * @param u [0, 1)^2の乱数
+ * @param alpha roughnessの2乗
+ * @return +Z半球上のハーフベクトル
+ */
+inline glm::vec3 ImportanceSampleGGX(const glm::vec2& u, float alpha) {
+  const float phi = glm::two_pi<float>() * u.x;
+  const float cos_theta =
+      std::sqrt((1.0f - u.y) / (1.0f + (alpha * alpha - 1.0f) * u.y));
+  const float sin_theta = std::sqrt(1.0f - cos_theta * cos_theta);
+  return glm::vec3(sin_theta * std::cos(phi), sin_theta * std::sin(phi),
+                   cos_theta);
+}
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_SAMPLING_H_
@@ -0,0 +1,190 @@
+#include "scene_renderer.h"
+
+#include "gl_state_cache.h"
+#include "gpu_profiler.h"
+#include "shader_program.h"
+
+namespace game {
+
+namespace {
+
+GLuint CreateTarget(GLenum format, int width, int height) {
+  GLuint texture;
+  glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+  glTextureStorage2D(texture, 1, format, width, height);
+  glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  return texture;
+}
+
+// 不透明なジオメトリを描く深度の状態にする
+void SetOpaqueState() {
+  auto& state = GlStateCache::GetInstance();
+  state.SetBlend(false);
+  state.SetDepthTest(true);
+  state.SetDepthMask(true);
+  state.DepthFunc(GL_LESS);
+}
+
+}  // namespace
+
+SceneRenderer::SceneRenderer()
+    : render_path_(RenderPath::kForward),
+      width_(0),
+      height_(0),
+      forward_program_(0),
+      geometry_program_(0),
+      forward_framebuffer_(0),
+      forward_color_texture_(0),
+      forward_depth_texture_(0) {}
+
+SceneRenderer::~SceneRenderer() {
+  DeleteTargets();
+  if (forward_program_ != 0) {
+    glDeleteProgram(forward_program_);
+  }
+  if (geometry_program_ != 0) {
+    glDeleteProgram(geometry_program_);
+  }
+}
+
+bool SceneRenderer::Initialize(const std::string& shader_directory,
+                               bool material_bindless) {
+  const std::string defines =
+      material_bindless ? "#extension GL_ARB_bindless_texture : require\n"
+                          "#define MATERIAL_BINDLESS"
+                        : "";
+  const auto vertex_path = shader_directory + "/scene.vert";
+  forward_program_ = LoadShaderProgram(
+      {{GL_VERTEX_SHADER, vertex_path},
+       {GL_FRAGMENT_SHADER, shader_directory + "/forward.frag"}},
+      defines);
+  geometry_program_ = LoadShaderProgram(
+      {{GL_VERTEX_SHADER, vertex_path},
+       {GL_FRAGMENT_SHADER, shader_directory + "/gbuffer.frag"}},
+      defines);
+  if (forward_program_ == 0 || geometry_program_ == 0) {
+    return false;
+  }
+  return deferred_renderer_.Initialize(shader_directory);
+}
+
+void SceneRenderer::Resize(int width, int height) {
+  deferred_renderer_.Resize(width, height);
+  if (width == width_ && height == height_) {
+    return;
+  }
+  DeleteTargets();
+  width_ = width;
+  height_ = height;
+
+  // ディファード描画の結果と同じ形式にそろえる
+  forward_color_texture_ = CreateTarget(GL_RGBA16F, width, height);
+  forward_depth_texture_ = CreateTarget(GL_DEPTH_COMPONENT32F, width, height);
+  glCreateFramebuffers(1, &forward_framebuffer_);
+  glNamedFramebufferTexture(forward_framebuffer_, GL_COLOR_ATTACHMENT0,
+                            forward_color_texture_, 0);
+  glNamedFramebufferTexture(forward_framebuffer_, GL_DEPTH_ATTACHMENT,
+                            forward_depth_texture_, 0);
+}
+
+void SceneRenderer::SetRenderPath(RenderPath path) { render_path_ = path; }
+
+RenderPath SceneRenderer::GetRenderPath() const { return render_path_; }
+
+GLuint SceneRenderer::Render(const SceneView& view,
+                             const std::vector<PointLight>& lights,
+                             const glm::vec3& ambient,
+                             const std::function<void()>& draw,
+                             JobSystem& job_system, GpuProfiler* profiler) {
+  if (render_path_ == RenderPath::kForward) {
+    RenderForward(view, lights, ambient, draw, job_system, profiler);
+    return forward_color_texture_;
+  }
+  RenderTiledDeferred(view, lights, ambient, draw, profiler);
+  return deferred_renderer_.GetLightingTexture();
+}
+
+void SceneRenderer::RenderForward(const SceneView& view,
+                                  const std::vector<PointLight>& lights,
+                                  const glm::vec3& ambient,
+                                  const std::function<void()>& draw,
+                                  JobSystem& job_system,
+                                  GpuProfiler* profiler) {
+  clustered_lighting_.Update(lights, view.view, view.projection,
+                             view.near_plane, view.far_plane,
+                             glm::ivec2(width_, height_), job_system);
+  clustered_lighting_.Upload();
+
+  GpuProfileScope scope(profiler, "Forward");
+  // 消去は深度の書き込みが有効でないと効かない
+  SetOpaqueState();
+  glBindFramebuffer(GL_FRAMEBUFFER, forward_framebuffer_);
+  glViewport(0, 0, width_, height_);
+  GLfloat zero[] = {0.0f, 0.0f, 0.0f, 0.0f};
+  GLfloat far_depth = 1.0f;
+  glClearNamedFramebufferfv(forward_framebuffer_, GL_COLOR, 0, zero);
+  glClearNamedFramebufferfv(forward_framebuffer_, GL_DEPTH, 0, &far_depth);
+
+  const auto view_projection = view.projection * view.view;
+  const auto camera_position = glm::vec3(glm::inverse(view.view)[3]);
+  glProgramUniformMatrix4fv(
+      forward_program_,
+      glGetUniformLocation(forward_program_, "view_projection"), 1, GL_FALSE,
+      &view_projection[0][0]);
+  glProgramUniformMatrix4fv(forward_program_,
+                            glGetUniformLocation(forward_program_, "view"), 1,
+                            GL_FALSE, &view.view[0][0]);
+  glProgramUniform3fv(
+      forward_program_,
+      glGetUniformLocation(forward_program_, "camera_position"), 1,
+      &camera_position[0]);
+  glProgramUniform3fv(forward_program_,
+                      glGetUniformLocation(forward_program_, "ambient"), 1,
+                      &ambient[0]);
+  clustered_lighting_.Bind();
+  GlStateCache::GetInstance().UseProgram(forward_program_);
+  draw();
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  clustered_lighting_.EndFrame();
+}
+
+void SceneRenderer::RenderTiledDeferred(const SceneView& view,
+                                        const std::vector<PointLight>& lights,
+                                        const glm::vec3& ambient,
+                                        const std::function<void()>& draw,
+                                        GpuProfiler* profiler) {
+  {
+    GpuProfileScope scope(profiler, "G-buffer");
+    SetOpaqueState();
+    deferred_renderer_.BeginGeometryPass();
+    const auto view_projection = view.projection * view.view;
+    glProgramUniformMatrix4fv(
+        geometry_program_,
+        glGetUniformLocation(geometry_program_, "view_projection"), 1,
+        GL_FALSE, &view_projection[0][0]);
+    GlStateCache::GetInstance().UseProgram(geometry_program_);
+    // ベースカラーのSRGB8_ALPHA8にリニアな値をsRGBに変換して書く
+    glEnable(GL_FRAMEBUFFER_SRGB);
+    draw();
+    glDisable(GL_FRAMEBUFFER_SRGB);
+    deferred_renderer_.EndGeometryPass();
+  }
+  GpuProfileScope scope(profiler, "Tiled shading");
+  deferred_renderer_.Shade(lights, view.view, view.projection, ambient);
+}
+
+void SceneRenderer::DeleteTargets() {
+  if (forward_framebuffer_ == 0) {
+    return;
+  }
+  glDeleteFramebuffers(1, &forward_framebuffer_);
+  const GLuint textures[] = {forward_color_texture_, forward_depth_texture_};
+  GlStateCache::GetInstance().DeleteTextures(2, textures);
+  forward_framebuffer_ = 0;
+}
+
+}  // namespace game
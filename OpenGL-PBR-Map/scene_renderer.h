@@ -0,0 +1,122 @@
+#ifndef OPENGL_PBR_MAP_SCENE_RENDERER_H_
+#define OPENGL_PBR_MAP_SCENE_RENDERER_H_
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "clustered_lighting.h"
+#include "deferred_renderer.h"
+#include "light.h"
+
+namespace game {
+
+class GpuProfiler;
+class JobSystem;
+
+/**
+ * @brief シーンの描画方式
+ */
+enum class RenderPath {
+  // ClusteredLightingのライトの一覧を使うフォワード描画
+  kForward,
+  // DeferredRendererによるタイルベースのディファード描画
+  kTiledDeferred,
+};
+
+/**
+ * @brief シーンを見るカメラ
+ */
+struct SceneView {
+  glm::mat4 view;
+  glm::mat4 projection;
+  float near_plane;
+  float far_plane;
+};
+
+/**
+ * @brief 選んだ描画方式でシーンを照らし、HDRの結果を返す
+ *
+ * どちらの方式もジオメトリはshaders/scene.vertで描き、照らし方は
+ * shaders/shading.glslを共有する。同じシーンで描き比べられるよう
+ * 方式はSetRenderPathで実行中に切り替えられる。
+ * kForward: ClusteredLightingでライトをクラスターに割り当て、
+ *           shaders/forward.fragで描きながら照らす
+ * kTiledDeferred: shaders/gbuffer.fragでG-bufferに描き、
+ *                 DeferredRenderer::Shadeで照らす
+ * ジオメトリのマテリアルはMaterialTable、インスタンスはDrawBatcherの
+ * SSBOから読むので、描画の前にそれぞれBindしておくこと。
+ */
+class SceneRenderer {
+ public:
+  SceneRenderer();
+  ~SceneRenderer();
+
+  SceneRenderer(const SceneRenderer&) = delete;
+  SceneRenderer& operator=(const SceneRenderer&) = delete;
+
+  /**
+   * @brief シェーダーを読み込む
+   * @param shader_directory shadersディレクトリのパス (末尾の区切りなし)
+   * @param material_bindless MaterialTable::IsBindless()の値
+   * @return 成功すればtrue
+   */
+  bool Initialize(const std::string& shader_directory,
+                  bool material_bindless);
+
+  /**
+   * @brief 画面の大きさに合わせて両方の方式のターゲットを作り直す
+   * @param width 幅
+   * @param height 高さ
+   */
+  void Resize(int width, int height);
+
+  void SetRenderPath(RenderPath path);
+  RenderPath GetRenderPath() const;
+
+  /**
+   * @brief 選んでいる方式でシーンを描いて照らす
+   * @param view カメラ
+   * @param lights ワールド空間の点光源
+   * @param ambient 全体に足す環境光
+   * @param draw ジオメトリを描く。シェーダーはバインド済みで、
+   *             頂点配列のバインドと描画の発行だけをする
+   * @param job_system ClusteredLightingの割り当てに使うJobSystem
+   * @param profiler 各段の時間を記録するGpuProfiler、nullptrなら測らない
+   * @return 照らした結果のRGBA16Fのテクスチャ
+   */
+  GLuint Render(const SceneView& view, const std::vector<PointLight>& lights,
+                const glm::vec3& ambient, const std::function<void()>& draw,
+                JobSystem& job_system, GpuProfiler* profiler);
+
+ private:
+  void RenderForward(const SceneView& view,
+                     const std::vector<PointLight>& lights,
+                     const glm::vec3& ambient,
+                     const std::function<void()>& draw,
+                     JobSystem& job_system, GpuProfiler* profiler);
+  void RenderTiledDeferred(const SceneView& view,
+                           const std::vector<PointLight>& lights,
+                           const glm::vec3& ambient,
+                           const std::function<void()>& draw,
+                           GpuProfiler* profiler);
+  void DeleteTargets();
+
+  RenderPath render_path_;
+  int width_;
+  int height_;
+  GLuint forward_program_;
+  GLuint geometry_program_;
+  GLuint forward_framebuffer_;
+  GLuint forward_color_texture_;
+  GLuint forward_depth_texture_;
+  ClusteredLighting clustered_lighting_;
+  DeferredRenderer deferred_renderer_;
+};
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_SCENE_RENDERER_H_
@@ -0,0 +1,140 @@
+#include "shader_program.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+namespace game {
+
+namespace {
+
+std::string GetDirectory(const std::string& path) {
+  const auto slash = path.find_last_of("/\\");
+  return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+}
+
+bool ExpandIncludes(const std::string& path, std::set<std::string>& included,
+                    std::string& output) {
+  if (!included.insert(path).second) {
+    return true;
+  }
+  std::ifstream file(path);
+  if (!file) {
+    std::cerr << "Can't open shader file: " << path << std::endl;
+    return false;
+  }
+  const auto directory = GetDirectory(path);
+  std::string line;
+  while (std::getline(file, line)) {
+    const auto directive = line.find("#include");
+    if (directive != std::string::npos &&
+        line.find_first_not_of(" \t") == directive) {
+      const auto begin = line.find('"', directive);
+      const auto end = line.find('"', begin + 1);
+      if (begin == std::string::npos || end == std::string::npos) {
+        std::cerr << "Can't parse #include in " << path << ": " << line
+                  << std::endl;
+        return false;
+      }
+      if (!ExpandIncludes(directory + line.substr(begin + 1, end - begin - 1),
+                          included, output)) {
+        return false;
+      }
+      continue;
+    }
+    output += line;
+    output += '\n';
+  }
+  return true;
+}
+
+GLuint CompileShader(GLenum type, const std::string& source,
+                     const std::string& path) {
+  const auto shader = glCreateShader(type);
+  const auto* text = source.c_str();
+  glShaderSource(shader, 1, &text, nullptr);
+  glCompileShader(shader);
+  GLint status;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+  if (status == GL_FALSE) {
+    GLint length;
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+    std::string log(std::max(length, 1), '\0');
+    glGetShaderInfoLog(shader, length, nullptr, &log[0]);
+    std::cerr << "Can't compile shader: " << path << "\n" << log << std::endl;
+    glDeleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+}  // namespace
+
+std::optional<std::string> LoadShaderSource(const std::string& path) {
+  std::set<std::string> included;
+  std::string source;
+  if (!ExpandIncludes(path, included, source)) {
+    return std::nullopt;
+  }
+  return source;
+}
+
+GLuint LoadShaderProgram(
+    const std::vector<std::pair<GLenum, std::string>>& stages,
+    const std::string& defines) {
+  const auto program = glCreateProgram();
+  std::vector<GLuint> shaders;
+  bool succeeded = true;
+  for (const auto& stage : stages) {
+    auto source = LoadShaderSource(stage.second);
+    if (!source) {
+      succeeded = false;
+      break;
+    }
+    // #versionは先頭になければならないので、その次の行に挿入する
+    if (!defines.empty()) {
+      const auto version = source->find("#version");
+      const auto line_end = source->find('\n', version);
+      const auto position =
+          version == std::string::npos ? 0 : line_end + 1;
+      source->insert(position, defines + "\n");
+    }
+    const auto shader = CompileShader(stage.first, *source, stage.second);
+    if (shader == 0) {
+      succeeded = false;
+      break;
+    }
+    glAttachShader(program, shader);
+    shaders.push_back(shader);
+  }
+
+  if (succeeded) {
+    glLinkProgram(program);
+    GLint status;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status == GL_FALSE) {
+      GLint length;
+      glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+      std::string log(std::max(length, 1), '\0');
+      glGetProgramInfoLog(program, length, nullptr, &log[0]);
+      std::cerr << "Can't link shader program: " << stages.front().second
+                << "\n" << log << std::endl;
+      succeeded = false;
+    }
+  }
+
+  // リンク後はシェーダーオブジェクトは不要
+  for (const auto shader : shaders) {
+    glDetachShader(program, shader);
+    glDeleteShader(shader);
+  }
+  if (!succeeded) {
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+}  // namespace game
@@ -0,0 +1,37 @@
+#ifndef OPENGL_PBR_MAP_SHADER_PROGRAM_H_
+#define OPENGL_PBR_MAP_SHADER_PROGRAM_H_
+
+#include <GL/glew.h>
+
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace game {
+
+/**
+ * @brief シェーダーのソースを読み込み、#includeを展開する
+ * @param path ファイルのパス
+ * @return ソース、読めなければnullopt
+ *
+ * #include "name" はファイルのあるディレクトリからの相対パスとして
+ * 展開する。同じファイルは2回目以降は展開しない。
+ */
+std::optional<std::string> LoadShaderSource(const std::string& path);
+
+/**
+ * @brief ファイルからシェーダーを読み込んでプログラムを作る
+ * @param stages シェーダーの種類とファイルのパスの組
+ * @param defines #versionの次の行に挿入する#defineなど
+ * @return プログラムの名前、失敗すれば0。呼び出し側でglDeleteProgramすること
+ *
+ * コンパイルやリンクに失敗した場合はログを標準エラーに出す。
+ */
+GLuint LoadShaderProgram(
+    const std::vector<std::pair<GLenum, std::string>>& stages,
+    const std::string& defines = "");
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_SHADER_PROGRAM_H_
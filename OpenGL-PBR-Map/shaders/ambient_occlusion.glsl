@@ -0,0 +1,23 @@
+// GroundTruthAmbientOcclusionの可視率を環境光とIBLに掛ける関数
+//   float visibility = texelFetch(ambient_occlusion,
+//                                 ivec2(gl_FragCoord.xy), 0).r;
+//   diffuse_ibl *= GtaoMultiBounce(visibility, albedo);
+//   specular_ibl *= ComputeSpecularOcclusion(n_dot_v, visibility, roughness);
+
+// 面の間の相互反射で明るい面ほど遮蔽が弱まる分を補う
+// (Jimenez et al. 2016の近似式)
+vec3 GtaoMultiBounce(float visibility, vec3 albedo) {
+  vec3 a = 2.0404 * albedo - 0.3324;
+  vec3 b = -4.7951 * albedo + 0.6417;
+  vec3 c = 2.7552 * albedo + 0.6903;
+  return max(vec3(visibility),
+             ((visibility * a + b) * visibility + c) * visibility);
+}
+
+// 可視率から鏡面反射の遮蔽を求める (Lagarde 2014の近似式)
+float ComputeSpecularOcclusion(float n_dot_v, float visibility,
+                               float roughness) {
+  return clamp(pow(n_dot_v + visibility, exp2(-16.0 * roughness - 1.0)) -
+                   1.0 + visibility,
+               0.0, 1.0);
+}
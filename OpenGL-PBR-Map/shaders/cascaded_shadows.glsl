@@ -0,0 +1,36 @@
+// CascadedShadowMapsが描いた平行光源の影を参照する関数
+
+layout(std430, binding = 7) readonly buffer CascadedShadows {
+  mat4 cascade_view_projections[4];
+  // 各カスケードの奥の深度
+  vec4 cascade_split_depths;
+  // 1テクセルのワールド空間での大きさ
+  vec4 cascade_texel_sizes;
+  uint cascade_count;
+};
+
+// ビュー空間の深度 (カメラの前方が正) からカスケードを選ぶ
+int GetShadowCascade(float view_depth) {
+  for (uint i = 0u; i < cascade_count; ++i) {
+    if (view_depth <= cascade_split_depths[i]) {
+      return int(i);
+    }
+  }
+  return -1;
+}
+
+// 平行光源の影の濃さを求める (1が照らされている)
+// 法線方向にテクセルの大きさだけずらして自己遮蔽を防ぐ
+float SampleCascadedShadow(sampler2DArrayShadow shadow_map,
+                           vec3 world_position, vec3 world_normal,
+                           float view_depth) {
+  int cascade = GetShadowCascade(view_depth);
+  if (cascade < 0) {
+    return 1.0;
+  }
+  vec3 offset_position =
+      world_position + world_normal * cascade_texel_sizes[cascade] * 1.5;
+  vec4 clip = cascade_view_projections[cascade] * vec4(offset_position, 1.0);
+  vec3 coord = clip.xyz / clip.w * 0.5 + 0.5;
+  return texture(shadow_map, vec4(coord.xy, float(cascade), coord.z));
+}
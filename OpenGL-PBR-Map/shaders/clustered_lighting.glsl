@@ -0,0 +1,46 @@
+// ClusteredLightingが割り当てたライトを参照する関数
+
+struct ClusterPointLight {
+  vec3 position;
+  float range;
+  vec3 intensity;
+  float padding;
+};
+
+layout(std430, binding = 2) readonly buffer ClusterLights {
+  ClusterPointLight cluster_lights[];
+};
+
+layout(std430, binding = 3) readonly buffer LightClusters {
+  // xyzがクラスターの数、wはクラスターあたりのライトの上限
+  uvec4 cluster_grid_size;
+  // xyがタイルのピクセル数、zwは深度からスライスを求める係数と切片
+  vec4 cluster_tile_and_slice;
+  // xが番号の配列の位置、yがライトの数
+  uvec2 light_clusters[];
+};
+
+layout(std430, binding = 4) readonly buffer ClusterLightIndices {
+  uint cluster_light_indices[];
+};
+
+// フラグメントのクラスターを求める
+// view_depthはビュー空間での深度 (カメラの前方が正)
+uvec2 GetLightCluster(vec2 frag_coord, float view_depth) {
+  uvec2 tile = uvec2(frag_coord / cluster_tile_and_slice.xy);
+  float slice = log(view_depth) * cluster_tile_and_slice.z -
+                cluster_tile_and_slice.w;
+  uvec3 cell = min(uvec3(tile, uint(max(slice, 0.0))),
+                   cluster_grid_size.xyz - 1u);
+  uint index = cell.x +
+               (cell.y + cell.z * cluster_grid_size.y) * cluster_grid_size.x;
+  return light_clusters[index];
+}
+
+// 使い方
+//   uvec2 cluster = GetLightCluster(gl_FragCoord.xy, view_depth);
+//   for (uint i = 0u; i < cluster.y; ++i) {
+//     ClusterPointLight light =
+//         cluster_lights[cluster_light_indices[cluster.x + i]];
+//     ...
+//   }
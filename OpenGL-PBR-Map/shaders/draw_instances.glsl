@@ -0,0 +1,19 @@
+// DrawBatcherが書き込むインスタンスごとの値を参照する関数
+// 各コマンドのbase_instanceがそのコマンドの最初のインスタンスを指す
+
+struct DrawInstance {
+  mat4 model;
+  uint material;
+  uint padding0;
+  uint padding1;
+  uint padding2;
+};
+
+layout(std430, binding = 0) readonly buffer DrawInstances {
+  DrawInstance draw_instances[];
+};
+
+// 頂点シェーダーでのみ使える
+DrawInstance GetDrawInstance() {
+  return draw_instances[gl_BaseInstance + gl_InstanceID];
+}
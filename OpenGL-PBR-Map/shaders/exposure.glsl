@@ -0,0 +1,16 @@
+// PostProcessの輝度のヒストグラムと露出
+
+#define HISTOGRAM_BIN_COUNT 256
+
+layout(std430, binding = 9) buffer Exposure {
+  // 0番は真っ黒な画素、1～255番はlog2の輝度を等分した範囲
+  uint histogram[HISTOGRAM_BIN_COUNT];
+  // 目が慣れた平均輝度。0なら最初のフレーム
+  float average_luminance;
+  // シーンの色に掛ける値
+  float exposure;
+};
+
+float GetLuminance(vec3 color) {
+  return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
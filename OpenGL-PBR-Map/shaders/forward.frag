@@ -0,0 +1,53 @@
+#version 460
+
+// ClusteredLightingがフラグメントのクラスターに割り当てたライトで照らす。
+// 照らし方はtiled_deferred.compと同じなので、同じシーンで描き比べられる。
+// G-bufferは発光を持たないので、どちらも発光は足さない
+
+#include "ambient_occlusion.glsl"
+#include "clustered_lighting.glsl"
+#include "materials.glsl"
+#include "shading.glsl"
+
+in vec3 world_position;
+in vec3 world_normal;
+in vec2 texcoord;
+flat in uint material_index;
+
+layout(location = 0) out vec4 output_color;
+
+uniform mat4 view;
+uniform vec3 camera_position;
+uniform vec3 ambient;
+
+void main() {
+  Material material = materials[material_index];
+  SurfaceMaterial surface = GetSurfaceMaterial(material, texcoord);
+  if (IsAlphaTested(material, surface)) {
+    discard;
+  }
+  vec3 base_color = surface.base_color.rgb;
+  float roughness = ClampRoughness(surface.roughness);
+  vec3 n = normalize(world_normal);
+  vec3 v = normalize(camera_position - world_position);
+
+  vec3 radiance =
+      ambient * base_color * GtaoMultiBounce(surface.occlusion, base_color);
+  float view_depth = -(view * vec4(world_position, 1.0)).z;
+  uvec2 cluster = GetLightCluster(gl_FragCoord.xy, view_depth);
+  for (uint i = 0u; i < cluster.y; ++i) {
+    ClusterPointLight light =
+        cluster_lights[cluster_light_indices[cluster.x + i]];
+    vec3 to_light = light.position - world_position;
+    float distance = length(to_light);
+    if (distance >= light.range) {
+      continue;
+    }
+    vec3 l = to_light / distance;
+    radiance += EvaluateBrdf(n, v, l, base_color, surface.metallic,
+                             roughness) *
+                light.intensity *
+                EvaluatePointLightFalloff(distance, light.range);
+  }
+  output_color = vec4(radiance, 1.0);
+}
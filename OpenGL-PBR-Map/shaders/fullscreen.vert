@@ -0,0 +1,12 @@
+#version 460
+
+// 頂点番号から画面全体を覆う1枚の三角形を作る。
+// glDrawArrays(GL_TRIANGLES, 0, 3)で頂点属性なしに描く
+
+out vec2 uv;
+
+void main() {
+  vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+  uv = position;
+  gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,27 @@
+#version 460
+
+// マテリアルを評価してG-bufferに書く。照らすのはtiled_deferred.comp
+
+#include "gbuffer.glsl"
+#include "materials.glsl"
+
+in vec3 world_position;
+in vec3 world_normal;
+in vec2 texcoord;
+flat in uint material_index;
+
+layout(location = 0) out vec2 gbuffer_normal;
+layout(location = 1) out vec4 gbuffer_base_color;
+layout(location = 2) out vec4 gbuffer_material;
+
+void main() {
+  Material material = materials[material_index];
+  SurfaceMaterial surface = GetSurfaceMaterial(material, texcoord);
+  if (IsAlphaTested(material, surface)) {
+    discard;
+  }
+  gbuffer_normal = EncodeOctahedral(normalize(world_normal));
+  gbuffer_base_color = vec4(surface.base_color.rgb, 1.0);
+  gbuffer_material =
+      vec4(surface.metallic, surface.roughness, surface.occlusion, 0.0);
+}
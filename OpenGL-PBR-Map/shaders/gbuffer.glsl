@@ -0,0 +1,23 @@
+// G-bufferの書き込みと読み出しに使う関数
+// 0: 法線 (RG16_SNORM、八面体写像)
+// 1: ベースカラー (SRGB8_ALPHA8)
+// 2: metallic, roughness, AO (RGBA8、aは未使用)
+
+// 単位ベクトルを八面体に写して[-1, 1]^2にする
+vec2 EncodeOctahedral(vec3 n) {
+  n /= abs(n.x) + abs(n.y) + abs(n.z);
+  vec2 e = n.xy;
+  if (n.z < 0.0) {
+    e = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0,
+                                 n.y >= 0.0 ? 1.0 : -1.0);
+  }
+  return e;
+}
+
+vec3 DecodeOctahedral(vec2 e) {
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.x += n.x >= 0.0 ? -t : t;
+  n.y += n.y >= 0.0 ? -t : t;
+  return normalize(n);
+}
@@ -0,0 +1,13 @@
+// GroundTruthAmbientOcclusionの各パスで使う関数
+
+// 深度バッファの値から線形の深度 (カメラの前方が正) を求める。
+// depth_parametersは射影行列の(m[3][2], m[2][2])
+float LinearizeDepth(float depth, vec2 depth_parameters) {
+  return depth_parameters.x / (depth * 2.0 - 1.0 + depth_parameters.y);
+}
+
+// 画面上の位置と線形の深度からビュー空間の位置を求める。
+// view_scaleは深度1でのビュー空間の半分の幅と高さ
+vec3 GetGtaoViewPosition(vec2 uv, float linear_depth, vec2 view_scale) {
+  return vec3((uv * 2.0 - 1.0) * view_scale * linear_depth, -linear_depth);
+}
@@ -0,0 +1,45 @@
+// IrradianceVolumeのアトラスを参照する関数
+// 各テクスチャはプローブのL2 SH (27個のfloat) を4個ずつ持つ
+
+struct IrradianceVolumeRoom {
+  vec4 bounds_min;
+  vec4 bounds_max;
+  vec4 atlas_offset;
+  vec4 probe_count;
+};
+
+uniform sampler3D irradiance_volume_atlas[7];
+
+vec3 SampleIrradianceVolume(IrradianceVolumeRoom room, vec3 position,
+                            vec3 normal) {
+  // プローブはセルの中心、つまりテクセルの中心にあるので
+  // 隣の部屋から補間されないよう半テクセル内側でクランプする
+  vec3 count = room.probe_count.xyz;
+  vec3 cell = (position - room.bounds_min.xyz) /
+              (room.bounds_max.xyz - room.bounds_min.xyz) * count;
+  cell = clamp(cell, vec3(0.5), count - 0.5);
+  vec3 uvw = (room.atlas_offset.xyz + cell) /
+             vec3(textureSize(irradiance_volume_atlas[0], 0));
+
+  float c[28];
+  for (int i = 0; i < 7; ++i) {
+    vec4 texel = texture(irradiance_volume_atlas[i], uvw);
+    c[i * 4 + 0] = texel.x;
+    c[i * 4 + 1] = texel.y;
+    c[i * 4 + 2] = texel.z;
+    c[i * 4 + 3] = texel.w;
+  }
+
+  vec3 n = normal;
+  float basis[9] = float[9](
+      0.282095, 0.488603 * n.y, 0.488603 * n.z, 0.488603 * n.x,
+      1.092548 * n.x * n.y, 1.092548 * n.y * n.z,
+      0.315392 * (3.0 * n.z * n.z - 1.0), 1.092548 * n.x * n.z,
+      0.546274 * (n.x * n.x - n.y * n.y));
+
+  vec3 irradiance = vec3(0.0);
+  for (int i = 0; i < 9; ++i) {
+    irradiance += vec3(c[i * 3 + 0], c[i * 3 + 1], c[i * 3 + 2]) * basis[i];
+  }
+  return max(irradiance, vec3(0.0));
+}
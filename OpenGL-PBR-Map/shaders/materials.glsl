@@ -0,0 +1,81 @@
+// MaterialTableのマテリアルを参照する関数
+// MaterialTable::IsBindless()がtrueならMATERIAL_BINDLESSを定義し、
+// このファイルより前に #extension GL_ARB_bindless_texture : require を書く
+
+#define MATERIAL_BASE_COLOR 0
+#define MATERIAL_NORMAL 1
+#define MATERIAL_METALLIC_ROUGHNESS 2
+#define MATERIAL_OCCLUSION 3
+
+#define MATERIAL_ALPHA_TEST 1u
+#define MATERIAL_DOUBLE_SIDED 2u
+
+struct Material {
+  vec4 base_color;
+  vec4 emissive;
+  float metallic;
+  float roughness;
+  float occlusion_strength;
+  uint flags;
+  uvec2 texture_handles[4];
+  ivec4 texture_layers;
+};
+
+layout(std430, binding = 1) readonly buffer Materials {
+  Material materials[];
+};
+
+#ifndef MATERIAL_BINDLESS
+layout(binding = 8) uniform sampler2DArray material_color_textures;
+layout(binding = 9) uniform sampler2DArray material_data_textures;
+#endif
+
+bool HasMaterialTexture(Material material, int slot) {
+  return material.texture_layers[slot] >= 0 ||
+         material.texture_handles[slot] != uvec2(0);
+}
+
+// テクスチャがなければ1を返すので、係数にそのまま掛けられる
+vec4 SampleMaterialTexture(Material material, int slot, vec2 uv) {
+  if (!HasMaterialTexture(material, slot)) {
+    return vec4(1.0);
+  }
+#ifdef MATERIAL_BINDLESS
+  return texture(sampler2D(material.texture_handles[slot]), uv);
+#else
+  vec3 uvw = vec3(uv, float(material.texture_layers[slot]));
+  if (slot == MATERIAL_BASE_COLOR) {
+    return texture(material_color_textures, uvw);
+  }
+  return texture(material_data_textures, uvw);
+#endif
+}
+
+// 係数とテクスチャを合わせた面の値
+struct SurfaceMaterial {
+  vec4 base_color;
+  float metallic;
+  float roughness;
+  float occlusion;
+};
+
+// メタリックとラフネスのテクスチャはglTFと同じくbにmetallic、gにroughness
+SurfaceMaterial GetSurfaceMaterial(Material material, vec2 uv) {
+  SurfaceMaterial surface;
+  surface.base_color =
+      material.base_color *
+      SampleMaterialTexture(material, MATERIAL_BASE_COLOR, uv);
+  vec4 metallic_roughness =
+      SampleMaterialTexture(material, MATERIAL_METALLIC_ROUGHNESS, uv);
+  surface.metallic = material.metallic * metallic_roughness.b;
+  surface.roughness = material.roughness * metallic_roughness.g;
+  surface.occlusion =
+      mix(1.0, SampleMaterialTexture(material, MATERIAL_OCCLUSION, uv).r,
+          material.occlusion_strength);
+  return surface;
+}
+
+bool IsAlphaTested(Material material, SurfaceMaterial surface) {
+  return (material.flags & MATERIAL_ALPHA_TEST) != 0u &&
+         surface.base_color.a < 0.5;
+}
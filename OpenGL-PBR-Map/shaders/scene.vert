@@ -0,0 +1,27 @@
+#version 460
+
+// DrawBatcherのインスタンスを描く。頂点はChunkVertexの並び
+// フォワード描画 (forward.frag) とG-buffer (gbuffer.frag) で共有する
+
+#include "draw_instances.glsl"
+
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in vec2 uv;
+
+out vec3 world_position;
+out vec3 world_normal;
+out vec2 texcoord;
+flat out uint material_index;
+
+uniform mat4 view_projection;
+
+void main() {
+  DrawInstance instance = GetDrawInstance();
+  vec4 world = instance.model * vec4(position, 1.0);
+  world_position = world.xyz;
+  world_normal = mat3(instance.model) * normal;
+  texcoord = uv;
+  material_index = instance.material;
+  gl_Position = view_projection * world;
+}
@@ -0,0 +1,42 @@
+// 点光源の減衰とBRDF。フォワード描画 (forward.frag) とタイルベースの
+// ディファード描画 (tiled_deferred.comp) で同じ結果になるよう共有する
+
+#define PI 3.14159265359
+
+// 逆2乗則にrangeで0になる窓関数を掛ける (light.hと同じ式)
+float EvaluatePointLightFalloff(float distance, float range) {
+  float ratio = distance / range;
+  float ratio4 = ratio * ratio * ratio * ratio;
+  float window = max(0.0, 1.0 - ratio4);
+  return window * window / max(distance * distance, 1.0e-4);
+}
+
+// GGXとSmithの高さ相関マスキングによるCook-TorranceのBRDF
+vec3 EvaluateBrdf(vec3 n, vec3 v, vec3 l, vec3 base_color, float metallic,
+                  float roughness) {
+  vec3 h = normalize(v + l);
+  float n_dot_v = max(dot(n, v), 1.0e-4);
+  float n_dot_l = max(dot(n, l), 0.0);
+  float n_dot_h = max(dot(n, h), 0.0);
+  float v_dot_h = max(dot(v, h), 0.0);
+  float alpha = roughness * roughness;
+  float alpha2 = alpha * alpha;
+
+  float d = n_dot_h * n_dot_h * (alpha2 - 1.0) + 1.0;
+  float distribution = alpha2 / (PI * d * d);
+  float visibility =
+      0.5 / (n_dot_l * sqrt(n_dot_v * n_dot_v * (1.0 - alpha2) + alpha2) +
+             n_dot_v * sqrt(n_dot_l * n_dot_l * (1.0 - alpha2) + alpha2) +
+             1.0e-5);
+  vec3 f0 = mix(vec3(0.04), base_color, metallic);
+  vec3 fresnel = f0 + (1.0 - f0) * pow(1.0 - v_dot_h, 5.0);
+
+  vec3 diffuse = (1.0 - metallic) * base_color / PI;
+  return (diffuse * (1.0 - fresnel) + distribution * visibility * fresnel) *
+         n_dot_l;
+}
+
+// 粗さの下限。これより小さいとハイライトが1ピクセルに潰れる
+float ClampRoughness(float roughness) {
+  return max(roughness, 0.045);
+}
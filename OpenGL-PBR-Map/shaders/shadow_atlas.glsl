@@ -0,0 +1,58 @@
+// ShadowAtlasが描いたシャドウマップを参照する関数
+
+struct ShadowView {
+  mat4 view_projection;
+  // xyがアトラスのUVでの左下隅、zが大きさ
+  vec4 atlas_rect;
+};
+
+layout(std430, binding = 6) readonly buffer ShadowViews {
+  ShadowView shadow_views[];
+};
+
+// 点光源の面を選ぶ。順番は+X, -X, +Y, -Y, +Z, -Z
+int GetShadowCubeFace(vec3 light_to_position) {
+  vec3 a = abs(light_to_position);
+  if (a.x >= a.y && a.x >= a.z) {
+    return light_to_position.x > 0.0 ? 0 : 1;
+  }
+  if (a.y >= a.z) {
+    return light_to_position.y > 0.0 ? 2 : 3;
+  }
+  return light_to_position.z > 0.0 ? 4 : 5;
+}
+
+// 1つの視点で影の濃さを求める (1が照らされている)
+// 隣の領域を読まないよう、半テクセル内側に収める
+float SampleShadowView(sampler2DShadow atlas, int view_index,
+                       vec3 world_position, float bias) {
+  ShadowView view = shadow_views[view_index];
+  vec4 clip = view.view_projection * vec4(world_position, 1.0);
+  vec3 ndc = clip.xyz / clip.w;
+  vec2 texel = 1.0 / vec2(textureSize(atlas, 0));
+  vec2 uv = clamp(ndc.xy * 0.5 + 0.5, texel * 0.5 / view.atlas_rect.z,
+                  1.0 - texel * 0.5 / view.atlas_rect.z);
+  vec2 atlas_uv = view.atlas_rect.xy + uv * view.atlas_rect.z;
+  return texture(atlas, vec3(atlas_uv, ndc.z * 0.5 + 0.5 - bias));
+}
+
+// 点光源の影。first_view_indexはShadowAtlas::GetFirstViewIndexの値
+float SamplePointShadow(sampler2DShadow atlas, int first_view_index,
+                        vec3 light_position, vec3 world_position,
+                        float bias) {
+  if (first_view_index < 0) {
+    return 1.0;
+  }
+  int face = GetShadowCubeFace(world_position - light_position);
+  return SampleShadowView(atlas, first_view_index + face, world_position,
+                          bias);
+}
+
+// スポットライトの影
+float SampleSpotShadow(sampler2DShadow atlas, int first_view_index,
+                       vec3 world_position, float bias) {
+  if (first_view_index < 0) {
+    return 1.0;
+  }
+  return SampleShadowView(atlas, first_view_index, world_position, bias);
+}
@@ -0,0 +1,37 @@
+#version 460
+
+// 露出、ブルーム、トーンマッピング、sRGBへの変換を1回で行う。
+// 出力先はGL_FRAMEBUFFER_SRGBを使わないフレームバッファ
+
+#include "exposure.glsl"
+
+in vec2 uv;
+
+layout(location = 0) out vec4 output_color;
+
+layout(binding = 0) uniform sampler2D scene;
+layout(binding = 1) uniform sampler2D bloom;
+
+uniform float bloom_intensity;
+// ブルームの各段を足し合わせた値を平均にする係数 (1 / 段の数)
+uniform float bloom_scale;
+
+// ACESのRRTとODTをまとめた曲線の近似式 (Narkowicz)
+vec3 TonemapAces(vec3 x) {
+  return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14),
+               0.0, 1.0);
+}
+
+vec3 LinearToSrgb(vec3 color) {
+  return mix(color * 12.92, 1.055 * pow(color, vec3(1.0 / 2.4)) - 0.055,
+             step(0.0031308, color));
+}
+
+void main() {
+  vec3 color = texelFetch(scene, ivec2(gl_FragCoord.xy), 0).rgb;
+  // ブルームはエネルギーを保つよう足すのではなく混ぜる
+  color = mix(color, textureLod(bloom, uv, 0.0).rgb * bloom_scale,
+              bloom_intensity);
+  color *= exposure > 0.0 ? exposure : 1.0;
+  output_color = vec4(LinearToSrgb(TonemapAces(color)), 1.0);
+}
@@ -0,0 +1,15 @@
+// TemporalAntiAliasingの速度バッファに書く値を求める関数
+//
+// 動くオブジェクトの頂点シェーダーで、ずらす前のビュー射影行列による
+// 現在のクリップ座標と、前のフレームのモデル行列とビュー射影行列による
+// クリップ座標を出力し、フラグメントシェーダーで補間された値を渡す。
+// 静的な物体は書かなくてよい。0のピクセルはカメラの動きだけで再投影する
+//   layout(location = 3) out vec2 out_velocity;
+//   out_velocity = GetVelocity(current_clip, previous_clip);
+
+// 前のフレームからの画面上の動き (UV単位)
+vec2 GetVelocity(vec4 current_clip, vec4 previous_clip) {
+  return (current_clip.xy / current_clip.w -
+          previous_clip.xy / previous_clip.w) *
+         0.5;
+}
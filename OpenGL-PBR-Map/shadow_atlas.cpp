@@ -0,0 +1,413 @@
+#include "shadow_atlas.h"
+
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+#include "gl_state_cache.h"
+
+namespace game {
+
+namespace {
+
+// キューブの各面の向きと上方向
+const glm::vec3 kCubeFaceDirections[ShadowAtlas::kCubeFaceCount] = {
+    {1.0f, 0.0f, 0.0f}, {-1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f},
+    {0.0f, -1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 0.0f, -1.0f}};
+const glm::vec3 kCubeFaceUps[ShadowAtlas::kCubeFaceCount] = {
+    {0.0f, -1.0f, 0.0f}, {0.0f, -1.0f, 0.0f}, {0.0f, 0.0f, 1.0f},
+    {0.0f, 0.0f, -1.0f}, {0.0f, -1.0f, 0.0f}, {0.0f, -1.0f, 0.0f}};
+
+// ライトの範囲に対する近クリップ面の距離の比
+constexpr float kNearPlaneRatio = 0.01f;
+
+int CeilPowerOfTwo(int value) {
+  int power = 1;
+  while (power < value) {
+    power *= 2;
+  }
+  return power;
+}
+
+bool operator==(const ShadowLightDesc& a, const ShadowLightDesc& b) {
+  return a.type == b.type && a.position == b.position &&
+         a.direction == b.direction && a.range == b.range &&
+         a.outer_angle == b.outer_angle;
+}
+
+}  // namespace
+
+ShadowAtlasAllocator::ShadowAtlasAllocator(int atlas_size, int min_tile_size)
+    : atlas_size_(atlas_size), used_area_(0) {
+  level_count_ = 1;
+  while ((atlas_size_ >> level_count_) >= min_tile_size) {
+    ++level_count_;
+  }
+  free_tiles_.resize(level_count_);
+  free_tiles_[0].push_back(glm::ivec2(0));
+}
+
+std::optional<ShadowTile> ShadowAtlasAllocator::Allocate(int size) {
+  if (size > atlas_size_) {
+    return std::nullopt;
+  }
+  const auto level = GetLevel(size);
+  // 空きのある最も小さい段を探す
+  auto source_level = level;
+  while (source_level >= 0 && free_tiles_[source_level].empty()) {
+    --source_level;
+  }
+  if (source_level < 0) {
+    return std::nullopt;
+  }
+
+  auto position = free_tiles_[source_level].back();
+  free_tiles_[source_level].pop_back();
+  // 目的の段まで4分割し、左下以外を空きに戻す
+  for (auto l = source_level + 1; l <= level; ++l) {
+    const auto child_size = atlas_size_ >> l;
+    free_tiles_[l].push_back(position + glm::ivec2(child_size, 0));
+    free_tiles_[l].push_back(position + glm::ivec2(0, child_size));
+    free_tiles_[l].push_back(position + glm::ivec2(child_size));
+  }
+  const auto tile_size = atlas_size_ >> level;
+  used_area_ += static_cast<std::size_t>(tile_size) * tile_size;
+  return ShadowTile{position.x, position.y, tile_size};
+}
+
+void ShadowAtlasAllocator::Free(const ShadowTile& tile) {
+  used_area_ -= static_cast<std::size_t>(tile.size) * tile.size;
+  auto level = GetLevel(tile.size);
+  glm::ivec2 position(tile.x, tile.y);
+  // 兄弟が全て空いていれば親にまとめる
+  while (level > 0) {
+    const auto size = atlas_size_ >> level;
+    const auto parent = position / (size * 2) * (size * 2);
+    auto& free_tiles = free_tiles_[level];
+    std::vector<std::size_t> siblings;
+    for (int i = 0; i < 4; ++i) {
+      const auto sibling = parent + glm::ivec2(i % 2, i / 2) * size;
+      if (sibling == position) {
+        continue;
+      }
+      const auto found =
+          std::find(free_tiles.begin(), free_tiles.end(), sibling);
+      if (found == free_tiles.end()) {
+        break;
+      }
+      siblings.push_back(found - free_tiles.begin());
+    }
+    if (siblings.size() != 3) {
+      break;
+    }
+    std::sort(siblings.rbegin(), siblings.rend());
+    for (const auto index : siblings) {
+      free_tiles.erase(free_tiles.begin() + index);
+    }
+    position = parent;
+    --level;
+  }
+  free_tiles_[level].push_back(position);
+}
+
+std::size_t ShadowAtlasAllocator::GetUsedArea() const { return used_area_; }
+
+int ShadowAtlasAllocator::GetLevel(int size) const {
+  int level = 0;
+  while ((atlas_size_ >> (level + 1)) >= size && level + 1 < level_count_) {
+    ++level;
+  }
+  return level;
+}
+
+ShadowAtlas::ShadowAtlas(int atlas_size, int min_tile_size, int max_tile_size)
+    : atlas_size_(atlas_size),
+      min_tile_size_(min_tile_size),
+      max_tile_size_(max_tile_size),
+      allocator_(atlas_size, min_tile_size),
+      static_render_count_(0),
+      static_texture_(0),
+      dynamic_texture_(0),
+      static_framebuffer_(0),
+      dynamic_framebuffer_(0),
+      view_buffer_(0),
+      view_buffer_size_(0) {}
+
+ShadowAtlas::~ShadowAtlas() {
+  if (static_texture_ == 0) {
+    return;
+  }
+  glDeleteFramebuffers(1, &static_framebuffer_);
+  glDeleteFramebuffers(1, &dynamic_framebuffer_);
+  auto& state = GlStateCache::GetInstance();
+  state.DeleteTextures(1, &static_texture_);
+  state.DeleteTextures(1, &dynamic_texture_);
+  glDeleteBuffers(1, &view_buffer_);
+}
+
+void ShadowAtlas::BeginFrame() {
+  for (auto& light : lights_) {
+    light.second.requested = false;
+  }
+}
+
+void ShadowAtlas::RequestLight(std::uint32_t id, const ShadowLightDesc& desc,
+                               float screen_coverage) {
+  auto& entry = lights_[id];
+  if (!(entry.desc == desc)) {
+    entry.desc = desc;
+    entry.static_valid = false;
+  }
+  entry.requested = true;
+  entry.desired_tile_size = ChooseTileSize(screen_coverage);
+}
+
+void ShadowAtlas::InvalidateStaticCasters(const AABB& bounds) {
+  for (auto& light : lights_) {
+    const auto& desc = light.second.desc;
+    const auto closest = glm::clamp(desc.position, bounds.min, bounds.max);
+    if (glm::distance(closest, desc.position) <= desc.range) {
+      light.second.static_valid = false;
+    }
+  }
+}
+
+void ShadowAtlas::Render(
+    const std::function<void(const ShadowView&, bool)>& draw_casters) {
+  // 登録されなかったライトと、解像度を下げるライトの領域を先に解放する。
+  // 下げるのは4分の1以下になったときだけにして、行き来を防ぐ
+  std::vector<std::uint32_t> ids;
+  for (auto it = lights_.begin(); it != lights_.end();) {
+    auto& entry = it->second;
+    if (!entry.requested) {
+      FreeTiles(entry);
+      it = lights_.erase(it);
+      continue;
+    }
+    if (!entry.tiles.empty() &&
+        entry.desired_tile_size * 4 <= entry.tile_size) {
+      FreeTiles(entry);
+    }
+    ids.push_back(it->first);
+    ++it;
+  }
+
+  // 大きい領域から割り当てると断片化しにくい。同じ大きさなら識別子の順
+  std::sort(ids.begin(), ids.end(), [&](std::uint32_t a, std::uint32_t b) {
+    const auto size_a = lights_[a].desired_tile_size;
+    const auto size_b = lights_[b].desired_tile_size;
+    return size_a > size_b || (size_a == size_b && a < b);
+  });
+  // 領域のないライトには、空きが足りなければ解像度を下げてでも割り当てる
+  for (const auto id : ids) {
+    auto& entry = lights_[id];
+    for (auto size = entry.desired_tile_size;
+         entry.tiles.empty() && size >= min_tile_size_; size /= 2) {
+      entry.tiles = AllocateTiles(entry.desc.type, size);
+      entry.tile_size = entry.tiles.empty() ? 0 : size;
+    }
+  }
+  // 解像度を上げるのは全てのライトに領域が行き渡った後で、
+  // 割り当てられなければ今の領域と保存した深度をそのまま使う
+  for (const auto id : ids) {
+    auto& entry = lights_[id];
+    if (entry.tiles.empty() || entry.desired_tile_size <= entry.tile_size) {
+      continue;
+    }
+    auto tiles = AllocateTiles(entry.desc.type, entry.desired_tile_size);
+    if (!tiles.empty()) {
+      FreeTiles(entry);
+      entry.tiles = std::move(tiles);
+      entry.tile_size = entry.desired_tile_size;
+    }
+  }
+
+  views_.clear();
+  std::vector<ShadowView> frame_views;
+  std::vector<std::uint32_t> frame_view_lights;
+  for (const auto id : ids) {
+    auto& entry = lights_[id];
+    entry.first_view_index = -1;
+    if (entry.tiles.empty()) {
+      continue;
+    }
+    entry.first_view_index = static_cast<int>(views_.size());
+    for (const auto& view : GetLightViews(entry)) {
+      GpuShadowView gpu_view;
+      gpu_view.view_projection = view.view_projection;
+      gpu_view.atlas_rect =
+          glm::vec4(static_cast<float>(view.tile.x) / atlas_size_,
+                    static_cast<float>(view.tile.y) / atlas_size_,
+                    static_cast<float>(view.tile.size) / atlas_size_, 0.0f);
+      views_.push_back(gpu_view);
+      frame_views.push_back(view);
+      frame_view_lights.push_back(id);
+    }
+  }
+
+  if (static_texture_ == 0) {
+    CreateTargets();
+  }
+  static_render_count_ = 0;
+  GlStateCache::GetInstance().SetDepthMask(true);
+  glEnable(GL_SCISSOR_TEST);
+  auto set_tile = [](const ShadowTile& tile) {
+    glViewport(tile.x, tile.y, tile.size, tile.size);
+    glScissor(tile.x, tile.y, tile.size, tile.size);
+  };
+
+  // 保存した深度がないライトは静的な遮蔽物だけを描いて保存する
+  glBindFramebuffer(GL_FRAMEBUFFER, static_framebuffer_);
+  for (std::size_t i = 0; i < frame_views.size(); ++i) {
+    const auto& entry = lights_[frame_view_lights[i]];
+    if (entry.static_valid) {
+      continue;
+    }
+    set_tile(frame_views[i].tile);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    draw_casters(frame_views[i], true);
+    ++static_render_count_;
+  }
+  for (const auto id : ids) {
+    lights_[id].static_valid = !lights_[id].tiles.empty();
+  }
+
+  // 保存した深度を写してから動的な遮蔽物を重ねる
+  glBindFramebuffer(GL_FRAMEBUFFER, dynamic_framebuffer_);
+  for (const auto& view : frame_views) {
+    const auto& tile = view.tile;
+    glCopyImageSubData(static_texture_, GL_TEXTURE_2D, 0, tile.x, tile.y, 0,
+                       dynamic_texture_, GL_TEXTURE_2D, 0, tile.x, tile.y, 0,
+                       tile.size, tile.size, 1);
+    set_tile(tile);
+    draw_casters(view, false);
+  }
+
+  glDisable(GL_SCISSOR_TEST);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void ShadowAtlas::Upload() {
+  const auto size =
+      static_cast<GLsizeiptr>(views_.size() * sizeof(GpuShadowView));
+  if (size > view_buffer_size_) {
+    view_buffer_size_ = std::max(size, view_buffer_size_ * 2);
+    glNamedBufferData(view_buffer_, view_buffer_size_, nullptr,
+                      GL_DYNAMIC_DRAW);
+  }
+  if (size > 0) {
+    glNamedBufferSubData(view_buffer_, 0, size, views_.data());
+  }
+}
+
+void ShadowAtlas::Bind(GLuint texture_unit) const {
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kViewBufferBinding,
+                   view_buffer_);
+  GlStateCache::GetInstance().BindTextureUnit(texture_unit, dynamic_texture_);
+}
+
+int ShadowAtlas::GetFirstViewIndex(std::uint32_t id) const {
+  const auto found = lights_.find(id);
+  return found == lights_.end() ? -1 : found->second.first_view_index;
+}
+
+const std::vector<GpuShadowView>& ShadowAtlas::GetViews() const {
+  return views_;
+}
+
+std::size_t ShadowAtlas::GetStaticRenderCount() const {
+  return static_render_count_;
+}
+
+const ShadowAtlasAllocator& ShadowAtlas::GetAllocator() const {
+  return allocator_;
+}
+
+int ShadowAtlas::ChooseTileSize(float screen_coverage) const {
+  const auto size = static_cast<int>(
+      std::ceil(glm::clamp(screen_coverage, 0.0f, 1.0f) * max_tile_size_));
+  return glm::clamp(CeilPowerOfTwo(size), min_tile_size_, max_tile_size_);
+}
+
+std::vector<ShadowTile> ShadowAtlas::AllocateTiles(ShadowLightDesc::Type type,
+                                                   int size) {
+  const auto tile_count =
+      type == ShadowLightDesc::Type::kPoint ? kCubeFaceCount : 1;
+  std::vector<ShadowTile> tiles;
+  for (int i = 0; i < tile_count; ++i) {
+    const auto tile = allocator_.Allocate(size);
+    if (!tile) {
+      // 一部だけ割り当てた領域は戻す
+      for (const auto& allocated : tiles) {
+        allocator_.Free(allocated);
+      }
+      return {};
+    }
+    tiles.push_back(*tile);
+  }
+  return tiles;
+}
+
+void ShadowAtlas::FreeTiles(LightEntry& entry) {
+  for (const auto& tile : entry.tiles) {
+    allocator_.Free(tile);
+  }
+  entry.tiles.clear();
+  entry.tile_size = 0;
+  entry.static_valid = false;
+}
+
+std::vector<ShadowView> ShadowAtlas::GetLightViews(
+    const LightEntry& entry) const {
+  const auto& desc = entry.desc;
+  const auto near_plane = desc.range * kNearPlaneRatio;
+  std::vector<ShadowView> views;
+  if (desc.type == ShadowLightDesc::Type::kPoint) {
+    const auto projection = glm::perspective(glm::half_pi<float>(), 1.0f,
+                                             near_plane, desc.range);
+    for (int face = 0; face < kCubeFaceCount; ++face) {
+      const auto view =
+          glm::lookAt(desc.position, desc.position + kCubeFaceDirections[face],
+                      kCubeFaceUps[face]);
+      views.push_back({projection * view, entry.tiles[face], desc.position,
+                       desc.range});
+    }
+  } else {
+    const auto direction = glm::normalize(desc.direction);
+    const auto up = std::abs(direction.y) > 0.99f
+                        ? glm::vec3(1.0f, 0.0f, 0.0f)
+                        : glm::vec3(0.0f, 1.0f, 0.0f);
+    const auto projection = glm::perspective(2.0f * desc.outer_angle, 1.0f,
+                                             near_plane, desc.range);
+    const auto view =
+        glm::lookAt(desc.position, desc.position + direction, up);
+    views.push_back({projection * view, entry.tiles[0], desc.position,
+                     desc.range});
+  }
+  return views;
+}
+
+void ShadowAtlas::CreateTargets() {
+  GLuint* framebuffers[] = {&static_framebuffer_, &dynamic_framebuffer_};
+  GLuint* textures[] = {&static_texture_, &dynamic_texture_};
+  for (int i = 0; i < 2; ++i) {
+    glCreateTextures(GL_TEXTURE_2D, 1, textures[i]);
+    glTextureStorage2D(*textures[i], 1, GL_DEPTH_COMPONENT32F, atlas_size_,
+                       atlas_size_);
+    glCreateFramebuffers(1, framebuffers[i]);
+    glNamedFramebufferTexture(*framebuffers[i], GL_DEPTH_ATTACHMENT,
+                              *textures[i], 0);
+  }
+  // シェーダーではハードウェアの比較で4点のPCFを使う
+  glTextureParameteri(dynamic_texture_, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTextureParameteri(dynamic_texture_, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTextureParameteri(dynamic_texture_, GL_TEXTURE_COMPARE_MODE,
+                      GL_COMPARE_REF_TO_TEXTURE);
+  glTextureParameteri(dynamic_texture_, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+  glCreateBuffers(1, &view_buffer_);
+}
+
+}  // namespace game
@@ -0,0 +1,226 @@
+#ifndef OPENGL_PBR_MAP_SHADOW_ATLAS_H_
+#define OPENGL_PBR_MAP_SHADOW_ATLAS_H_
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "aabb.h"
+
+namespace game {
+
+/**
+ * @brief アトラスの中の正方形の領域
+ */
+struct ShadowTile {
+  int x;
+  int y;
+  int size;
+};
+
+/**
+ * @brief 四分木で正方形の領域を割り当てる
+ *
+ * 一辺が2のべき乗の領域を、アトラスを4分割していった各段の空き領域の
+ * 一覧から取り出す。空きがなければ1つ上の段の領域を4分割し、解放した
+ * 領域は4つの兄弟が揃えば1つ上の段に戻す。
+ */
+class ShadowAtlasAllocator {
+ public:
+  /**
+   * @brief コンストラクタ
+   * @param atlas_size アトラスの一辺のピクセル数 (2のべき乗)
+   * @param min_tile_size 最小の領域の一辺のピクセル数 (2のべき乗)
+   */
+  ShadowAtlasAllocator(int atlas_size, int min_tile_size);
+
+  /**
+   * @brief 領域を割り当てる
+   * @param size 一辺のピクセル数 (2のべき乗)
+   * @return 領域、空きがなければnullopt
+   */
+  std::optional<ShadowTile> Allocate(int size);
+
+  void Free(const ShadowTile& tile);
+
+  /**
+   * @brief 割り当てている領域の面積の合計を取得する
+   * @return ピクセル数
+   */
+  std::size_t GetUsedArea() const;
+
+ private:
+  int GetLevel(int size) const;
+
+  int atlas_size_;
+  int level_count_;
+  // 段ごとの空き領域の左下隅。0段目がアトラス全体
+  std::vector<std::vector<glm::ivec2>> free_tiles_;
+  std::size_t used_area_;
+};
+
+/**
+ * @brief 影を落とすライトの種類と配置
+ */
+struct ShadowLightDesc {
+  enum class Type { kPoint, kSpot };
+
+  Type type = Type::kPoint;
+  glm::vec3 position{0.0f};
+  // スポットライトの向き
+  glm::vec3 direction{0.0f, -1.0f, 0.0f};
+  float range = 1.0f;
+  // スポットライトの外側の円錐の半角 (ラジアン)
+  float outer_angle = 0.5f;
+};
+
+/**
+ * @brief シェーダーがSSBOから読むシャドウマップの視点 (std430)
+ */
+struct GpuShadowView {
+  glm::mat4 view_projection;
+  // xyがアトラスのUVでの左下隅、zが大きさ、wは未使用
+  glm::vec4 atlas_rect;
+};
+
+/**
+ * @brief シャドウマップを描く1つの視点
+ */
+struct ShadowView {
+  glm::mat4 view_projection;
+  ShadowTile tile;
+  glm::vec3 light_position;
+  float range;
+};
+
+/**
+ * @brief 点光源とスポットライトのシャドウマップを1枚のアトラスに置き、
+ *        静的な遮蔽物の深度を使い回す
+ *
+ * ライトごとの解像度は画面に占める割合で決め、四分木で領域を割り当てる。
+ * 点光源はキューブの6面を別々の領域に描く。静的な遮蔽物だけの深度は
+ * 別のアトラスに保存しておき、ライトが動いたか、ライトの範囲の静的な
+ * 遮蔽物が変わったときだけ描き直す。毎フレームは保存した深度を写してから
+ * 動的な遮蔽物だけを重ねて描くので、影を落とすライトが増えても
+ * 費用はほぼ動的な遮蔽物の数で決まる。
+ *
+ * 1フレームの使い方はBeginFrame、RequestLightを影を落とすライトの数だけ、
+ * Render、Uploadの順に呼び、シェーダーはGetFirstViewIndexで得た番号で
+ * 視点を読む (shaders/shadow_atlas.glsl)。
+ */
+class ShadowAtlas {
+ public:
+  static constexpr GLuint kViewBufferBinding = 6;
+  // 点光源の面の順番は+X, -X, +Y, -Y, +Z, -Z
+  static constexpr int kCubeFaceCount = 6;
+
+  /**
+   * @brief コンストラクタ
+   * @param atlas_size アトラスの一辺のピクセル数
+   * @param min_tile_size 最小の領域の一辺のピクセル数
+   * @param max_tile_size 最大の領域の一辺のピクセル数
+   */
+  ShadowAtlas(int atlas_size = 8192, int min_tile_size = 128,
+              int max_tile_size = 2048);
+  ~ShadowAtlas();
+
+  ShadowAtlas(const ShadowAtlas&) = delete;
+  ShadowAtlas& operator=(const ShadowAtlas&) = delete;
+
+  void BeginFrame();
+
+  /**
+   * @brief このフレームに影を落とすライトを登録する
+   * @param id 呼び出し側で決めるライトの識別子
+   * @param desc ライトの種類と配置
+   * @param screen_coverage ライトの範囲が画面に占める割合 [0, 1]
+   */
+  void RequestLight(std::uint32_t id, const ShadowLightDesc& desc,
+                    float screen_coverage);
+
+  /**
+   * @brief 範囲内の静的な遮蔽物が変わったライトの保存した深度を捨てる
+   * @param bounds 変わった遮蔽物のバウンディングボックス
+   */
+  void InvalidateStaticCasters(const AABB& bounds);
+
+  /**
+   * @brief 領域を割り当て、シャドウマップを描く
+   * @param draw_casters draw_casters(view, static_casters)の形で呼ばれ、
+   *        static_castersがtrueなら静的な、falseなら動的な遮蔽物を描く
+   *
+   * 呼ばれる時点でフレームバッファ、ビューポート、シザーは設定してある。
+   * このフレームに登録されなかったライトの領域は解放する。
+   */
+  void Render(const std::function<void(const ShadowView&, bool)>& draw_casters);
+
+  /**
+   * @brief 視点をSSBOに書き込む
+   */
+  void Upload();
+
+  /**
+   * @brief SSBOとアトラスのテクスチャをバインドする
+   * @param texture_unit アトラスをバインドするテクスチャユニット
+   */
+  void Bind(GLuint texture_unit) const;
+
+  /**
+   * @brief ライトの最初の視点の番号を取得する
+   * @param id ライトの識別子
+   * @return 番号、このフレームに領域がなければ-1
+   */
+  int GetFirstViewIndex(std::uint32_t id) const;
+
+  const std::vector<GpuShadowView>& GetViews() const;
+
+  /**
+   * @brief 直前のRenderで静的な遮蔽物を描き直した視点の数を取得する
+   * @return 視点の数
+   */
+  std::size_t GetStaticRenderCount() const;
+
+  const ShadowAtlasAllocator& GetAllocator() const;
+
+ private:
+  struct LightEntry {
+    ShadowLightDesc desc;
+    int tile_size = 0;
+    std::vector<ShadowTile> tiles;
+    bool requested = false;
+    bool static_valid = false;
+    int desired_tile_size = 0;
+    int first_view_index = -1;
+  };
+
+  int ChooseTileSize(float screen_coverage) const;
+  // 全ての領域を割り当てられなければ空を返す
+  std::vector<ShadowTile> AllocateTiles(ShadowLightDesc::Type type, int size);
+  void FreeTiles(LightEntry& entry);
+  std::vector<ShadowView> GetLightViews(const LightEntry& entry) const;
+  void CreateTargets();
+
+  int atlas_size_;
+  int min_tile_size_;
+  int max_tile_size_;
+  ShadowAtlasAllocator allocator_;
+  std::unordered_map<std::uint32_t, LightEntry> lights_;
+  std::vector<GpuShadowView> views_;
+  std::size_t static_render_count_;
+
+  GLuint static_texture_;
+  GLuint dynamic_texture_;
+  GLuint static_framebuffer_;
+  GLuint dynamic_framebuffer_;
+  GLuint view_buffer_;
+  GLsizeiptr view_buffer_size_;
+};
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_SHADOW_ATLAS_H_
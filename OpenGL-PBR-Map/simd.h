@@ -0,0 +1,17 @@
+#ifndef OPENGL_PBR_MAP_SIMD_H_
+#define OPENGL_PBR_MAP_SIMD_H_
+
+// x64では常にSSE2が使える
+// /arch:AVX2 (MSVC) や -mavx2 (GCC/Clang) でビルドした場合はAVX2も使う
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GAME_SIMD_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define GAME_SIMD_AVX2 1
+#include <immintrin.h>
+#endif
+
+#endif  // OPENGL_PBR_MAP_SIMD_H_
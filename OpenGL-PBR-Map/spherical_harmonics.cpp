@@ -0,0 +1,370 @@
+#include "spherical_harmonics.h"
+
+#include <glm/gtc/constants.hpp>
+
+#include <cmath>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "job_system.h"
+#include "simd.h"
+
+namespace game {
+
+namespace {
+
+constexpr float kSHBand0 = 0.282095f;
+constexpr float kSHBand1 = 0.488603f;
+constexpr float kSHBand2 = 1.092548f;
+constexpr float kSHBand2Zonal = 0.315392f;
+constexpr float kSHBand2XY = 0.546274f;
+
+// キューブマップの面ごとの、方向 = axis + s * u + t * v を与える基底
+struct CubemapFaceBasis {
+  glm::vec3 axis;
+  glm::vec3 u;
+  glm::vec3 v;
+};
+
+const CubemapFaceBasis kCubemapFaceBases[6] = {
+    {{1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, -1.0f}, {0.0f, -1.0f, 0.0f}},
+    {{-1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, -1.0f, 0.0f}},
+    {{0.0f, 1.0f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f}},
+    {{0.0f, -1.0f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, -1.0f}},
+    {{0.0f, 0.0f, 1.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, -1.0f, 0.0f}},
+    {{0.0f, 0.0f, -1.0f}, {-1.0f, 0.0f, 0.0f}, {0.0f, -1.0f, 0.0f}},
+};
+
+// 1行分の重み付き和
+struct SHRowSum {
+  float values[27];
+  float weight;
+};
+
+void AccumulateTexel(const glm::vec3& unnormalized_direction,
+                     float texel_area, const float* rgb, SHRowSum& sum) {
+  const float length2 =
+      glm::dot(unnormalized_direction, unnormalized_direction);
+  const float inverse_length = 1.0f / std::sqrt(length2);
+  const float weight = texel_area * inverse_length * inverse_length *
+                       inverse_length;
+  const auto basis = EvaluateSHBasis(unnormalized_direction * inverse_length);
+  for (int i = 0; i < 9; ++i) {
+    const float w = basis[i] * weight;
+    sum.values[i * 3 + 0] += w * rgb[0];
+    sum.values[i * 3 + 1] += w * rgb[1];
+    sum.values[i * 3 + 2] += w * rgb[2];
+  }
+  sum.weight += weight;
+}
+
+#ifdef GAME_SIMD_SSE2
+float HorizontalSum(__m128 v) {
+  const __m128 shuffled = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+  const __m128 sums = _mm_add_ps(v, shuffled);
+  return _mm_cvtss_f32(
+      _mm_add_ss(sums, _mm_movehl_ps(shuffled, sums)));
+}
+#endif
+
+// キューブマップ1行分を射影し、処理したテクセルの重みの和も返す
+void ProjectCubemapRow(const CubemapView& cubemap, int face, int y,
+                       SHRowSum& sum) {
+  const auto& basis = kCubemapFaceBases[face];
+  const int size = cubemap.size;
+  const float texel_size = 2.0f / static_cast<float>(size);
+  const float texel_area = texel_size * texel_size;
+  const float t = (static_cast<float>(y) + 0.5f) * texel_size - 1.0f;
+  const glm::vec3 row_origin = basis.axis + t * basis.v;
+  const float* row =
+      cubemap.faces[face] + static_cast<std::size_t>(y) * size * 3;
+
+  for (auto& value : sum.values) {
+    value = 0.0f;
+  }
+  sum.weight = 0.0f;
+
+  int x = 0;
+#ifdef GAME_SIMD_SSE2
+  __m128 accumulators[27];
+  for (auto& accumulator : accumulators) {
+    accumulator = _mm_setzero_ps();
+  }
+  __m128 weight_sum = _mm_setzero_ps();
+
+  const __m128 lane_offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+  const __m128 texel_size4 = _mm_set1_ps(texel_size);
+  const __m128 texel_area4 = _mm_set1_ps(texel_area);
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 three = _mm_set1_ps(3.0f);
+  const __m128 band0 = _mm_set1_ps(kSHBand0);
+  const __m128 band1 = _mm_set1_ps(kSHBand1);
+  const __m128 band2 = _mm_set1_ps(kSHBand2);
+  const __m128 band2_zonal = _mm_set1_ps(kSHBand2Zonal);
+  const __m128 band2_xy = _mm_set1_ps(kSHBand2XY);
+
+  for (; x + 4 <= size; x += 4) {
+    const __m128 s = _mm_sub_ps(
+        _mm_mul_ps(_mm_add_ps(_mm_set1_ps(static_cast<float>(x)), lane_offsets),
+                   texel_size4),
+        one);
+    const __m128 dx = _mm_add_ps(_mm_set1_ps(row_origin.x),
+                                 _mm_mul_ps(s, _mm_set1_ps(basis.u.x)));
+    const __m128 dy = _mm_add_ps(_mm_set1_ps(row_origin.y),
+                                 _mm_mul_ps(s, _mm_set1_ps(basis.u.y)));
+    const __m128 dz = _mm_add_ps(_mm_set1_ps(row_origin.z),
+                                 _mm_mul_ps(s, _mm_set1_ps(basis.u.z)));
+    const __m128 length2 = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+    const __m128 inverse_length = _mm_div_ps(one, _mm_sqrt_ps(length2));
+    const __m128 weight = _mm_mul_ps(
+        texel_area4,
+        _mm_mul_ps(inverse_length, _mm_mul_ps(inverse_length, inverse_length)));
+    const __m128 nx = _mm_mul_ps(dx, inverse_length);
+    const __m128 ny = _mm_mul_ps(dy, inverse_length);
+    const __m128 nz = _mm_mul_ps(dz, inverse_length);
+
+    __m128 sh[9];
+    sh[0] = band0;
+    sh[1] = _mm_mul_ps(band1, ny);
+    sh[2] = _mm_mul_ps(band1, nz);
+    sh[3] = _mm_mul_ps(band1, nx);
+    sh[4] = _mm_mul_ps(band2, _mm_mul_ps(nx, ny));
+    sh[5] = _mm_mul_ps(band2, _mm_mul_ps(ny, nz));
+    sh[6] = _mm_mul_ps(band2_zonal,
+                       _mm_sub_ps(_mm_mul_ps(three, _mm_mul_ps(nz, nz)), one));
+    sh[7] = _mm_mul_ps(band2, _mm_mul_ps(nx, nz));
+    sh[8] = _mm_mul_ps(band2_xy,
+                       _mm_sub_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)));
+
+    // RGBのインターリーブを4テクセル分のチャンネルごとに並べ替える
+    const float* texels = row + x * 3;
+    const __m128 r = _mm_set_ps(texels[9], texels[6], texels[3], texels[0]);
+    const __m128 g = _mm_set_ps(texels[10], texels[7], texels[4], texels[1]);
+    const __m128 b = _mm_set_ps(texels[11], texels[8], texels[5], texels[2]);
+    const __m128 weighted_r = _mm_mul_ps(r, weight);
+    const __m128 weighted_g = _mm_mul_ps(g, weight);
+    const __m128 weighted_b = _mm_mul_ps(b, weight);
+
+    for (int i = 0; i < 9; ++i) {
+      accumulators[i * 3 + 0] =
+          _mm_add_ps(accumulators[i * 3 + 0], _mm_mul_ps(sh[i], weighted_r));
+      accumulators[i * 3 + 1] =
+          _mm_add_ps(accumulators[i * 3 + 1], _mm_mul_ps(sh[i], weighted_g));
+      accumulators[i * 3 + 2] =
+          _mm_add_ps(accumulators[i * 3 + 2], _mm_mul_ps(sh[i], weighted_b));
+    }
+    weight_sum = _mm_add_ps(weight_sum, weight);
+  }
+
+  for (int i = 0; i < 27; ++i) {
+    sum.values[i] = HorizontalSum(accumulators[i]);
+  }
+  sum.weight = HorizontalSum(weight_sum);
+#endif
+
+  // SIMDの幅に満たない残りのテクセル
+  for (; x < size; ++x) {
+    const float s = (static_cast<float>(x) + 0.5f) * texel_size - 1.0f;
+    AccumulateTexel(row_origin + s * basis.u, texel_area, row + x * 3, sum);
+  }
+}
+
+// L2バンドの回転に使う5方向
+const glm::vec3 kRotationDirections[5] = {
+    {1.0f, 0.0f, 0.0f},
+    {0.0f, 0.0f, 1.0f},
+    {0.70710678f, 0.70710678f, 0.0f},
+    {0.70710678f, 0.0f, 0.70710678f},
+    {0.0f, 0.70710678f, 0.70710678f},
+};
+
+std::array<float, 5> EvaluateSHBand2(const glm::vec3& d) {
+  return {kSHBand2 * d.x * d.y, kSHBand2 * d.y * d.z,
+          kSHBand2Zonal * (3.0f * d.z * d.z - 1.0f), kSHBand2 * d.x * d.z,
+          kSHBand2XY * (d.x * d.x - d.y * d.y)};
+}
+
+using Matrix5 = std::array<std::array<float, 5>, 5>;
+
+// 5方向で評価したL2基底の行列の逆行列をGauss-Jordan法で求める
+Matrix5 ComputeInverseRotationBasis() {
+  Matrix5 a;
+  Matrix5 inverse{};
+  for (int i = 0; i < 5; ++i) {
+    a[i] = EvaluateSHBand2(kRotationDirections[i]);
+    inverse[i][i] = 1.0f;
+  }
+  for (int column = 0; column < 5; ++column) {
+    int pivot = column;
+    for (int row = column + 1; row < 5; ++row) {
+      if (std::abs(a[row][column]) > std::abs(a[pivot][column])) {
+        pivot = row;
+      }
+    }
+    std::swap(a[column], a[pivot]);
+    std::swap(inverse[column], inverse[pivot]);
+    const float scale = 1.0f / a[column][column];
+    for (int j = 0; j < 5; ++j) {
+      a[column][j] *= scale;
+      inverse[column][j] *= scale;
+    }
+    for (int row = 0; row < 5; ++row) {
+      if (row == column) {
+        continue;
+      }
+      const float factor = a[row][column];
+      for (int j = 0; j < 5; ++j) {
+        a[row][j] -= factor * a[column][j];
+        inverse[row][j] -= factor * inverse[column][j];
+      }
+    }
+  }
+  return inverse;
+}
+
+}  // namespace
+
+SphericalHarmonicsL2& SphericalHarmonicsL2::operator+=(
+    const SphericalHarmonicsL2& other) {
+  for (int i = 0; i < 9; ++i) {
+    coefficients[i] += other.coefficients[i];
+  }
+  return *this;
+}
+
+SphericalHarmonicsL2& SphericalHarmonicsL2::operator*=(float scale) {
+  for (auto& coefficient : coefficients) {
+    coefficient *= scale;
+  }
+  return *this;
+}
+
+std::array<float, 9> EvaluateSHBasis(const glm::vec3& d) {
+  return {kSHBand0,
+          kSHBand1 * d.y,
+          kSHBand1 * d.z,
+          kSHBand1 * d.x,
+          kSHBand2 * d.x * d.y,
+          kSHBand2 * d.y * d.z,
+          kSHBand2Zonal * (3.0f * d.z * d.z - 1.0f),
+          kSHBand2 * d.x * d.z,
+          kSHBand2XY * (d.x * d.x - d.y * d.y)};
+}
+
+SphericalHarmonicsL2 ProjectCubemapToSH(const CubemapView& cubemap,
+                                        JobSystem& job_system) {
+  const std::size_t row_count = static_cast<std::size_t>(cubemap.size) * 6;
+  std::vector<SHRowSum> rows(row_count);
+  job_system.ParallelFor(
+      row_count, 16, [&](std::size_t begin, std::size_t end) {
+        for (auto i = begin; i < end; ++i) {
+          const int face = static_cast<int>(i / cubemap.size);
+          const int y = static_cast<int>(i % cubemap.size);
+          ProjectCubemapRow(cubemap, face, y, rows[i]);
+        }
+      });
+
+  // 結果がスレッド数に依存しないよう行の順番で足し合わせる
+  double sums[27] = {};
+  double weight = 0.0;
+  for (const auto& row : rows) {
+    for (int i = 0; i < 27; ++i) {
+      sums[i] += row.values[i];
+    }
+    weight += row.weight;
+  }
+
+  // 立体角の近似誤差を打ち消すため重みの和が4piになるよう正規化する
+  SphericalHarmonicsL2 sh;
+  const double normalization = 4.0 * glm::pi<double>() / weight;
+  for (int i = 0; i < 9; ++i) {
+    sh.coefficients[i] =
+        glm::vec3(sums[i * 3 + 0], sums[i * 3 + 1], sums[i * 3 + 2]) *
+        static_cast<float>(normalization);
+  }
+  return sh;
+}
+
+glm::vec3 EvaluateSH(const SphericalHarmonicsL2& sh,
+                     const glm::vec3& direction) {
+  const auto basis = EvaluateSHBasis(direction);
+  glm::vec3 result(0.0f);
+  for (int i = 0; i < 9; ++i) {
+    result += sh.coefficients[i] * basis[i];
+  }
+  return result;
+}
+
+SphericalHarmonicsL2 ConvolveSHWithCosineLobe(
+    const SphericalHarmonicsL2& radiance) {
+  // クランプされたコサインのゾーナル調和関数係数
+  const float band0 = glm::pi<float>();
+  const float band1 = glm::two_pi<float>() / 3.0f;
+  const float band2 = glm::quarter_pi<float>();
+
+  SphericalHarmonicsL2 irradiance;
+  irradiance.coefficients[0] = radiance.coefficients[0] * band0;
+  for (int i = 1; i < 4; ++i) {
+    irradiance.coefficients[i] = radiance.coefficients[i] * band1;
+  }
+  for (int i = 4; i < 9; ++i) {
+    irradiance.coefficients[i] = radiance.coefficients[i] * band2;
+  }
+  return irradiance;
+}
+
+SphericalHarmonicsL2 RotateSH(const SphericalHarmonicsL2& sh,
+                              const glm::mat3& rotation) {
+  static const Matrix5 inverse_basis = ComputeInverseRotationBasis();
+
+  SphericalHarmonicsL2 rotated;
+  rotated.coefficients[0] = sh.coefficients[0];
+
+  // L1は方向ベクトルの線形関数なので (x, y, z) の並びで回転行列を掛ける
+  for (int channel = 0; channel < 3; ++channel) {
+    const glm::vec3 band1(sh.coefficients[3][channel],
+                          sh.coefficients[1][channel],
+                          sh.coefficients[2][channel]);
+    const glm::vec3 rotated_band1 = rotation * band1;
+    rotated.coefficients[1][channel] = rotated_band1.y;
+    rotated.coefficients[2][channel] = rotated_band1.z;
+    rotated.coefficients[3][channel] = rotated_band1.x;
+  }
+
+  // L2は逆回転した5方向で元の関数を評価し、基底行列の逆行列で係数に戻す
+  const glm::mat3 inverse_rotation = glm::transpose(rotation);
+  glm::vec3 values[5];
+  for (int i = 0; i < 5; ++i) {
+    const auto basis =
+        EvaluateSHBand2(inverse_rotation * kRotationDirections[i]);
+    values[i] = glm::vec3(0.0f);
+    for (int j = 0; j < 5; ++j) {
+      values[i] += sh.coefficients[4 + j] * basis[j];
+    }
+  }
+  for (int i = 0; i < 5; ++i) {
+    glm::vec3 coefficient(0.0f);
+    for (int j = 0; j < 5; ++j) {
+      coefficient += inverse_basis[i][j] * values[j];
+    }
+    rotated.coefficients[4 + i] = coefficient;
+  }
+  return rotated;
+}
+
+std::array<glm::vec4, 7> PackSHForUniformBuffer(
+    const SphericalHarmonicsL2& sh) {
+  float floats[28] = {};
+  for (int i = 0; i < 9; ++i) {
+    floats[i * 3 + 0] = sh.coefficients[i].r;
+    floats[i * 3 + 1] = sh.coefficients[i].g;
+    floats[i * 3 + 2] = sh.coefficients[i].b;
+  }
+  std::array<glm::vec4, 7> packed;
+  std::memcpy(packed.data(), floats, sizeof(floats));
+  return packed;
+}
+
+}  // namespace game
@@ -0,0 +1,92 @@
+#ifndef OPENGL_PBR_MAP_SPHERICAL_HARMONICS_H_
+#define OPENGL_PBR_MAP_SPHERICAL_HARMONICS_H_
+
+#include <glm/glm.hpp>
+
+#include <array>
+
+namespace game {
+
+class JobSystem;
+
+/**
+ * @brief RGBのL2球面調和関数 (9係数)
+ *
+ * 係数の並びは (l, m) = (0, 0), (1, -1), (1, 0), (1, 1), (2, -2), (2, -1),
+ * (2, 0), (2, 1), (2, 2) の順。
+ */
+struct SphericalHarmonicsL2 {
+  std::array<glm::vec3, 9> coefficients{};
+
+  SphericalHarmonicsL2& operator+=(const SphericalHarmonicsL2& other);
+  SphericalHarmonicsL2& operator*=(float scale);
+};
+
+/**
+ * @brief キューブマップのRGB floatテクセルへの参照
+ *
+ * 面の順番とテクセルの向きはGL_TEXTURE_CUBE_MAP_POSITIVE_Xから始まる
+ * OpenGLの規約に従う。各面はsize * size * 3個のfloatを持つ。
+ */
+struct CubemapView {
+  int size;
+  std::array<const float*, 6> faces;
+};
+
+/**
+ * @brief 方向に対するSH基底関数の値を計算する
+ * @param direction 正規化された方向
+ * @return 9個の基底関数の値
+ */
+std::array<float, 9> EvaluateSHBasis(const glm::vec3& direction);
+
+/**
+ * @brief キューブマップをテクセルの立体角で重み付けしてSHに射影する
+ * @param cubemap 射影するキューブマップ
+ * @param job_system 面の行単位で並列化に使うJobSystem
+ * @return 放射輝度のSH係数
+ */
+SphericalHarmonicsL2 ProjectCubemapToSH(const CubemapView& cubemap,
+                                        JobSystem& job_system);
+
+/**
+ * @brief SHを方向について評価する
+ * @param sh 評価するSH
+ * @param direction 正規化された方向
+ * @return その方向の値
+ */
+glm::vec3 EvaluateSH(const SphericalHarmonicsL2& sh,
+                     const glm::vec3& direction);
+
+/**
+ * @brief SHをクランプされたコサインローブで畳み込む
+ * @param radiance 放射輝度のSH
+ * @return 放射照度のSH
+ *
+ * Lambertの拡散反射はalbedo / pi * EvaluateSH(irradiance, normal)になる。
+ */
+SphericalHarmonicsL2 ConvolveSHWithCosineLobe(
+    const SphericalHarmonicsL2& radiance);
+
+/**
+ * @brief SHを回転する
+ * @param sh 回転するSH
+ * @param rotation 回転行列
+ * @return f'(d) = f(rotation^T d)を満たすSH
+ *
+ * L2バンドは回転した5方向での評価値から係数を解き直すので
+ * Wigner行列を組み立てるより軽い。
+ */
+SphericalHarmonicsL2 RotateSH(const SphericalHarmonicsL2& sh,
+                              const glm::mat3& rotation);
+
+/**
+ * @brief SHをstd140のUniform Bufferに詰める
+ * @param sh 詰めるSH
+ * @return 27個のfloatを隙間なく並べた7個のvec4
+ */
+std::array<glm::vec4, 7> PackSHForUniformBuffer(const SphericalHarmonicsL2& sh);
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_SPHERICAL_HARMONICS_H_
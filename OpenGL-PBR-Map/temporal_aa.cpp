@@ -0,0 +1,188 @@
+#include "temporal_aa.h"
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/gtx/color_space_YCoCg.hpp>
+
+#include "gl_state_cache.h"
+#include "sampling.h"
+#include "shader_program.h"
+
+namespace game {
+
+namespace {
+
+constexpr int kGroupSize = 16;
+
+}  // namespace
+
+glm::vec3 ResolveTemporalSample(const glm::vec3& current,
+                                const glm::vec3& history,
+                                const std::array<glm::vec3, 9>& neighborhood,
+                                float current_weight) {
+  auto neighborhood_min = glm::rgb2YCoCg(neighborhood[0]);
+  auto neighborhood_max = neighborhood_min;
+  for (const auto& color : neighborhood) {
+    const auto ycocg = glm::rgb2YCoCg(color);
+    neighborhood_min = glm::min(neighborhood_min, ycocg);
+    neighborhood_max = glm::max(neighborhood_max, ycocg);
+  }
+
+  // 箱の外にあれば中心との線分が箱と交わる点まで戻す
+  auto history_ycocg = glm::rgb2YCoCg(history);
+  const auto center = (neighborhood_min + neighborhood_max) * 0.5f;
+  const auto extents = glm::max((neighborhood_max - neighborhood_min) * 0.5f,
+                                glm::vec3(1.0e-4f));
+  const auto offset = history_ycocg - center;
+  const auto units = glm::abs(offset / extents);
+  const auto scale = glm::max(units.x, glm::max(units.y, units.z));
+  if (scale > 1.0f) {
+    history_ycocg = center + offset / scale;
+  }
+  const auto clipped = glm::YCoCg2rgb(history_ycocg);
+
+  // 明るい画素がちらつかないよう輝度の逆数で重みをつける
+  const auto current_luma = glm::rgb2YCoCg(current).x;
+  const auto history_luma = history_ycocg.x;
+  const auto weight = current_weight / (1.0f + current_luma);
+  const auto history_weight = (1.0f - current_weight) / (1.0f + history_luma);
+  return (current * weight + clipped * history_weight) /
+         (weight + history_weight);
+}
+
+TemporalAntiAliasing::TemporalAntiAliasing()
+    : width_(0),
+      height_(0),
+      frame_index_(0),
+      jitter_(0.0f),
+      view_projection_(1.0f),
+      previous_view_projection_(1.0f),
+      history_valid_(false),
+      history_index_(0),
+      program_(0),
+      linear_sampler_(0),
+      velocity_texture_(0),
+      history_textures_{0, 0} {}
+
+TemporalAntiAliasing::~TemporalAntiAliasing() {
+  DeleteTargets();
+  if (program_ != 0) {
+    glDeleteProgram(program_);
+    glDeleteSamplers(1, &linear_sampler_);
+  }
+}
+
+bool TemporalAntiAliasing::Initialize(const std::string& shader_directory) {
+  program_ = LoadShaderProgram(
+      {{GL_COMPUTE_SHADER, shader_directory + "/taa_resolve.comp"}});
+  if (program_ == 0) {
+    return false;
+  }
+  // 再投影した履歴はピクセルの間をバイリニアで読む
+  glCreateSamplers(1, &linear_sampler_);
+  glSamplerParameteri(linear_sampler_, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glSamplerParameteri(linear_sampler_, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glSamplerParameteri(linear_sampler_, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glSamplerParameteri(linear_sampler_, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  return true;
+}
+
+void TemporalAntiAliasing::Resize(int width, int height) {
+  if (width == width_ && height == height_) {
+    return;
+  }
+  DeleteTargets();
+  width_ = width;
+  height_ = height;
+
+  glCreateTextures(GL_TEXTURE_2D, 1, &velocity_texture_);
+  glTextureStorage2D(velocity_texture_, 1, GL_RG16F, width, height);
+  glCreateTextures(GL_TEXTURE_2D, 2, history_textures_.data());
+  for (const auto texture : history_textures_) {
+    glTextureStorage2D(texture, 1, GL_RGBA16F, width, height);
+  }
+  ClearVelocity();
+  ResetHistory();
+}
+
+void TemporalAntiAliasing::BeginFrame(const glm::mat4& view_projection) {
+  ++frame_index_;
+  // 0番目は(0, 0)になるので1から始める
+  const auto index = (frame_index_ - 1) % kJitterSequenceLength + 1;
+  jitter_ = glm::vec2(Halton(index, 2), Halton(index, 3)) - 0.5f;
+  previous_view_projection_ =
+      history_valid_ ? view_projection_ : view_projection;
+  view_projection_ = view_projection;
+}
+
+glm::vec2 TemporalAntiAliasing::GetJitter() const { return jitter_; }
+
+glm::mat4 TemporalAntiAliasing::GetJitteredProjection(
+    const glm::mat4& projection) const {
+  const auto offset = jitter_ * 2.0f / glm::vec2(width_, height_);
+  return glm::translate(glm::mat4(1.0f), glm::vec3(offset, 0.0f)) *
+         projection;
+}
+
+GLuint TemporalAntiAliasing::GetVelocityTexture() const {
+  return velocity_texture_;
+}
+
+void TemporalAntiAliasing::ClearVelocity() {
+  const GLfloat zero[] = {0.0f, 0.0f};
+  glClearTexImage(velocity_texture_, 0, GL_RG, GL_FLOAT, zero);
+}
+
+void TemporalAntiAliasing::ResetHistory() { history_valid_ = false; }
+
+GLuint TemporalAntiAliasing::Resolve(GLuint color_texture,
+                                     GLuint depth_texture,
+                                     const glm::mat4& projection,
+                                     const glm::mat4& view) {
+  const auto source = history_textures_[history_index_];
+  const auto destination = history_textures_[1 - history_index_];
+
+  auto& state = GlStateCache::GetInstance();
+  state.UseProgram(program_);
+  // 深度はずらして描いたので、ずらした行列の逆で位置に戻す
+  const auto inverse_view_projection =
+      glm::inverse(GetJitteredProjection(projection) * view);
+  auto set_matrix = [&](const char* name, const glm::mat4& matrix) {
+    glProgramUniformMatrix4fv(program_, glGetUniformLocation(program_, name),
+                              1, GL_FALSE, &matrix[0][0]);
+  };
+  set_matrix("inverse_view_projection", inverse_view_projection);
+  set_matrix("view_projection", view_projection_);
+  set_matrix("previous_view_projection", previous_view_projection_);
+  glProgramUniform1i(program_, glGetUniformLocation(program_, "history_valid"),
+                     history_valid_ ? 1 : 0);
+
+  state.BindTextureUnit(0, color_texture);
+  state.BindTextureUnit(1, depth_texture);
+  state.BindTextureUnit(2, velocity_texture_);
+  state.BindTextureUnit(3, source);
+  glBindSampler(3, linear_sampler_);
+  glBindImageTexture(0, destination, 0, GL_FALSE, 0, GL_WRITE_ONLY,
+                     GL_RGBA16F);
+  glDispatchCompute((width_ + kGroupSize - 1) / kGroupSize,
+                    (height_ + kGroupSize - 1) / kGroupSize, 1);
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT |
+                  GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+  glBindSampler(3, 0);
+
+  history_index_ = 1 - history_index_;
+  history_valid_ = true;
+  return destination;
+}
+
+void TemporalAntiAliasing::DeleteTargets() {
+  if (velocity_texture_ == 0) {
+    return;
+  }
+  auto& state = GlStateCache::GetInstance();
+  state.DeleteTextures(1, &velocity_texture_);
+  state.DeleteTextures(2, history_textures_.data());
+  velocity_texture_ = 0;
+}
+
+}  // namespace game
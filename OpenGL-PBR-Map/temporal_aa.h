@@ -0,0 +1,139 @@
+#ifndef OPENGL_PBR_MAP_TEMPORAL_AA_H_
+#define OPENGL_PBR_MAP_TEMPORAL_AA_H_
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace game {
+
+/**
+ * @brief 過去のフレームの色を近傍の色の範囲に収めて混ぜる
+ * @param current 現在のフレームの色
+ * @param history 再投影した過去のフレームの色
+ * @param neighborhood 現在のフレームの3x3の近傍の色 (中央が4番)
+ * @param current_weight 現在のフレームの色を混ぜる割合
+ * @return 混ぜた色
+ *
+ * shaders/taa_resolve.compと同じ計算をするCPU上の参照実装。
+ * 色はYCoCgに変換し、近傍の最小と最大の箱へ中心に向かって切り詰める。
+ */
+glm::vec3 ResolveTemporalSample(const glm::vec3& current,
+                                const glm::vec3& history,
+                                const std::array<glm::vec3, 9>& neighborhood,
+                                float current_weight);
+
+/**
+ * @brief 時間方向のアンチエイリアス (TAA)
+ *
+ * 射影行列をフレームごとにHalton列 (基数2と3) でピクセル未満ずらし、
+ * 過去のフレームの結果を再投影して混ぜることで、1ピクセルに複数の
+ * サンプルを積み重ねる。再投影はカメラの動きなら深度から求め、
+ * 動くオブジェクトは速度バッファに書いた画面上の動きを使う
+ * (shaders/velocity.glsl)。近傍で最も手前のピクセルの動きを使うので
+ * 輪郭が途切れにくい。過去の色は現在の3x3の近傍の色のYCoCgでの範囲に
+ * 切り詰め、見えるようになった面の残像を抑える
+ * (shaders/taa_resolve.comp)。
+ *
+ * 1フレームの使い方はBeginFrame、GetJitteredProjectionで描画、
+ * Resolveの順。Resolveの結果をポストプロセスに渡す。
+ */
+class TemporalAntiAliasing {
+ public:
+  // ずらし方を繰り返す周期
+  static constexpr std::uint32_t kJitterSequenceLength = 8;
+
+  TemporalAntiAliasing();
+  ~TemporalAntiAliasing();
+
+  TemporalAntiAliasing(const TemporalAntiAliasing&) = delete;
+  TemporalAntiAliasing& operator=(const TemporalAntiAliasing&) = delete;
+
+  /**
+   * @brief シェーダーを読み込む
+   * @param shader_directory shadersディレクトリのパス (末尾の区切りなし)
+   * @return 成功すればtrue
+   */
+  bool Initialize(const std::string& shader_directory);
+
+  /**
+   * @brief 画面の大きさに合わせて速度バッファと履歴を作り直す
+   * @param width 幅
+   * @param height 高さ
+   */
+  void Resize(int width, int height);
+
+  /**
+   * @brief フレームを進め、ずらす量を決める
+   * @param view_projection ずらす前のビュー射影行列
+   */
+  void BeginFrame(const glm::mat4& view_projection);
+
+  /**
+   * @brief このフレームのずらす量を取得する
+   * @return ピクセル単位の[-0.5, 0.5)のずれ
+   */
+  glm::vec2 GetJitter() const;
+
+  /**
+   * @brief 射影行列をこのフレームのずれだけずらす
+   * @param projection 射影行列
+   * @return NDCでずれの分だけ平行移動した射影行列
+   */
+  glm::mat4 GetJitteredProjection(const glm::mat4& projection) const;
+
+  /**
+   * @brief 速度バッファを取得する
+   * @return RG16Fのテクスチャ。動くオブジェクトだけが書き、それ以外は0
+   *
+   * シーンのフレームバッファにカラーアタッチメントとして付ける。
+   */
+  GLuint GetVelocityTexture() const;
+
+  /**
+   * @brief 速度バッファを0で消す
+   */
+  void ClearVelocity();
+
+  /**
+   * @brief 履歴を捨て、次のResolveで現在のフレームだけを使う
+   *
+   * カメラが瞬間移動したときなどに呼ぶ。
+   */
+  void ResetHistory();
+
+  /**
+   * @brief 現在のフレームと履歴を混ぜる
+   * @param color_texture ずらして描いたリニアなHDRのシーン
+   * @param depth_texture シーンの深度
+   * @param projection ずらす前の射影行列
+   * @param view ビュー行列
+   * @return 混ぜた結果のRGBA16Fのテクスチャ。次のResolveまで有効
+   */
+  GLuint Resolve(GLuint color_texture, GLuint depth_texture,
+                 const glm::mat4& projection, const glm::mat4& view);
+
+ private:
+  void DeleteTargets();
+
+  int width_;
+  int height_;
+  std::uint32_t frame_index_;
+  glm::vec2 jitter_;
+  glm::mat4 view_projection_;
+  glm::mat4 previous_view_projection_;
+  bool history_valid_;
+  int history_index_;
+
+  GLuint program_;
+  GLuint linear_sampler_;
+  GLuint velocity_texture_;
+  std::array<GLuint, 2> history_textures_;
+};
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_TEMPORAL_AA_H_
@@ -0,0 +1,49 @@
+#ifndef OPENGL_PBR_MAP_TEXEL_RASTERIZER_H_
+#define OPENGL_PBR_MAP_TEXEL_RASTERIZER_H_
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+
+namespace game {
+
+/**
+ * @brief テクスチャ空間の三角形に中心が含まれるテクセルを列挙する
+ * @param uv テクセル単位の三角形の頂点
+ * @param width テクスチャの幅
+ * @param height テクスチャの高さ
+ * @param function function(x, y, barycentric)の形で呼び出される関数
+ */
+template <typename Function>
+void RasterizeTriangleTexels(const glm::vec2 uv[3], int width, int height,
+                             Function&& function) {
+  const auto cross = [](const glm::vec2& a, const glm::vec2& b) {
+    return a.x * b.y - a.y * b.x;
+  };
+  const float area = cross(uv[1] - uv[0], uv[2] - uv[0]);
+  if (std::abs(area) < 1.0e-8f) {
+    return;
+  }
+  const auto min = glm::max(
+      glm::ivec2(glm::floor(glm::min(uv[0], glm::min(uv[1], uv[2])))),
+      glm::ivec2(0));
+  const auto max =
+      glm::min(glm::ivec2(glm::ceil(glm::max(uv[0], glm::max(uv[1], uv[2])))),
+               glm::ivec2(width, height));
+  for (int y = min.y; y < max.y; ++y) {
+    for (int x = min.x; x < max.x; ++x) {
+      const glm::vec2 p(static_cast<float>(x) + 0.5f,
+                        static_cast<float>(y) + 0.5f);
+      const float w0 = cross(uv[2] - uv[1], p - uv[1]) / area;
+      const float w1 = cross(uv[0] - uv[2], p - uv[2]) / area;
+      const float w2 = 1.0f - w0 - w1;
+      if (w0 >= 0.0f && w1 >= 0.0f && w2 >= 0.0f) {
+        function(x, y, glm::vec3(w0, w1, w2));
+      }
+    }
+  }
+}
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_TEXEL_RASTERIZER_H_
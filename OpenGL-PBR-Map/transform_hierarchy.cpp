@@ -0,0 +1,302 @@
+#include "transform_hierarchy.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "simd.h"
+
+namespace game {
+
+namespace {
+
+// まとめて掛け合わせるノードの数
+constexpr std::size_t kBatchSize = 64;
+
+#ifdef GAME_SIMD_SSE2
+// 1回の積和で同時に計算するノードの数
+constexpr std::size_t kSimdWidth = 4;
+
+// 4つの行列を要素ごとに並べ替える。soa[column * 4 + row]のレーンiが
+// matrices[i][column][row]になる。glm::mat4は16バイト境界に揃って
+// いないのでloaduで読む
+void LoadTransposed(const glm::mat4* const matrices[kSimdWidth],
+                    __m128 soa[16]) {
+  for (int column = 0; column < 4; ++column) {
+    auto c0 = _mm_loadu_ps(&(*matrices[0])[column][0]);
+    auto c1 = _mm_loadu_ps(&(*matrices[1])[column][0]);
+    auto c2 = _mm_loadu_ps(&(*matrices[2])[column][0]);
+    auto c3 = _mm_loadu_ps(&(*matrices[3])[column][0]);
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+    soa[column * 4] = c0;
+    soa[column * 4 + 1] = c1;
+    soa[column * 4 + 2] = c2;
+    soa[column * 4 + 3] = c3;
+  }
+}
+
+// LoadTransposedの逆
+void StoreTransposed(const __m128 soa[16],
+                     glm::mat4* const matrices[kSimdWidth]) {
+  for (int column = 0; column < 4; ++column) {
+    auto c0 = soa[column * 4];
+    auto c1 = soa[column * 4 + 1];
+    auto c2 = soa[column * 4 + 2];
+    auto c3 = soa[column * 4 + 3];
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+    _mm_storeu_ps(&(*matrices[0])[column][0], c0);
+    _mm_storeu_ps(&(*matrices[1])[column][0], c1);
+    _mm_storeu_ps(&(*matrices[2])[column][0], c2);
+    _mm_storeu_ps(&(*matrices[3])[column][0], c3);
+  }
+}
+#endif
+
+}  // namespace
+
+std::uint32_t TransformHierarchy::Create(std::uint32_t parent,
+                                         const glm::mat4& local) {
+  std::uint32_t node;
+  if (free_nodes_.empty()) {
+    node = static_cast<std::uint32_t>(slots_.size());
+    slots_.push_back(kNone);
+  } else {
+    node = free_nodes_.back();
+    free_nodes_.pop_back();
+  }
+
+  const auto parent_slot = parent == kNone ? kNone : slots_[parent];
+  assert(parent == kNone || parent_slot != kNone);
+  const auto depth = parent_slot == kNone ? 0 : depths_[parent_slot] + 1;
+  // 末尾に追加して深さ順が崩れるなら次のUpdateで並べ直す
+  if (!depths_.empty() && depth < depths_.back()) {
+    needs_sort_ = true;
+  }
+
+  const auto slot = static_cast<std::uint32_t>(nodes_.size());
+  locals_.push_back(local);
+  worlds_.push_back(local);
+  parents_.push_back(parent_slot);
+  depths_.push_back(depth);
+  dirty_.push_back(1);
+  nodes_.push_back(node);
+  slots_[node] = slot;
+  first_dirty_slot_ = std::min(first_dirty_slot_, slot);
+  return node;
+}
+
+void TransformHierarchy::Destroy(std::uint32_t node) {
+  const auto root_slot = slots_[node];
+  if (root_slot == kNone) {
+    return;
+  }
+  if (needs_sort_) {
+    SortByDepth();
+  }
+
+  // 親は子より前にあるので、後ろへ1回なめれば子孫がすべて見つかる
+  const auto count = nodes_.size();
+  std::vector<std::uint8_t> removed(count, 0);
+  removed[root_slot] = 1;
+  for (auto slot = root_slot + 1; slot < count; ++slot) {
+    const auto parent = parents_[slot];
+    removed[slot] = parent != kNone && removed[parent];
+  }
+
+  // 残るノードを詰めて、スロットの対応を付け直す
+  std::vector<std::uint32_t> new_slots(count, kNone);
+  std::uint32_t write = 0;
+  for (std::uint32_t read = 0; read < count; ++read) {
+    if (removed[read]) {
+      slots_[nodes_[read]] = kNone;
+      free_nodes_.push_back(nodes_[read]);
+      continue;
+    }
+    new_slots[read] = write;
+    locals_[write] = locals_[read];
+    worlds_[write] = worlds_[read];
+    parents_[write] =
+        parents_[read] == kNone ? kNone : new_slots[parents_[read]];
+    depths_[write] = depths_[read];
+    dirty_[write] = dirty_[read];
+    nodes_[write] = nodes_[read];
+    slots_[nodes_[write]] = write;
+    ++write;
+  }
+  locals_.resize(write);
+  worlds_.resize(write);
+  parents_.resize(write);
+  depths_.resize(write);
+  dirty_.resize(write);
+  nodes_.resize(write);
+
+  first_dirty_slot_ = kNone;
+  for (std::uint32_t slot = 0; slot < write; ++slot) {
+    if (dirty_[slot]) {
+      first_dirty_slot_ = slot;
+      break;
+    }
+  }
+}
+
+void TransformHierarchy::SetLocal(std::uint32_t node, const glm::mat4& local) {
+  const auto slot = slots_[node];
+  locals_[slot] = local;
+  dirty_[slot] = 1;
+  first_dirty_slot_ = std::min(first_dirty_slot_, slot);
+}
+
+const glm::mat4& TransformHierarchy::GetLocal(std::uint32_t node) const {
+  return locals_[slots_[node]];
+}
+
+const glm::mat4& TransformHierarchy::GetWorld(std::uint32_t node) const {
+  return worlds_[slots_[node]];
+}
+
+std::uint32_t TransformHierarchy::GetParent(std::uint32_t node) const {
+  const auto parent_slot = parents_[slots_[node]];
+  return parent_slot == kNone ? kNone : nodes_[parent_slot];
+}
+
+void TransformHierarchy::Update() {
+  updated_count_ = 0;
+  if (needs_sort_) {
+    SortByDepth();
+  }
+  if (first_dirty_slot_ == kNone) {
+    return;
+  }
+
+  // 変更のあったノードから後ろへ、親の変更を子に伝えながら集める。
+  // 同じ深さのノードは互いに依存しないので、深さが変わるまでまとめて計算する
+  std::uint32_t batch[kBatchSize];
+  std::size_t batch_count = 0;
+  auto batch_depth = depths_[first_dirty_slot_];
+  const auto count = static_cast<std::uint32_t>(nodes_.size());
+  for (auto slot = first_dirty_slot_; slot < count; ++slot) {
+    const auto parent = parents_[slot];
+    if (!dirty_[slot] && (parent == kNone || !dirty_[parent])) {
+      continue;
+    }
+    dirty_[slot] = 1;
+    if (batch_count == kBatchSize || depths_[slot] != batch_depth) {
+      MultiplyBatch(batch, batch_count);
+      batch_count = 0;
+      batch_depth = depths_[slot];
+    }
+    batch[batch_count++] = slot;
+    ++updated_count_;
+  }
+  MultiplyBatch(batch, batch_count);
+
+  std::fill(dirty_.begin() + first_dirty_slot_, dirty_.end(), 0);
+  first_dirty_slot_ = kNone;
+}
+
+std::size_t TransformHierarchy::GetUpdatedCount() const {
+  return updated_count_;
+}
+
+std::size_t TransformHierarchy::GetNodeCount() const { return nodes_.size(); }
+
+void TransformHierarchy::SortByDepth() {
+  needs_sort_ = false;
+  const auto count = static_cast<std::uint32_t>(nodes_.size());
+  const auto max_depth = *std::max_element(depths_.begin(), depths_.end());
+
+  // 深さごとの数え上げで安定に並べ替える
+  std::vector<std::uint32_t> offsets(max_depth + 2, 0);
+  for (const auto depth : depths_) {
+    ++offsets[depth + 1];
+  }
+  for (std::size_t i = 1; i < offsets.size(); ++i) {
+    offsets[i] += offsets[i - 1];
+  }
+  std::vector<std::uint32_t> new_slots(count);
+  for (std::uint32_t slot = 0; slot < count; ++slot) {
+    new_slots[slot] = offsets[depths_[slot]]++;
+  }
+
+  std::vector<glm::mat4> locals(count);
+  std::vector<glm::mat4> worlds(count);
+  std::vector<std::uint32_t> parents(count);
+  std::vector<std::uint32_t> depths(count);
+  std::vector<std::uint8_t> dirty(count);
+  std::vector<std::uint32_t> nodes(count);
+  first_dirty_slot_ = kNone;
+  for (std::uint32_t slot = 0; slot < count; ++slot) {
+    const auto new_slot = new_slots[slot];
+    locals[new_slot] = locals_[slot];
+    worlds[new_slot] = worlds_[slot];
+    parents[new_slot] =
+        parents_[slot] == kNone ? kNone : new_slots[parents_[slot]];
+    depths[new_slot] = depths_[slot];
+    dirty[new_slot] = dirty_[slot];
+    nodes[new_slot] = nodes_[slot];
+    slots_[nodes_[slot]] = new_slot;
+    if (dirty_[slot]) {
+      first_dirty_slot_ = std::min(first_dirty_slot_, new_slot);
+    }
+  }
+  locals_.swap(locals);
+  worlds_.swap(worlds);
+  parents_.swap(parents);
+  depths_.swap(depths);
+  dirty_.swap(dirty);
+  nodes_.swap(nodes);
+}
+
+void TransformHierarchy::MultiplyBatch(const std::uint32_t* slots,
+                                       std::size_t count) {
+  // 根は親を掛けずにそのまま写し、親を持つノードだけを掛け合わせる
+  std::uint32_t children[kBatchSize];
+  std::size_t child_count = 0;
+  for (std::size_t i = 0; i < count; ++i) {
+    const auto slot = slots[i];
+    if (parents_[slot] == kNone) {
+      worlds_[slot] = locals_[slot];
+    } else {
+      children[child_count++] = slot;
+    }
+  }
+
+  std::size_t i = 0;
+#ifdef GAME_SIMD_SSE2
+  // 4ノードずつSoAに並べ替え、各要素を4ノード同時に積和で求める。
+  // 同じ深さのノードの親はこのまとまりに含まれない
+  for (; i + kSimdWidth <= child_count; i += kSimdWidth) {
+    const glm::mat4* parent_matrices[kSimdWidth];
+    const glm::mat4* local_matrices[kSimdWidth];
+    glm::mat4* world_matrices[kSimdWidth];
+    for (std::size_t lane = 0; lane < kSimdWidth; ++lane) {
+      const auto slot = children[i + lane];
+      parent_matrices[lane] = &worlds_[parents_[slot]];
+      local_matrices[lane] = &locals_[slot];
+      world_matrices[lane] = &worlds_[slot];
+    }
+    __m128 parent[16];
+    __m128 local[16];
+    __m128 world[16];
+    LoadTransposed(parent_matrices, parent);
+    LoadTransposed(local_matrices, local);
+    // world[c][r] = Σk parent[k][r] * local[c][k]
+    for (int column = 0; column < 4; ++column) {
+      for (int row = 0; row < 4; ++row) {
+        auto sum = _mm_mul_ps(parent[row], local[column * 4]);
+        for (int k = 1; k < 4; ++k) {
+          sum = _mm_add_ps(
+              sum, _mm_mul_ps(parent[k * 4 + row], local[column * 4 + k]));
+        }
+        world[column * 4 + row] = sum;
+      }
+    }
+    StoreTransposed(world, world_matrices);
+  }
+#endif
+  for (; i < child_count; ++i) {
+    const auto slot = children[i];
+    worlds_[slot] = worlds_[parents_[slot]] * locals_[slot];
+  }
+}
+
+}  // namespace game
@@ -0,0 +1,93 @@
+#ifndef OPENGL_PBR_MAP_TRANSFORM_HIERARCHY_H_
+#define OPENGL_PBR_MAP_TRANSFORM_HIERARCHY_H_
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace game {
+
+/**
+ * @brief シーンの親子関係を持つ変換行列の集まり
+ *
+ * ノードは深さ順に並べた平坦な配列に持ち、親は必ず子より前にある。
+ * SetLocalで変更したノードとその子孫だけをUpdateで計算し直すので、
+ * 動かない大きな階層は毎フレームの費用がかからない。
+ * ワールド行列は同じ深さのノードをまとめてSIMDで掛け合わせる。
+ */
+class TransformHierarchy {
+ public:
+  static constexpr std::uint32_t kNone = 0xffffffffu;
+
+  /**
+   * @brief ノードを作る
+   * @param parent 親のノード、根ならkNone
+   * @param local 親に対する変換行列
+   * @return ノードの番号、Destroyするまで変わらない
+   */
+  std::uint32_t Create(std::uint32_t parent, const glm::mat4& local);
+
+  /**
+   * @brief ノードを子孫ごと削除する
+   * @param node ノードの番号
+   */
+  void Destroy(std::uint32_t node);
+
+  /**
+   * @brief 親に対する変換行列を設定する
+   * @param node ノードの番号
+   * @param local 変換行列
+   */
+  void SetLocal(std::uint32_t node, const glm::mat4& local);
+
+  const glm::mat4& GetLocal(std::uint32_t node) const;
+
+  /**
+   * @brief ワールド行列を取得する
+   * @param node ノードの番号
+   * @return 最後のUpdateで求めたワールド行列
+   */
+  const glm::mat4& GetWorld(std::uint32_t node) const;
+
+  std::uint32_t GetParent(std::uint32_t node) const;
+
+  /**
+   * @brief 変更のあったノードとその子孫のワールド行列を計算し直す
+   */
+  void Update();
+
+  /**
+   * @brief 直前のUpdateで計算したノードの数を取得する
+   * @return ノードの数
+   */
+  std::size_t GetUpdatedCount() const;
+
+  std::size_t GetNodeCount() const;
+
+ private:
+  void SortByDepth();
+  void MultiplyBatch(const std::uint32_t* slots, std::size_t count);
+
+  // 以下は深さ順の並び (スロット) ごとの値
+  std::vector<glm::mat4> locals_;
+  std::vector<glm::mat4> worlds_;
+  // 親のスロット、根ならkNone
+  std::vector<std::uint32_t> parents_;
+  std::vector<std::uint32_t> depths_;
+  std::vector<std::uint8_t> dirty_;
+  // スロットからノードの番号への対応
+  std::vector<std::uint32_t> nodes_;
+
+  // ノードの番号からスロットへの対応、削除済みならkNone
+  std::vector<std::uint32_t> slots_;
+  std::vector<std::uint32_t> free_nodes_;
+  // 変更のあった最初のスロット
+  std::uint32_t first_dirty_slot_ = kNone;
+  bool needs_sort_ = false;
+  std::size_t updated_count_ = 0;
+};
+
+}  // namespace game
+
+#endif  // OPENGL_PBR_MAP_TRANSFORM_HIERARCHY_H_